@@ -0,0 +1,535 @@
+// ============================================================================
+// Realtime Ray Tracer - Benchmark
+//
+// Reproducible numbers for the BVH builder and the shaders' traversal,
+// written as JSON so two versions can be compared run against run:
+//
+//   RealtimeRaytracing.Benchmark [--mesh FILE]... [--repeat N] [--size WxH]
+//                                [--output FILE] [--no-gpu]
+//
+// The bundled meshes are always measured; --mesh adds more, e.g. large
+// scanned models. Each mesh loads the way the renderer loads it (through the
+// mesh cache), then:
+//
+//   build:    BVHBuilder::build, threaded and serial, the pooled refit the
+//             TLAS uses (here over the triangles' boxes) and the wide
+//             collapse, each repeated and reported as min / median / mean ms,
+//             with the tree's SAH cost, depth, leaf-size histogram and memory.
+//   traverse: the mesh as the only instance of a TLAS, seen from three views
+//             fitted to its bounds. Primary, diffuse and shadow rays are cast
+//             per traversal variant (bench_traverse.comp); GPU time from
+//             timer queries gives Mrays/s, and a separate counting pass gives
+//             nodes and primitives per ray, which don't depend on the machine.
+//
+// Runs from the project directory, like the renderer, for the shader paths.
+// ============================================================================
+
+#include "glad2/gl.h"
+#include "GLFW/glfw3.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glm/glm/glm.hpp>
+
+#include "includes/shader.h"
+#include "includes/camera.h"
+#include "rt_structs.h"
+#include "rt_bvh.h"
+#include "rt_accel.h"
+#include "rt_meshcache.h"
+#include "rt_json.h"
+#include "rt_threadpool.h"
+
+namespace {
+
+const char* const BUNDLED_MESHES[] = {
+	"external/box.obj",
+	"external/smooth-monkey.obj",
+	"external/smooth_bunny.obj",
+};
+
+struct BenchOptions {
+	std::vector<std::string> meshes;
+	int repeat = 5;
+	int width = 1280;
+	int height = 720;
+	bool gpu = true;
+	std::string output = "benchmark.json";
+};
+
+bool parseArgs(int argc, char** argv, BenchOptions& options) {
+	for (const char* mesh : BUNDLED_MESHES) options.meshes.push_back(mesh);
+
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (arg == "--mesh" && hasValue) options.meshes.push_back(argv[++i]);
+		else if (arg == "--repeat" && hasValue) options.repeat = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "--output" && hasValue) options.output = argv[++i];
+		else if (arg == "--no-gpu") options.gpu = false;
+		else if (arg == "--size" && hasValue) {
+			int w = 0, h = 0;
+			if (std::sscanf(argv[++i], "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+				std::cout << "--size takes WIDTHxHEIGHT, e.g. 1280x720" << std::endl;
+				return false;
+			}
+			options.width = w;
+			options.height = h;
+		}
+		else {
+			std::cout << "Usage: " << argv[0] << " [--mesh FILE]... [--repeat N] [--size WxH]"
+				<< " [--output FILE] [--no-gpu]" << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+// Min / median / mean of repeated measurements, in ms.
+void writeTimes(JsonWriter& json, const char* key, std::vector<double> ms) {
+	std::sort(ms.begin(), ms.end());
+	double sum = 0.0;
+	for (double t : ms) sum += t;
+	const size_t n = ms.size();
+	json.beginObject(key);
+	json.value("min", ms.front());
+	json.value("median", n % 2 ? ms[n / 2] : 0.5 * (ms[n / 2 - 1] + ms[n / 2]));
+	json.value("mean", sum / n);
+	json.endObject();
+}
+
+double median(std::vector<double> values) {
+	std::sort(values.begin(), values.end());
+	const size_t n = values.size();
+	return n % 2 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+}
+
+template <typename F>
+double timeMs(F&& f) {
+	const auto start = std::chrono::high_resolution_clock::now();
+	f();
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// Build, refit and collapse timings and the shape of the tree.
+void benchmarkBuild(JsonWriter& json, const StagedMesh& mesh, int repeat) {
+	const IndexedGeometry& geometry = mesh.geometry;
+	const size_t triCount = mesh.triangleCount();
+
+	BVHBuildOptions threaded;
+	BVHBuildOptions serial;
+	serial.threads = 1;
+	ThreadPool pool(std::max(1, (int)std::thread::hardware_concurrency() - 1));
+
+	// A mesh is far wider than any TLAS, so this is where the pooled refit shows
+	std::vector<AABB> triBounds(triCount);
+	for (size_t i = 0; i < triCount; i++) {
+		const IndexedTriangle& tri = geometry.triangles[i];
+		triBounds[i].expand(geometry.position(tri.v0));
+		triBounds[i].expand(geometry.position(tri.v1));
+		triBounds[i].expand(geometry.position(tri.v2));
+	}
+
+	std::vector<double> buildMs, serialMs, refitMs, collapseMs;
+	BVHBuilder builder;
+	std::vector<WideBVHNode> wide;
+	for (int r = 0; r < repeat; r++) {
+		serialMs.push_back(timeMs([&] { builder.build(geometry, 0, triCount, serial); }));
+		buildMs.push_back(timeMs([&] { builder.build(geometry, 0, triCount, threaded); }));
+		refitMs.push_back(timeMs([&] { builder.refit(triBounds, &pool); }));
+		collapseMs.push_back(timeMs([&] { wide = builder.collapseToWide<BVH_WIDTH>(); }));
+	}
+
+	const BVHStats stats = ComputeBVHStats(builder.getNodes(), builder.getPrimitiveIndices().size(),
+		BVHBuilder::TRAVERSAL_COST, BVHBuilder::INTERSECTION_COST);
+	const size_t geometryBytes = geometry.positions.size() * sizeof(glm::vec4)
+		+ geometry.normals.size() * sizeof(glm::vec4)
+		+ geometry.shading.size() * sizeof(VertexShading)
+		+ geometry.triangles.size() * sizeof(IndexedTriangle);
+
+	json.beginObject("build");
+	writeTimes(json, "build_ms", buildMs);
+	writeTimes(json, "build_serial_ms", serialMs);
+	writeTimes(json, "refit_ms", refitMs);
+	writeTimes(json, "collapse_ms", collapseMs);
+	json.value("nodes", stats.nodes);
+	json.value("leaves", stats.leaves);
+	json.value("depth", stats.depth);
+	json.value("sah_cost", stats.sahCost);
+	json.value("min_leaf_size", stats.minLeafSize);
+	json.value("max_leaf_size", stats.maxLeafSize);
+	json.value("mean_leaf_size", stats.meanLeafSize);
+	json.beginArray("leaf_size_histogram"); // leaves of 0, 1, ... primitives; the last bin is the rest
+	for (size_t count : stats.leafSizeHistogram) json.value(count);
+	json.endArray();
+	json.value("wide_nodes", wide.size());
+	json.value("wide_depth", WideBVHDepth(wide.data(), wide.size()));
+	json.beginObject("bytes");
+	json.value("bvh", stats.bytes);
+	json.value("wide_bvh", wide.size() * sizeof(WideBVHNode));
+	json.value("isect_triangles", triCount * sizeof(IsectTriangle));
+	json.value("geometry", geometryBytes);
+	json.endObject();
+	json.endObject();
+
+	std::cout << "  build " << median(buildMs) << " ms (serial " << median(serialMs) << " ms), refit "
+		<< median(refitMs) << " ms, SAH " << stats.sahCost << ", depth " << stats.depth
+		<< ", " << stats.nodes << " nodes" << std::endl;
+}
+
+// A storage buffer at binding, never empty so every block the kernel
+// declares is backed.
+template <typename T>
+GLuint storageBuffer(GLuint binding, const std::vector<T>& data) {
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(16, data.size() * sizeof(T)),
+		data.empty() ? nullptr : data.data(), GL_STATIC_DRAW);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	return buffer;
+}
+
+// Must match BenchRay in bench_traverse.comp.
+struct BenchRay {
+	glm::vec4 origin;
+	glm::vec4 direction;
+};
+
+enum RayKind { BenchPrimary = 0, BenchDiffuse = 1, BenchShadow = 2 };
+const char* const RAY_KIND_NAMES[] = { "primary", "diffuse", "shadow" };
+
+struct TraversalVariant {
+	const char* name;
+	bool wide;       // u_useWideBVH; any-hit rays always take the binary tree
+	int shortStack;  // BVH_SHORT_STACK, 0 for the full stack
+};
+
+const TraversalVariant VARIANTS[] = {
+	{ "binary", false, 0 },
+	{ "wide", true, 0 },
+	{ "binary_short_stack", false, 8 },
+};
+
+// Casts every ray kind from each view, per traversal variant.
+class TraversalBenchmark {
+public:
+	TraversalBenchmark(int width, int height) : width(width), height(height) {
+		glGenQueries(1, &timer);
+		glGenBuffers(1, &rayBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, rayBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr)width * height * sizeof(BenchRay), nullptr, GL_DYNAMIC_COPY);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 22, rayBuffer);
+
+		glGenBuffers(1, &statsBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, 8 * sizeof(GLuint), nullptr, GL_DYNAMIC_READ);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20, statsBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	~TraversalBenchmark() {
+		glDeleteQueries(1, &timer);
+		glDeleteBuffers(1, &rayBuffer);
+		glDeleteBuffers(1, &statsBuffer);
+	}
+
+	TraversalBenchmark(const TraversalBenchmark&) = delete;
+	TraversalBenchmark& operator=(const TraversalBenchmark&) = delete;
+
+	void run(JsonWriter& json, const StagedMesh& mesh, int repeat) {
+		// The mesh as a scene of its own, as the renderer would place it
+		IndexedGeometry geometry;
+		TwoLevelBVH accel;
+		MeshInstance instance;
+		instance.meshID = mesh.addTo(geometry, accel, instance.firstTri, instance.triCount);
+		instance.updateModel();
+		accel.buildTLAS({ instance });
+
+		const std::vector<Material> materials(1, Material{});
+		std::vector<GLuint> buffers = {
+			storageBuffer(0, materials),
+			storageBuffer(1, geometry.triangles),
+			storageBuffer(2, std::vector<Sphere>()),
+			storageBuffer(3, accel.getBLASNodes()),
+			storageBuffer(4, accel.getBLASPrimitiveIndices()),
+			storageBuffer(7, accel.getWideNodes()),
+			storageBuffer(8, accel.getTLASNodes()),
+			storageBuffer(9, accel.getInstances()),
+			storageBuffer(16, accel.getIsectTriangles()),
+			storageBuffer(17, geometry.positions),
+			storageBuffer(18, geometry.normals),
+			storageBuffer(21, geometry.shading),
+		};
+
+		// One program per stack configuration, sized for this mesh's trees
+		std::vector<shader> kernels;
+		for (const TraversalVariant& variant : VARIANTS) {
+			shader::globalDefines() = traversalDefines(accel, variant.shortStack, true);
+			kernels.push_back(shader("src/shaders/bench_traverse.comp"));
+		}
+		shader::globalDefines().clear();
+
+		const AABB bounds = accel.getMeshes()[instance.meshID].bounds;
+		const glm::vec3 center = bounds.center();
+		const float radius = std::max(1e-4f, 0.5f * glm::length(bounds.max - bounds.min));
+		const glm::vec3 viewDirections[] = {
+			glm::vec3(0.0f, 0.25f, 1.0f),  // front
+			glm::vec3(1.0f, 0.25f, 0.0f),  // side
+			glm::vec3(-1.0f, 0.8f, -1.0f), // from above and behind
+		};
+		const float fov = 45.0f;
+		const float distance = 1.1f * radius / std::sin(glm::radians(fov) * 0.5f);
+
+		json.beginArray("traverse");
+		for (size_t v = 0; v < sizeof(viewDirections) / sizeof(viewDirections[0]); v++) {
+			Camera camera;
+			camera.Position = center + glm::normalize(viewDirections[v]) * distance;
+			camera.lookAt(center);
+			camera.Zoom = fov;
+
+			for (int kind = BenchPrimary; kind <= BenchShadow; kind++) {
+				json.beginObject();
+				json.value("view", (int)v);
+				json.value("rays", RAY_KIND_NAMES[kind]);
+
+				// Rays from the first program; the trees are the same for all of them
+				setUniforms(kernels[0], camera, kind, false);
+				kernels[0].setBool("u_generate", true);
+				dispatch();
+				glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+				json.beginArray("variants");
+				size_t referenceHits = 0;
+				bool first = true;
+				for (size_t k = 0; k < kernels.size(); k++) {
+					if (kind == BenchShadow && VARIANTS[k].wide) continue;
+					const VariantResult result = measure(kernels[k], camera, kind, VARIANTS[k].wide, repeat);
+
+					json.beginObject();
+					json.value("variant", VARIANTS[k].name);
+					writeTimes(json, "gpu_ms", result.gpuMs);
+					writeTimes(json, "wall_ms", result.wallMs);
+					json.value("ray_count", result.rays);
+					json.value("hit_count", result.hits);
+					json.value("mrays_per_s", result.rays / (median(result.gpuMs) * 1e3));
+					json.value("nodes_per_ray", result.rays > 0 ? result.nodes / result.rays : 0.0);
+					json.value("prims_per_ray", result.rays > 0 ? result.prims / result.rays : 0.0);
+					json.endObject();
+
+					std::cout << "  view " << v << " " << RAY_KIND_NAMES[kind] << " " << VARIANTS[k].name << ": "
+						<< result.rays / (median(result.gpuMs) * 1e3) << " Mrays/s, "
+						<< (result.rays > 0 ? result.nodes / result.rays : 0.0) << " nodes/ray" << std::endl;
+
+					// Every variant has to find the same hits
+					if (first) referenceHits = result.hits;
+					else if (result.hits != referenceHits)
+						std::cout << "  warning: " << VARIANTS[k].name << " found " << result.hits
+						<< " hits, " << VARIANTS[0].name << " " << referenceHits << std::endl;
+					first = false;
+				}
+				json.endArray();
+				json.endObject();
+			}
+		}
+		json.endArray();
+
+		for (shader& kernel : kernels) glDeleteProgram(kernel.ID);
+		glDeleteBuffers((GLsizei)buffers.size(), buffers.data());
+	}
+
+private:
+	struct VariantResult {
+		std::vector<double> gpuMs;
+		std::vector<double> wallMs; // dispatch to glFinish
+		size_t rays = 0;
+		size_t hits = 0;
+		double nodes = 0.0;
+		double prims = 0.0;
+	};
+
+	const int width, height;
+	GLuint timer = 0;
+	GLuint rayBuffer = 0;
+	GLuint statsBuffer = 0;
+
+	void setUniforms(shader& kernel, const Camera& camera, int kind, bool wide) const {
+		kernel.use();
+		kernel.setVec2("resolution", glm::vec2(width, height));
+		kernel.setVec3("camPos", camera.Position);
+		kernel.setVec3("camFront", camera.Front);
+		kernel.setVec3("camRight", camera.Right);
+		kernel.setVec3("camUp", camera.Up);
+		kernel.setFloat("camFov", camera.Zoom);
+		kernel.setInt("u_rayKind", kind);
+		kernel.setVec3("u_lightDirection", glm::normalize(glm::vec3(0.4f, 1.0f, 0.3f)));
+		kernel.setBool("u_useWideBVH", wide);
+		kernel.setBool("u_traversalStats", false);
+	}
+
+	void dispatch() const {
+		glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+	}
+
+	VariantResult measure(shader& kernel, const Camera& camera, int kind, bool wide, int repeat) {
+		VariantResult result;
+		setUniforms(kernel, camera, kind, wide);
+		kernel.setBool("u_generate", false);
+
+		// Once to warm up, then timed on their own. Tracing again gives the
+		// same rays, since the result only goes in the flag.
+		// Wall time around a finished dispatch is kept next to the queries,
+		// for drivers whose timers can't be trusted.
+		dispatch();
+		for (int r = 0; r < repeat; r++) {
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			glFinish();
+			result.wallMs.push_back(timeMs([&] {
+				glBeginQuery(GL_TIME_ELAPSED, timer);
+				dispatch();
+				glEndQuery(GL_TIME_ELAPSED);
+				glFinish();
+			}));
+			GLuint64 ns = 0;
+			glGetQueryObjectui64v(timer, GL_QUERY_RESULT, &ns);
+			result.gpuMs.push_back(ns * 1e-6);
+		}
+
+		// Counters cost atomics, so they get a pass of their own
+		GLuint zero = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffer);
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+		kernel.setBool("u_traversalStats", true);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		dispatch();
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+		// rays, nodes, primitives as 64-bit lo/hi pairs (TraversalStats in rt_scene.glsl)
+		GLuint counters[8];
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), counters);
+		const double rays = counters[0] + counters[1] * 4294967296.0;
+		result.nodes = counters[2] + counters[3] * 4294967296.0;
+		result.prims = counters[4] + counters[5] * 4294967296.0;
+
+		std::vector<BenchRay> rayResults((size_t)width * height);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, rayBuffer);
+		glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, rayResults.size() * sizeof(BenchRay), rayResults.data());
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		for (const BenchRay& ray : rayResults) {
+			if (ray.direction.w > 0.0f) result.rays++;
+			if (ray.direction.w > 1.5f) result.hits++;
+		}
+		if ((size_t)rays != result.rays)
+			std::cout << "  warning: counted " << (size_t)rays << " rays for " << result.rays << " written" << std::endl;
+		return result;
+	}
+};
+
+std::string timestamp() {
+	char buffer[32];
+	const std::time_t now = std::time(nullptr);
+	std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+	return buffer;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	BenchOptions options;
+	if (!parseArgs(argc, argv, options)) return 1;
+
+	// A hidden window, only for the context
+	GLFWwindow* window = nullptr;
+	if (options.gpu) {
+		if (!glfwInit()) {
+			std::cout << "Failed to intialize GLFW" << std::endl;
+			return 1;
+		}
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		window = glfwCreateWindow(64, 64, "Benchmark", NULL, NULL);
+		if (window == NULL) {
+			std::cout << "Failed to create GLFW window!" << std::endl;
+			glfwTerminate();
+			return 1;
+		}
+		glfwMakeContextCurrent(window);
+		if (!gladLoadGL(glfwGetProcAddress)) {
+			std::cout << "Failed to intialize GLAD" << std::endl;
+			glfwTerminate();
+			return 1;
+		}
+	}
+
+	JsonWriter json;
+	json.beginObject();
+	json.value("format", 1);
+	json.value("timestamp", timestamp());
+	json.value("hardware_threads", (int)std::thread::hardware_concurrency());
+	json.value("renderer", options.gpu ? reinterpret_cast<const char*>(glGetString(GL_RENDERER)) : "");
+	json.value("gl_version", options.gpu ? reinterpret_cast<const char*>(glGetString(GL_VERSION)) : "");
+	json.value("repeat", options.repeat);
+	json.value("width", options.width);
+	json.value("height", options.height);
+	json.value("bvh_width", BVH_WIDTH);
+	json.value("sah_buckets", BVHBuildOptions().buckets);
+	json.value("max_leaf_size", BVHBuildOptions().maxLeafSize);
+
+	{
+		std::unique_ptr<TraversalBenchmark> traversal;
+		if (options.gpu) traversal.reset(new TraversalBenchmark(options.width, options.height));
+
+		json.beginArray("meshes");
+		for (const std::string& path : options.meshes) {
+			std::cout << path << std::endl;
+			json.beginObject();
+			json.value("path", path);
+
+			StagedMesh mesh;
+			try {
+				MeshCache::load(path, mesh);
+			}
+			catch (const std::exception& e) {
+				std::cout << "  failed to load: " << e.what() << std::endl;
+				mesh = StagedMesh();
+			}
+			if (mesh.triangleCount() == 0) {
+				std::cout << "  skipped, no triangles" << std::endl;
+				json.value("error", "no triangles loaded");
+				json.endObject();
+				continue;
+			}
+
+			json.value("triangles", mesh.triangleCount());
+			json.value("vertices", mesh.geometry.positions.size());
+			benchmarkBuild(json, mesh, options.repeat);
+			if (traversal) traversal->run(json, mesh, options.repeat);
+			json.endObject();
+		}
+		json.endArray();
+	}
+	json.endObject();
+
+	std::ofstream file(options.output);
+	file << json.str();
+	if (!file) {
+		std::cout << "Failed to write " << options.output << std::endl;
+		return 1;
+	}
+	std::cout << "Wrote " << options.output << std::endl;
+
+	if (window) glfwTerminate();
+	return 0;
+}
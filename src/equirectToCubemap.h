@@ -1,207 +1,123 @@
+#ifndef EQUIRECT_TO_CUBEMAP_H
+#define EQUIRECT_TO_CUBEMAP_H
+
 #include <glad2/gl.h>
+
+#include <algorithm>
 #include <iostream>
 #include <vector>
-#include <string>
 
-#include <glm/glm/glm.hpp>
 #include "includes/shader.h"
 
+// Turns the equirectangular HDR sky into the cubemap the ray tracing shaders
+// sample, with two compute kernels and no framebuffer:
+//
+//   equirect_to_cubemap.comp: level 0, all six faces in one dispatch through
+//                             a layered image
+//   prefilter_cubemap.comp:   every further level, GGX-prefiltered for
+//                             roughness level / (levels - 1) from a
+//                             box-filtered copy of level 0
+//
+// Level 0 is the sky as escaped paths see it. The others are what a rough
+// metal reflects of it across its whole lobe (prefilteredSkyLight in
+// rt_shading.glsl). Both kernels write RGBA16F, and SkyCacheWriter
+// (rt_skycache.h) makes the BC6H copy of the result.
 class EquirectToCubemap {
 public:
-    EquirectToCubemap() {
-        setupShaders();
-        setupGeometry();
-        setupFramebuffer();
-    }
-
-    ~EquirectToCubemap() {
-        glDeleteVertexArrays(1, &cubeVAO);
-        glDeleteBuffers(1, &cubeVBO);
-        glDeleteFramebuffers(1, &captureFBO);
-        glDeleteRenderbuffers(1, &captureRBO);
-    }
-
-    GLuint convertToCubemap(GLuint equirectTexture, int cubemapSize = 512) {
-        // Create cubemap texture
-        GLuint envCubemap;
-        glGenTextures(1, &envCubemap);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, envCubemap);
-
-        for (unsigned int i = 0; i < 6; ++i) {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F,
-                cubemapSize, cubemapSize, 0, GL_RGB, GL_FLOAT, nullptr);
-        }
-
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        glm::mat4 projection(
-            glm::vec4(1.0f, 0.0f, 0.0f, 0.0f), 
-            glm::vec4(0.0f, 1.0f, 0.0f, 0.0f),
-            glm::vec4(0.0f, 0.0f, -1.002f, -1.0f),
-            glm::vec4(0.0f, 0.0f, -0.2002f, 0.0f));
-
-        // View matrices for each cubemap face
-        std::vector<glm::mat4> viewMatrices = {
-            // +X (Right face)
-            { 0.0f, 0.0f,-1.0f, 0.0f,
-              0.0f,-1.0f, 0.0f, 0.0f,
-             -1.0f, 0.0f, 0.0f, 0.0f,
-              0.0f, 0.0f, 0.0f, 1.0f },
-
-              // -X (Left face)
-              { 0.0f, 0.0f, 1.0f, 0.0f,
-                0.0f,-1.0f, 0.0f, 0.0f,
-                1.0f, 0.0f, 0.0f, 0.0f,
-                0.0f, 0.0f, 0.0f, 1.0f },
-
-                // +Y (Top face) - FIXED
-                { 1.0f, 0.0f, 0.0f, 0.0f,
-                  0.0f, 0.0f,-1.0f, 0.0f,
-                  0.0f, 1.0f, 0.0f, 0.0f,
-                  0.0f, 0.0f, 0.0f, 1.0f },
-
-                  // -Y (Bottom face) - FIXED  
-                  { 1.0f, 0.0f, 0.0f, 0.0f,
-                    0.0f, 0.0f, 1.0f, 0.0f,
-                    0.0f,-1.0f, 0.0f, 0.0f,
-                    0.0f, 0.0f, 0.0f, 1.0f },
-
-                    // +Z (Front face)
-                    { 1.0f, 0.0f, 0.0f, 0.0f,
-                      0.0f,-1.0f, 0.0f, 0.0f,
-                      0.0f, 0.0f,-1.0f, 0.0f,
-                      0.0f, 0.0f, 0.0f, 1.0f },
-
-                      // -Z (Back face)
-                      {-1.0f, 0.0f, 0.0f, 0.0f,
-                        0.0f,-1.0f, 0.0f, 0.0f,
-                        0.0f, 0.0f, 1.0f, 0.0f,
-                        0.0f, 0.0f, 0.0f, 1.0f }
-        };
-
-        // Configure framebuffer
-        glBindFramebuffer(GL_FRAMEBUFFER, captureFBO);
-        glBindRenderbuffer(GL_RENDERBUFFER, captureRBO);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, cubemapSize, cubemapSize);
-
-        // Convert HDR equirectangular environment map to cubemap
-        m_shader.use();
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, equirectTexture);
-        m_shader.setInt("equirectangularMap", 0);
-
-        
-        m_shader.setMat4("projection", projection);
-
-        glViewport(0, 0, cubemapSize, cubemapSize);
-        glBindVertexArray(cubeVAO);
-
-        for (unsigned int i = 0; i < 6; ++i) {
-            m_shader.setMat4("view", viewMatrices.at(i));
-
-            // Attach cubemap face
-            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, envCubemap, 0);
-
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-            // Draw cube
-            glDrawArrays(GL_TRIANGLES, 0, 36);
-        }
-
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-        return envCubemap;
-    }
+	static const int PREFILTER_LEVELS = 6;   // roughness 0, 0.2, .. 1
+	static const int PREFILTER_SAMPLES = 64; // GGX samples per texel of a prefiltered level
+
+	EquirectToCubemap()
+		: convertKernel("src/shaders/equirect_to_cubemap.comp"),
+		prefilterKernel("src/shaders/prefilter_cubemap.comp") {}
+
+	~EquirectToCubemap() {
+		glDeleteProgram(convertKernel.ID);
+		glDeleteProgram(prefilterKernel.ID);
+	}
+
+	EquirectToCubemap(const EquirectToCubemap&) = delete;
+	EquirectToCubemap& operator=(const EquirectToCubemap&) = delete;
+
+	// The levels a cubemap of cubemapSize gets, PREFILTER_LEVELS unless it's
+	// too small for that many.
+	static int levelCount(int cubemapSize) {
+		int levels = 1;
+		while (levels < PREFILTER_LEVELS && (cubemapSize >> levels) > 0) levels++;
+		return levels;
+	}
+
+	// Returns a new RGBA16F cubemap with levelCount(cubemapSize) levels.
+	GLuint convertToCubemap(GLuint equirectTexture, int cubemapSize = 1024) {
+		// Level 0 with a full box-filtered chain, which the prefilter reads from
+		GLuint source = createCubemap(GL_RGBA16F, cubemapSize, fullMipCount(cubemapSize));
+
+		convertKernel.use();
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, equirectTexture);
+		convertKernel.setInt("u_equirect", 0);
+		convertKernel.setInt("u_size", cubemapSize);
+		glBindImageTexture(0, source, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+		const GLuint groups = (GLuint)(cubemapSize + GROUP_SIZE - 1) / GROUP_SIZE;
+		glDispatchCompute(groups, groups, 6);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+		glBindTexture(GL_TEXTURE_CUBE_MAP, source);
+		glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+
+		const int levels = levelCount(cubemapSize);
+		GLuint cubemap = createCubemap(GL_RGBA16F, cubemapSize, levels);
+		glCopyImageSubData(source, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0,
+			cubemap, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, cubemapSize, cubemapSize, 6);
+
+		prefilterKernel.use();
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, source);
+		prefilterKernel.setInt("u_source", 0);
+		prefilterKernel.setInt("u_sampleCount", PREFILTER_SAMPLES);
+		for (int level = 1; level < levels; level++) {
+			const int size = std::max(1, cubemapSize >> level);
+			const GLuint levelGroups = (GLuint)(size + GROUP_SIZE - 1) / GROUP_SIZE;
+			prefilterKernel.setInt("u_size", size);
+			prefilterKernel.setFloat("u_roughness", (float)level / (levels - 1));
+			glBindImageTexture(0, cubemap, level, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+			glDispatchCompute(levelGroups, levelGroups, 6);
+		}
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+		glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+		glDeleteTextures(1, &source);
+		return cubemap;
+	}
+
+	// An empty cubemap with immutable storage, set up for sampling.
+	static GLuint createCubemap(GLenum internalFormat, int cubemapSize, int levels) {
+		GLuint cubemap;
+		glGenTextures(1, &cubemap);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
+		glTexStorage2D(GL_TEXTURE_CUBE_MAP, levels, internalFormat, cubemapSize, cubemapSize);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		return cubemap;
+	}
 
 private:
-    shader m_shader;
-    GLuint cubeVAO, cubeVBO;
-    GLuint captureFBO, captureRBO;
-
-    void setupShaders() {
-        m_shader = shader("src/shaders/projection.vert", "src/shaders/equirectToCubemap.frag");
-    }
-
-    void setupGeometry() {
-        // Cube vertices
-        float cubeVertices[] = {
-            // positions          
-            -1.0f,  1.0f, -1.0f,
-            -1.0f, -1.0f, -1.0f,
-             1.0f, -1.0f, -1.0f,
-             1.0f, -1.0f, -1.0f,
-             1.0f,  1.0f, -1.0f,
-            -1.0f,  1.0f, -1.0f,
-
-            -1.0f, -1.0f,  1.0f,
-            -1.0f, -1.0f, -1.0f,
-            -1.0f,  1.0f, -1.0f,
-            -1.0f,  1.0f, -1.0f,
-            -1.0f,  1.0f,  1.0f,
-            -1.0f, -1.0f,  1.0f,
-
-             1.0f, -1.0f, -1.0f,
-             1.0f, -1.0f,  1.0f,
-             1.0f,  1.0f,  1.0f,
-             1.0f,  1.0f,  1.0f,
-             1.0f,  1.0f, -1.0f,
-             1.0f, -1.0f, -1.0f,
-
-            -1.0f, -1.0f,  1.0f,
-            -1.0f,  1.0f,  1.0f,
-             1.0f,  1.0f,  1.0f,
-             1.0f,  1.0f,  1.0f,
-             1.0f, -1.0f,  1.0f,
-            -1.0f, -1.0f,  1.0f,
-
-            -1.0f,  1.0f, -1.0f,
-             1.0f,  1.0f, -1.0f,
-             1.0f,  1.0f,  1.0f,
-             1.0f,  1.0f,  1.0f,
-            -1.0f,  1.0f,  1.0f,
-            -1.0f,  1.0f, -1.0f,
-
-            -1.0f, -1.0f, -1.0f,
-            -1.0f, -1.0f,  1.0f,
-             1.0f, -1.0f, -1.0f,
-             1.0f, -1.0f, -1.0f,
-            -1.0f, -1.0f,  1.0f,
-             1.0f, -1.0f,  1.0f
-        };
-
-        glGenVertexArrays(1, &cubeVAO);
-        glGenBuffers(1, &cubeVBO);
-
-        glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), cubeVertices, GL_STATIC_DRAW);
-
-        glBindVertexArray(cubeVAO);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    }
-
-    void setupFramebuffer() {
-        glGenFramebuffers(1, &captureFBO);
-        glGenRenderbuffers(1, &captureRBO);
-    }
+	static const int GROUP_SIZE = 8; // CUBEMAP_GROUP_SIZE in cubemap_common.glsl
+
+	shader convertKernel;
+	shader prefilterKernel;
+
+	static int fullMipCount(int size) {
+		int levels = 1;
+		while (size > 1) {
+			size /= 2;
+			levels++;
+		}
+		return levels;
+	}
 };
 
-// Usage example:
-/*
-// Load your equirectangular HDR texture first (using stb_image or similar)
-GLuint equirectTexture = loadHDRTexture("path/to/your/hdr.hdr");
-
-// Create converter and convert to cubemap
-EquirectToCubemap converter;
-GLuint cubemapTexture = converter.convertToCubemap(equirectTexture, 1024);
-
-// Now you can use cubemapTexture as your HDR cubemap
-// Don't forget to generate mipmaps if needed:
-glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-*/
\ No newline at end of file
+#endif // !EQUIRECT_TO_CUBEMAP_H
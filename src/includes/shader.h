@@ -6,9 +6,27 @@
 #include "glad2/gl.h"
 #include "glm/glm/glm.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
 #include <sstream>
 #include <fstream>
 #include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <utime.h>
+#endif
 
 class shader {
 public:
@@ -16,86 +34,44 @@ public:
     
     shader() { std::cout << "Empty Shader Object Created." << std::endl; }
 
-	shader(const char* vertex_path, const char* fragment_path) {
-        std::string vertexCode;
-        std::string fragmentCode;
-
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-
-        vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-
-        try {
-            // open files
-            vShaderFile.open(vertex_path);
-            fShaderFile.open(fragment_path);
-            std::stringstream vShaderStream, fShaderStream;
-
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-
-            vShaderFile.close();
-            fShaderFile.close();
-
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
-
-        }
-        catch (std::ifstream::failure e) {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ" << std::endl;
-        }
-
-        const char* vShaderCode = vertexCode.c_str();
-        const char* fShaderCode = fragmentCode.c_str();
-
-        // Compile the Shaders
-
-        unsigned int vertex, fragment;
-        int success;
-        char infoLog[512];
-
-        // Compile Vertex Shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-
-        // print any compile errors
-        glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-        if (!success) {
-            glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-            std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-        }
+	shader(const char* vertex_path, const char* fragment_path)
+        : stages{ { GL_VERTEX_SHADER, vertex_path }, { GL_FRAGMENT_SHADER, fragment_path } },
+        defines(globalDefines()) {
+        bool success;
+        ID = build(success);
+	}
 
-        // Compile Fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
+    // Compute shader program (used by the wavefront path tracer kernels).
+    explicit shader(const char* compute_path)
+        : stages{ { GL_COMPUTE_SHADER, compute_path } }, defines(globalDefines()) {
+        bool success;
+        ID = build(success);
+    }
 
-        // print any compile errors
-        glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-        if (!success) {
-            glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-            std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+    // Whether a file the program was built from, a stage or anything it
+    // includes, has been saved since.
+    bool sourcesChanged() const {
+        for (const SourceFile& file : files) {
+            if (modificationTime(file.path) != file.modified) return true;
         }
+        return false;
+    }
 
-        // link into shader program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-
-        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    // Builds the program again from the same files and defines, for hot
+    // reloading. If the new version doesn't compile the old program stays, so
+    // a typo while editing doesn't take the renderer down. Returns whether the
+    // program was replaced.
+    bool reload() {
+        bool success;
+        const unsigned int program = build(success);
         if (!success) {
-            glGetProgramInfoLog(ID, 512, NULL, infoLog);
-            std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-            std::cout << "AT VERTEX: " << vertex_path << "\nFRAGMENT: " << fragment_path << std::endl;
+            glDeleteProgram(program);
+            return false;
         }
-
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-	}
-
+        glDeleteProgram(ID);
+        ID = program;
+        return true;
+    }
 
     void use() {
         glUseProgram(ID);
@@ -121,6 +97,9 @@ public:
     void setInt(const std::string& name, int value) const {
         glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
     }
+    void setUInt(const std::string& name, unsigned int value) const {
+        glUniform1ui(glGetUniformLocation(ID, name.c_str()), value);
+    }
     void setInt2(const std::string& name, int v1, int v2) const {
         glUniform2i(glGetUniformLocation(ID, name.c_str()), v1, v2);
     }
@@ -180,6 +159,307 @@ public:
         return ID;
     }
 
+    // Lines spliced in after the #version of every program compiled from then
+    // on, for limits only known at runtime, e.g. "#define BVH_STACK_SIZE 24\n".
+    static std::string& globalDefines() {
+        static std::string defines;
+        return defines;
+    }
+
+    // Where linked programs are kept with glGetProgramBinary, so a program
+    // whose sources, defines and driver haven't changed loads instead of
+    // compiling. Empty (the default) turns the cache off. Only the
+    // BINARY_CACHE_LIMIT most recently used binaries are kept.
+    static std::string& binaryCacheDirectory() {
+        static std::string directory;
+        return directory;
+    }
+
+private:
+    struct Stage {
+        GLenum type;
+        std::string path;
+    };
+
+    struct SourceFile {
+        std::string path;
+        long long modified;
+    };
+
+    std::vector<Stage> stages;
+    std::string defines;             // globalDefines() when the program was created
+    std::vector<SourceFile> files;   // everything the stages include, for sourcesChanged()
+
+    static const char* stageName(GLenum type) {
+        switch (type) {
+        case GL_VERTEX_SHADER: return "VERTEX";
+        case GL_FRAGMENT_SHADER: return "FRAGMENT";
+        default: return "COMPUTE";
+        }
+    }
+
+    // Compiles and links the stages, or loads the program from the binary
+    // cache. success is false if any of it failed.
+    unsigned int build(bool& success) {
+        // Each stage is its own compile, so it gets every header it includes
+        // even if another stage included it as well
+        std::set<std::string> allIncluded;
+        std::vector<std::string> sources;
+        for (const Stage& stage : stages) {
+            std::set<std::string> included;
+            sources.push_back(loadSource(stage.path, included));
+            allIncluded.insert(included.begin(), included.end());
+        }
+
+        files.clear();
+        for (const std::string& path : allIncluded) files.push_back({ path, modificationTime(path) });
+
+        unsigned int program = glCreateProgram();
+        const std::string cachePath = binaryCachePath(sources);
+        if (!cachePath.empty() && loadBinary(program, cachePath)) {
+            success = true;
+            return program;
+        }
+
+        int status;
+        char infoLog[1024];
+        success = true;
+
+        std::vector<unsigned int> compiled;
+        for (size_t i = 0; i < stages.size(); i++) {
+            const char* code = sources[i].c_str();
+            unsigned int stage = glCreateShader(stages[i].type);
+            glShaderSource(stage, 1, &code, NULL);
+            glCompileShader(stage);
+
+            // print any compile errors
+            glGetShaderiv(stage, GL_COMPILE_STATUS, &status);
+            if (!status) {
+                glGetShaderInfoLog(stage, 1024, NULL, infoLog);
+                std::cout << "ERROR::SHADER::" << stageName(stages[i].type) << "::COMPILATION_FAILED\n" << infoLog << std::endl;
+                std::cout << "AT " << stageName(stages[i].type) << ": " << stages[i].path << std::endl;
+                success = false;
+            }
+            glAttachShader(program, stage);
+            compiled.push_back(stage);
+        }
+
+        // link into shader program
+        if (!cachePath.empty()) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(program);
+
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if (!status) {
+            glGetProgramInfoLog(program, 1024, NULL, infoLog);
+            std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+            for (const Stage& stage : stages) std::cout << "AT " << stageName(stage.type) << ": " << stage.path << std::endl;
+            success = false;
+        }
+        else if (success && !cachePath.empty()) {
+            saveBinary(program, cachePath);
+            pruneBinaryCache();
+        }
+
+        for (unsigned int stage : compiled) glDeleteShader(stage);
+        return program;
+    }
+
+    // Binary cache files: this header, then the driver's program binary.
+    struct BinaryHeader {
+        uint32_t magic;
+        uint32_t format;   // the driver's binary format
+        uint64_t key;      // see binaryCachePath
+        uint64_t length;
+    };
+    static const uint32_t BINARY_MAGIC = 0x47525052; // "RPRG"
+
+    // Binaries kept in the cache: a few dozen programs for each of the
+    // permutations switched between most recently.
+    static const size_t BINARY_CACHE_LIMIT = 256;
+
+    // FNV-1a, as the mesh cache hashes its sources.
+    static uint64_t hash(uint64_t h, const std::string& text) {
+        for (unsigned char c : text) h = (h ^ c) * 1099511628211ull;
+        return h;
+    }
+
+    // The program's key: its final sources and the driver that compiles them,
+    // whose binaries don't carry over to another driver or version.
+    static uint64_t binaryKey(const std::vector<std::string>& sources) {
+        uint64_t key = 14695981039346656037ull;
+        for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION }) {
+            const GLubyte* value = glGetString(name);
+            key = hash(key, value ? reinterpret_cast<const char*>(value) : "");
+        }
+        for (const std::string& source : sources) key = hash(hash(key, source), "\n//stage\n");
+        return key;
+    }
+
+    // The cache file for these sources, or empty if there is no cache: none
+    // configured or a driver without binary formats.
+    std::string binaryCachePath(const std::vector<std::string>& sources) const {
+        if (binaryCacheDirectory().empty()) return "";
+        static const bool supported = [] {
+            GLint formats = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+            return formats > 0 && makeDirectory(binaryCacheDirectory());
+        }();
+        if (!supported) return "";
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)binaryKey(sources));
+        return binaryCacheDirectory() + "/" + name;
+    }
+
+    // The driver can refuse a binary even with a matching key (it changed
+    // without changing its version string); the program is compiled then.
+    static bool loadBinary(unsigned int program, const std::string& path) {
+        std::ifstream file(path, std::ios::binary);
+        BinaryHeader header;
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != BINARY_MAGIC ||
+            header.length == 0 || header.length > (1ull << 30)) return false;
+
+        std::vector<char> binary((size_t)header.length);
+        if (!file.read(binary.data(), binary.size())) return false;
+
+        glProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+        int status;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if (status == 0) return false;
+
+        // Touched, so pruneBinaryCache() sees it as recently used
+        file.close();
+#ifdef _WIN32
+        _utime(path.c_str(), nullptr);
+#else
+        utime(path.c_str(), nullptr);
+#endif
+        return true;
+    }
+
+    // Written to a temporary file and renamed, so an interrupted write never
+    // leaves a truncated binary behind.
+    static void saveBinary(unsigned int program, const std::string& path) {
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) return;
+
+        BinaryHeader header = { BINARY_MAGIC, 0, 0, 0 };
+        std::vector<char> binary((size_t)length);
+        GLsizei written = 0;
+        glGetProgramBinary(program, length, &written, &header.format, binary.data());
+        if (written <= 0) return;
+        header.length = (uint64_t)written;
+
+        const std::string tempPath = path + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(binary.data(), written);
+            if (!file) return;
+        }
+        std::remove(path.c_str());
+        if (std::rename(tempPath.c_str(), path.c_str()) != 0) std::remove(tempPath.c_str());
+    }
+
+    // Deletes the least recently used binaries beyond BINARY_CACHE_LIMIT, so
+    // the programs of sources and defines that are gone don't pile up.
+    static void pruneBinaryCache() {
+        const std::string& directory = binaryCacheDirectory();
+        std::vector<std::pair<long long, std::string>> binaries;
+        for (const std::string& name : listDirectory(directory)) {
+            if (name.size() != 20 || name.compare(16, 4, ".bin") != 0) continue; // %016llx.bin
+            const std::string path = directory + "/" + name;
+            binaries.push_back({ modificationTime(path), path });
+        }
+        if (binaries.size() <= BINARY_CACHE_LIMIT) return;
+
+        std::sort(binaries.begin(), binaries.end());
+        for (size_t i = 0; i + BINARY_CACHE_LIMIT < binaries.size(); i++) std::remove(binaries[i].second.c_str());
+    }
+
+    static std::vector<std::string> listDirectory(const std::string& path) {
+        std::vector<std::string> names;
+#ifdef _WIN32
+        _finddata_t entry;
+        const intptr_t handle = _findfirst((path + "/*").c_str(), &entry);
+        if (handle == -1) return names;
+        do names.push_back(entry.name); while (_findnext(handle, &entry) == 0);
+        _findclose(handle);
+#else
+        DIR* dir = opendir(path.c_str());
+        if (!dir) return names;
+        while (const dirent* entry = readdir(dir)) names.push_back(entry->d_name);
+        closedir(dir);
+#endif
+        return names;
+    }
+
+    static bool makeDirectory(const std::string& path) {
+#ifdef _WIN32
+        return _mkdir(path.c_str()) == 0 || errno == EEXIST;
+#else
+        return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+    }
+
+    // Last write time, or -1 if the file can't be read.
+    static long long modificationTime(const std::string& path) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) return -1;
+        return (long long)st.st_mtime;
+    }
+
+    // Reads a shader file, splicing in any `#include "file"` lines (relative to
+    // the including file) so the fragment shader and the compute kernels can
+    // share the same scene and shading code. Each file is only included once
+    // per stage, and included collects them all.
+    std::string loadSource(const std::string& path, std::set<std::string>& included) const {
+        std::string source = loadSourceFile(path, included);
+
+        const size_t version = source.find("#version");
+        if (version != std::string::npos && !defines.empty()) {
+            const size_t lineEnd = source.find('\n', version);
+            source.insert(lineEnd == std::string::npos ? source.size() : lineEnd + 1, defines);
+        }
+        return source;
+    }
+
+    static std::string loadSourceFile(const std::string& path, std::set<std::string>& included) {
+        if (!included.insert(path).second) return "";
+
+        std::ifstream file;
+        file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+
+        std::stringstream stream;
+        try {
+            file.open(path);
+            stream << file.rdbuf();
+            file.close();
+        }
+        catch (const std::ifstream::failure& e) {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << path << std::endl;
+            return "";
+        }
+
+        const std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+
+        std::string source;
+        std::string line;
+        while (std::getline(stream, line)) {
+            size_t directive = line.find("#include");
+            size_t open = line.find('"');
+            size_t close = line.find_last_of('"');
+            if (directive != std::string::npos && line.find_first_not_of(" \t") == directive &&
+                open != std::string::npos && close > open) {
+                source += loadSourceFile(directory + line.substr(open + 1, close - open - 1), included);
+                continue;
+            }
+            source += line + "\n";
+        }
+        return source;
+    }
+
 };
 
 #endif
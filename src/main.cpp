@@ -18,7 +18,8 @@
 //   - CPU → GPU data transfer is minimized, with scene data (geometry,
 //     materials, and BVH nodes) uploaded to GPU buffers.
 //   - A Bounding Volume Hierarchy (BVH) is used to accelerate ray/scene
-//     intersections, enabling realtime performance on static meshes.
+//     intersections: one per mesh in object space, under a small top-level
+//     BVH over the instances, so moving a mesh only refits the top level.
 //   - Progressive accumulation over time provides noise reduction and higher
 //     quality images without sacrificing interactivity.
 //
@@ -43,7 +44,9 @@
 #include "../external/stb_image_write.h"
 
 #include <chrono>
+#include <climits>
 #include <iomanip>
+#include <memory>
 
 #include "rt_includes.h"
 #include "equirectToCubemap.h"
@@ -59,8 +62,9 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 GLuint loadCubemap(const std::vector<std::string>& faces);
 GLuint loadHDRCubemap(const std::vector<std::string>& faces);
 
-// Basic window setup with GLFW and GLAD
-GLFWwindow* init(unsigned int width, unsigned int height, const char* name) {
+// Basic window setup with GLFW and GLAD. A hidden window only provides the
+// context, for batch rendering.
+GLFWwindow* init(unsigned int width, unsigned int height, const char* name, bool hidden = false) {
 	if (!glfwInit()) {
 		std::cout << "Failed to intialize GLFW" << std::endl;
 		std::exit(-1);
@@ -69,6 +73,7 @@ GLFWwindow* init(unsigned int width, unsigned int height, const char* name) {
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	if (hidden) glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
 	GLFWwindow* window = glfwCreateWindow(width, height, name, NULL, NULL);
 
@@ -86,7 +91,7 @@ GLFWwindow* init(unsigned int width, unsigned int height, const char* name) {
 	glfwSetKeyCallback(window, key_callback);
 
 	// tell GLFW to capture our mouse
-	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+	if (!hidden) glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
 
 	if (!gladLoadGL(glfwGetProcAddress)) {
@@ -112,136 +117,167 @@ void saveScreenshot(const char* filename, int width, int height) {
 	stbi_write_png(filename, width, height, 3, pixels.data(), width * 3);
 }
 
-int main() {
+// The view-projection matching the primary rays of getRay(), for projecting
+// this frame's hits into the previous frame's accumulation.
+glm::mat4 cameraViewProjection(Camera& camera, float aspect) {
+	return glm::perspective(glm::radians(camera.Zoom), aspect, 0.1f, 1000.0f) * camera.GetViewMatrix();
+}
+
+// The traversal stack defines for the scene. The GPU LBVH can be switched
+// to later, so the BLAS bound covers the deepest tree it could build for any
+// mesh too.
+std::string sceneTraversalDefines(const TwoLevelBVH& accel, int shortStack, bool complete) {
+	int lbvhDepth = 0;
+	for (const auto& mesh : accel.getMeshes())
+		if (mesh.primType == InstanceTriangles) lbvhDepth = std::max(lbvhDepth, LBVHBuilder::maxDepth((int)mesh.triCount));
+	return traversalDefines(accel, shortStack, complete, lbvhDepth);
+}
+
+int main(int argc, char** argv) {
+	// Offline rendering of a camera path, when asked for on the command line
+	BatchRenderer batch;
+	if (!batch.parseArgs(argc, argv)) return 1;
+
 	// Create GLFW window
-	GLFWwindow* window = init(WIDTH, HEIGHT, "Raytracing");
+	GLFWwindow* window = init(WIDTH, HEIGHT, "Raytracing", batch.enabled);
+	if (batch.enabled) glfwSwapInterval(0); // never wait for vsync
+
+	// The final image is drawn at the window's framebuffer size, the ray pass
+	// at a fraction of it picked by the dynamic resolution controller.
+	// Batch frames are always WIDTH x HEIGHT and at full resolution.
+	if (!batch.enabled) glfwGetFramebufferSize(window, &outputWidth, &outputHeight);
+	DynamicResolution dynamicRes(outputWidth, outputHeight);
+	if (batch.enabled) dynamicRes.enabled = false;
+	int renderWidth = dynamicRes.getRenderWidth();
+	int renderHeight = dynamicRes.getRenderHeight();
+
+	// Linked programs are cached on disk, so only the first launch after a
+	// shader or driver change pays for the compiles
+	shader::binaryCacheDirectory() = "shader_cache";
 
 	// Create some shaders
-	shader my_shader("src/shaders/fullscreen.vert", "src/shaders/fragment.frag");
-	shader brightPassShader("src/shaders/fullscreen.vert", "src/shaders/bloom_extract.frag");
-	shader blurShader("src/shaders/fullscreen.vert", "src/shaders/blur.frag");
 	shader finalCompositeShader("src/shaders/fullscreen.vert", "src/shaders/composite.frag");
 
-	// Create an array of Materials for lookup in the Shader.
-	std::vector<Material> mats = {
-		//  albedo x,   y,   z,   w,       Material Type, Emission, Fuzz, IOR
-		Material{0.7, 0.7, 0.9, 0.0, MaterialType::Metal,      0.0, 0.01, 0.0},
-		Material{0.6, 0.6, 0.6, 0.0, MaterialType::Lambertian, 0.0, 0.0,  0.0},
-		Material{1.0, 0.8, 0.6, 0.0, MaterialType::Emissive,   5.0, 0.0,  0.0},
-		Material{1.0, 0.9, 0.6, 0.0, MaterialType::Emissive,   3.5, 0.0,  0.0},
-		Material{1.0, 1.0, 1.0, 0.0, MaterialType::Dielectric, 0.0, 0.0,  1.5}, // Glass
-		Material{1.0, 0.8, 1.0, 0.0, MaterialType::Lambertian, 0.0, 0.0,  0.0},
-		Material{0.7, 0.7, 0.7, 0.0, MaterialType::Metal,      0.0, 0.5,  0.0},
-		Material{0.8, 0.6, 0.2, 0.0, MaterialType::Metal,      0.0, 0.0,  0.0}, // Brass
-		Material{0.6, 0.6, 0.6, 0.0, MaterialType::Metal,      0.0, 0.0,  0.0}	// Iron(?)
-	}; // Note: albedo.w is for memory alignment, and is unused in the shader.
-
-	// Load mesh and create triangles
-	std::vector<Triangle> allTriangles;
-
-	std::vector<MeshInstance> instances(2);
-
-	// Load meshes
-
-	float meshPositions[2][3] = { 
-		{2.0f, -0.65f, -1.0f}, 
-		{1.0f, -0.35f, -1.0f} 
-	};
-	float meshRotations[2][3] = { 
-		{0.0f, 3.0f * 3.14f / 4.0f, 0.0f},
-		{0.0f, 3.0f * 3.14f / 4.0f, 0.0f},
-	};
-	float meshScales[2] = {0.0f, 0.35f};
-
-	// Bunny
-	try {
-		rt_Mesh mesh("external/box.obj", 8); // path, material ID (index in mats)
-
-		MeshInstance meshInst;
-		meshInst.name = "Box";
-		meshInst.materialID = 8;
-		meshInst.originalTris = mesh.getTriangles(); // object-space
-		meshInst.firstTri = allTriangles.size();
-		meshInst.triCount = meshInst.originalTris.size();
-		
-		meshInst.position = glm::vec3(meshPositions[0][0], meshPositions[0][1], meshPositions[0][2]);
-		meshInst.rotation = glm::vec3(meshRotations[0][0], meshRotations[0][1], meshRotations[0][2]);
-		meshInst.scale = glm::vec3(meshScales[0]); // your original scale
-		meshInst.updateModel();
-		std::vector<Triangle> tmp;
-		ApplyTransform(meshInst.originalTris, tmp, meshInst.model);
-		allTriangles.insert(allTriangles.end(), tmp.begin(), tmp.end());
+	// Materials, spheres and where the meshes go come from the scene file.
+	// Note: metallic and roughness only apply to Metal (roughness to Dielectric too).
+	SceneDescription scene;
+	if (!scene.load(batch.scenePath)) {
+		glfwTerminate();
+		return 1;
+	}
+	std::vector<Material> mats = scene.materials; // edited from the GUI
 
-		instances[0] = meshInst;
+	if (scene.hasCamera) {
+		camera.Position = scene.cameraPosition;
+		camera.lookAt(scene.cameraTarget);
+		if (scene.cameraFov > 0.0f) camera.Zoom = scene.cameraFov;
 	}
-	catch (const std::exception& e) {
-		std::cout << "Failed to load mesh: " << e.what() << std::endl;
+	else {
+		camera.lookAt(glm::vec3(0.0, 0.0, 0.0));
 	}
 
-	// Monkey
-	try {
-		rt_Mesh mesh("external/smooth-monkey.obj", 7); // path, material ID (index in mats)
-
+	// Shared vertex and index arrays for every mesh, in object space
+	IndexedGeometry geometry;
+
+	// One bottom-level BVH per mesh, built in object space as the meshes load
+	TwoLevelBVH accel;
+	// Refits the TLAS while instances move, kept apart from the loader's
+	// pool so a frame never waits behind a mesh import
+	ThreadPool refitPool(std::max(1, (int)std::thread::hardware_concurrency() - 1));
+
+	// Meshes import and build on worker threads while the window renders,
+	// and pop into the scene as they finish. Until then their instances have
+	// no mesh and are skipped.
+	AssetLoader loader;
+	std::vector<MeshInstance> instances;
+	std::vector<int> meshRequests; // the loader request behind each mesh instance
+	for (const SceneMesh& mesh : scene.meshes) {
 		MeshInstance meshInst;
-		meshInst.name = "Monkey";
-		meshInst.materialID = 7;
-		meshInst.originalTris = mesh.getTriangles(); // object-space
-		meshInst.firstTri = allTriangles.size();
-		meshInst.triCount = meshInst.originalTris.size();
-
-		meshInst.position = glm::vec3(meshPositions[1][0], meshPositions[1][1], meshPositions[1][2]);
-		meshInst.rotation = glm::vec3(meshRotations[1][0], meshRotations[1][1], meshRotations[1][2]);
-		meshInst.scale = glm::vec3(meshScales[1]);
+		meshInst.name = mesh.name;
+		meshInst.materialID = mesh.materialID;
+		meshInst.position = mesh.position;
+		meshInst.rotation = mesh.rotation;
+		meshInst.scale = mesh.scale;
 		meshInst.updateModel();
-		std::vector<Triangle> tmp;
-		ApplyTransform(meshInst.originalTris, tmp, meshInst.model);
-		allTriangles.insert(allTriangles.end(), tmp.begin(), tmp.end());
-		instances[1] = meshInst;
-	}
-	catch (const std::exception& e) {
-		std::cout << "Failed to load mesh: " << e.what() << std::endl;
+		instances.push_back(meshInst);
+		// Object space, imported only on a cache miss. The material is the instance's
+		meshRequests.push_back(loader.requestMesh(mesh.path));
 	}
-
-	// Spheres setup
-	Sphere spheres[7] = {
-		Sphere{0.0,    0.0,  -1.0, 0.0, 0.5,   0, 0, 0},
-		Sphere{0.0, -100.5,  -1.0, 0.0, 100.0, 1, 0, 0},
-		Sphere{-3.0,   0.0,   0.0, 0.0, 0.2,   2, 0, 0},
-		Sphere{3.0,    0.5,  0.75, 0.0, 0.5,   3, 0, 0},
-		Sphere{2,  -0.25, -0.25, 0.0, 0.25,  4, 0, 0},
-		Sphere{1.0,    0.5,   3.5, 0.0, 3.0,   0, 0, 0}
-		//Sphere{0.0,   15.0,   0.0, 0.0, 10.0,  2, 0, 0}
+	const int skyCubemapSize = 1024;
+	if (!scene.skyboxPath.empty()) loader.requestSky(scene.skyboxPath, skyCubemapSize);
+
+	// Material textures decode up front; the ray tracing shaders are compiled
+	// for whichever way they get sampled
+	TextureSet textures;
+	textures.load(scene.textures);
+	textures.upload();
+
+	// Every batch frame shows the whole scene, so a batch waits for it
+	if (batch.enabled) loader.waitAll();
+
+	// Adds up to maxMeshes staged meshes to the geometry and the BVHs, and
+	// returns their mesh IDs. Instances of the same file share the mesh, each
+	// with its own material.
+	const int meshCount = (int)instances.size();
+	auto takeStagedMeshes = [&](int maxMeshes) {
+		std::vector<int> added;
+		int request;
+		std::unique_ptr<StagedMesh> staged;
+		while ((int)added.size() < maxMeshes && loader.takeMesh(request, staged)) {
+			size_t firstTri, triCount;
+			const int meshID = staged->addTo(geometry, accel, firstTri, triCount);
+			for (int i = 0; i < meshCount; i++) {
+				if (meshRequests[i] != request) continue;
+				instances[i].meshID = meshID;
+				instances[i].firstTri = firstTri;
+				instances[i].triCount = triCount;
+			}
+			added.push_back(meshID);
+		}
+		return added;
 	};
+	takeStagedMeshes(INT_MAX);
+
+	// All spheres share one BLAS, placed in the world by an identity instance.
+	// The mesh instances above stay first so the GUI can index them.
+	{
+		MeshInstance sphereInst;
+		sphereInst.name = "Spheres";
+		sphereInst.meshID = accel.addSpheres(scene.spheres);
+		sphereInst.updateModel();
+		instances.push_back(sphereInst);
+	}
 
-	int sphereCount = sizeof(spheres) / sizeof(Sphere);
 
+	// Build the top-level BVH over the mesh instances loaded so far
+	accel.buildTLAS(instances);
 
-	// Start building the BVH
-	BVHBuilder bvhBuilder;
-	bvhBuilder.build(allTriangles);
+	// Emissive spheres and triangles, in world space, for light sampling
+	LightList lightList;
+	lightList.build(instances, accel, geometry, mats);
 
-	const auto& bvhNodes = bvhBuilder.getNodes();
-	const auto& primitives = bvhBuilder.getPrimitiveIndices();
+	const auto& bvhNodes = accel.getBLASNodes();
+	const auto& primitives = accel.getBLASPrimitiveIndices();
 
 	// Some BVH Debug stuff. -------------------------------------------------------------
 #ifdef RT_DEBUG
 	std::cout << "=== BVH DEBUG ===" << std::endl;
-	std::cout << "Input triangles: " << allTriangles.size() << std::endl;
-	std::cout << "BVH nodes: " << bvhNodes.size() << std::endl;
-	std::cout << "BVH primitives: " << primitives.size() << std::endl;
-
-	if (!bvhNodes.empty()) {
-		std::cout << "Root node bounds: ("
-			<< bvhNodes[0].min.x << "," << bvhNodes[0].min.y << "," << bvhNodes[0].min.z
+	std::cout << "Input triangles: " << geometry.triangles.size() << " ("
+		<< geometry.positions.size() << " shared vertices, "
+		<< (geometry.triangles.size() * sizeof(IndexedTriangle) + geometry.positions.size() * (2 * sizeof(glm::vec4) + sizeof(VertexShading))) / 1024
+		<< " KB)" << std::endl;
+	std::cout << "BLAS nodes: " << bvhNodes.size() << std::endl;
+	std::cout << "BLAS primitives: " << primitives.size() << std::endl;
+	std::cout << "TLAS nodes: " << accel.getTLASNodes().size() << std::endl;
+	std::cout << "Instances: " << accel.getInstances().size() << std::endl;
+
+	if (!accel.getTLASNodes().empty()) {
+		const BVHNode& root = accel.getTLASNodes()[0];
+		std::cout << "TLAS root bounds: ("
+			<< root.min.x << "," << root.min.y << "," << root.min.z
 			<< ") to ("
-			<< bvhNodes[0].max.x << "," << bvhNodes[0].max.y << "," << bvhNodes[0].max.z
+			<< root.max.x << "," << root.max.y << "," << root.max.z
 			<< ")" << std::endl;
-		std::cout << "Root left child: " << bvhNodes[0].leftChild << std::endl;
-		std::cout << "Root right child: " << bvhNodes[0].rightChild << std::endl;
-	}
-
-	if (!primitives.empty()) {
-		std::cout << "First primitive triangle index: " << primitives[0] << std::endl;
 	}
 	std::cout << "=================" << std::endl;
 #endif
@@ -269,137 +305,268 @@ int main() {
 	
 	// The textures being swapped for accumulation of rays over time.
 	// This is what makes renders gradually increase in quality as you let the camera sit.
-	GLuint accumulationTex[2];
-	glGenTextures(2, accumulationTex);
+	RenderTargets accumulation(renderWidth, renderHeight);
 
 	GLuint accumulationFBO;
 	glGenFramebuffers(1, &accumulationFBO);
 
-	for (int i = 0; i < 2; i++) {
-		glBindTexture(GL_TEXTURE_2D, accumulationTex[i]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, WIDTH, HEIGHT, 0,
-			GL_RGBA, GL_FLOAT, nullptr); // store HDR float data
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	}
-
 	int readIndex = 0;
 	int writeIndex = 1;
 
 	int frameCount = 1;
 
-	for (int i = 0; i < 2; i++) {
-		glBindTexture(GL_TEXTURE_2D, accumulationTex[i]);
-		std::vector<float> empty(WIDTH * HEIGHT * 4, 0.0f);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, WIDTH, HEIGHT, GL_RGBA, GL_FLOAT, empty.data());
-	}
-
 	float focusDistance = 20.0f; // Unused for now
-	camera.lookAt(glm::vec3(0.0, 0.0, 0.0));
 
 	// Sending material, sphere, and triangle data to the GPU through SSBOs.
 	GLuint matSSBO;
 	glGenBuffers(1, &matSSBO);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, matSSBO);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, mats.size() * sizeof(Material), mats.data(), GL_STATIC_DRAW);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, mats.size() * sizeof(Material), mats.data(), GL_DYNAMIC_DRAW); // edited from the GUI
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, matSSBO); // binding=0 in GLSL
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-	GLuint triSSBO;
-	glGenBuffers(1, &triSSBO);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, triSSBO);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, allTriangles.size() * sizeof(Triangle), allTriangles.data(), GL_STATIC_DRAW);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, triSSBO); // binding=1 in GLSL
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-	
+	// Geometry and BVH SSBOs. Meshes that finish loading later are appended,
+	// so each buffer grows with its array.
+	UploadRing uploads;
+	GrowableBuffer triangleBuffer(1);     // binding=1 in GLSL
+	GrowableBuffer positionBuffer(17);    // binding=17
+	GrowableBuffer normalBuffer(18);      // binding=18
+	GrowableBuffer shadingBuffer(21);     // binding=21, texture coordinates and tangents
+	GrowableBuffer bvhBuffer(3);          // binding=3
+	GrowableBuffer primBuffer(4);         // binding=4, primitive references
+	GrowableBuffer isectBuffer(16);       // binding=16, intersection-only triangles in leaf order
+	GrowableBuffer wideBvhBuffer(7);      // binding=7, compressed wide BVH sharing the leaves above
+	const auto& isectTriangles = accel.getIsectTriangles();
+	const auto& wideNodes = accel.getWideNodes();
+	auto appendGeometry = [&]() {
+		triangleBuffer.append(uploads, geometry.triangles);
+		positionBuffer.append(uploads, geometry.positions);
+		normalBuffer.append(uploads, geometry.normals);
+		shadingBuffer.append(uploads, geometry.shading);
+		bvhBuffer.append(uploads, bvhNodes);
+		primBuffer.append(uploads, primitives);
+		isectBuffer.append(uploads, isectTriangles);
+		wideBvhBuffer.append(uploads, wideNodes);
+	};
+	uploads.beginFrame();
+	appendGeometry();
+	uploads.endFrame();
+
 	GLuint sphereSSBO;
 	glGenBuffers(1, &sphereSSBO);
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, sphereSSBO);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(spheres), spheres, GL_STATIC_DRAW);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, accel.getSpheres().size() * sizeof(Sphere), accel.getSpheres().data(), GL_STATIC_DRAW); // BLAS leaf order
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, sphereSSBO); // binding=2 in GLSL
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
+	// TLAS nodes and instance SSBOs. These are the only buffers a moved object touches.
+	GLuint tlasSSBO = 0;
+	GLuint instanceSSBO = 0;
+	size_t tlasNodeCount = accel.getTLASNodes().size();
+	size_t instanceCount = accel.getInstances().size();
+	bool tlasRefitted = false; // since the last build, by a move
 
-	// BVH Nodes SSBO
-	GLuint bvhSSBO;
-
-	if (!bvhNodes.empty()) {
-		glGenBuffers(1, &bvhSSBO);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvhSSBO);
+	if (!accel.getTLASNodes().empty()) {
+		glGenBuffers(1, &tlasSSBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, tlasSSBO);
 		glBufferData(GL_SHADER_STORAGE_BUFFER,
-			bvhNodes.size() * sizeof(BVHNode),
-			bvhNodes.data(), GL_STATIC_DRAW);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, bvhSSBO); // binding = 3
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
-	}
-
-	// Primitive references SSBO
-	GLuint primSSBO;
+			accel.getTLASNodes().size() * sizeof(BVHNode),
+			accel.getTLASNodes().data(), GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, tlasSSBO); // binding = 8
 
-	if (!primitives.empty()) {
-		glGenBuffers(1, &primSSBO);
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, primSSBO);
+		glGenBuffers(1, &instanceSSBO);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceSSBO);
 		glBufferData(GL_SHADER_STORAGE_BUFFER,
-			primitives.size() * sizeof(int),
-			primitives.data(), GL_STATIC_DRAW);
-		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, primSSBO); // binding = 4
+			accel.getInstances().size() * sizeof(GPUInstance),
+			accel.getInstances().data(), GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, instanceSSBO); // binding = 9
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 	}
 
-	// Post Processing Setup
-
-	GLuint hdrFBO;
-	glGenFramebuffers(1, &hdrFBO);
-	glBindFramebuffer(GL_FRAMEBUFFER, hdrFBO);
+	// Light list SSBO: the header, then the lights. Respecified when the light count changes.
+	GLuint lightSSBO;
+	size_t lightCount = lightList.getLights().size();
+	glGenBuffers(1, &lightSSBO);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightSSBO);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GPULightHeader) + lightCount * sizeof(GPULight), nullptr, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GPULightHeader), &lightList.getHeader());
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(GPULightHeader), lightCount * sizeof(GPULight), lightList.getLights().data());
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 19, lightSSBO); // binding = 19
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-	GLuint colorBuffer;
-	glGenTextures(1, &colorBuffer);
-	glBindTexture(GL_TEXTURE_2D, colorBuffer);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, WIDTH, HEIGHT, 0, GL_RGBA, GL_FLOAT, nullptr);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	// Post Processing Setup
 
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorBuffer, 0);
+	// Render resolution to output resolution, the hook for a temporal upscaler
+	Upscaler upscaler(outputWidth, outputHeight);
 
+	// Half output resolution and below, so the glow costs a fraction of a full-screen pass
+	BloomPyramid bloom(outputWidth, outputHeight);
 
-	GLuint bloomFBO[2];
-	GLuint bloomTex[2];
+	///
 
-	glGenFramebuffers(2, bloomFBO);
-	glGenTextures(2, bloomTex);
+	// HDR Cubemap with GGX-prefiltered levels, once the loader has staged the sky
+	// Along with its importance sampling tables, for sampling the sky as a light
+	EnvironmentCDF envCDF;
+	EquirectToCubemap converter;
+	SkyCacheWriter skyWriter; // a converted sky's BC6H copy and cache file
+	GLuint cubemapTexture = 0;
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS); // the rough levels are a few texels across
+
+	auto takeStagedSky = [&]() {
+		std::unique_ptr<StagedSky> sky;
+		if (!loader.takeSky(sky)) return false;
+
+		// A cache hit is uploaded as it is
+		if (sky->cached()) {
+			cubemapTexture = SkyCache::upload(sky->cubemap);
+			if (cubemapTexture == 0) {
+				std::cout << "Failed to upload cached sky, converting " << sky->path << " again" << std::endl;
+				loader.requestSky(sky->path, skyCubemapSize, false);
+				return false;
+			}
+			envCDF.build(sky->envWeights, sky->envWidth, sky->envHeight);
+			return true;
+		}
 
-	for (int i = 0; i < 2; i++) {
-		glBindFramebuffer(GL_FRAMEBUFFER, bloomFBO[i]);
-		glBindTexture(GL_TEXTURE_2D, bloomTex[i]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, WIDTH, HEIGHT, 0, GL_RGBA, GL_FLOAT, nullptr);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, bloomTex[i], 0);
+		// A miss is converted on the GPU and rendered from at once, and
+		// compressed when the driver can and cached over the next frames
+		const HDRImage& image = sky->image;
+		GLuint equirectTexture = uploadHDRTexture(image);
+		if (equirectTexture == 0) return false;
+		std::vector<float> envWeights = EnvironmentCDF::texelWeights(image.data.get(), image.width, image.height, image.nrComponents);
+		envCDF.build(envWeights, image.width, image.height);
 
-		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-			std::cerr << "Bloom FBO " << i << " not complete!" << std::endl;
-	}
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		cubemapTexture = converter.convertToCubemap(equirectTexture, skyCubemapSize);
+		glDeleteTextures(1, &equirectTexture); // only the cubemap is sampled
 
-	///
+		skyWriter.begin(*sky, cubemapTexture, EquirectToCubemap::levelCount(skyCubemapSize),
+			std::move(envWeights), image.width, image.height);
+		return true;
+	};
+	// The BC6H copy replaces the converted sky once it's made
+	auto takeCompressedSky = [&](GLuint compressed) {
+		if (compressed == 0) return false;
+		glDeleteTextures(1, &cubemapTexture);
+		cubemapTexture = compressed;
+		return true;
+	};
+	takeStagedSky(); // already there for a batch
+	if (batch.enabled) takeCompressedSky(skyWriter.finish()); // every keyframe sees the same sky
 
-	// Load HDR Cubemap
-	GLuint equirectTexture = loadHDRTexture("textures/skybox/hdrSky.hdr");
+	bool useSkybox = true;
+	float skyboxIntentsity = scene.skyboxIntensity;
+
+	// Dither mask for the blue-noise sampler
+	BlueNoiseTexture blueNoise;
+	blueNoise.generate(64);
+
+	// Optional compute-shader wavefront path tracer. The fragment shader path
+	// stays the default and the fallback.
+	bool useWavefront = false;
+	bool useWideBVH = true;
+	bool useLightSampling = true;
+	bool useEnvSampling = true;
+	bool usePrefilteredSky = false; // rough metals read the prefiltered sky levels, an approximation
+	float prefilterMinRoughness = 0.3f;
+	int samplerType = 1; // 0: PCG, 1: Sobol (Owen scrambled), 2: blue noise, as in rt_sampler.glsl
+
+	// Adaptive sampling: tiles stop being traced once their noise is below the threshold
+	AdaptiveSampler adaptive(renderWidth, renderHeight);
+	bool useAdaptiveSampling = true;
+	float adaptiveThreshold = 0.02f; // relative standard error
+	int adaptiveMinSamples = 16;
+
+	// Several samples per pixel per displayed frame, split into bands so no
+	// draw runs long enough to trip the watchdog
+	TileScheduler tiles(renderWidth, renderHeight);
+
+	// Camera moves reproject the accumulation rather than resetting it
+	bool useReprojection = true;
+	int maxHistory = 64; // samples a reprojected pixel keeps at most
+
+	// G-buffer guided à-trous denoiser, for usable frames at a few samples per pixel
+	Denoiser denoiser(renderWidth, renderHeight);
+	bool useDenoiser = true;
+
+	// Per-pass GPU timings, and optional ray / node / primitive counts from the shaders
+	GPUProfiler profiler;
+	TraversalStats traversalStats;
+
+	// Batch frames are tone mapped offscreen and read back asynchronously.
+	// Every pixel gets exactly the requested samples from a reset accumulation,
+	// with no pixel skipping (u_disablePixelSkip).
+	GLuint batchFBO = 0;
+	GLuint batchTex = 0;
+	std::unique_ptr<AsyncImageWriter> batchWriter;
+	if (batch.enabled) {
+		glGenFramebuffers(1, &batchFBO);
+		glGenTextures(1, &batchTex);
+		glBindFramebuffer(GL_FRAMEBUFFER, batchFBO);
+		glBindTexture(GL_TEXTURE_2D, batchTex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, outputWidth, outputHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, batchTex, 0);
 
-	EquirectToCubemap converter;
-	GLuint cubemapTexture = converter.convertToCubemap(equirectTexture, 1024);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cerr << "Batch FBO not complete!" << std::endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
-	glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-	glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+		batchWriter.reset(new AsyncImageWriter(outputWidth, outputHeight));
+		useReprojection = false;
+		useAdaptiveSampling = false;
+	}
 
-	bool useSkybox = true;
-	float skyboxIntentsity = 1.0f;
-	float maxIntensity = 10.0f;
+	// Path depth: a total cap, one per lobe type, and the depth Russian roulette starts at
+	int maxBounces = 32;
+	int maxDiffuseBounces = 8;
+	int maxSpecularBounces = 16;
+	int maxTransmissionBounces = 24;
+	int rrStartDepth = 3;
+
+	// Bottom-level BVHs come from the CPU SAH build by default. The GPU LBVH
+	// builds faster trees of lower quality, for geometry that changes often.
+	LBVHBuilder lbvh;
+	int blasBuilder = 0; // 0: SAH (CPU), 1: LBVH (GPU)
+	bool rebuildBLASEveryFrame = false;
+
+	// Edits made at runtime stream through the persistently mapped ring, and
+	// only the element ranges that changed are copied into the GPU buffers.
+	DirtyRanges materialEdits;
+	DirtyRanges blasNodeEdits;
+	DirtyRanges blasPrimEdits;
+	DirtyRanges isectEdits;
 		
 	//
 
+	bool loadingScene = loader.busy();
+	bool stacksFinal = !loader.loadingMeshes();
+
+	// The ray tracing programs are specialized for the scene (ShaderPermutation)
+	// and built again whenever that changes: the sky arriving or toggled, a
+	// material type edited in, the BVH mode, the bounce cap, the short stack, a
+	// deeper TLAS, or the final stack sizes once loading is done. A permutation
+	// seen before comes from the binary cache.
+	int bvhShortStack = 0; // BVH_SHORT_STACK entries, 0 for the full stack
+	auto rayTracingDefines = [&]() {
+		ShaderPermutation permutation;
+		permutation.skybox = useSkybox && cubemapTexture != 0;
+		permutation.bvhMode = accel.getTLASNodes().empty() ? ShaderPermutation::BVHBruteForce
+			: useWideBVH && blasBuilder == 0 && !accel.getWideNodes().empty() ? ShaderPermutation::BVHWide
+			: ShaderPermutation::BVHBinary; // the wide nodes are collapsed from the SAH trees only
+		permutation.materialMask = ShaderPermutation::materialTypes(mats);
+		permutation.maxBounces = maxBounces;
+		return textures.shaderDefines() + sceneTraversalDefines(accel, bvhShortStack, stacksFinal)
+			+ permutation.defines();
+	};
+	shader::globalDefines() = rayTracingDefines();
+	shader my_shader("src/shaders/fullscreen.vert", "src/shaders/fragment.frag");
+	WavefrontTracer wavefront(renderWidth, renderHeight);
+
+	// Shader files saved while the program runs are picked up a moment later
+	const bool hotReloadShaders = !batch.enabled;
+	double lastShaderCheck = glfwGetTime();
+
 	IMGUI_CHECKVERSION();
 	ImGui::CreateContext();
 	ImGuiIO& io = ImGui::GetIO(); (void)io;
@@ -412,6 +579,67 @@ int main() {
 		deltaTime = currentFrame - lastFrame;
 		lastFrame = currentFrame;
 
+		// Moves to the next keyframe of the path, until there are none left
+		if (batch.enabled) {
+			if (!batch.beginFrame(camera)) break;
+			if (batch.startsKeyframe()) frameCount = 1;
+		}
+
+		uploads.beginFrame();
+
+		// Meshes and the sky pop in as the loader finishes them, one mesh a
+		// frame so no single frame stalls on several uploads
+		bool meshesArrived = false;
+		if (loadingScene) {
+			const std::vector<int> added = takeStagedMeshes(1);
+			if (!added.empty()) {
+				appendGeometry();
+				if (blasBuilder == 1) {
+					for (int meshID : added) {
+						const auto& mesh = accel.getMeshes()[meshID];
+						if (mesh.primType == InstanceTriangles) lbvh.build(mesh.firstTri, mesh.triCount, mesh.root, mesh.firstPrim);
+					}
+				}
+				meshesArrived = true;
+			}
+			if (takeStagedSky()) frameCount = 1;
+
+			// Every tree is there now, so the stacks get their final size
+			if (!stacksFinal && !loader.loadingMeshes()) stacksFinal = true;
+			loadingScene = loader.busy();
+		}
+		// Spread over the frames after a converted sky arrives
+		if (skyWriter.busy() && takeCompressedSky(skyWriter.update())) frameCount = 1;
+
+		// A new permutation rebuilds every ray tracing program
+		const std::string defines = rayTracingDefines();
+		if (defines != shader::globalDefines()) {
+			shader::globalDefines() = defines;
+#ifdef RT_DEBUG
+			std::cout << "Shader permutation:\n" << defines;
+#endif
+			glDeleteProgram(my_shader.ID);
+			my_shader = shader("src/shaders/fullscreen.vert", "src/shaders/fragment.frag");
+			wavefront.reloadKernels();
+		}
+		else if (hotReloadShaders && glfwGetTime() - lastShaderCheck > 0.5) {
+			lastShaderCheck = glfwGetTime();
+			bool reloaded = false;
+			for (shader* s : { &my_shader, &finalCompositeShader }) {
+				if (s->sourcesChanged()) reloaded |= s->reload();
+			}
+			reloaded |= wavefront.reloadChangedKernels();
+			if (reloaded) {
+#ifdef RT_DEBUG
+				std::cout << "Shaders reloaded" << std::endl;
+#endif
+				frameCount = 1;
+			}
+		}
+
+		profiler.beginFrame(deltaTime * 1000.0f);
+		traversalStats.beginFrame();
+
 		ImGui_ImplOpenGL3_NewFrame();
 		ImGui_ImplGlfw_NewFrame();
 		ImGui::NewFrame();
@@ -422,104 +650,237 @@ int main() {
 		static glm::vec3 lastCamFront = camera.Front;
 		static glm::vec3 lastCamUp = camera.Up;
 
+		// The view this frame's history was rendered from
+		static glm::mat4 prevViewProj = cameraViewProjection(camera, (float)renderWidth / renderHeight);
+		static glm::vec3 prevCamPos = camera.Position;
+
 		// Detect change
-		if (camera.Position != lastCamPos || camera.Front != lastCamFront || camera.Up != lastCamUp) {
-			frameCount = 1; // reset accumulation
+		const bool cameraChanged = camera.Position != lastCamPos || camera.Front != lastCamFront || camera.Up != lastCamUp;
+		bool cameraMoved = false;
+		if (cameraChanged) {
+			if (useReprojection) {
+				cameraMoved = true; // carry the history over
+			}
+			else {
+				frameCount = 1; // reset accumulation
+			}
 			lastCamPos = camera.Position;
 			lastCamFront = camera.Front;
 			lastCamUp = camera.Up;
 		}
-
-		// === STEP 1: RAYTRACING PASS ===
-		// Render raytracing result to accumulation buffer
-		glBindFramebuffer(GL_FRAMEBUFFER, accumulationFBO);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumulationTex[writeIndex], 0);
-
-		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-			std::cerr << "Framebuffer incomplete!" << std::endl;
+		// A lower render resolution while the camera moves, full resolution
+		// once it stops. On a size change the history keeps its old size until
+		// this frame has reprojected it into the new one.
+		bool renderResized = false;
+		if (outputResized && !batch.enabled) { // batch frames keep their size
+			outputResized = false;
+			bloom.resize(outputWidth, outputHeight);
+			upscaler.resize(outputWidth, outputHeight);
+			renderResized |= dynamicRes.setOutputSize(outputWidth, outputHeight);
+		}
+		renderResized |= dynamicRes.update(cameraChanged, tiles.sampleCostMs());
+		if (renderResized) {
+			renderWidth = dynamicRes.getRenderWidth();
+			renderHeight = dynamicRes.getRenderHeight();
+			accumulation.resize(renderWidth, renderHeight, readIndex);
+			wavefront.resize(renderWidth, renderHeight);
+			adaptive.resize(renderWidth, renderHeight);
+			tiles.resize(renderWidth, renderHeight);
+			denoiser.resize(renderWidth, renderHeight);
 		}
 
-		glViewport(0, 0, WIDTH, HEIGHT);
-		glClearColor(0.2f, 0.0f, 0.2f, 1.0);
-		glClear(GL_COLOR_BUFFER_BIT);
+		// Nothing to reproject after a reset
+		bool reproject = (cameraMoved || renderResized) && frameCount > 1;
 
-		// Bind the previous frame's accumulation texture for reading
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, accumulationTex[readIndex]);
+		// A batch keyframe takes exactly its samples, never more, and a moving
+		// camera takes one per frame so the resolution alone sets the frame time
+		if (batch.enabled) tiles.beginFrame(batch.samplesLeft());
+		else if (dynamicRes.isMoving()) tiles.beginFrame(1);
+		else tiles.beginFrame();
+		const int samplesThisFrame = tiles.samplesPerFrame();
+		int drawSamples = samplesThisFrame; // samples per pixel of the last draw
 
-		my_shader.use();
-		my_shader.setInt("u_accumulationTex", 0);
+		// === STEP 1: RAYTRACING PASS ===
+		profiler.begin("Ray Tracing");
+		// Uniforms shared by the fragment shader and the wavefront kernels.
+		auto setSceneUniforms = [&](const shader& s) {
+			// Set cubemap uniforms. The unit is set even without a sky, since
+			// the sampler left on unit 0 would clash with the 2D ones there.
+			s.setInt("u_skybox", 1);
+			if (useSkybox && cubemapTexture != 0) {
+				glActiveTexture(GL_TEXTURE1);
+				glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+				s.setBool("u_useSkybox", true);
+			}
+			else {
+				s.setBool("u_useSkybox", false);
+			}
 
-		// Set cubemap uniforms
-		if (useSkybox && cubemapTexture != 0) {
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-			my_shader.setInt("u_skybox", 1);
-			my_shader.setBool("u_useSkybox", true);
+			// Environment CDFs, only for the HDR skybox
+			const bool envSampling = useEnvSampling && useSkybox && cubemapTexture != 0 && envCDF.valid();
+			if (envSampling) {
+				glActiveTexture(GL_TEXTURE2);
+				glBindTexture(GL_TEXTURE_2D, envCDF.getConditional());
+				glActiveTexture(GL_TEXTURE3);
+				glBindTexture(GL_TEXTURE_2D, envCDF.getMarginal());
+				s.setInt("u_envConditional", 2);
+				s.setInt("u_envMarginal", 3);
+				s.setFloat("u_envIntegral", envCDF.getIntegral());
+			}
+			s.setBool("u_useEnvSampling", envSampling);
+			s.setBool("u_prefilteredSky", usePrefilteredSky);
+			s.setFloat("u_prefilterMinRoughness", prefilterMinRoughness);
+
+			glActiveTexture(GL_TEXTURE4);
+			glBindTexture(GL_TEXTURE_2D, blueNoise.getTexture());
+			s.setInt("u_blueNoise", 4);
+			s.setInt("u_samplerType", samplerType);
+
+			glActiveTexture(GL_TEXTURE5);
+			glBindTexture(GL_TEXTURE_2D, adaptive.getMask());
+			s.setInt("u_adaptiveMask", 5);
+			s.setBool("u_adaptiveSampling", useAdaptiveSampling);
+			s.setFloat("u_adaptiveThreshold", adaptiveThreshold);
+			s.setInt("u_adaptiveMinSamples", adaptiveMinSamples);
+			s.setBool("u_disablePixelSkip", batch.enabled);
+
+			// Units 6 to 8 are the accumulation history, bound per pass
+			textures.bind(s, 9);
+
+			s.setBool("u_reproject", reproject);
+			s.setMat4("u_prevViewProj", prevViewProj);
+			s.setVec3("u_prevCamPos", prevCamPos);
+			s.setVec2("u_prevResolution", accumulation.sizeOf(readIndex));
+			s.setInt("u_maxHistory", maxHistory);
+
+			// Set camera uniforms
+			s.setVec3("camPos", camera.Position);
+			s.setVec3("camFront", camera.Front);
+			s.setVec3("camRight", camera.Right);
+			s.setVec3("camUp", camera.Up);
+			s.setFloat("camFov", camera.Zoom);
+			s.setVec2("resolution", glm::vec2(renderWidth, renderHeight));
+			s.setFloat("time", glfwGetTime());
+			s.setInt("frameCount", frameCount);
+			s.setFloat("skyboxIntensity", skyboxIntentsity);
+			// The wide nodes are collapsed from the SAH trees only
+			s.setBool("u_useWideBVH", useWideBVH && blasBuilder == 0);
+			s.setBool("u_useLightSampling", useLightSampling);
+			s.setInt("u_maxBounces", maxBounces);
+			s.setInt("u_maxDiffuseBounces", maxDiffuseBounces);
+			s.setInt("u_maxSpecularBounces", maxSpecularBounces);
+			s.setInt("u_maxTransmissionBounces", maxTransmissionBounces);
+			s.setInt("u_rrStartDepth", rrStartDepth);
+			s.setBool("u_traversalStats", traversalStats.enabled);
+		};
+
+		tiles.beginTiming();
+		if (useWavefront) {
+			// Render raytracing result to accumulation buffer, one compute dispatch per stage.
+			// The kernels take one sample per pixel, so they run once per sample.
+			wavefront.setMaxBounces(maxBounces);
+			for (int i = 0; i < samplesThisFrame; i++) {
+				if (i > 0) {
+					std::swap(readIndex, writeIndex);
+					frameCount++;
+					reproject = false;
+				}
+				accumulation.fit(writeIndex);
+				wavefront.render(accumulation[readIndex], accumulation[writeIndex], setSceneUniforms);
+			}
+			drawSamples = 1;
 		}
 		else {
-			my_shader.setBool("u_useSkybox", false);
-		}
-
-		// Set camera uniforms
-		my_shader.setVec3("camPos", camera.Position);
-		my_shader.setVec3("camFront", camera.Front);
-		my_shader.setVec3("camRight", camera.Right);
-		my_shader.setVec3("camUp", camera.Up);
-		my_shader.setFloat("camFov", camera.Zoom);
-		my_shader.setVec2("resolution", glm::vec2(WIDTH, HEIGHT));
-		my_shader.setFloat("time", glfwGetTime());
-		my_shader.setInt("frameCount", frameCount++);
-		my_shader.setFloat("skyboxIntensity", skyboxIntentsity);
-		my_shader.setFloat("maxIntensity", maxIntensity);
-
-		// RENDER THE RAYTRACING
-		glBindVertexArray(VAO);
-		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-		// Swap read/write indices for accumulation
-		std::swap(readIndex, writeIndex);
-
-		// === STEP 2: BLOOM BRIGHT PASS ===
-		glBindFramebuffer(GL_FRAMEBUFFER, bloomFBO[0]);
-		glViewport(0, 0, WIDTH, HEIGHT);
-		glClear(GL_COLOR_BUFFER_BIT);
-
-		brightPassShader.use();
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, accumulationTex[readIndex]); // Use the newly written accumulation
-		brightPassShader.setInt("hdrTex", 0);
-		brightPassShader.setFloat("threshold", 1.0f);
-
-		glBindVertexArray(VAO);
-		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-		// === STEP 3: BLOOM BLUR PASSES ===
-		bool horizontal = true;
-		int blurIterations = 10;
-		int read = 0, write = 1;
+			// Render raytracing result to accumulation buffer
+			glBindFramebuffer(GL_FRAMEBUFFER, accumulationFBO);
+			accumulation.fit(writeIndex);
+			const AccumulationTargets& target = accumulation[writeIndex];
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.color, 0);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, target.moments, 0);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, target.albedo, 0);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, target.normalDepth, 0);
+			const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+			glDrawBuffers(4, drawBuffers);
+
+			if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+				std::cerr << "Framebuffer incomplete!" << std::endl;
+			}
 
-		for (int i = 0; i < blurIterations; i++) {
-			glBindFramebuffer(GL_FRAMEBUFFER, bloomFBO[write]);
-			glViewport(0, 0, WIDTH, HEIGHT);
+			glViewport(0, 0, renderWidth, renderHeight);
+			glClearColor(0.2f, 0.0f, 0.2f, 1.0);
 			glClear(GL_COLOR_BUFFER_BIT);
 
-			blurShader.use();
-			blurShader.setBool("horizontal", horizontal);
+			// Bind the previous frame's accumulation texture for reading
 			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, bloomTex[read]);
-			blurShader.setInt("image", 0);
-
+			glBindTexture(GL_TEXTURE_2D, accumulation[readIndex].color);
+			glActiveTexture(GL_TEXTURE6);
+			glBindTexture(GL_TEXTURE_2D, accumulation[readIndex].moments);
+			glActiveTexture(GL_TEXTURE7);
+			glBindTexture(GL_TEXTURE_2D, accumulation[readIndex].albedo);
+			glActiveTexture(GL_TEXTURE8);
+			glBindTexture(GL_TEXTURE_2D, accumulation[readIndex].normalDepth);
+
+			my_shader.use();
+			my_shader.setInt("u_accumulationTex", 0);
+			my_shader.setInt("u_momentsTex", 6);
+			my_shader.setInt("u_albedoTex", 7);
+			my_shader.setInt("u_normalDepthTex", 8);
+			my_shader.setInt("u_samplesPerPass", samplesThisFrame);
+			setSceneUniforms(my_shader);
+
+			// RENDER THE RAYTRACING
+			// One band at a time, each flushed as its own submission
 			glBindVertexArray(VAO);
-			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+			glEnable(GL_SCISSOR_TEST);
+			for (int i = 0; i < tiles.bandCount(); i++) {
+				int y, rows;
+				tiles.bandRows(i, y, rows);
+				glScissor(0, y, renderWidth, rows);
+				glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+				glFlush();
+			}
+			glDisable(GL_SCISSOR_TEST);
+		}
+		tiles.endTiming();
 
-			horizontal = !horizontal;
-			std::swap(read, write);
+		// Decide which tiles the next frame traces
+		if (useAdaptiveSampling) {
+			adaptive.update(accumulation[writeIndex].moments, adaptiveThreshold, adaptiveMinSamples);
 		}
+		profiler.end();
+		frameCount += drawSamples;
+		prevViewProj = cameraViewProjection(camera, (float)renderWidth / renderHeight);
+		prevCamPos = camera.Position;
 
-		// === STEP 4: FINAL COMPOSITE TO SCREEN ===
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glViewport(0, 0, WIDTH, HEIGHT);
+		// Swap read/write indices for accumulation
+		std::swap(readIndex, writeIndex);
+
+		// === STEP 2: DENOISE ===
+		// Everything after this shows the filtered image; accumulation stays raw.
+		GLuint displayTex = accumulation[readIndex].color;
+		if (useDenoiser) {
+			profiler.begin("Denoise");
+			displayTex = denoiser.apply(accumulation[readIndex], VAO);
+			profiler.end();
+		}
+
+		// === STEP 3: UPSCALE ===
+		// Render resolution to output resolution. prevViewProj is this frame's
+		// view by now.
+		profiler.begin("Upscale");
+		displayTex = upscaler.apply(displayTex, renderWidth, renderHeight, accumulation[readIndex], prevViewProj);
+		profiler.end();
+
+		// === STEP 4: BLOOM ===
+		// Bright pass and blur in one pyramid, from the displayed image
+		profiler.begin("Bloom");
+		GLuint bloomTex = bloom.apply(displayTex, VAO);
+		profiler.end();
+
+		// === STEP 5: FINAL COMPOSITE TO SCREEN ===
+		profiler.begin("Composite");
+		glBindFramebuffer(GL_FRAMEBUFFER, batchFBO); // 0 unless batch rendering
+		glViewport(0, 0, outputWidth, outputHeight);
 		glClearColor(0.0f, 0.0f, 0.0f, 1.0);
 		glClear(GL_COLOR_BUFFER_BIT);
 
@@ -527,63 +888,187 @@ int main() {
 
 		// Bind raytraced scene
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, accumulationTex[readIndex]);
+		glBindTexture(GL_TEXTURE_2D, displayTex);
 		finalCompositeShader.setInt("hdrTex", 0);
 
 		// Bind bloom result
 		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, bloomTex[read]);
+		glBindTexture(GL_TEXTURE_2D, bloomTex);
 		finalCompositeShader.setInt("bloomTex", 1);
+		finalCompositeShader.setFloat("bloomStrength", bloom.strength());
 
 		finalCompositeShader.setFloat("exposure", 1.0f);
 
 		glBindVertexArray(VAO);
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		profiler.end();
+		traversalStats.endFrame();
+
+		if (batch.enabled) {
+			batch.endFrame(*batchWriter, accumulation[readIndex].color, accumulation[readIndex].moments, batchFBO, samplesThisFrame);
+		}
 
 		// Mesh Controls
 		std::string label;
 
-		bool anyMeshMoved = false;
+		bool anyMeshMoved = meshesArrived;
+		bool lightsChanged = meshesArrived; // the emitters themselves, which needs a light list build
+		std::vector<int> movedInstances;    // the lights of these only follow their instance
 		int fps = 1 / deltaTime;
 		std::string fps_label = "FPS: " + std::to_string(fps);
 
 		ImGui::Begin("Settings");
 		ImGui::Text(fps_label.c_str());
 
+		// Results lag a few frames behind, since they are only read once ready
+		if (ImGui::CollapsingHeader("Profiler")) {
+			profiler.drawImGui();
+			traversalStats.drawImGui(profiler.average("Ray Tracing"));
+		}
+
 		ImGui::Separator();
 
 		ImGui::Text("Move Meshes");
-		
-		label = instances[0].name + " Position";
-		anyMeshMoved |= ImGui::DragFloat3(label.c_str(), meshPositions[0], 0.01f);
-		label = instances[1].name + " Position";
-		anyMeshMoved |= ImGui::DragFloat3(label.c_str(), meshPositions[1], 0.01f);
+		if (loadingScene) {
+			ImGui::Text("Loading %d meshes...", loader.meshesLoading());
+		}
 
-		ImGui::Separator();
-		label = instances[0].name + " Rotation";
-		anyMeshMoved |= ImGui::DragFloat3(label.c_str(), meshRotations[0], 0.01f);
-		label = instances[1].name + " Rotation";
-		anyMeshMoved |= ImGui::DragFloat3(label.c_str(), meshRotations[1], 0.01f);
+		for (int i = 0; i < meshCount; i++) {
+			MeshInstance& inst = instances[i];
+			ImGui::PushID(i);
+			ImGui::Separator();
+			ImGui::Text(inst.meshID < 0 ? "%s (loading)" : "%s", inst.name.c_str());
+			bool moved = ImGui::DragFloat3("Position", &inst.position.x, 0.01f);
+			moved |= ImGui::DragFloat3("Rotation", &inst.rotation.x, 0.01f);
+			moved |= ImGui::DragFloat3("Scale", &inst.scale.x, 0.01f);
+			const bool materialChanged = ImGui::DragInt("Material", &inst.materialID, 1.0f, 0, mats.size() - 1);
+			ImGui::PopID();
+
+			if (moved) movedInstances.push_back(i);
+			anyMeshMoved |= moved || materialChanged;
+			lightsChanged |= materialChanged;
+		}
 
 		ImGui::Separator();
-		label = instances[0].name + " Scale";
-		anyMeshMoved |= ImGui::DragFloat(label.c_str(), &meshScales[0], 0.01f);
-		label = instances[1].name + " Scale";
-		anyMeshMoved |= ImGui::DragFloat(label.c_str(), &meshScales[1], 0.01f);
+		if (ImGui::CollapsingHeader("Materials")) {
+			for (size_t m = 0; m < mats.size(); m++) {
+				Material& mat = mats[m];
+				bool edited = false;
+
+				ImGui::PushID((int)m);
+				label = "Material " + std::to_string(m);
+				ImGui::TextUnformatted(label.c_str());
+				edited |= ImGui::ColorEdit3("Albedo", &mat.albedo_x);
+				edited |= ImGui::Combo("Type", &mat.type, "Lambertian\0Metal\0Dielectric\0Emissive\0");
+				edited |= ImGui::DragFloat("Emission", &mat.emissionStrength, 0.05f, 0.0f, 100.0f);
+				edited |= ImGui::DragFloat("Roughness", &mat.roughness, 0.005f, 0.0f, 1.0f);
+				edited |= ImGui::DragFloat("Metallic", &mat.metallic, 0.005f, 0.0f, 1.0f);
+				edited |= ImGui::DragFloat("IOR", &mat.refractionIndex, 0.01f, 1.0f, 3.0f);
+				if (mat.albedoTexture >= 0 || mat.roughnessTexture >= 0 || mat.normalTexture >= 0) {
+					edited |= ImGui::DragFloat2("UV Scale", &mat.uvScale_x, 0.01f);
+					edited |= ImGui::DragFloat2("UV Offset", &mat.uvOffset_x, 0.005f);
+				}
+				ImGui::PopID();
+
+				if (edited) {
+					materialEdits.mark(m, 1);
+					lightsChanged = true;
+					frameCount = 1;
+				}
+			}
+		}
 
 		ImGui::Separator();
-		label = instances[0].name + " Material";
-		anyMeshMoved |= ImGui::DragInt(label.c_str(), &instances[0].materialID, 1.0f, 0, mats.size() - 1);
-		label = instances[1].name + " Material";
-		anyMeshMoved |= ImGui::DragInt(label.c_str(), &instances[1].materialID, 1.0f, 0, mats.size() - 1);
+		if (ImGui::DragFloat("Skybox Intensity", &skyboxIntentsity, 0.01f, 0.05f, 10.0f)) {
+			frameCount = 1;
+		}
 
 		ImGui::Separator();
-		if (ImGui::DragFloat("Skybox Intensity", &skyboxIntentsity, 0.01f, 0.05f, 10.0f)) {
+		ImGui::Checkbox("Wavefront Path Tracer (compute)", &useWavefront);
+		ImGui::Checkbox("Wide BVH (quantized)", &useWideBVH);
+		ImGui::SliderInt("Short Stack (0 = full)", &bvhShortStack, 0, 32);
+		if (ImGui::Checkbox("Light Sampling (NEE + MIS)", &useLightSampling)) {
+			frameCount = 1;
+		}
+		if (ImGui::Checkbox("Environment Sampling (MIS)", &useEnvSampling)) {
 			frameCount = 1;
 		}
-		if (ImGui::DragFloat("Skybox Max Intensity", &maxIntensity, 0.01f, 1.0f, 20.0f)) {
+		if (ImGui::Checkbox("Prefiltered Sky for Rough Metals", &usePrefilteredSky)) {
 			frameCount = 1;
 		}
+		if (usePrefilteredSky && ImGui::SliderFloat("From Roughness", &prefilterMinRoughness, 0.0f, 1.0f)) {
+			frameCount = 1;
+		}
+		if (ImGui::Combo("Sampler", &samplerType, "PCG\0Sobol (Owen)\0Blue Noise\0")) {
+			frameCount = 1;
+		}
+
+		if (ImGui::CollapsingHeader("Path Depth")) {
+			bool depthChanged = false;
+			depthChanged |= ImGui::SliderInt("Max Bounces", &maxBounces, 1, WavefrontTracer::MAX_BOUNCES);
+			depthChanged |= ImGui::SliderInt("Diffuse", &maxDiffuseBounces, 0, WavefrontTracer::MAX_BOUNCES);
+			depthChanged |= ImGui::SliderInt("Specular", &maxSpecularBounces, 0, WavefrontTracer::MAX_BOUNCES);
+			depthChanged |= ImGui::SliderInt("Transmission", &maxTransmissionBounces, 0, WavefrontTracer::MAX_BOUNCES);
+			depthChanged |= ImGui::SliderInt("Russian Roulette From", &rrStartDepth, 0, WavefrontTracer::MAX_BOUNCES);
+			if (depthChanged) frameCount = 1;
+		}
+
+		// How much tracing a displayed frame does. Neither resets accumulation.
+		if (ImGui::CollapsingHeader("Samples Per Frame")) {
+			ImGui::Checkbox("Adapt To Frame Time", &tiles.adaptive);
+			if (tiles.adaptive) {
+				ImGui::SliderFloat("Target Frame (ms)", &tiles.targetFrameMs, 4.0f, 500.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+				ImGui::SliderInt("Max Samples", &tiles.maxSamples, 1, 256);
+			}
+			else {
+				ImGui::SliderInt("Samples", &tiles.fixedSamples, 1, 256);
+			}
+			ImGui::SliderFloat("Max Dispatch (ms)", &tiles.maxDispatchMs, 10.0f, 1000.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+			ImGui::Text("%d spp in %d bands, %.1f Msamples/s", tiles.samplesPerFrame(), tiles.bandCount(), tiles.samplesPerSecond() / 1e6);
+		}
+
+		// Only lowers the resolution while the camera moves; a still camera renders at full size
+		if (ImGui::CollapsingHeader("Dynamic Resolution")) {
+			ImGui::Checkbox("Scale While Moving", &dynamicRes.enabled);
+			ImGui::SliderFloat("Moving Frame (ms)", &dynamicRes.targetFrameMs, 4.0f, 100.0f, "%.0f", ImGuiSliderFlags_Logarithmic);
+			ImGui::SliderFloat("Min Scale", &dynamicRes.minScale, 0.125f, 1.0f, "%.3f");
+			ImGui::SliderInt("Settle Frames", &dynamicRes.settleFrames, 1, 60);
+			ImGui::Text("Render %d x %d (%.0f%%) of %d x %d", renderWidth, renderHeight,
+				dynamicRes.getScale() * 100.0f, outputWidth, outputHeight);
+		}
+
+		// Converged tiles are judged again every frame, so none of this resets accumulation
+		if (ImGui::CollapsingHeader("Adaptive Sampling")) {
+			ImGui::Checkbox("Enabled", &useAdaptiveSampling);
+			ImGui::SliderFloat("Error Threshold", &adaptiveThreshold, 0.001f, 0.2f, "%.3f", ImGuiSliderFlags_Logarithmic);
+			ImGui::SliderInt("Min Samples", &adaptiveMinSamples, 2, 256);
+		}
+
+		if (ImGui::CollapsingHeader("Temporal Reprojection")) {
+			ImGui::Checkbox("Reproject On Camera Move", &useReprojection);
+			ImGui::SliderInt("Max History", &maxHistory, 1, 1024);
+		}
+
+		// Only the displayed image is filtered, so none of this resets accumulation either
+		if (ImGui::CollapsingHeader("Denoiser")) {
+			ImGui::Checkbox("Denoise", &useDenoiser);
+			ImGui::SliderInt("Iterations", &denoiser.iterations, 1, 8);
+			ImGui::SliderFloat("Color Sigma", &denoiser.sigmaColor, 0.5f, 16.0f);
+			ImGui::SliderFloat("Normal Sigma", &denoiser.sigmaNormal, 1.0f, 256.0f);
+			ImGui::SliderFloat("Depth Sigma", &denoiser.sigmaDepth, 0.001f, 0.2f, "%.3f", ImGuiSliderFlags_Logarithmic);
+		}
+
+		// The glow widens with every level of the pyramid
+		if (ImGui::CollapsingHeader("Bloom")) {
+			ImGui::SliderInt("Mip Levels", &bloom.mipCount, 1, BloomPyramid::MAX_MIPS);
+			ImGui::SliderFloat("Threshold", &bloom.threshold, 0.0f, 8.0f);
+			ImGui::SliderFloat("Filter Radius", &bloom.filterRadius, 0.5f, 3.0f);
+			ImGui::SliderFloat("Intensity", &bloom.intensity, 0.0f, 4.0f);
+		}
+		bool blasBuilderChanged = ImGui::Combo("BLAS Builder", &blasBuilder, "SAH (CPU)\0LBVH (GPU)\0");
+		if (blasBuilder == 1) {
+			ImGui::Checkbox("Rebuild BLAS Every Frame", &rebuildBLASEveryFrame);
+		}
 
 		ImGui::Separator();
 
@@ -603,60 +1088,134 @@ int main() {
 				<< std::put_time(&tm, "%Y-%m-%d_%H-%M-%S")
 				<< ".png";
 			std::string filename = ss.str();
-			saveScreenshot(filename.c_str(), WIDTH, HEIGHT);
+			saveScreenshot(filename.c_str(), outputWidth, outputHeight);
 		}
 
+		if (blasBuilderChanged || (blasBuilder == 1 && rebuildBLASEveryFrame)) {
+			frameCount = 1;
+
+			if (blasBuilder == 1) {
+				// Written straight into the BLAS ranges of bindings 3 and 4
+				for (const auto& mesh : accel.getMeshes()) {
+					if (mesh.primType != InstanceTriangles) continue;
+					lbvh.build(mesh.firstTri, mesh.triCount, mesh.root, mesh.firstPrim);
+				}
+			}
+			else {
+				// Restore just the ranges the LBVH wrote over, mesh by mesh
+				for (const auto& mesh : accel.getMeshes()) {
+					if (mesh.root < 0 || mesh.primType != InstanceTriangles) continue;
+					blasNodeEdits.mark(mesh.root, 2 * mesh.triCount - 1);
+					blasPrimEdits.mark(mesh.firstPrim, mesh.triCount);
+					isectEdits.mark(mesh.firstPrim, mesh.triCount);
+				}
+			}
+		}
+
+		// While instances move the TLAS is only refit to them, and once they are
+		// at rest it is rebuilt for a tight tree again. The rebuild bounds the
+		// same instances, so the image doesn't change and keeps accumulating.
+		bool tlasChanged = anyMeshMoved;
 		if (anyMeshMoved) {
 			frameCount = 1;
 
-			int i = 0;
-			for (auto& inst : instances) {
-				inst.position = glm::vec3(meshPositions[i][0], meshPositions[i][1], meshPositions[i][2]);
-				inst.rotation = glm::vec3(meshRotations[i][0], meshRotations[i][1], meshRotations[i][2]);
-				inst.scale = glm::vec3(meshScales[i]);
-				inst.updateModel();
-
-				std::vector<Triangle> transformed;
-				ApplyTransform(inst.originalTris, transformed, inst.model);
-				std::copy(transformed.begin(), transformed.end(), allTriangles.begin() + inst.firstTri);
-				i++;
+			for (int i = 0; i < meshCount; i++) {
+				instances[i].updateModel();
 			}
 
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, triSSBO);
-			glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
-				allTriangles.size() * sizeof(Triangle), allTriangles.data());
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+			// Instances can appear or vanish (zero scale), which needs a rebuild
+			tlasRefitted = accel.refitTLAS(instances, &refitPool);
+			if (!tlasRefitted) accel.buildTLAS(instances);
+		}
+		else if (tlasRefitted) {
+			accel.buildTLAS(instances);
+			tlasRefitted = false;
+			tlasChanged = true;
+		}
 
-			bvhBuilder.refit(allTriangles);
-			const auto& bvhNodes = bvhBuilder.getNodes();
-			glBindBuffer(GL_SHADER_STORAGE_BUFFER, bvhSSBO);
-			glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
-				bvhNodes.size() * sizeof(BVHNode), bvhNodes.data());
+		// Only the TLAS and instance transforms change; triangles and BLASes stay put.
+		// The buffers are only respecified when their length changes.
+		if (tlasChanged) {
+			const auto& tlasNodes = accel.getTLASNodes();
+			const auto& gpuInstances = accel.getInstances();
+
+			if (!tlasSSBO) glGenBuffers(1, &tlasSSBO);
+			if (tlasNodes.size() != tlasNodeCount) {
+				tlasNodeCount = tlasNodes.size();
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, tlasSSBO);
+				glBufferData(GL_SHADER_STORAGE_BUFFER, tlasNodeCount * sizeof(BVHNode), nullptr, GL_DYNAMIC_DRAW);
+				glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, tlasSSBO);
+			}
+			uploads.upload(tlasSSBO, 0, tlasNodes.size() * sizeof(BVHNode), tlasNodes.data());
+
+			if (!instanceSSBO) glGenBuffers(1, &instanceSSBO);
+			if (gpuInstances.size() != instanceCount) {
+				instanceCount = gpuInstances.size();
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceSSBO);
+				glBufferData(GL_SHADER_STORAGE_BUFFER, instanceCount * sizeof(GPUInstance), nullptr, GL_DYNAMIC_DRAW);
+				glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, instanceSSBO);
+			}
+			uploads.upload(instanceSSBO, 0, gpuInstances.size() * sizeof(GPUInstance), gpuInstances.data());
 			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 		}
 
+		// Lights are in world space. Material edits and new meshes rebuild the
+		// list, moves only re-place the moved instances' lights.
+		if (lightsChanged || !movedInstances.empty()) {
+			if (lightsChanged || !lightList.move(movedInstances, instances, accel, geometry))
+				lightList.build(instances, accel, geometry, mats);
+			const auto& lights = lightList.getLights();
+
+			if (lights.size() != lightCount) {
+				lightCount = lights.size();
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightSSBO);
+				glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GPULightHeader) + lightCount * sizeof(GPULight), nullptr, GL_DYNAMIC_DRAW);
+				glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 19, lightSSBO);
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+			}
+			uploads.upload(lightSSBO, 0, sizeof(GPULightHeader), &lightList.getHeader());
+			uploads.upload(lightSSBO, sizeof(GPULightHeader), lights.size() * sizeof(GPULight), lights.data());
+		}
+
+		materialEdits.flush(uploads, matSSBO, mats);
+		blasNodeEdits.flush(uploads, bvhBuffer.id(), bvhNodes);
+		blasPrimEdits.flush(uploads, primBuffer.id(), primitives);
+		isectEdits.flush(uploads, isectBuffer.id(), isectTriangles);
+
 		ImGui::End();
 		ImGui::Render();
-		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		if (!batch.enabled) {
+			ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		}
+
+		uploads.endFrame();
 
 		glfwPollEvents();
-		glfwSwapBuffers(window);
+		if (!batch.enabled) {
+			glfwSwapBuffers(window);
+		}
 	}
-	// Cleanup
+	// Let the last batch frames reach the disk
+	batchWriter.reset();
+
+	// Cleanup. A sky still being cached is cached on the next launch instead.
+	skyWriter.cancel();
 	if (cubemapTexture != 0) {
 		glDeleteTextures(1, &cubemapTexture);
 	}
 
 	if (matSSBO) glDeleteBuffers(1, &matSSBO);
-	if (triSSBO) glDeleteBuffers(1, &triSSBO);
 	if (sphereSSBO) glDeleteBuffers(1, &sphereSSBO);
-	if (bvhSSBO) glDeleteBuffers(1, &bvhSSBO);
-	if (primSSBO) glDeleteBuffers(1, &primSSBO);
+	if (tlasSSBO) glDeleteBuffers(1, &tlasSSBO);
+	if (instanceSSBO) glDeleteBuffers(1, &instanceSSBO);
+	if (lightSSBO) glDeleteBuffers(1, &lightSSBO);
+	if (batchFBO) glDeleteFramebuffers(1, &batchFBO);
+	if (batchTex) glDeleteTextures(1, &batchTex);
 
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();
 	ImGui::DestroyContext();
 
 	glfwTerminate();
-	return 0;
+	return batch.samplesComplete() ? 0 : 1;
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <cmath>
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -18,59 +19,148 @@
 struct MeshData {
     std::vector<glm::vec3> vertices;
     std::vector<glm::vec3> normals;
+    std::vector<glm::vec2> texcoords;   // first UV channel, if the mesh has one
+    std::vector<glm::vec4> tangents;    // w: bitangent sign, if Assimp could compute them
     std::vector<unsigned int> indices;
 };
 
 class rt_Mesh {
 public:
+    // Assimp post-processing applied on import. Part of the mesh cache key.
+    static const unsigned int IMPORT_FLAGS =
+        aiProcess_Triangulate |
+        aiProcess_GenSmoothNormals |
+        aiProcess_CalcTangentSpace |
+        aiProcess_FlipUVs;
+
     std::vector<MeshData> meshes;
-    std::vector<Triangle> triangles;
 
     rt_Mesh(std::string const& path, int materialID = 0) : defaultMaterialID(materialID) {
         loadMesh(path);
-        generateTriangles();
     }
 
-    // Get all triangles for uploading to GPU
-    const std::vector<Triangle>& getTriangles() const {
-        return triangles;
-    }
+    // Appends this mesh's vertices and triangles to the scene geometry. Triangle
+    // indices are offset past the vertices already there, so every mesh shares
+    // the same buffers. Returns the number of triangles added.
+    size_t appendTo(IndexedGeometry& geometry) const {
+        const size_t firstTri = geometry.triangles.size();
 
-    // Transform all triangles by a matrix (for positioning/scaling meshes)
-    void transform(const glm::mat4& matrix) {
-        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(matrix)));
+        for (const auto& mesh : meshes) {
+            const uint32_t baseVertex = (uint32_t)geometry.positions.size();
 
-        for (auto& triangle : triangles) {
-            // Transform vertices
-            glm::vec4 v0 = matrix * glm::vec4(triangle.v0.x, triangle.v0.y, triangle.v0.z, 1.0);
-            glm::vec4 v1 = matrix * glm::vec4(triangle.v1.x, triangle.v1.y, triangle.v1.z, 1.0);
-            glm::vec4 v2 = matrix * glm::vec4(triangle.v2.x, triangle.v2.y, triangle.v2.z, 1.0);
+            for (const auto& v : mesh.vertices) {
+                geometry.positions.push_back(glm::vec4(v, 0.0f));
+            }
 
-            triangle.v0 = v0;
-            triangle.v1 = v1;
-            triangle.v2 = v2;
+            // Use mesh normals if available, otherwise average the face normals
+            if (mesh.normals.size() == mesh.vertices.size()) {
+                for (const auto& n : mesh.normals) {
+                    geometry.normals.push_back(glm::vec4(n, 0.0f));
+                }
+            }
+            else {
+                std::vector<glm::vec3> normals(mesh.vertices.size(), glm::vec3(0.0f));
+                for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                    unsigned int idx0 = mesh.indices[i];
+                    unsigned int idx1 = mesh.indices[i + 1];
+                    unsigned int idx2 = mesh.indices[i + 2];
+                    if (idx0 >= mesh.vertices.size() || idx1 >= mesh.vertices.size() || idx2 >= mesh.vertices.size()) continue;
+
+                    glm::vec3 edge1 = mesh.vertices[idx1] - mesh.vertices[idx0];
+                    glm::vec3 edge2 = mesh.vertices[idx2] - mesh.vertices[idx0];
+                    glm::vec3 normal = glm::cross(edge1, edge2); // area weighted
+                    normals[idx0] += normal;
+                    normals[idx1] += normal;
+                    normals[idx2] += normal;
+                }
+                for (const auto& n : normals) {
+                    float len = glm::length(n);
+                    geometry.normals.push_back(glm::vec4(len > 0.0f ? n / len : glm::vec3(0.0f, 1.0f, 0.0f), 0.0f));
+                }
+            }
 
-            // Transform normals
-            glm::vec3 n0 = normalMatrix * glm::vec3(triangle.n0.x, triangle.n0.y, triangle.n0.z);
-            glm::vec3 n1 = normalMatrix * glm::vec3(triangle.n1.x, triangle.n1.y, triangle.n1.z);
-            glm::vec3 n2 = normalMatrix * glm::vec3(triangle.n2.x, triangle.n2.y, triangle.n2.z);
+            // Texture coordinates, and tangents along +u for normal maps. Meshes
+            // without UVs get zeros, which the shaders treat as untextured.
+            const bool hasTexcoords = mesh.texcoords.size() == mesh.vertices.size();
+            const std::vector<glm::vec4> tangents = mesh.tangents.size() == mesh.vertices.size()
+                ? mesh.tangents : computeTangents(mesh, hasTexcoords);
+            for (size_t i = 0; i < mesh.vertices.size(); i++) {
+                VertexShading vertex = {};
+                vertex.tangent = tangents[i];
+                if (hasTexcoords) vertex.texcoord = mesh.texcoords[i];
+                geometry.shading.push_back(vertex);
+            }
 
-            triangle.n0.x = n0.x; triangle.n0.y = n0.y; triangle.n0.z = n0.z;
-            triangle.n1.x = n1.x; triangle.n1.y = n1.y; triangle.n1.z = n1.z;
-            triangle.n2.x = n2.x; triangle.n2.y = n2.y; triangle.n2.z = n2.z;
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                unsigned int idx0 = mesh.indices[i];
+                unsigned int idx1 = mesh.indices[i + 1];
+                unsigned int idx2 = mesh.indices[i + 2];
+
+                if (idx0 < mesh.vertices.size() &&
+                    idx1 < mesh.vertices.size() &&
+                    idx2 < mesh.vertices.size()) {
+                    IndexedTriangle tri;
+                    tri.v0 = baseVertex + idx0;
+                    tri.v1 = baseVertex + idx1;
+                    tri.v2 = baseVertex + idx2;
+                    tri.materialID = defaultMaterialID;
+                    geometry.triangles.push_back(tri);
+                }
+            }
         }
+
+        const size_t triCount = geometry.triangles.size() - firstTri;
+#ifdef RT_DEBUG
+        std::cout << "Appended " << triCount << " triangles from mesh" << std::endl;
+#endif
+        return triCount;
     }
 
 private:
     int defaultMaterialID;
 
+    // Per-vertex tangents from the UV gradients of the faces around each
+    // vertex, for meshes Assimp gave none (same convention as
+    // aiProcess_CalcTangentSpace). Zero without UVs.
+    static std::vector<glm::vec4> computeTangents(const MeshData& mesh, bool hasTexcoords) {
+        std::vector<glm::vec3> tangents(mesh.vertices.size(), glm::vec3(0.0f));
+        std::vector<glm::vec3> bitangents(mesh.vertices.size(), glm::vec3(0.0f));
+        if (hasTexcoords) {
+            for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+                unsigned int idx[3] = { mesh.indices[i], mesh.indices[i + 1], mesh.indices[i + 2] };
+                if (idx[0] >= mesh.vertices.size() || idx[1] >= mesh.vertices.size() || idx[2] >= mesh.vertices.size()) continue;
+
+                glm::vec3 edge1 = mesh.vertices[idx[1]] - mesh.vertices[idx[0]];
+                glm::vec3 edge2 = mesh.vertices[idx[2]] - mesh.vertices[idx[0]];
+                glm::vec2 duv1 = mesh.texcoords[idx[1]] - mesh.texcoords[idx[0]];
+                glm::vec2 duv2 = mesh.texcoords[idx[2]] - mesh.texcoords[idx[0]];
+                float det = duv1.x * duv2.y - duv2.x * duv1.y;
+                if (std::abs(det) < 1e-12f) continue;
+
+                glm::vec3 t = (edge1 * duv2.y - edge2 * duv1.y) / det;
+                glm::vec3 b = (edge2 * duv1.x - edge1 * duv2.x) / det;
+                for (unsigned int v : idx) {
+                    tangents[v] += t;
+                    bitangents[v] += b;
+                }
+            }
+        }
+
+        std::vector<glm::vec4> result(mesh.vertices.size(), glm::vec4(0.0f));
+        for (size_t v = 0; v < mesh.vertices.size(); v++) {
+            glm::vec3 n = v < mesh.normals.size() ? mesh.normals[v] : glm::vec3(0.0f);
+            glm::vec3 t = tangents[v] - n * glm::dot(n, tangents[v]); // Gram-Schmidt
+            float len = glm::length(t);
+            if (len <= 0.0f) continue;
+            float sign = glm::dot(glm::cross(n, t), bitangents[v]) < 0.0f ? -1.0f : 1.0f;
+            result[v] = glm::vec4(t / len, sign);
+        }
+        return result;
+    }
+
     void loadMesh(std::string const& path) {
         Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path,
-            aiProcess_Triangulate |
-            aiProcess_GenSmoothNormals |
-            aiProcess_CalcTangentSpace |
-            aiProcess_FlipUVs);
+        const aiScene* scene = importer.ReadFile(path, IMPORT_FLAGS);
 
         if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
             std::cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << std::endl;
@@ -111,6 +201,17 @@ private:
                 normal.z = mesh->mNormals[i].z;
                 meshData.normals.push_back(normal);
             }
+
+            if (mesh->mTextureCoords[0]) {
+                meshData.texcoords.push_back(glm::vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y));
+            }
+
+            if (mesh->mTangents && mesh->mBitangents && mesh->mNormals) {
+                glm::vec3 n(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+                glm::vec3 t(mesh->mTangents[i].x, mesh->mTangents[i].y, mesh->mTangents[i].z);
+                glm::vec3 b(mesh->mBitangents[i].x, mesh->mBitangents[i].y, mesh->mBitangents[i].z);
+                meshData.tangents.push_back(glm::vec4(t, glm::dot(glm::cross(n, t), b) < 0.0f ? -1.0f : 1.0f));
+            }
         }
 
         // Process indices
@@ -123,81 +224,6 @@ private:
 
         return meshData;
     }
-
-    void generateTriangles() {
-        for (const auto& mesh : meshes) {
-            // Generate triangles from indices
-            for (size_t i = 0; i < mesh.indices.size(); i += 3) {
-                if (i + 2 < mesh.indices.size()) {
-                    unsigned int idx0 = mesh.indices[i];
-                    unsigned int idx1 = mesh.indices[i + 1];
-                    unsigned int idx2 = mesh.indices[i + 2];
-
-                    if (idx0 < mesh.vertices.size() &&
-                        idx1 < mesh.vertices.size() &&
-                        idx2 < mesh.vertices.size()) {
-
-                        Triangle tri = {};
-
-                        // Set vertices
-                        tri.v0.x = mesh.vertices[idx0].x;
-                        tri.v0.y = mesh.vertices[idx0].y;
-                        tri.v0.z = mesh.vertices[idx0].z;
-                        tri.v0.w = 0.0f;
-
-                        tri.v1.x = mesh.vertices[idx1].x;
-                        tri.v1.y = mesh.vertices[idx1].y;
-                        tri.v1.z = mesh.vertices[idx1].z;
-                        tri.v1.w = 0.0f;
-
-                        tri.v2.x = mesh.vertices[idx2].x;
-                        tri.v2.y = mesh.vertices[idx2].y;
-                        tri.v2.z = mesh.vertices[idx2].z;
-                        tri.v2.w = 0.0f;
-
-                        // Set normals (use mesh normals if available, otherwise compute face normal)
-                        if (!mesh.normals.empty()) {
-                            tri.n0.x = mesh.normals[idx0].x;
-                            tri.n0.y = mesh.normals[idx0].y;
-                            tri.n0.z = mesh.normals[idx0].z;
-                            tri.n0.w = 0.0f;
-
-                            tri.n1.x = mesh.normals[idx1].x;
-                            tri.n1.y = mesh.normals[idx1].y;
-                            tri.n1.z = mesh.normals[idx1].z;
-                            tri.n1.w = 0.0f;
-
-                            tri.n2.x = mesh.normals[idx2].x;
-                            tri.n2.y = mesh.normals[idx2].y;
-                            tri.n2.z = mesh.normals[idx2].z;
-                            tri.n2.w = 0.0f;
-                        }
-                        else {
-                            // Compute face normal
-                            glm::vec3 edge1 = mesh.vertices[idx1] - mesh.vertices[idx0];
-                            glm::vec3 edge2 = mesh.vertices[idx2] - mesh.vertices[idx0];
-                            glm::vec3 normal = glm::normalize(glm::cross(edge1, edge2));
-
-                            tri.n0.x = tri.n1.x = tri.n2.x = normal.x;
-                            tri.n0.y = tri.n1.y = tri.n2.y = normal.y;
-                            tri.n0.z = tri.n1.z = tri.n2.z = normal.z;
-                            tri.n0.w = tri.n1.w = tri.n2.w = 0.0f;
-                        }
-
-                        tri.materialID = defaultMaterialID;
-                        tri.cx = (tri.v0.x + tri.v1.x + tri.v2.x) / 3;
-                        tri.cy = (tri.v0.y + tri.v1.y + tri.v2.y) / 3;
-                        tri.cz = (tri.v0.z + tri.v1.z + tri.v2.z) / 3;
-
-                        triangles.push_back(tri);
-                    }
-                }
-            }
-        }
-#ifdef RT_DEBUG
-        std::cout << "Generated " << triangles.size() << " triangles from mesh" << std::endl;
-#endif
-    }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,360 @@
+#ifndef RT_ACCEL_H
+#define RT_ACCEL_H
+
+#include "rt_structs.h"
+#include "rt_bvh.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Two-level acceleration structure.
+//
+// Every mesh gets a bottom-level BVH (BLAS) built once over its object-space
+// triangles. All BLASes are concatenated into the same node / primitive index
+// arrays the single-level BVH used, with absolute child and primitive offsets,
+// so the shader can traverse any of them from its root index.
+//
+// A small top-level BVH (TLAS) is built over the world-space bounds of the
+// instances. Moving an instance only refits or rebuilds the TLAS and the
+// instance array; the triangles and BLASes never change.
+class TwoLevelBVH {
+public:
+	// A bottom-level tree as BVHBuilder lays it out: node 0 is the root, child
+	// and primitive indices are local to the mesh. Plain pointers so a mapped
+	// cache file can be added in place.
+	struct BLASLayout {
+		const BVHNode* nodes = nullptr;
+		size_t nodeCount = 0;
+		const WideBVHNode* wideNodes = nullptr;
+		size_t wideCount = 0;
+		const int* primitiveIndices = nullptr;  // relative to firstTri
+		size_t primCount = 0;
+	};
+
+	// Builds a BLAS over geometry.triangles[firstTri, firstTri + triCount) and returns its mesh ID.
+	int addMesh(const IndexedGeometry& geometry, size_t firstTri, size_t triCount) {
+		BVHBuilder builder;
+		builder.build(geometry, firstTri, triCount);
+
+		const std::vector<WideBVHNode> wide = builder.collapseToWide<BVH_WIDTH>();
+
+		BLASLayout layout;
+		layout.nodes = builder.getNodes().data();
+		layout.nodeCount = builder.getNodes().size();
+		layout.wideNodes = wide.data();
+		layout.wideCount = wide.size();
+		layout.primitiveIndices = builder.getPrimitiveIndices().data();
+		layout.primCount = builder.getPrimitiveIndices().size();
+		return addMesh(geometry, firstTri, triCount, layout);
+	}
+
+	// Adds an already built BLAS over the same triangle range, e.g. from the mesh cache.
+	int addMesh(const IndexedGeometry& geometry, size_t firstTri, size_t triCount, const BLASLayout& layout) {
+		BLAS blas;
+		blas.root = (int)blasNodes.size();
+		blas.wideRoot = (int)wideNodes.size();
+		blas.firstPrim = (int)blasPrimitives.size();
+		blas.firstTri = (int)firstTri;
+		blas.triCount = (int)triCount;
+
+		blas.depth = BVHDepth(layout.nodes, layout.nodeCount);
+		blas.wideDepth = WideBVHDepth(layout.wideNodes, layout.wideCount);
+
+		if (layout.nodeCount == 0) {
+			blas.root = blas.wideRoot = -1;
+			meshes.push_back(blas);
+			return (int)meshes.size() - 1;
+		}
+
+		const int nodeOffset = blas.root;
+		const int wideOffset = blas.wideRoot;
+		const int primOffset = blas.firstPrim;
+
+		blas.bounds = AABB(glm::vec3(layout.nodes[0].min), glm::vec3(layout.nodes[0].max));
+		blas.hull = topBoxes(layout.nodes, layout.nodeCount);
+
+		for (size_t i = 0; i < layout.nodeCount; i++) {
+			BVHNode node = layout.nodes[i];
+			if (node.leftChild < 0) {
+				node.leftChild -= primOffset; // -(offset + 1) stays negative
+			}
+			else {
+				node.leftChild += nodeOffset;
+				node.rightChild += nodeOffset;
+			}
+			blasNodes.push_back(node);
+		}
+
+		// Leave room for an LBVH over the same triangles, which always uses 2n - 1 nodes
+		blasNodes.resize(nodeOffset + 2 * triCount - 1, BVHNode{});
+
+		for (size_t i = 0; i < layout.wideCount; i++) {
+			WideBVHNode node = layout.wideNodes[i];
+			for (int c = 0; c < node.childCount; c++) {
+				node.children[c] += node.children[c] < 0 ? -primOffset : wideOffset;
+			}
+			wideNodes.push_back(node);
+		}
+
+		// Primitive indices become absolute indices into the shared triangle array,
+		// and the intersection stream follows the same leaf order
+		for (size_t i = 0; i < layout.primCount; i++) {
+			const int prim = layout.primitiveIndices[i];
+			blasPrimitives.push_back(prim + (int)firstTri);
+			isectTriangles.push_back(MakeIsectTriangle(geometry, prim + (int)firstTri));
+		}
+
+		meshes.push_back(blas);
+
+#ifdef RT_DEBUG
+		std::cout << "BLAS " << meshes.size() - 1 << ": " << triCount << " triangles, "
+			<< layout.nodeCount << " nodes" << std::endl;
+#endif
+		return (int)meshes.size() - 1;
+	}
+
+	// Builds a BLAS over analytic spheres and returns its mesh ID. Instances
+	// place it like any mesh; its leaves index the leaf-ordered getSpheres().
+	int addSpheres(const std::vector<Sphere>& spheres) {
+		std::vector<AABB> bounds;
+		for (const Sphere& sp : spheres) {
+			glm::vec3 center(sp.center_x, sp.center_y, sp.center_z);
+			bounds.push_back(AABB(center - glm::vec3(sp.radius), center + glm::vec3(sp.radius)));
+		}
+
+		BVHBuilder builder;
+		builder.build(bounds);
+
+		BLAS blas;
+		blas.primType = InstanceSpheres;
+		blas.root = (int)blasNodes.size();
+		blas.firstPrim = (int)sphereArray.size();
+		blas.depth = BVHDepth(builder.getNodes().data(), builder.getNodes().size());
+
+		if (builder.getNodes().empty()) {
+			blas.root = -1;
+			meshes.push_back(blas);
+			return (int)meshes.size() - 1;
+		}
+
+		const int nodeOffset = blas.root;
+		const int primOffset = blas.firstPrim;
+		blas.bounds = AABB(glm::vec3(builder.getNodes()[0].min), glm::vec3(builder.getNodes()[0].max));
+		blas.hull = topBoxes(builder.getNodes().data(), builder.getNodes().size());
+
+		for (BVHNode node : builder.getNodes()) {
+			if (node.leftChild < 0) {
+				node.leftChild -= primOffset;
+			}
+			else {
+				node.leftChild += nodeOffset;
+				node.rightChild += nodeOffset;
+			}
+			blasNodes.push_back(node);
+		}
+
+		for (int prim : builder.getPrimitiveIndices()) {
+			sphereArray.push_back(spheres[prim]);
+		}
+
+		meshes.push_back(blas);
+
+#ifdef RT_DEBUG
+		std::cout << "BLAS " << meshes.size() - 1 << ": " << spheres.size() << " spheres, "
+			<< builder.getNodes().size() << " nodes" << std::endl;
+#endif
+		return (int)meshes.size() - 1;
+	}
+
+	// Rebuilds the TLAS over the current instance transforms. The GPU instance
+	// array is reordered to match the TLAS leaves, so a leaf's primitive range
+	// is also its range in the instance buffer.
+	void buildTLAS(const std::vector<MeshInstance>& instances) {
+		tlasInstances = visibleInstances(instances);
+		tlasBuilder.build(instanceBounds(instances));
+		updateInstances(instances);
+
+		const std::vector<BVHNode>& nodes = tlasBuilder.getNodes();
+		const int depth = BVHDepth(nodes.data(), nodes.size());
+		if (depth > tlasStackDepth) tlasStackDepth = depth + TLAS_DEPTH_MARGIN;
+	}
+
+	// Refits the TLAS to moved instances, keeping its shape and the instance
+	// order. Much cheaper than a rebuild while something is being dragged, but
+	// the tree loosens as instances move apart, so callers rebuild once things
+	// are at rest. Returns false without changing anything when instances have
+	// appeared or vanished since the last build, which needs buildTLAS. With a
+	// pool, levels of the tree wide enough to be worth it are split across its
+	// threads, which only happens with thousands of instances.
+	bool refitTLAS(const std::vector<MeshInstance>& instances, ThreadPool* pool = nullptr) {
+		if (visibleInstances(instances) != tlasInstances) return false;
+		tlasBuilder.refit(instanceBounds(instances), pool);
+		updateInstances(instances);
+		return true;
+	}
+
+	struct BLAS {
+		int primType = InstanceTriangles;
+		int root = -1;        // triangles: 2 * triCount - 1 nodes are reserved from here
+		int wideRoot = -1;    // triangles only
+		int firstPrim = 0;    // into the primitive indices, or getSpheres() for spheres
+		int firstTri = 0;
+		int triCount = 0;
+		int depth = 0;        // levels of the SAH tree
+		int wideDepth = 0;
+		AABB bounds; // object space
+		std::vector<AABB> hull; // object space, the top of the tree that instance bounds are taken from
+	};
+
+	// Deepest SAH BLAS, in levels, for sizing the shader's traversal stacks.
+	int getMaxBLASDepth() const {
+		int depth = 0;
+		for (const BLAS& blas : meshes) depth = std::max(depth, blas.depth);
+		return depth;
+	}
+
+	int getMaxWideDepth() const {
+		int depth = 0;
+		for (const BLAS& blas : meshes) depth = std::max(depth, blas.wideDepth);
+		return depth;
+	}
+
+	// The TLAS stack size: the deepest TLAS built so far plus a margin, so the
+	// rebuilds that reshape it as instances move only change the shaders once
+	// the tree grows past that.
+	int getMaxTLASDepth() const {
+		return tlasStackDepth;
+	}
+
+	const std::vector<BVHNode>& getBLASNodes() const { return blasNodes; }
+	const std::vector<int>& getBLASPrimitiveIndices() const { return blasPrimitives; }
+	const std::vector<IsectTriangle>& getIsectTriangles() const { return isectTriangles; }
+	const std::vector<WideBVHNode>& getWideNodes() const { return wideNodes; }
+	const std::vector<BVHNode>& getTLASNodes() const { return tlasBuilder.getNodes(); }
+	const std::vector<GPUInstance>& getInstances() const { return gpuInstances; }
+	const std::vector<BLAS>& getMeshes() const { return meshes; }
+	const std::vector<Sphere>& getSpheres() const { return sphereArray; }
+
+private:
+	// Levels of a BLAS whose boxes make up its hull, so at most 8 boxes. Their
+	// transformed corners bound a rotated mesh much more tightly than the root
+	// box does, at a fixed cost however large the mesh.
+	static constexpr int HULL_DEPTH = 4;
+
+	// Levels of TLAS stack beyond the deepest tree built
+	static constexpr int TLAS_DEPTH_MARGIN = 2;
+
+	// The nodes HULL_DEPTH levels down, and any leaves above them.
+	static std::vector<AABB> topBoxes(const BVHNode* nodes, size_t nodeCount) {
+		std::vector<AABB> boxes;
+		if (nodeCount == 0) return boxes;
+		std::vector<std::pair<int, int>> stack = { { 0, 1 } };
+		while (!stack.empty()) {
+			const std::pair<int, int> entry = stack.back();
+			stack.pop_back();
+			const BVHNode& node = nodes[entry.first];
+			if (node.leftChild < 0 || entry.second == HULL_DEPTH) {
+				boxes.push_back(AABB(glm::vec3(node.min), glm::vec3(node.max)));
+				continue;
+			}
+			stack.push_back({ node.leftChild, entry.second + 1 });
+			stack.push_back({ node.rightChild, entry.second + 1 });
+		}
+		return boxes;
+	}
+
+	// Indices of the instances the TLAS covers, in order.
+	std::vector<int> visibleInstances(const std::vector<MeshInstance>& instances) const {
+		std::vector<int> visible;
+		for (size_t i = 0; i < instances.size(); i++) {
+			const MeshInstance& inst = instances[i];
+			if (inst.meshID < 0 || meshes[inst.meshID].root < 0) continue;
+			if (glm::determinant(inst.model) == 0.0f) continue; // zero scale hides the instance
+			visible.push_back((int)i);
+		}
+		return visible;
+	}
+
+	// World-space bounds of each of tlasInstances.
+	std::vector<AABB> instanceBounds(const std::vector<MeshInstance>& instances) const {
+		std::vector<AABB> bounds;
+		for (int i : tlasInstances) {
+			AABB b;
+			for (const AABB& box : meshes[instances[i].meshID].hull) b.expand(transformBounds(box, instances[i].model));
+			bounds.push_back(b);
+		}
+		return bounds;
+	}
+
+	// The GPU instance array, in TLAS leaf order.
+	void updateInstances(const std::vector<MeshInstance>& instances) {
+		gpuInstances.clear();
+		for (int prim : tlasBuilder.getPrimitiveIndices()) {
+			const MeshInstance& inst = instances[tlasInstances[prim]];
+			const BLAS& blas = meshes[inst.meshID];
+
+			GPUInstance gpu = {};
+			gpu.model = inst.model;
+			gpu.modelInv = inst.modelInv;
+			gpu.blasRoot = blas.root;
+			gpu.wideRoot = blas.wideRoot;
+			gpu.firstTri = blas.firstTri;
+			gpu.triCount = blas.triCount;
+			gpu.materialID = inst.materialID;
+			gpu.primType = blas.primType;
+			gpuInstances.push_back(gpu);
+		}
+	}
+
+	// World-space box around the eight transformed corners of an object-space box.
+	static AABB transformBounds(const AABB& b, const glm::mat4& m) {
+		AABB result;
+		for (int i = 0; i < 8; i++) {
+			glm::vec3 corner(
+				(i & 1) ? b.max.x : b.min.x,
+				(i & 2) ? b.max.y : b.min.y,
+				(i & 4) ? b.max.z : b.min.z);
+			result.expand(glm::vec3(m * glm::vec4(corner, 1.0f)));
+		}
+		return result;
+	}
+
+	std::vector<BLAS> meshes;
+	std::vector<BVHNode> blasNodes;
+	std::vector<int> blasPrimitives;
+	std::vector<IsectTriangle> isectTriangles;
+	std::vector<WideBVHNode> wideNodes;
+	std::vector<Sphere> sphereArray; // sphere BLAS leaf order
+
+	BVHBuilder tlasBuilder;
+	std::vector<int> tlasInstances; // the instance behind each TLAS primitive
+	int tlasStackDepth = 1;
+	std::vector<GPUInstance> gpuInstances;
+};
+
+// Sizes for the shaders' traversal stacks, as #defines. Ordered traversal
+// pushes at most one node per level, so a stack as deep as the tree never
+// drops a node. minBLASDepth covers trees built elsewhere that the BLAS stacks
+// must fit as well, such as the GPU LBVH's. Until every mesh has loaded
+// (complete is false) the BLAS stacks keep the shaders' roomy defaults.
+// shortStack > 0 trades the full stack for a ring of that many entries plus
+// restarts from the root, for trees of up to 63 levels.
+inline std::string traversalDefines(const TwoLevelBVH& accel, int shortStack, bool complete,
+	int minBLASDepth = 0) {
+	const int tlasDepth = accel.getMaxTLASDepth();
+	std::string defines = "#define TLAS_STACK_SIZE " + std::to_string(tlasDepth) + "\n";
+	if (!complete) return defines;
+
+	const int blasDepth = std::max(accel.getMaxBLASDepth(), minBLASDepth);
+	const int wideDepth = std::max(1, accel.getMaxWideDepth());
+
+	defines += "#define BVH_STACK_SIZE " + std::to_string(std::max(1, blasDepth)) + "\n"
+		+ "#define WIDE_BVH_STACK_SIZE " + std::to_string((BVH_WIDTH - 1) * (wideDepth - 1) + 1) + "\n";
+	if (shortStack > 0 && blasDepth <= 63)
+		defines += "#define BVH_SHORT_STACK " + std::to_string(shortStack) + "\n";
+	return defines;
+}
+
+#endif // !RT_ACCEL_H
@@ -0,0 +1,78 @@
+#ifndef RT_ADAPTIVE_H
+#define RT_ADAPTIVE_H
+
+#include <glad2/gl.h>
+
+#include <vector>
+
+#include "includes/shader.h"
+
+// Adaptive sampling: decides which tiles of the image still need rays.
+//
+// The accumulation passes keep per-pixel luminance moments next to the colour
+// average (see rt_adaptive.glsl). After each frame update() reduces them to a
+// tile mask, one texel per ADAPTIVE_TILE_SIZE tile, that isPixelSkipped reads
+// on the next frame: tiles whose worst pixel has reached the error threshold
+// stop being traced, so the remaining rays go where the noise is.
+class AdaptiveSampler {
+public:
+	// Mirrors ADAPTIVE_TILE_SIZE in rt_adaptive.glsl.
+	static constexpr int TILE_SIZE = 16;
+
+	AdaptiveSampler(int width, int height)
+		: tileKernel("src/shaders/adaptive_tiles.comp") {
+		glGenTextures(1, &maskTex);
+		resize(width, height);
+	}
+
+	~AdaptiveSampler() {
+		glDeleteTextures(1, &maskTex);
+	}
+
+	AdaptiveSampler(const AdaptiveSampler&) = delete;
+	AdaptiveSampler& operator=(const AdaptiveSampler&) = delete;
+
+	// Rebuilds the mask for a new image size, with every tile traced again.
+	void resize(int newWidth, int newHeight) {
+		width = newWidth;
+		height = newHeight;
+		tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+		tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+		// Every tile starts out unconverged
+		std::vector<unsigned char> trace((size_t)tilesX * tilesY, 255);
+		glBindTexture(GL_TEXTURE_2D, maskTex);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, tilesX, tilesY, 0, GL_RED, GL_UNSIGNED_BYTE, trace.data());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// Rebuilds the tile mask from the moments just written (RGBA32F).
+	void update(GLuint momentsTex, float threshold, int minSamples) {
+		tileKernel.use();
+		tileKernel.setVec2("resolution", glm::vec2(width, height));
+		tileKernel.setFloat("u_adaptiveThreshold", threshold);
+		tileKernel.setInt("u_adaptiveMinSamples", minSamples);
+
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, momentsTex);
+		tileKernel.setInt("u_momentsTex", 0);
+		glBindImageTexture(0, maskTex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R8);
+
+		glDispatchCompute(tilesX, tilesY, 1);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+
+	GLuint getMask() const { return maskTex; }
+
+private:
+	int width, height;
+	int tilesX, tilesY;
+	shader tileKernel;
+	GLuint maskTex = 0;
+};
+
+#endif // !RT_ADAPTIVE_H
@@ -0,0 +1,370 @@
+#ifndef RT_BATCH_H
+#define RT_BATCH_H
+
+#include <glad2/gl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glm/glm/glm.hpp>
+
+#include "includes/camera.h"
+
+// Asynchronous readback of finished frames: the raw HDR accumulation as a
+// Radiance .hdr and the tone-mapped image as a .png.
+//
+// capture() only queues glGetTexImage / glReadPixels into pixel pack buffers
+// and drops a fence behind them. poll() maps the buffers whose fence has
+// signalled and hands the pixels to a writer thread, so neither the GPU copy
+// nor the disk I/O holds up the frames rendered in the meantime.
+class AsyncImageWriter {
+public:
+	static constexpr int SLOTS = 3;
+
+	AsyncImageWriter(int width, int height) : width(width), height(height) {
+		for (Slot& slot : slots) {
+			glGenBuffers(1, &slot.hdrPBO);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.hdrPBO);
+			glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 3 * sizeof(float), nullptr, GL_STREAM_READ);
+			glGenBuffers(1, &slot.ldrPBO);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.ldrPBO);
+			glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 3, nullptr, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		worker = std::thread([this] { writeLoop(); });
+	}
+
+	~AsyncImageWriter() {
+		finish();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		wake.notify_all();
+		worker.join();
+
+		for (Slot& slot : slots) {
+			if (slot.fence) glDeleteSync(slot.fence);
+			glDeleteBuffers(1, &slot.hdrPBO);
+			glDeleteBuffers(1, &slot.ldrPBO);
+		}
+	}
+
+	AsyncImageWriter(const AsyncImageWriter&) = delete;
+	AsyncImageWriter& operator=(const AsyncImageWriter&) = delete;
+
+	// Queues a copy of hdrTex (RGBA32F) and of the colour attachment of ldrFBO.
+	// The files are written as path + ".hdr" and path + ".png".
+	void capture(GLuint hdrTex, GLuint ldrFBO, const std::string& path) {
+		Slot& slot = slots[next];
+		next = (next + 1) % SLOTS;
+		if (slot.fence) retire(slot, true); // every slot in flight: wait for the oldest
+
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.hdrPBO);
+		glBindTexture(GL_TEXTURE_2D, hdrTex);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_FLOAT, nullptr);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.ldrPBO);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, ldrFBO);
+		glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+		slot.path = path;
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush(); // so the fence is actually submitted before anyone polls it
+	}
+
+	// Hands every finished readback to the writer thread, without waiting.
+	void poll() {
+		for (Slot& slot : slots) {
+			if (slot.fence) retire(slot, false);
+		}
+	}
+
+	// Waits for every readback and file write still pending.
+	void finish() {
+		for (int i = 0; i < SLOTS; i++) {
+			Slot& slot = slots[(next + i) % SLOTS];
+			if (slot.fence) retire(slot, true);
+		}
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this] { return jobs.empty() && !writing; });
+	}
+
+private:
+	struct Slot {
+		GLuint hdrPBO = 0;
+		GLuint ldrPBO = 0;
+		GLsync fence = 0;
+		std::string path;
+	};
+
+	struct Job {
+		std::string path;
+		std::vector<float> hdr;
+		std::vector<unsigned char> ldr;
+	};
+
+	void retire(Slot& slot, bool wait) {
+		const GLuint64 timeout = wait ? 10000000000ull : 0; // 10 s
+		const GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+		if (status == GL_TIMEOUT_EXPIRED && !wait) return;
+		glDeleteSync(slot.fence);
+		slot.fence = 0;
+		if (status == GL_WAIT_FAILED || status == GL_TIMEOUT_EXPIRED) {
+			std::cout << "Readback of " << slot.path << " failed" << std::endl;
+			return;
+		}
+
+		Job job;
+		job.path = slot.path;
+		job.hdr.resize((size_t)width * height * 3);
+		job.ldr.resize((size_t)width * height * 3);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.hdrPBO);
+		glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, job.hdr.size() * sizeof(float), job.hdr.data());
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.ldrPBO);
+		glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, job.ldr.size(), job.ldr.data());
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push_back(std::move(job));
+		}
+		wake.notify_one();
+	}
+
+	void writeLoop() {
+		for (;;) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return quit || !jobs.empty(); });
+				if (jobs.empty()) return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+				writing = true;
+			}
+
+			// GL rows run bottom to top
+			flipRows(job.hdr.data(), width * 3);
+			flipRows(job.ldr.data(), width * 3);
+			const std::string hdrPath = job.path + ".hdr";
+			const std::string pngPath = job.path + ".png";
+			if (!stbi_write_hdr(hdrPath.c_str(), width, height, 3, job.hdr.data()))
+				std::cout << "Failed to write " << hdrPath << std::endl;
+			if (!stbi_write_png(pngPath.c_str(), width, height, 3, job.ldr.data(), width * 3))
+				std::cout << "Failed to write " << pngPath << std::endl;
+#ifdef RT_DEBUG
+			std::cout << "Wrote " << hdrPath << " and " << pngPath << std::endl;
+#endif
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				writing = false;
+			}
+			idle.notify_all();
+		}
+	}
+
+	template <typename T>
+	void flipRows(T* pixels, int rowLength) const {
+		for (int y = 0; y < height / 2; ++y) {
+			std::swap_ranges(pixels + (size_t)y * rowLength, pixels + (size_t)(y + 1) * rowLength,
+				pixels + (size_t)(height - 1 - y) * rowLength);
+		}
+	}
+
+	int width, height;
+	Slot slots[SLOTS];
+	int next = 0;
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	std::deque<Job> jobs;
+	bool writing = false;
+	bool quit = false;
+};
+
+// Offline batch rendering, enabled from the command line:
+//
+//   RealtimeRaytracing --batch [--spp N] [--camera-path FILE] [--output PREFIX]
+//
+// (--scene FILE, which works with or without --batch, is parsed here too.)
+//
+// Each camera keyframe is rendered from a reset accumulation for exactly spp
+// samples per pixel, over as many frames as that takes, then written as PREFIX_NNNN.hdr / .png.
+// No pixel is skipped along the way, and the sample counts are checked
+// before the frame is written; a run with any that fall short exits with 1. The
+// camera path is a text file with one keyframe per line,
+//
+//   posX posY posZ targetX targetY targetZ [fov]
+//
+// where '#' starts a comment. Without one the default camera is rendered once.
+class BatchRenderer {
+public:
+	bool enabled = false;
+	int spp = 64;
+	std::string outputPrefix = "screenshots/batch";
+	std::string scenePath = "scenes/default.json";
+
+	// Returns false if the arguments are malformed.
+	bool parseArgs(int argc, char** argv) {
+		std::string cameraPath;
+		for (int i = 1; i < argc; i++) {
+			const std::string arg = argv[i];
+			const bool hasValue = i + 1 < argc;
+			if (arg == "--batch") enabled = true;
+			else if (arg == "--spp" && hasValue) spp = std::max(1, std::atoi(argv[++i]));
+			else if (arg == "--camera-path" && hasValue) cameraPath = argv[++i];
+			else if (arg == "--output" && hasValue) outputPrefix = argv[++i];
+			else if (arg == "--scene" && hasValue) scenePath = argv[++i];
+			else {
+				std::cout << "Unknown argument: " << arg << std::endl;
+				std::cout << "Usage: " << argv[0] << " [--scene FILE] [--batch [--spp N] [--camera-path FILE] [--output PREFIX]]" << std::endl;
+				return false;
+			}
+		}
+		return cameraPath.empty() || loadCameraPath(cameraPath);
+	}
+
+	// Call before the frame is rendered. Moves the camera to the next keyframe
+	// when one starts, and returns false once the path is done.
+	bool beginFrame(Camera& camera) {
+		if (sample > 0) return true;
+		if (keyframes.empty() && key == 0) {
+			keyframeStart = std::chrono::steady_clock::now();
+			return true; // the camera as it is
+		}
+		if (key >= (int)keyframes.size()) return false;
+
+		const Keyframe& k = keyframes[key];
+		camera.Position = k.position;
+		camera.lookAt(k.target);
+		if (k.fov > 0.0f) camera.Zoom = k.fov;
+		keyframeStart = std::chrono::steady_clock::now();
+		return true;
+	}
+
+	// Whether this frame is the first sample of a keyframe.
+	bool startsKeyframe() const {
+		return sample == 0;
+	}
+
+	// Samples the current keyframe still needs.
+	int samplesLeft() const {
+		return spp - sample;
+	}
+
+	// Call once the frame's accumulation and tone-mapped image are complete,
+	// with the samples per pixel the frame took. momentsTex is the
+	// accumulation's moments, whose z is each pixel's sample count.
+	void endFrame(AsyncImageWriter& writer, GLuint hdrTex, GLuint momentsTex, GLuint ldrFBO, int samples) {
+		sample += samples;
+		if (sample >= spp) {
+			std::ostringstream path;
+			path << outputPrefix << "_" << std::setw(4) << std::setfill('0') << key;
+			writer.capture(hdrTex, ldrFBO, path.str());
+			checkSampleCounts(momentsTex);
+
+#ifdef RT_DEBUG
+			const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - keyframeStart).count();
+			std::cout << "Batch frame " << key << ": " << spp << " spp in " << ms << " ms" << std::endl;
+#endif
+			sample = 0;
+			key++;
+		}
+		writer.poll();
+	}
+
+	// Whether every keyframe so far got exactly spp samples in every pixel.
+	bool samplesComplete() const {
+		return incompleteFrames == 0;
+	}
+
+private:
+	struct Keyframe {
+		glm::vec3 position;
+		glm::vec3 target;
+		float fov = 0.0f; // vertical, in degrees; 0 keeps the camera's
+	};
+
+	// Reads back the sample counts of a finished keyframe and reports the
+	// pixels that took more or fewer than spp. This waits for the GPU, but
+	// only once per keyframe.
+	void checkSampleCounts(GLuint momentsTex) {
+		GLint width = 0, height = 0;
+		glBindTexture(GL_TEXTURE_2D, momentsTex);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+		glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+		std::vector<float> counts((size_t)width * height);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_BLUE, GL_FLOAT, counts.data());
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		size_t wrong = 0;
+		float fewest = (float)spp, most = (float)spp;
+		for (float n : counts) {
+			if (n == (float)spp) continue;
+			wrong++;
+			fewest = std::min(fewest, n);
+			most = std::max(most, n);
+		}
+		if (wrong > 0) {
+			std::cout << "Batch frame " << key << ": " << wrong << " of " << counts.size()
+				<< " pixels took " << fewest << " to " << most << " samples instead of " << spp << std::endl;
+			incompleteFrames++;
+		}
+	}
+
+	bool loadCameraPath(const std::string& path) {
+		std::ifstream file(path);
+		if (!file) {
+			std::cout << "Failed to open camera path: " << path << std::endl;
+			return false;
+		}
+
+		std::string line;
+		while (std::getline(file, line)) {
+			line = line.substr(0, line.find('#'));
+			std::istringstream in(line);
+			Keyframe k;
+			if (!(in >> k.position.x >> k.position.y >> k.position.z >> k.target.x >> k.target.y >> k.target.z))
+				continue;
+			in >> k.fov;
+			keyframes.push_back(k);
+		}
+
+#ifdef RT_DEBUG
+		std::cout << "Camera path: " << keyframes.size() << " keyframes from " << path << std::endl;
+#endif
+		return !keyframes.empty();
+	}
+
+	std::vector<Keyframe> keyframes;
+	int key = 0;
+	int sample = 0;
+	int incompleteFrames = 0;
+	std::chrono::steady_clock::time_point keyframeStart;
+};
+
+#endif // !RT_BATCH_H
@@ -0,0 +1,133 @@
+#ifndef RT_BLOOM_H
+#define RT_BLOOM_H
+
+#include <glad2/gl.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "includes/shader.h"
+
+// Bloom as a downsample / upsample pyramid rather than repeated full-resolution
+// blurs. The bright parts of the image are filtered down a chain of half-size
+// levels (bloom_downsample.frag), then tent-filtered back up with each level
+// added onto the next larger one (bloom_upsample.frag). The glow's radius
+// is set by how many levels are used, and all but the first pass run
+// at a quarter of the pixels of the pass before, so the cost stays a small
+// fraction of a single full-resolution blur.
+class BloomPyramid {
+public:
+	static constexpr int MAX_MIPS = 8;
+
+	BloomPyramid(int width, int height)
+		: downsampleShader("src/shaders/fullscreen.vert", "src/shaders/bloom_downsample.frag"),
+		upsampleShader("src/shaders/fullscreen.vert", "src/shaders/bloom_upsample.frag") {
+		glGenTextures(MAX_MIPS, mipTex);
+		glGenFramebuffers(MAX_MIPS, mipFBO);
+		resize(width, height);
+
+		// The accumulation textures are point sampled, but the 13-tap filter
+		// relies on bilinear taps
+		glGenSamplers(1, &linearSampler);
+		glSamplerParameteri(linearSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glSamplerParameteri(linearSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glSamplerParameteri(linearSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glSamplerParameteri(linearSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+
+	~BloomPyramid() {
+		glDeleteSamplers(1, &linearSampler);
+		glDeleteFramebuffers(MAX_MIPS, mipFBO);
+		glDeleteTextures(MAX_MIPS, mipTex);
+	}
+
+	BloomPyramid(const BloomPyramid&) = delete;
+	BloomPyramid& operator=(const BloomPyramid&) = delete;
+
+	// Reallocates the levels for a new output size. The source image handed
+	// to apply() can be any size; it is only read through bilinear taps.
+	void resize(int width, int height) {
+		for (int i = 0; i < MAX_MIPS; i++) {
+			mipWidth[i] = std::max(1, width >> (i + 1));
+			mipHeight[i] = std::max(1, height >> (i + 1));
+
+			glBindTexture(GL_TEXTURE_2D, mipTex[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, mipWidth[i], mipHeight[i], 0, GL_RGBA, GL_FLOAT, nullptr);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+			glBindFramebuffer(GL_FRAMEBUFFER, mipFBO[i]);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mipTex[i], 0);
+			if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+				std::cout << "Bloom FBO " << i << " not complete!" << std::endl;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	int mipCount = 5;          // levels below full resolution, the glow's radius
+	float threshold = 1.0f;    // luminance a pixel needs to bloom
+	float filterRadius = 1.0f; // upsample tent, in texels
+	float intensity = 1.0f;
+
+	// Builds the pyramid from hdrTex and returns the half-resolution result.
+	// quadVAO draws the full-screen quad of fullscreen.vert.
+	GLuint apply(GLuint hdrTex, GLuint quadVAO) {
+		const int mips = std::max(1, std::min(mipCount, MAX_MIPS));
+
+		glBindVertexArray(quadVAO);
+		glActiveTexture(GL_TEXTURE0);
+		glBindSampler(0, linearSampler);
+
+		// Down, thresholding on the way into the first level
+		downsampleShader.use();
+		downsampleShader.setInt("u_sourceTex", 0);
+		downsampleShader.setFloat("u_threshold", threshold);
+		for (int i = 0; i < mips; i++) {
+			glBindFramebuffer(GL_FRAMEBUFFER, mipFBO[i]);
+			glViewport(0, 0, mipWidth[i], mipHeight[i]);
+			glBindTexture(GL_TEXTURE_2D, i == 0 ? hdrTex : mipTex[i - 1]);
+			downsampleShader.setBool("u_firstPass", i == 0);
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		}
+
+		// Up, each level adding onto the one above it
+		upsampleShader.use();
+		upsampleShader.setInt("u_sourceTex", 0);
+		upsampleShader.setFloat("u_filterRadius", filterRadius);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+		for (int i = mips - 1; i > 0; i--) {
+			glBindFramebuffer(GL_FRAMEBUFFER, mipFBO[i - 1]);
+			glViewport(0, 0, mipWidth[i - 1], mipHeight[i - 1]);
+			glBindTexture(GL_TEXTURE_2D, mipTex[i]);
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		}
+		glDisable(GL_BLEND);
+
+		glBindSampler(0, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		lastMips = mips;
+		return mipTex[0];
+	}
+
+	// Scale for the composite. Every level adds a copy of the bright pixels'
+	// energy, so the sum is brought back to one copy's worth.
+	float strength() const {
+		return intensity / lastMips;
+	}
+
+private:
+	shader downsampleShader;
+	shader upsampleShader;
+	GLuint mipTex[MAX_MIPS];
+	GLuint mipFBO[MAX_MIPS];
+	int mipWidth[MAX_MIPS];
+	int mipHeight[MAX_MIPS];
+	GLuint linearSampler = 0;
+	int lastMips = 1;
+};
+
+#endif // !RT_BLOOM_H
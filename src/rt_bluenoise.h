@@ -0,0 +1,146 @@
+#ifndef RT_BLUENOISE_H
+#define RT_BLUENOISE_H
+
+#include <glad2/gl.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// A tileable blue-noise dither mask, for the blue-noise sampler in
+// rt_sampler.glsl.
+//
+// Generated at startup with void-and-cluster [Ulichney 1993, "The
+// void-and-cluster method for dither array generation"]: pixels are ranked by
+// repeatedly filling the largest void of a binary pattern (or emptying its
+// tightest cluster), measured by a toroidal Gaussian energy so the mask tiles.
+// Uploaded as R32F with each pixel's rank mapped to [0,1).
+class BlueNoiseTexture {
+public:
+	BlueNoiseTexture() = default;
+	~BlueNoiseTexture() {
+		if (texture) glDeleteTextures(1, &texture);
+	}
+
+	BlueNoiseTexture(const BlueNoiseTexture&) = delete;
+	BlueNoiseTexture& operator=(const BlueNoiseTexture&) = delete;
+
+	void generate(int size) {
+		std::vector<float> mask = voidAndCluster(size);
+
+		if (!texture) glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, size, size, 0, GL_RED, GL_FLOAT, mask.data());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+#ifdef RT_DEBUG
+		std::cout << "Blue noise: " << size << "x" << size << std::endl;
+#endif
+	}
+
+	GLuint getTexture() const { return texture; }
+
+private:
+	static std::vector<float> voidAndCluster(int size) {
+		const int n = size * size;
+		const float sigma = 1.5f;
+
+		// Gaussian by toroidal offset
+		std::vector<float> kernel(n);
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				const int dx = std::min(x, size - x);
+				const int dy = std::min(y, size - y);
+				kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+			}
+		}
+
+		std::vector<unsigned char> pattern(n, 0);
+		std::vector<float> energy(n, 0.0f);
+		auto toggle = [&](std::vector<unsigned char>& bits, std::vector<float>& e, int i) {
+			const int ix = i % size;
+			const int iy = i / size;
+			const float sign = bits[i] ? -1.0f : 1.0f;
+			bits[i] = !bits[i];
+			for (int y = 0; y < size; y++) {
+				const int row = ((y - iy + size) % size) * size;
+				for (int x = 0; x < size; x++) {
+					e[y * size + x] += sign * kernel[row + (x - ix + size) % size];
+				}
+			}
+		};
+		// The set pixel with the most energy, or the empty one with the least
+		auto tightestCluster = [&](const std::vector<unsigned char>& bits, const std::vector<float>& e) {
+			int best = -1;
+			for (int i = 0; i < n; i++) {
+				if (bits[i] && (best < 0 || e[i] > e[best])) best = i;
+			}
+			return best;
+		};
+		auto largestVoid = [&](const std::vector<unsigned char>& bits, const std::vector<float>& e) {
+			int best = -1;
+			for (int i = 0; i < n; i++) {
+				if (!bits[i] && (best < 0 || e[i] < e[best])) best = i;
+			}
+			return best;
+		};
+
+		// Initial pattern: a tenth of the pixels at random, then spread out
+		// until moving the tightest one lands it straight back
+		std::mt19937 rng(1993u);
+		const int initialCount = std::max(1, n / 10);
+		for (int placed = 0; placed < initialCount;) {
+			const int i = (int)(rng() % (unsigned)n);
+			if (!pattern[i]) {
+				toggle(pattern, energy, i);
+				placed++;
+			}
+		}
+		for (int iter = 0; iter < n; iter++) {
+			const int cluster = tightestCluster(pattern, energy);
+			toggle(pattern, energy, cluster);
+			const int gap = largestVoid(pattern, energy);
+			if (gap == cluster) {
+				toggle(pattern, energy, cluster);
+				break;
+			}
+			toggle(pattern, energy, gap);
+		}
+
+		std::vector<int> rank(n, 0);
+
+		// Ranks below the initial pattern: empty its tightest clusters
+		{
+			std::vector<unsigned char> bits = pattern;
+			std::vector<float> e = energy;
+			for (int r = initialCount - 1; r >= 0; r--) {
+				const int cluster = tightestCluster(bits, e);
+				toggle(bits, e, cluster);
+				rank[cluster] = r;
+			}
+		}
+
+		// The rest: fill the largest voids
+		for (int r = initialCount; r < n; r++) {
+			const int gap = largestVoid(pattern, energy);
+			toggle(pattern, energy, gap);
+			rank[gap] = r;
+		}
+
+		std::vector<float> mask(n);
+		for (int i = 0; i < n; i++) {
+			mask[i] = (rank[i] + 0.5f) / n;
+		}
+		return mask;
+	}
+
+	GLuint texture = 0;
+};
+
+#endif // !RT_BLUENOISE_H
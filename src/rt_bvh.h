@@ -2,9 +2,18 @@
 #define RT_BVH_H
 
 #include "rt_structs.h"
+#include "rt_threadpool.h"
+#include "rt_simd.h"
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <climits>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <thread>
 #include <glm/glm/glm.hpp>
 
 // Axis-Aligned Bounding Box
@@ -35,6 +44,108 @@ struct AABB {
 };
 
 
+// Tuning knobs for BVHBuilder::build.
+struct BVHBuildOptions {
+	static constexpr int MAX_BUCKETS = 64;
+
+	int threads = 0;        // 0 = one per hardware thread, 1 = serial
+	int buckets = 12;       // SAH buckets per axis, 2 to MAX_BUCKETS
+	int maxLeafSize = 4;    // ranges this small always become leaves
+};
+
+// Levels in a binary BVH laid out from node 0 (a lone leaf is 1), which the
+// shader's traversal stack is sized from.
+inline int BVHDepth(const BVHNode* nodes, size_t nodeCount) {
+	if (nodeCount == 0) return 0;
+	int depth = 0;
+	std::vector<std::pair<int, int>> stack = { { 0, 1 } };
+	while (!stack.empty()) {
+		const std::pair<int, int> entry = stack.back();
+		stack.pop_back();
+		depth = std::max(depth, entry.second);
+		const BVHNode& node = nodes[entry.first];
+		if (node.leftChild >= 0) {
+			stack.push_back({ node.leftChild, entry.second + 1 });
+			stack.push_back({ node.rightChild, entry.second + 1 });
+		}
+	}
+	return depth;
+}
+
+// The same for a wide BVH, whose interior children are the indices >= 0.
+template <int Width>
+int WideBVHDepth(const WideBVHNodeT<Width>* nodes, size_t nodeCount) {
+	if (nodeCount == 0) return 0;
+	int depth = 0;
+	std::vector<std::pair<int, int>> stack = { { 0, 1 } };
+	while (!stack.empty()) {
+		const std::pair<int, int> entry = stack.back();
+		stack.pop_back();
+		depth = std::max(depth, entry.second);
+		const WideBVHNodeT<Width>& node = nodes[entry.first];
+		for (int c = 0; c < node.childCount; c++) {
+			if (node.children[c] >= 0) stack.push_back({ node.children[c], entry.second + 1 });
+		}
+	}
+	return depth;
+}
+
+// Shape and size of a built binary BVH, for the benchmark's reports.
+struct BVHStats {
+	static constexpr int HISTOGRAM_BINS = 17; // leaves of 0..15 primitives, then 16 and more
+
+	size_t nodes = 0;
+	size_t leaves = 0;
+	int depth = 0;
+	float sahCost = 0.0f;  // expected cost of a ray, in BVHBuilder's SAH units
+	int minLeafSize = 0;
+	int maxLeafSize = 0;
+	float meanLeafSize = 0.0f;
+	size_t leafSizeHistogram[HISTOGRAM_BINS] = {};
+	size_t bytes = 0;      // nodes and primitive indices
+};
+
+// Walks a tree laid out from node 0, as BVHBuilder builds it.
+inline BVHStats ComputeBVHStats(const std::vector<BVHNode>& nodes, size_t primitiveCount,
+	float traversalCost, float intersectionCost) {
+	BVHStats stats;
+	stats.nodes = nodes.size();
+	stats.bytes = nodes.size() * sizeof(BVHNode) + primitiveCount * sizeof(int);
+	if (nodes.empty()) return stats;
+
+	stats.depth = BVHDepth(nodes.data(), nodes.size());
+	const glm::vec3 rootExtent = glm::vec3(nodes[0].max - nodes[0].min);
+	const float rootArea = 2.0f * (rootExtent.x * rootExtent.y + rootExtent.y * rootExtent.z + rootExtent.x * rootExtent.z);
+	const float invRootArea = rootArea > 0.0f ? 1.0f / rootArea : 0.0f;
+
+	size_t leafPrims = 0;
+	stats.minLeafSize = INT_MAX;
+	std::vector<int> stack = { 0 };
+	while (!stack.empty()) {
+		const BVHNode& node = nodes[stack.back()];
+		stack.pop_back();
+
+		const glm::vec3 d = glm::vec3(node.max - node.min);
+		const float area = 2.0f * (d.x * d.y + d.y * d.z + d.x * d.z) * invRootArea;
+		if (node.leftChild < 0) {
+			const int count = node.rightChild;
+			stats.leaves++;
+			leafPrims += count;
+			stats.minLeafSize = std::min(stats.minLeafSize, count);
+			stats.maxLeafSize = std::max(stats.maxLeafSize, count);
+			stats.leafSizeHistogram[std::min(count, BVHStats::HISTOGRAM_BINS - 1)]++;
+			stats.sahCost += area * count * intersectionCost;
+		}
+		else {
+			stats.sahCost += area * traversalCost;
+			stack.push_back(node.leftChild);
+			stack.push_back(node.rightChild);
+		}
+	}
+	stats.meanLeafSize = stats.leaves > 0 ? (float)leafPrims / stats.leaves : 0.0f;
+	return stats;
+}
+
 // A BVH is an acceleration structure that recursively splits a mesh or 
 // scene into smaller nodes containing less geometry. The idea here is 
 // to be able to discard as much geometry as possble per ray, in order 
@@ -43,43 +154,102 @@ class BVHBuilder {
 public:
 	std::vector<BVHNode> nodes;
 	std::vector<int> primitiveIndices; // The index into the triangle array.
+
+	// SAH costs of visiting a node and of testing a primitive
+	static constexpr float TRAVERSAL_COST = 0.125f;
+	static constexpr float INTERSECTION_COST = 1.0f;
 	
-	void build(const std::vector<Triangle>& triangles) {
+	// Builds over geometry.triangles[firstTri, firstTri + triCount).
+	// primitiveIndices are relative to firstTri.
+	void build(const IndexedGeometry& geometry, size_t firstTri, size_t triCount,
+		const BVHBuildOptions& options = BVHBuildOptions()) {
 		nodes.clear();
 		primitiveIndices.clear();
+		levelStarts.clear();
 
 #ifdef RT_DEBUG
-		std::cout << "BVH build called with " << triangles.size() << " triangles" << std::endl;
+		std::cout << "BVH build called with " << triCount << " triangles" << std::endl;
+		auto buildStart = std::chrono::high_resolution_clock::now();
 #endif
-		if (triangles.empty()) {
+		if (triCount == 0) {
 			std::cout << "No triangles to build BVH for!" << std::endl;
 			return;
 		}
 
-		std::vector<PrimInfo> primInfo;
-		primInfo.reserve(triangles.size());
-
-		for (size_t i = 0; i < triangles.size(); i++) {
-			AABB bounds = getTriangleBounds(triangles[i]);
-			primInfo.push_back({ bounds, bounds.center(), (int)i });
+		std::vector<PrimInfo> primInfo(triCount);
+		for (size_t i = 0; i < triCount; i++) {
+			AABB bounds = getTriangleBounds(geometry, firstTri + i);
+			primInfo[i] = { bounds, bounds.center(), (int)i };
 		}
 
-		nodes.reserve(2 * triangles.size());
-		primitiveIndices.reserve(triangles.size());
-
-		buildRecursive(primInfo, 0, primInfo.size());
+		buildFromPrimInfo(primInfo, options);
 #ifdef RT_DEBUG
+		std::chrono::duration<double, std::milli> buildTime = std::chrono::high_resolution_clock::now() - buildStart;
 		std::cout << "BVH built with " << nodes.size() << " nodes for "
-			<< triangles.size() << " triangles" << std::endl;
+			<< triCount << " triangles in " << buildTime.count() << " ms" << std::endl;
 #endif
 	}
 
+	// Builds over arbitrary boxes, e.g. instance bounds for a top-level BVH.
+	// primitiveIndices then index into the bounds array.
+	void build(const std::vector<AABB>& bounds, const BVHBuildOptions& options = BVHBuildOptions()) {
+		nodes.clear();
+		primitiveIndices.clear();
+		levelStarts.clear();
+		if (bounds.empty()) return;
+
+		std::vector<PrimInfo> primInfo(bounds.size());
+		for (size_t i = 0; i < bounds.size(); i++) {
+			primInfo[i] = { bounds[i], bounds[i].center(), (int)i };
+		}
+
+		buildFromPrimInfo(primInfo, options);
+	}
+
 	const std::vector<BVHNode>& getNodes() const { return nodes; }
 	const std::vector<int>& getPrimitiveIndices() const { return primitiveIndices; }
 
-	void refit(const std::vector<Triangle>& triangles) {
+	// Refits the tree after its boxes have moved, keeping its shape. bounds is
+	// indexed like the array the tree was built from. Runs bottom-up over the
+	// nodes in level order: every node of a level only reads the level below,
+	// so wide levels are split across the pool's threads.
+	void refit(const std::vector<AABB>& bounds, ThreadPool* pool = nullptr) {
 		if (nodes.empty()) return;
-		refitNode(0, triangles);
+		if (levelStarts.empty()) computeLevelOrder();
+
+		for (int level = (int)levelStarts.size() - 2; level >= 0; level--) {
+			const int start = levelStarts[level];
+			const int end = levelStarts[level + 1];
+
+			if (!pool || end - start < PARALLEL_REFIT_NODES) {
+				for (int i = start; i < end; i++) refitNode(levelOrder[i], bounds);
+				continue;
+			}
+			parallelChunks(pool, pool->threadCount(), start, end, [&](int, int s, int e) {
+				for (int i = s; i < e; i++) refitNode(levelOrder[i], bounds);
+			});
+		}
+	}
+
+	// Collapses the binary SAH tree into a Width-wide tree with quantized child
+	// bounds. Each wide node opens up the largest-area interior children of a
+	// binary node until it holds Width children. Leaves and primitiveIndices
+	// are shared with the binary tree, so this can be called again after refit().
+	template <int Width>
+	std::vector<WideBVHNodeT<Width>> collapseToWide() const {
+		std::vector<WideBVHNodeT<Width>> wide;
+		if (nodes.empty()) return wide;
+
+		wide.reserve(nodes.size() / 2 + 1);
+		wide.emplace_back();
+		collapseNode<Width>(wide, 0, 0);
+
+#ifdef RT_DEBUG
+		std::cout << "Wide BVH" << Width << " collapsed to " << wide.size() << " nodes ("
+			<< wide.size() * sizeof(WideBVHNodeT<Width>) << " bytes, binary: "
+			<< nodes.size() * sizeof(BVHNode) << " bytes)" << std::endl;
+#endif
+		return wide;
 	}
 
 private:
@@ -89,9 +259,129 @@ private:
 		int primitiveIndex;
 	};
 
-	static constexpr int MAX_PRIMS_IN_LEAF = 4;
+	// Hard cap so a leaf's count fits the wide BVH's 8-bit leafCount.
+	static constexpr int MAX_PRIMS_IN_LARGE_LEAF = 255;
+
+	template <int Width>
+	void collapseNode(std::vector<WideBVHNodeT<Width>>& wide, int wideIndex, int binaryIndex) const {
+		// Gather up to Width binary subtrees under this wide node
+		int children[Width];
+		int count = 0;
+
+		const BVHNode& top = nodes[binaryIndex];
+		if (top.leftChild < 0) {
+			children[count++] = binaryIndex; // the whole tree is one leaf
+		}
+		else {
+			children[count++] = top.leftChild;
+			children[count++] = top.rightChild;
+		}
+
+		while (count < Width) {
+			int best = -1;
+			float bestArea = -1.0f;
+			for (int i = 0; i < count; i++) {
+				const BVHNode& child = nodes[children[i]];
+				if (child.leftChild < 0) continue; // leaves can't be opened
+				float area = AABB(glm::vec3(child.min), glm::vec3(child.max)).surfaceArea();
+				if (area > bestArea) {
+					bestArea = area;
+					best = i;
+				}
+			}
+			if (best < 0) break;
+
+			const BVHNode& opened = nodes[children[best]];
+			children[best] = opened.leftChild;
+			children[count++] = opened.rightChild;
+		}
+
+		// Quantization frame: origin at the node's min corner, and a power-of-two
+		// scale per axis so that the node's extent maps into [0, 255].
+		AABB bounds;
+		for (int i = 0; i < count; i++) {
+			bounds.expand(AABB(glm::vec3(nodes[children[i]].min), glm::vec3(nodes[children[i]].max)));
+		}
+
+		WideBVHNodeT<Width> node = {};
+		node.origin = bounds.min;
+		node.childCount = (uint8_t)count;
+
+		float scale[3];
+		for (int axis = 0; axis < 3; axis++) {
+			float extent = bounds.max[axis] - bounds.min[axis];
+			int e = extent > 0.0f ? (int)std::ceil(std::log2(extent / 255.0f)) : -126;
+			e = std::max(-126, std::min(127, e));
+			node.exponent[axis] = (uint8_t)(e + 127);
+			scale[axis] = std::ldexp(1.0f, e);
+		}
+
+		int pending[Width];
+		int pendingWide[Width];
+		int pendingCount = 0;
+
+		for (int i = 0; i < count; i++) {
+			const BVHNode& child = nodes[children[i]];
+			for (int axis = 0; axis < 3; axis++) {
+				// Round outward so the quantized box always contains the real one
+				float lo = std::floor((child.min[axis] - node.origin[axis]) / scale[axis]);
+				float hi = std::ceil((child.max[axis] - node.origin[axis]) / scale[axis]);
+				node.qlo[axis][i] = (uint8_t)std::max(0.0f, std::min(255.0f, lo));
+				node.qhi[axis][i] = (uint8_t)std::max(0.0f, std::min(255.0f, hi));
+			}
+
+			if (child.leftChild < 0) {
+				node.children[i] = child.leftChild; // same -(offset + 1) encoding
+				node.leafCount[i] = (uint8_t)child.rightChild;
+			}
+			else {
+				node.children[i] = (int)wide.size();
+				node.leafCount[i] = 0;
+				pending[pendingCount] = children[i];
+				pendingWide[pendingCount++] = (int)wide.size();
+				wide.emplace_back();
+			}
+		}
+
+		wide[wideIndex] = node;
+
+		for (int i = 0; i < pendingCount; i++) {
+			collapseNode<Width>(wide, pendingWide[i], pending[i]);
+		}
+	}
+
+	// Nodes in breadth-first order, levelStarts[d] being where depth d begins.
+	// Recomputed by refit() after each build.
+	std::vector<int> levelOrder;
+	std::vector<int> levelStarts;
+
+	// Levels narrower than this are refit on the calling thread
+	static constexpr int PARALLEL_REFIT_NODES = 2048;
+
+	void computeLevelOrder() {
+		levelOrder.clear();
+		levelStarts.clear();
+		levelOrder.reserve(nodes.size());
+		levelOrder.push_back(0);
+
+		size_t levelStart = 0;
+		while (levelStart < levelOrder.size()) {
+			const size_t levelEnd = levelOrder.size();
+			levelStarts.push_back((int)levelStart);
+			for (size_t i = levelStart; i < levelEnd; i++) {
+				const BVHNode& node = nodes[levelOrder[i]];
+				if (node.leftChild >= 0) {
+					levelOrder.push_back(node.leftChild);
+					levelOrder.push_back(node.rightChild);
+				}
+			}
+			levelStart = levelEnd;
+		}
+		levelStarts.push_back((int)levelOrder.size());
+	}
 
-	AABB refitNode(int nodeIdx, const std::vector<Triangle>& triangles) {
+	// Recomputes one node's box, from its primitives or its already refit children.
+	void refitNode(int nodeIdx, const std::vector<AABB>& primBounds) {
 		BVHNode& node = nodes[nodeIdx];
 
 		if (node.leftChild < 0) { // leaf
@@ -100,87 +390,165 @@ private:
 
 			AABB bounds;
 			for (int i = 0; i < primCount; ++i) {
-				const int triIdx = primitiveIndices[primOffset + i];
-				// Reuse same bounding method used at build-time:
-				const Triangle& t = triangles[triIdx];
-
-				// Inline getTriangleBounds(t) to avoid private access issues:
-				AABB tb;
-				tb.expand(glm::vec3(t.v0.x, t.v0.y, t.v0.z));
-				tb.expand(glm::vec3(t.v1.x, t.v1.y, t.v1.z));
-				tb.expand(glm::vec3(t.v2.x, t.v2.y, t.v2.z));
-
-				bounds.expand(tb);
+				bounds.expand(primBounds[primitiveIndices[primOffset + i]]);
 			}
 			node.min = glm::vec4(bounds.min, 0.0f);
 			node.max = glm::vec4(bounds.max, 0.0f);
-			return bounds;
 		}
 		else {
 			// internal: combine children
-			const int L = node.leftChild;
-			const int R = node.rightChild;
-			AABB leftB = refitNode(L, triangles);
-			AABB rightB = refitNode(R, triangles);
-
-			AABB b = leftB;
-			b.expand(rightB);
-			node.min = glm::vec4(b.min, 0.0f);
-			node.max = glm::vec4(b.max, 0.0f);
-			return b;
+			const BVHNode& L = nodes[node.leftChild];
+			const BVHNode& R = nodes[node.rightChild];
+			node.min = glm::min(L.min, R.min);
+			node.max = glm::max(L.max, R.max);
 		}
 	}
 
-	AABB getTriangleBounds(const Triangle& tri) const {
+	AABB getTriangleBounds(const IndexedGeometry& geometry, size_t triangleIndex) const {
+		const IndexedTriangle& tri = geometry.triangles[triangleIndex];
+#if RT_SSE
+		// One vertex per register; w is ignored
+		__m128 p0 = LoadVec4(geometry.positions[tri.v0]);
+		__m128 p1 = LoadVec4(geometry.positions[tri.v1]);
+		__m128 p2 = LoadVec4(geometry.positions[tri.v2]);
+		return AABB(ToVec3(_mm_min_ps(p0, _mm_min_ps(p1, p2))), ToVec3(_mm_max_ps(p0, _mm_max_ps(p1, p2))));
+#else
 		AABB bounds;
-		bounds.expand(tri.v0);
-		bounds.expand(tri.v1);
-		bounds.expand(tri.v2);
+		bounds.expand(geometry.position(tri.v0));
+		bounds.expand(geometry.position(tri.v1));
+		bounds.expand(geometry.position(tri.v2));
 		return bounds;
+#endif
 	}
 
-	int buildRecursive(std::vector<PrimInfo>& primInfo, int start, int end) {
-		int nodeIndex = nodes.size();
-		nodes.emplace_back(); // Placeholder
+	// Per-build state, shared by all tasks of one build.
+	struct BuildContext {
+		std::vector<PrimInfo>& primInfo;
+		int buckets;
+		int maxLeafSize;
+		ThreadPool* pool;
+		std::atomic<int> nodeCount{ 1 }; // the root is node 0
+	};
 
-		// Compute bounding box for current range
+	struct Bucket {
 		AABB bounds;
-		for (int i = start; i < end; i++) {
-			bounds.expand(primInfo[i].bounds);
+		int count = 0;
+	};
+
+	// Subtrees larger than this are built as separate tasks
+	static constexpr int PARALLEL_SUBTREE_PRIMS = 4096;
+	// Nodes larger than this bin their primitives on every thread
+	static constexpr int PARALLEL_BINNING_PRIMS = 65536;
+
+	void buildFromPrimInfo(std::vector<PrimInfo>& primInfo, const BVHBuildOptions& options) {
+		int threads = options.threads > 0 ? options.threads : (int)std::thread::hardware_concurrency();
+		std::unique_ptr<ThreadPool> pool;
+		if (threads > 1 && (int)primInfo.size() > PARALLEL_SUBTREE_PRIMS) {
+			pool.reset(new ThreadPool(threads - 1));
 		}
 
-		int numPrims = end - start;
+		BuildContext ctx{ primInfo,
+			std::max(2, std::min((int)BVHBuildOptions::MAX_BUCKETS, options.buckets)),
+			std::max(1, std::min((int)MAX_PRIMS_IN_LARGE_LEAF, options.maxLeafSize)),
+			pool.get() };
 
-		if (numPrims <= MAX_PRIMS_IN_LEAF) {
-			createLeaf(nodeIndex, bounds, primInfo, start, end);
-			return nodeIndex;
+		// A binary tree over n leaves-worth of primitives never needs more than 2n - 1 nodes
+		nodes.resize(2 * primInfo.size() - 1);
+		buildNode(ctx, 0, 0, (int)primInfo.size());
+		nodes.resize(ctx.nodeCount);
+
+		// Leaves reference their primInfo range directly, so the final order is the index array
+		primitiveIndices.resize(primInfo.size());
+		for (size_t i = 0; i < primInfo.size(); i++) {
+			primitiveIndices[i] = primInfo[i].primitiveIndex;
 		}
+	}
 
-		// Choose split dimension and position using SAH
-		int splitDim;
-		int splitPos;
-		float splitCost = findBestSplit(primInfo, start, end, bounds, splitDim, splitPos);
+	// Only the few top-level nodes are big enough to be worth binning on every thread.
+	static int chunkCount(const BuildContext& ctx, int numPrims) {
+		return (ctx.pool && numPrims >= PARALLEL_BINNING_PRIMS) ? ctx.pool->threadCount() : 1;
+	}
 
-		// Create a leaf if the split isn't beneficial
-		if (splitCost >= numPrims) {
-			createLeaf(nodeIndex, bounds, primInfo, start, end);
-			return nodeIndex;
+	// Runs fn(chunk, begin, end) over [start, end) split into chunks tasks.
+	template <typename Fn>
+	static void parallelChunks(ThreadPool* pool, int chunks, int start, int end, Fn fn) {
+		ThreadPool::TaskGroup group;
+		int chunkSize = (end - start + chunks - 1) / chunks;
+		for (int c = 1; c < chunks; c++) {
+			int chunkStart = std::min(end, start + c * chunkSize);
+			int chunkEnd = std::min(end, chunkStart + chunkSize);
+			pool->run(group, [=] { fn(c, chunkStart, chunkEnd); });
 		}
+		fn(0, start, std::min(end, start + chunkSize));
+		pool->wait(group);
+	}
 
-		// Partition primitives
-		std::nth_element(primInfo.begin() + start, 
-			primInfo.begin() + splitPos, 
-			primInfo.begin() + end,
-			[splitDim](const PrimInfo& a, const PrimInfo& b) {
-				return a.centroid[splitDim] < b.centroid[splitDim];
+	void buildNode(BuildContext& ctx, int nodeIndex, int start, int end) {
+		std::vector<PrimInfo>& primInfo = ctx.primInfo;
+		int numPrims = end - start;
+
+		// Bounds of the primitives and of their centroids
+		AABB bounds, centroidBounds;
+		int chunks = chunkCount(ctx, numPrims);
+		if (chunks == 1) {
+			for (int i = start; i < end; i++) {
+				bounds.expand(primInfo[i].bounds);
+				centroidBounds.expand(primInfo[i].centroid);
+			}
+		}
+		else {
+			std::vector<AABB> chunkBounds(chunks), chunkCentroids(chunks);
+			parallelChunks(ctx.pool, chunks, start, end, [&](int c, int s, int e) {
+				for (int i = s; i < e; i++) {
+					chunkBounds[c].expand(primInfo[i].bounds);
+					chunkCentroids[c].expand(primInfo[i].centroid);
+				}
+			});
+			for (int c = 0; c < chunks; c++) {
+				bounds.expand(chunkBounds[c]);
+				centroidBounds.expand(chunkCentroids[c]);
 			}
-		);
+		}
 
-		// Build children
-		int leftChild = buildRecursive(primInfo, start, splitPos);
-		int rightChild = buildRecursive(primInfo, splitPos, end);
+		if (numPrims <= ctx.maxLeafSize) {
+			createLeaf(nodeIndex, bounds, start, end);
+			return;
+		}
+
+		// Choose split dimension and bucket using SAH
+		int splitDim, splitBucket;
+		float splitCost = findBestSplit(ctx, start, end, bounds, centroidBounds, splitDim, splitBucket);
+
+		int mid;
+		if (splitDim < 0) {
+			// All centroids coincide; SAH can't separate them
+			if (numPrims <= MAX_PRIMS_IN_LARGE_LEAF) {
+				createLeaf(nodeIndex, bounds, start, end);
+				return;
+			}
+			mid = (start + end) / 2;
+		}
+		else if (splitCost >= numPrims && numPrims <= MAX_PRIMS_IN_LARGE_LEAF) {
+			// Create a leaf if the split isn't beneficial
+			createLeaf(nodeIndex, bounds, start, end);
+			return;
+		}
+		else {
+			// One partition per node, using the same bucket mapping as the binning
+			float lo = centroidBounds.min[splitDim];
+			float scale = ctx.buckets / (centroidBounds.max[splitDim] - lo);
+			int buckets = ctx.buckets;
+			auto splitIter = std::partition(primInfo.begin() + start, primInfo.begin() + end,
+				[=](const PrimInfo& p) {
+					return bucketIndex(p.centroid[splitDim], lo, scale, buckets) < splitBucket;
+				});
+			mid = (int)(splitIter - primInfo.begin());
+		}
+
+		// Children are allocated as a pair
+		int leftChild = ctx.nodeCount.fetch_add(2);
+		int rightChild = leftChild + 1;
 
-		// Update current
 		BVHNode& node = nodes[nodeIndex];
 		node.min = glm::vec4(bounds.min, 0.0);
 		node.max = glm::vec4(bounds.max, 0.0);
@@ -188,109 +556,120 @@ private:
 		node.rightChild = rightChild;
 		node.pad0 = node.pad1 = 0;
 
-		return nodeIndex;
+		// Build children, the left one as a task when it's big enough
+		if (ctx.pool && numPrims > PARALLEL_SUBTREE_PRIMS) {
+			ThreadPool::TaskGroup group;
+			ctx.pool->run(group, [&ctx, this, leftChild, start, mid] { buildNode(ctx, leftChild, start, mid); });
+			buildNode(ctx, rightChild, mid, end);
+			ctx.pool->wait(group);
+		}
+		else {
+			buildNode(ctx, leftChild, start, mid);
+			buildNode(ctx, rightChild, mid, end);
+		}
 	}
 
-	void createLeaf(int nodeIndex, const AABB& bounds, const std::vector<PrimInfo>& primInfo, int start, int end) {
+	void createLeaf(int nodeIndex, const AABB& bounds, int start, int end) {
 		BVHNode& node = nodes[nodeIndex];
 		node.min = glm::vec4(bounds.min, 0.0);
 		node.max = glm::vec4(bounds.max, 0.0);
 
-		// Store current size before adding primitives
-		int primitiveOffset = (int)primitiveIndices.size();
-
 		// negative values indicate leaf nodes
-		node.leftChild = -(primitiveOffset+ 1); // negative offset to primitives. +1 is to ensure that we are non-zero.
+		node.leftChild = -(start + 1); // negative offset to primitives. +1 is to ensure that we are non-zero.
 		node.rightChild = end - start;
+		node.pad0 = node.pad1 = 0;
+	}
 
-		// add primitives to the array
-		for (int i = start; i < end; i++) {
-			int ref;
-			ref = primInfo[i].primitiveIndex;
-			primitiveIndices.push_back(ref);
-		}
+	static int bucketIndex(float centroid, float lo, float scale, int buckets) {
+		return std::min(buckets - 1, (int)((centroid - lo) * scale));
 	}
 
-	float findBestSplit(std::vector<PrimInfo>& primInfo, int start, int end,
-		const AABB& bounds, int& bestDim, int& bestPos) {
+	// Bins every primitive once per axis, then finds the cheapest split with a
+	// prefix and a suffix sweep over the buckets: O(n + buckets) per axis.
+	float findBestSplit(BuildContext& ctx, int start, int end, const AABB& bounds,
+		const AABB& centroidBounds, int& bestDim, int& bestBucket) {
+		const std::vector<PrimInfo>& primInfo = ctx.primInfo;
+		const int numBuckets = ctx.buckets;
 		float bestCost = FLT_MAX;
-		bestDim = 0;
-		bestPos = (start + end) / 2;
-
-		const int numBuckets = 12;
+		bestDim = -1;
+		bestBucket = 0;
 
-		// Try each dimension
+		glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+		float scale[3];
 		for (int dim = 0; dim < 3; dim++) {
-			// Find centroid bounds for this dimension
-			float minCentroid = FLT_MAX;
-			float maxCentroid = -FLT_MAX;
+			scale[dim] = extent[dim] > 0.0f ? numBuckets / extent[dim] : 0.0f;
+		}
 
-			for (int i = start; i < end; i++) {
-				minCentroid = std::min(minCentroid, primInfo[i].centroid[dim]);
-				maxCentroid = std::max(maxCentroid, primInfo[i].centroid[dim]);
+		// Assign primitives to buckets, one bucket set per chunk
+		Bucket buckets[3 * BVHBuildOptions::MAX_BUCKETS];
+		auto binRange = [&](Bucket* out, int s, int e) {
+			for (int i = s; i < e; i++) {
+				for (int dim = 0; dim < 3; dim++) {
+					if (scale[dim] == 0.0f) continue; // Can't split on this dimension
+					int b = bucketIndex(primInfo[i].centroid[dim], centroidBounds.min[dim], scale[dim], numBuckets);
+					out[dim * numBuckets + b].count++;
+					out[dim * numBuckets + b].bounds.expand(primInfo[i].bounds);
+				}
 			}
+		};
 
-			if (minCentroid == maxCentroid) continue; // Can't split on this dimension
-
-			// Initialize buckets
-			struct Bucket {
-				int count = 0;
-				AABB bounds;
-			};
-			Bucket buckets[numBuckets];
-
-			// Assign primitives to buckets
-			for (int i = start; i < end; i++) {
-				int bucketIndex = std::min(numBuckets - 1,
-					(int)(numBuckets * (primInfo[i].centroid[dim] - minCentroid) / (maxCentroid - minCentroid)));
-				buckets[bucketIndex].count++;
-				buckets[bucketIndex].bounds.expand(primInfo[i].bounds);
+		int chunks = chunkCount(ctx, end - start);
+		if (chunks == 1) {
+			binRange(buckets, start, end);
+		}
+		else {
+			std::vector<Bucket> chunkBuckets((chunks - 1) * 3 * numBuckets);
+			parallelChunks(ctx.pool, chunks, start, end, [&](int c, int s, int e) {
+				binRange(c == 0 ? buckets : &chunkBuckets[(c - 1) * 3 * numBuckets], s, e);
+			});
+			for (int c = 0; c < chunks - 1; c++) {
+				for (int b = 0; b < 3 * numBuckets; b++) {
+					buckets[b].count += chunkBuckets[c * 3 * numBuckets + b].count;
+					buckets[b].bounds.expand(chunkBuckets[c * 3 * numBuckets + b].bounds);
+				}
 			}
+		}
 
-			// Compute cost for each potential split
-			for (int splitBucket = 1; splitBucket < numBuckets; splitBucket++) {
-				AABB leftBounds, rightBounds;
-				int leftCount = 0, rightCount = 0;
+		// SAH cost: traversal cost + intersection cost
+		const float traversalCost = TRAVERSAL_COST;
+		const float intersectionCost = INTERSECTION_COST;
+		const float area = bounds.surfaceArea();
+		const float invArea = area > 0.0f ? 1.0f / area : 0.0f;
 
-				// Left side (buckets 0 to splitBucket-1)
-				for (int i = 0; i < splitBucket; i++) {
-					leftBounds.expand(buckets[i].bounds);
-					leftCount += buckets[i].count;
-				}
+		float leftArea[BVHBuildOptions::MAX_BUCKETS];
+		int leftCount[BVHBuildOptions::MAX_BUCKETS];
 
-				// Right side (buckets splitBucket to numBuckets-1)
-				for (int i = splitBucket; i < numBuckets; i++) {
-					rightBounds.expand(buckets[i].bounds);
-					rightCount += buckets[i].count;
-				}
+		for (int dim = 0; dim < 3; dim++) {
+			if (scale[dim] == 0.0f) continue;
+			const Bucket* axisBuckets = &buckets[dim * numBuckets];
+
+			// Prefix sweep: left side of split i is buckets [0, i)
+			AABB leftBounds;
+			int count = 0;
+			for (int i = 1; i < numBuckets; i++) {
+				leftBounds.expand(axisBuckets[i - 1].bounds);
+				count += axisBuckets[i - 1].count;
+				leftArea[i] = leftBounds.surfaceArea();
+				leftCount[i] = count;
+			}
+
+			// Suffix sweep: right side of split i is buckets [i, numBuckets)
+			AABB rightBounds;
+			count = 0;
+			for (int i = numBuckets - 1; i >= 1; i--) {
+				rightBounds.expand(axisBuckets[i].bounds);
+				count += axisBuckets[i].count;
 
 				// Skip if one side is empty
-				if (leftCount == 0 || rightCount == 0) continue;
+				if (leftCount[i] == 0 || count == 0) continue;
 
-				// SAH cost: traversal cost + intersection cost
-				float traversalCost = 0.125f;
-				float intersectionCost = 1.0f;
 				float cost = traversalCost + intersectionCost *
-					(leftCount * leftBounds.surfaceArea() +
-						rightCount * rightBounds.surfaceArea()) / bounds.surfaceArea();
+					(leftCount[i] * leftArea[i] + count * rightBounds.surfaceArea()) * invArea;
 
 				if (cost < bestCost) {
 					bestCost = cost;
 					bestDim = dim;
-
-					// Calculate split centroid
-					float splitCentroid = minCentroid + (maxCentroid - minCentroid) * splitBucket / numBuckets;
-
-					// Find actual split position by partitioning
-					auto splitIter = std::partition(primInfo.begin() + start,
-						primInfo.begin() + end,
-						[dim, splitCentroid](const PrimInfo& p) {
-							return p.centroid[dim] < splitCentroid;
-						});
-					bestPos = splitIter - primInfo.begin();
-
-					// Ensure split position is valid
-					bestPos = std::max(start + 1, std::min(end - 1, bestPos));
+					bestBucket = i;
 				}
 			}
 		}
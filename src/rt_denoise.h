@@ -0,0 +1,126 @@
+#ifndef RT_DENOISE_H
+#define RT_DENOISE_H
+
+#include <glad2/gl.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "includes/shader.h"
+#include "rt_wavefront.h"
+
+// Real-time denoiser between the ray pass and the post chain.
+//
+// An edge-avoiding à-trous wavelet filter guided by the first-hit G-buffer and
+// the per-pixel variance from the luminance moments, in the spirit of SVGF
+// (without its temporal reprojection). The prepare pass demodulates the
+// albedo and works out each pixel's variance; each iteration then doubles the
+// filter's footprint. Only what is displayed is filtered: accumulation keeps
+// averaging the raw samples, and as the variance falls the filter lets the
+// converged image through untouched.
+class Denoiser {
+public:
+	Denoiser(int width, int height)
+		: prepareShader("src/shaders/fullscreen.vert", "src/shaders/denoise_prepare.frag"),
+		atrousShader("src/shaders/fullscreen.vert", "src/shaders/denoise_atrous.frag") {
+		glGenTextures(2, pingPongTex);
+		glGenFramebuffers(2, pingPongFBO);
+		resize(width, height);
+	}
+
+	~Denoiser() {
+		glDeleteFramebuffers(2, pingPongFBO);
+		glDeleteTextures(2, pingPongTex);
+	}
+
+	Denoiser(const Denoiser&) = delete;
+	Denoiser& operator=(const Denoiser&) = delete;
+
+	// Reallocates the ping-pong targets to match the accumulation's size.
+	void resize(int newWidth, int newHeight) {
+		width = newWidth;
+		height = newHeight;
+		for (int i = 0; i < 2; i++) {
+			glBindTexture(GL_TEXTURE_2D, pingPongTex[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+			glBindFramebuffer(GL_FRAMEBUFFER, pingPongFBO[i]);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pingPongTex[i], 0);
+			if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+				std::cout << "Denoiser FBO " << i << " not complete!" << std::endl;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	// Filter strength. Higher sigmas blur across larger colour / normal / depth differences.
+	int iterations = 5;
+	float sigmaColor = 4.0f;
+	float sigmaNormal = 128.0f;
+	float sigmaDepth = 0.02f;
+
+	// Filters the accumulation just written and returns the denoised colour
+	// (RGBA32F). quadVAO draws the full-screen quad of fullscreen.vert.
+	GLuint apply(const AccumulationTargets& input, GLuint quadVAO) {
+		glViewport(0, 0, width, height);
+		glBindVertexArray(quadVAO);
+
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, input.albedo);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, input.normalDepth);
+
+		// Demodulate and estimate variance
+		glBindFramebuffer(GL_FRAMEBUFFER, pingPongFBO[0]);
+		prepareShader.use();
+		setGuides(prepareShader);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, input.color);
+		prepareShader.setInt("u_colorTex", 0);
+		glActiveTexture(GL_TEXTURE3);
+		glBindTexture(GL_TEXTURE_2D, input.moments);
+		prepareShader.setInt("u_momentsTex", 3);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+		// À-trous iterations, the last one remodulating
+		atrousShader.use();
+		setGuides(atrousShader);
+		atrousShader.setFloat("u_sigmaColor", sigmaColor);
+		atrousShader.setInt("u_inputTex", 0);
+
+		const int passes = std::max(1, iterations);
+		int read = 0;
+		for (int i = 0; i < passes; i++) {
+			glBindFramebuffer(GL_FRAMEBUFFER, pingPongFBO[1 - read]);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, pingPongTex[read]);
+			atrousShader.setInt("u_stepSize", 1 << i);
+			atrousShader.setBool("u_finalPass", i == passes - 1);
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+			read = 1 - read;
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return pingPongTex[read];
+	}
+
+private:
+	void setGuides(const shader& s) const {
+		s.setInt("u_albedoTex", 1);
+		s.setInt("u_normalDepthTex", 2);
+		s.setFloat("u_sigmaNormal", sigmaNormal);
+		s.setFloat("u_sigmaDepth", sigmaDepth);
+	}
+
+	int width = 0, height = 0;
+	shader prepareShader;
+	shader atrousShader;
+	GLuint pingPongTex[2];
+	GLuint pingPongFBO[2];
+};
+
+#endif // !RT_DENOISE_H
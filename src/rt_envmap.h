@@ -0,0 +1,126 @@
+#ifndef RT_ENVMAP_H
+#define RT_ENVMAP_H
+
+#include <glad2/gl.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// Importance sampling tables for an equirectangular HDR environment.
+//
+// The map is treated as a piecewise-constant distribution over its texels,
+// each weighted by luminance * sin(polar angle) so directions are chosen in
+// proportion to the light they carry rather than their area in the image.
+// Sampling picks a row from the marginal CDF, then a column from that row's
+// conditional CDF (both binary searched in the shader). Matches the direction
+// mapping of cubemap_common.glsl, with rows in the same bottom-up order as
+// the texture loadHDRTexture uploads.
+//
+//   conditional: RG32F, width x height. r: the row's inclusive normalized CDF,
+//                g: the texel's weight, for looking up pdfs.
+//   marginal:    R32F, height x 1. Inclusive normalized CDF over rows.
+//   integral:    the mean texel weight, so weight / integral is the pdf over [0,1]^2.
+class EnvironmentCDF {
+public:
+	EnvironmentCDF() = default;
+	~EnvironmentCDF() {
+		if (conditionalTex) glDeleteTextures(1, &conditionalTex);
+		if (marginalTex) glDeleteTextures(1, &marginalTex);
+	}
+
+	EnvironmentCDF(const EnvironmentCDF&) = delete;
+	EnvironmentCDF& operator=(const EnvironmentCDF&) = delete;
+
+	// data: width * height texels of channels floats, bottom row first.
+	void build(const float* data, int width, int height, int channels) {
+		build(texelWeights(data, width, height, channels), width, height);
+	}
+
+	// The weight of every texel, which is all the tables are built from. A
+	// cached sky (rt_skycache.h) keeps these instead of the decoded image.
+	static std::vector<float> texelWeights(const float* data, int width, int height, int channels) {
+		std::vector<float> weights((size_t)width * height);
+		for (int y = 0; y < height; y++) {
+			const float sinTheta = std::sin(3.14159265f * (y + 0.5f) / height);
+			for (int x = 0; x < width; x++) {
+				const float* texel = data + ((size_t)y * width + x) * channels;
+				const float lum = channels >= 3
+					? 0.2126f * texel[0] + 0.7152f * texel[1] + 0.0722f * texel[2]
+					: texel[0];
+				weights[(size_t)y * width + x] = std::max(lum, 0.0f) * sinTheta;
+			}
+		}
+		return weights;
+	}
+
+	void build(const std::vector<float>& weights, int width, int height) {
+		if (width <= 0 || height <= 0 || weights.size() != (size_t)width * height) return;
+
+		std::vector<float> conditional((size_t)width * height * 2);
+		std::vector<float> marginal(height);
+
+		double total = 0.0;
+		for (int y = 0; y < height; y++) {
+			double rowSum = 0.0;
+			for (int x = 0; x < width; x++) {
+				const float weight = weights[(size_t)y * width + x];
+
+				rowSum += weight;
+				conditional[((size_t)y * width + x) * 2 + 0] = (float)rowSum;
+				conditional[((size_t)y * width + x) * 2 + 1] = weight;
+			}
+
+			// Normalize the row. A black row is never picked, but keeps a valid CDF.
+			for (int x = 0; x < width; x++) {
+				float& cdf = conditional[((size_t)y * width + x) * 2];
+				cdf = rowSum > 0.0 ? (float)(cdf / rowSum) : (float)(x + 1) / width;
+			}
+			conditional[((size_t)y * width + width - 1) * 2] = 1.0f;
+
+			total += rowSum;
+			marginal[y] = (float)total;
+		}
+
+		if (!(total > 0.0)) {
+			std::cout << "EnvironmentCDF: environment is black, importance sampling disabled" << std::endl;
+			return;
+		}
+		for (float& cdf : marginal) cdf = (float)(cdf / total);
+		marginal[height - 1] = 1.0f;
+		integral = (float)(total / ((double)width * height));
+
+		conditionalTex = createTexture(GL_RG32F, GL_RG, width, height, conditional.data());
+		marginalTex = createTexture(GL_R32F, GL_RED, height, 1, marginal.data());
+
+#ifdef RT_DEBUG
+		std::cout << "Environment CDF: " << width << "x" << height << ", mean weight " << integral << std::endl;
+#endif
+	}
+
+	bool valid() const { return conditionalTex != 0 && marginalTex != 0; }
+	GLuint getConditional() const { return conditionalTex; }
+	GLuint getMarginal() const { return marginalTex; }
+	float getIntegral() const { return integral; }
+
+private:
+	static GLuint createTexture(GLenum internalFormat, GLenum format, int width, int height, const float* data) {
+		GLuint tex;
+		glGenTextures(1, &tex);
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_FLOAT, data);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return tex;
+	}
+
+	GLuint conditionalTex = 0;
+	GLuint marginalTex = 0;
+	float integral = 0.0f;
+};
+
+#endif // !RT_ENVMAP_H
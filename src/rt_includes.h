@@ -10,8 +10,27 @@
 #include "rt_structs.h"
 #include "rt_mesh.h"
 #include "rt_bvh.h"
+#include "rt_accel.h"
+#include "rt_meshcache.h"
+#include "rt_json.h"
+#include "rt_scenefile.h"
+#include "rt_lights.h"
 #include "rt_skybox.h"
+#include "rt_textures.h"
+#include "rt_loader.h"
+#include "rt_bluenoise.h"
 #include "rt_input.h"
+#include "rt_wavefront.h"
+#include "rt_adaptive.h"
+#include "rt_tiles.h"
+#include "rt_denoise.h"
+#include "rt_resolution.h"
+#include "rt_bloom.h"
+#include "rt_profiler.h"
+#include "rt_batch.h"
+#include "rt_lbvh.h"
+#include "rt_upload.h"
+#include "rt_permutation.h"
 
 inline double random_double() {
 	// Returns a random real in [0,1).
@@ -6,6 +6,12 @@
 const unsigned int WIDTH = 1920;
 const unsigned int HEIGHT = 1080;
 
+// The window's framebuffer size, which the final image is drawn at.
+// framebuffer_size_callback records changes for the render loop to pick up.
+int outputWidth = WIDTH;
+int outputHeight = HEIGHT;
+bool outputResized = false;
+
 // timing
 float deltaTime = 0.0f;	// time between current frame and last frame
 float lastFrame = 0.0f;
@@ -49,6 +55,13 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 	// make sure the viewport matches the new window dimensions; note that width and 
 	// height will be significantly larger than specified on retina displays.
 	glViewport(0, 0, width, height);
+
+	// A minimised window reports 0 x 0, keep the last real size then
+	if (width > 0 && height > 0) {
+		outputWidth = width;
+		outputHeight = height;
+		outputResized = true;
+	}
 }
 
 
@@ -0,0 +1,281 @@
+#ifndef RT_JSON_H
+#define RT_JSON_H
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A small JSON reader, just enough for scene files. Objects keep their keys
+// in file order, numbers are doubles and strings only understand the simple
+// escapes (\uXXXX becomes '?').
+class JsonValue {
+public:
+	enum Type { Null, Bool, Number, String, Array, Object };
+
+	Type type = Null;
+	bool boolean = false;
+	double number = 0.0;
+	std::string string;
+	std::vector<JsonValue> items;                          // Array
+	std::vector<std::pair<std::string, JsonValue>> members; // Object
+
+	bool isNumber() const { return type == Number; }
+	bool isString() const { return type == String; }
+	bool isArray() const { return type == Array; }
+	bool isObject() const { return type == Object; }
+
+	// The member called key, or null if there is none (or this isn't an object).
+	const JsonValue* find(const std::string& key) const {
+		for (const auto& member : members) {
+			if (member.first == key) return &member.second;
+		}
+		return nullptr;
+	}
+
+	double getNumber(const std::string& key, double fallback) const {
+		const JsonValue* v = find(key);
+		return v && v->type == Number ? v->number : fallback;
+	}
+
+	bool getBool(const std::string& key, bool fallback) const {
+		const JsonValue* v = find(key);
+		return v && v->type == Bool ? v->boolean : fallback;
+	}
+
+	std::string getString(const std::string& key, const std::string& fallback) const {
+		const JsonValue* v = find(key);
+		return v && v->type == String ? v->string : fallback;
+	}
+
+	// Parses text into root. On failure returns false and describes the
+	// problem, with its line, in error.
+	static bool parse(const std::string& text, JsonValue& root, std::string& error) {
+		Parser parser{ text, 0, error };
+		root = JsonValue();
+		if (!parser.value(root, 0)) return false;
+		parser.skipSpace();
+		if (parser.pos != text.size()) return parser.fail("trailing characters");
+		return true;
+	}
+
+private:
+	struct Parser {
+		const std::string& text;
+		size_t pos;
+		std::string& error;
+
+		static constexpr int MAX_DEPTH = 64;
+
+		bool fail(const char* what) {
+			int line = 1;
+			for (size_t i = 0; i < pos && i < text.size(); i++) line += text[i] == '\n';
+			error = std::string(what) + " at line " + std::to_string(line);
+			return false;
+		}
+
+		void skipSpace() {
+			while (pos < text.size()) {
+				const char c = text[pos];
+				if (c == ' ' || c == '\t' || c == '\n' || c == '\r') pos++;
+				else break;
+			}
+		}
+
+		bool literal(const char* word) {
+			const size_t start = pos;
+			for (const char* c = word; *c; c++, pos++) {
+				if (pos >= text.size() || text[pos] != *c) {
+					pos = start;
+					return false;
+				}
+			}
+			return true;
+		}
+
+		bool value(JsonValue& out, int depth) {
+			if (depth > MAX_DEPTH) return fail("nesting too deep");
+			skipSpace();
+			if (pos >= text.size()) return fail("unexpected end of file");
+
+			const char c = text[pos];
+			if (c == '{') return object(out, depth);
+			if (c == '[') return array(out, depth);
+			if (c == '"') {
+				out.type = String;
+				return stringValue(out.string);
+			}
+			if (literal("true")) { out.type = Bool; out.boolean = true; return true; }
+			if (literal("false")) { out.type = Bool; out.boolean = false; return true; }
+			if (literal("null")) { out.type = Null; return true; }
+
+			const char* begin = text.c_str() + pos;
+			char* end = nullptr;
+			out.number = std::strtod(begin, &end);
+			if (end == begin) return fail("unexpected character");
+			out.type = Number;
+			pos += end - begin;
+			return true;
+		}
+
+		bool object(JsonValue& out, int depth) {
+			out.type = Object;
+			pos++; // {
+			skipSpace();
+			if (pos < text.size() && text[pos] == '}') { pos++; return true; }
+
+			while (true) {
+				skipSpace();
+				std::string key;
+				if (pos >= text.size() || text[pos] != '"') return fail("expected a key");
+				if (!stringValue(key)) return false;
+
+				skipSpace();
+				if (pos >= text.size() || text[pos] != ':') return fail("expected ':'");
+				pos++;
+
+				out.members.emplace_back(std::move(key), JsonValue());
+				if (!value(out.members.back().second, depth + 1)) return false;
+
+				skipSpace();
+				if (pos < text.size() && text[pos] == ',') { pos++; continue; }
+				if (pos < text.size() && text[pos] == '}') { pos++; return true; }
+				return fail("expected ',' or '}'");
+			}
+		}
+
+		bool array(JsonValue& out, int depth) {
+			out.type = Array;
+			pos++; // [
+			skipSpace();
+			if (pos < text.size() && text[pos] == ']') { pos++; return true; }
+
+			while (true) {
+				out.items.emplace_back();
+				if (!value(out.items.back(), depth + 1)) return false;
+
+				skipSpace();
+				if (pos < text.size() && text[pos] == ',') { pos++; continue; }
+				if (pos < text.size() && text[pos] == ']') { pos++; return true; }
+				return fail("expected ',' or ']'");
+			}
+		}
+
+		bool stringValue(std::string& out) {
+			pos++; // opening quote
+			while (pos < text.size()) {
+				const char c = text[pos++];
+				if (c == '"') return true;
+				if (c != '\\') { out += c; continue; }
+
+				if (pos >= text.size()) break;
+				const char e = text[pos++];
+				switch (e) {
+				case 'n': out += '\n'; break;
+				case 't': out += '\t'; break;
+				case 'r': out += '\r'; break;
+				case 'b': out += '\b'; break;
+				case 'f': out += '\f'; break;
+				case 'u':
+					if (pos + 4 > text.size()) return fail("bad escape");
+					pos += 4;
+					out += '?';
+					break;
+				default: out += e; break; // \" \\ \/
+				}
+			}
+			return fail("unterminated string");
+		}
+	};
+};
+
+// The other direction, for reports: writes JSON to a string as it goes.
+// Values inside an object take a key, values inside an array don't.
+//
+//   JsonWriter json;
+//   json.beginObject();
+//   json.value("name", "box");
+//   json.beginArray("times");
+//   json.value(1.5);
+//   json.endArray();
+//   json.endObject();
+class JsonWriter {
+public:
+	void beginObject(const char* key = nullptr) { open(key, '{'); }
+	void endObject() { close('}'); }
+	void beginArray(const char* key = nullptr) { open(key, '['); }
+	void endArray() { close(']'); }
+
+	void value(const char* key, double v) {
+		prefix(key);
+		if (!std::isfinite(v)) { // JSON has no inf or nan
+			text += "null";
+			return;
+		}
+		char buffer[32];
+		std::snprintf(buffer, sizeof(buffer), "%.6g", v);
+		text += buffer;
+	}
+	void value(const char* key, int v) { value(key, (double)v); }
+	void value(const char* key, size_t v) { value(key, (double)v); }
+	void value(const char* key, bool v) { prefix(key); text += v ? "true" : "false"; }
+	void value(const char* key, const std::string& v) { prefix(key); quoted(v); }
+	void value(const char* key, const char* v) { value(key, std::string(v)); }
+
+	// Array elements
+	template <typename T>
+	void value(const T& v) { value(nullptr, v); }
+
+	const std::string& str() const { return text; }
+
+private:
+	std::string text;
+	std::vector<bool> hasItems; // per open object or array
+
+	void prefix(const char* key) {
+		if (!hasItems.empty()) {
+			if (hasItems.back()) text += ",";
+			hasItems.back() = true;
+			text += "\n" + std::string(hasItems.size() * 2, ' ');
+		}
+		if (key) {
+			quoted(key);
+			text += ": ";
+		}
+	}
+
+	void open(const char* key, char bracket) {
+		prefix(key);
+		text += bracket;
+		hasItems.push_back(false);
+	}
+
+	void close(char bracket) {
+		const bool items = hasItems.back();
+		hasItems.pop_back();
+		if (items) text += "\n" + std::string(hasItems.size() * 2, ' ');
+		text += bracket;
+		if (hasItems.empty()) text += "\n";
+	}
+
+	void quoted(const std::string& v) {
+		text += '"';
+		for (char c : v) {
+			switch (c) {
+			case '"': text += "\\\""; break;
+			case '\\': text += "\\\\"; break;
+			case '\n': text += "\\n"; break;
+			case '\t': text += "\\t"; break;
+			case '\r': text += "\\r"; break;
+			default:
+				if ((unsigned char)c < 0x20) continue; // other control characters are dropped
+				text += c;
+			}
+		}
+		text += '"';
+	}
+};
+
+#endif // !RT_JSON_H
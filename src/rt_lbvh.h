@@ -0,0 +1,172 @@
+#ifndef RT_LBVH_H
+#define RT_LBVH_H
+
+#include <glad2/gl.h>
+
+#include <iostream>
+
+#include "includes/shader.h"
+
+// Builds linear BVHs (LBVH) on the GPU, as an alternative to BVHBuilder for
+// geometry that changes too often for a CPU build and re-upload. Trees are
+// lower quality than SAH (one triangle per leaf, splits by Morton order
+// rather than cost) but are built entirely in compute shaders:
+//
+//   centroids -> Morton codes -> radix sort -> Karras hierarchy -> bounds
+//
+// Nodes, primitive indices and the leaf-ordered intersection stream are
+// written straight into the BVHNodes, PrimitiveIndices and IsectTriangles
+// buffers, read from Triangles and VertexPositions; these must be bound at
+// 3, 4, 16, 1 and 17.
+class LBVHBuilder {
+public:
+	LBVHBuilder()
+		: mortonKernel("src/shaders/lbvh_morton.comp"),
+		sortKernel("src/shaders/lbvh_radix_sort.comp"),
+		hierarchyKernel("src/shaders/lbvh_hierarchy.comp"),
+		boundsKernel("src/shaders/lbvh_bounds.comp") {
+		glGenBuffers(1, &scratchSSBO);
+		glGenBuffers(2, keySSBO);
+		glGenBuffers(2, valueSSBO);
+		glGenBuffers(1, &histogramSSBO);
+	}
+
+	~LBVHBuilder() {
+		glDeleteBuffers(1, &scratchSSBO);
+		glDeleteBuffers(2, keySSBO);
+		glDeleteBuffers(2, valueSSBO);
+		glDeleteBuffers(1, &histogramSSBO);
+	}
+
+	// Deepest tree a build over triCount triangles can produce, in levels. Every
+	// split down a path is at a longer common key prefix: up to 30 Morton bits,
+	// then the index bits that break ties between equal codes, then the leaf.
+	static int maxDepth(int triCount) {
+		int indexBits = 0;
+		while ((1 << indexBits) < triCount) indexBits++;
+		return MORTON_BITS + indexBits + 1;
+	}
+
+	// Builds a BVH over triangles [firstTri, firstTri + triCount). Writes
+	// 2 * triCount - 1 nodes from nodeOffset (root first) and triCount primitive
+	// indices and intersection triangles from primOffset.
+	void build(int firstTri, int triCount, int nodeOffset, int primOffset) {
+		if (triCount <= 0) return;
+
+		reserve(triCount);
+		const GLuint groups = (triCount + GROUP_SIZE - 1) / GROUP_SIZE;
+
+		// Reset the centroid bounds and the visit flags
+		GLuint initialBounds[8] = { 0xFFFFFFFFu, 0xFFFFFFFFu, 0xFFFFFFFFu, 0u, 0u, 0u, 0u, 0u };
+		GLuint zero = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, scratchSSBO);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(initialBounds), initialBounds);
+		glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI,
+			sizeof(initialBounds) + (2 * triCount - 1) * sizeof(GLint), (triCount - 1) * sizeof(GLint),
+			GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, scratchSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, histogramSSBO);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		for (shader* kernel : { &mortonKernel, &sortKernel, &hierarchyKernel, &boundsKernel }) {
+			kernel->use();
+			kernel->setInt("u_triCount", triCount);
+			kernel->setInt("u_firstTri", firstTri);
+			kernel->setInt("u_nodeOffset", nodeOffset);
+			kernel->setInt("u_primOffset", primOffset);
+		}
+
+		// Centroids and their bounds, then Morton codes
+		bindSortBuffers(0);
+		mortonKernel.use();
+		mortonKernel.setInt("u_stage", 0);
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		mortonKernel.setInt("u_stage", 1);
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		// Radix sort, 4 bits per pass. An even pass count leaves the result in buffer 0.
+		sortKernel.use();
+		sortKernel.setInt("u_numGroups", (int)groups);
+		for (int pass = 0; pass < SORT_PASSES; pass++) {
+			bindSortBuffers(pass & 1);
+			sortKernel.setInt("u_shift", pass * 4);
+
+			sortKernel.setInt("u_stage", 0);
+			glDispatchCompute(groups, 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+			sortKernel.setInt("u_stage", 1);
+			glDispatchCompute(1, 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+			sortKernel.setInt("u_stage", 2);
+			glDispatchCompute(groups, 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		}
+
+		// Hierarchy, then bounds from the leaves up
+		bindSortBuffers(0);
+		hierarchyKernel.use();
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		boundsKernel.use();
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	}
+
+private:
+	static constexpr int GROUP_SIZE = 256;   // LBVH_GROUP_SIZE in lbvh_common.glsl
+	static constexpr int MORTON_BITS = 30;   // morton3D in lbvh_morton.comp
+	static constexpr int SORT_PASSES = 8;    // 4-bit digits over 30-bit Morton codes
+	static constexpr int RADIX_BUCKETS = 16;
+
+	// Grows the scratch buffers to fit triCount triangles. They never shrink.
+	void reserve(int triCount) {
+		if (triCount <= capacity) return;
+		capacity = triCount;
+
+		const GLsizeiptr keys = capacity * sizeof(GLuint);
+		const GLsizeiptr groups = (capacity + GROUP_SIZE - 1) / GROUP_SIZE;
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, scratchSSBO);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, 8 * sizeof(GLuint) + 3 * keys, nullptr, GL_DYNAMIC_COPY);
+		for (int i = 0; i < 2; i++) {
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, keySSBO[i]);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, keys, nullptr, GL_DYNAMIC_COPY);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, valueSSBO[i]);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, keys, nullptr, GL_DYNAMIC_COPY);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, histogramSSBO);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, RADIX_BUCKETS * groups * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+#ifdef RT_DEBUG
+		std::cout << "LBVH scratch sized for " << capacity << " triangles" << std::endl;
+#endif
+	}
+
+	// Sort input at bindings 11/12, output at 13/14
+	void bindSortBuffers(int input) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, keySSBO[input]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, valueSSBO[input]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, keySSBO[1 - input]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, valueSSBO[1 - input]);
+	}
+
+	int capacity = 0;
+	GLuint scratchSSBO = 0;
+	GLuint keySSBO[2] = { 0, 0 };
+	GLuint valueSSBO[2] = { 0, 0 };
+	GLuint histogramSSBO = 0;
+
+	shader mortonKernel;
+	shader sortKernel;
+	shader hierarchyKernel;
+	shader boundsKernel;
+};
+
+#endif // !RT_LBVH_H
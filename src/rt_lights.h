@@ -0,0 +1,209 @@
+#ifndef RT_LIGHTS_H
+#define RT_LIGHTS_H
+
+#include "rt_structs.h"
+#include "rt_accel.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+// Kinds of light in the light list. Must match LIGHT_* in rt_lights.glsl.
+enum LightType {
+	LightSphere,
+	LightTriangle
+};
+
+// One emissive primitive in world space. Must match Light in rt_lights.glsl.
+struct GPULight {
+	glm::vec4 p0;        // sphere: center, w radius. triangle: v0
+	glm::vec4 e1;        // triangle: v1 - v0
+	glm::vec4 e2;        // triangle: v2 - v0
+	glm::vec4 emission;  // rgb: emitted radiance. w unused
+	int type;            // LightType
+	float cdf;           // running sum of power up to and including this light, normalized
+	int pad0, pad1;
+	// Total: 80 bytes
+};
+static_assert(sizeof(GPULight) == 80, "GPULight must be 80 bytes");
+
+// Leads the lights SSBO, ahead of the GPULight array.
+struct GPULightHeader {
+	float totalPower;    // sum of luminance(emission) * area over every light
+	int lightCount;
+	int pad0, pad1;
+};
+static_assert(sizeof(GPULightHeader) == 16, "GPULightHeader must be 16 bytes");
+
+// The scene's emissive spheres and triangles, flattened to world space for
+// explicit light sampling. Lights are picked in proportion to their power.
+// Triangles are sampled uniformly by area, so the area-measure pdf of any
+// point on one is just luminance(emission) / totalPower; spheres are sampled
+// over the cone they subtend (sampleLight in rt_lights.glsl).
+//
+// build() finds the emitters, which a material edit or a new mesh needs.
+// Moving instances only re-places their own lights with move().
+class LightList {
+public:
+	void build(const std::vector<MeshInstance>& instances, const TwoLevelBVH& accel,
+		const IndexedGeometry& geometry, const std::vector<Material>& materials)
+	{
+		lights.clear();
+		sources.clear();
+		power.clear();
+		instanceLights.assign(instances.size(), LightRange());
+
+		for (size_t i = 0; i < instances.size(); i++) {
+			const MeshInstance& inst = instances[i];
+			if (inst.meshID < 0) continue;
+			instanceLights[i].visible = isVisible(inst);
+			if (!instanceLights[i].visible) continue;
+			instanceLights[i].first = (int)lights.size();
+
+			const TwoLevelBVH::BLAS& blas = accel.getMeshes()[inst.meshID];
+			if (blas.primType == InstanceSpheres) {
+				const std::vector<Sphere>& spheres = accel.getSpheres();
+				for (int s = 0; s < (int)spheres.size(); s++) {
+					const int materialID = inst.materialID >= 0 ? inst.materialID : spheres[s].materialID;
+					if (!isEmissive(materials, materialID)) continue;
+					addLight(materials[materialID], (int)i, s);
+				}
+			}
+			else {
+				for (int t = blas.firstTri; t < blas.firstTri + blas.triCount; t++) {
+					const int materialID = inst.materialID >= 0 ? inst.materialID : geometry.triangles[t].materialID;
+					if (!isEmissive(materials, materialID)) continue;
+					addLight(materials[materialID], (int)i, t);
+				}
+			}
+			instanceLights[i].count = (int)lights.size() - instanceLights[i].first;
+		}
+
+		for (size_t l = 0; l < lights.size(); l++) place(l, instances, accel, geometry);
+		normalize();
+
+#ifdef RT_DEBUG
+		std::cout << "Lights: " << lights.size() << ", total power " << header.totalPower << std::endl;
+#endif
+	}
+
+	// Re-places the lights of the moved instances, and the CDF over all of
+	// them. Returns false without changes when an instance was shown or
+	// hidden since build(), which needs a build.
+	bool move(const std::vector<int>& moved, const std::vector<MeshInstance>& instances,
+		const TwoLevelBVH& accel, const IndexedGeometry& geometry)
+	{
+		if (instanceLights.size() != instances.size()) return false;
+		for (int i : moved) {
+			if (instances[i].meshID >= 0 && isVisible(instances[i]) != instanceLights[i].visible) return false;
+		}
+
+		for (int i : moved) {
+			const LightRange& range = instanceLights[i];
+			for (int l = range.first; l < range.first + range.count; l++) place(l, instances, accel, geometry);
+		}
+		normalize();
+		return true;
+	}
+
+	const GPULightHeader& getHeader() const { return header; }
+	const std::vector<GPULight>& getLights() const { return lights; }
+
+private:
+	// An instance's lights, contiguous in the list
+	struct LightRange {
+		int first = 0;
+		int count = 0;
+		bool visible = false;
+	};
+
+	// Where a light comes from: its instance, and the sphere or triangle in it
+	struct LightSource {
+		int instance;
+		int primitive;
+	};
+
+	static bool isVisible(const MeshInstance& inst) {
+		return glm::determinant(inst.model) != 0.0f; // hidden, as in buildTLAS
+	}
+
+	static bool isEmissive(const std::vector<Material>& materials, int materialID) {
+		return materialID >= 0 && materialID < (int)materials.size()
+			&& materials[materialID].type == Emissive;
+	}
+
+	static glm::vec4 emission(const Material& mat) {
+		return glm::vec4(mat.albedo_x, mat.albedo_y, mat.albedo_z, 0.0f) * mat.emissionStrength;
+	}
+
+	static float luminance(const glm::vec4& c) {
+		return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+	}
+
+	// Appends a light with material's emission, placed later. Materials that
+	// can't emit add none.
+	void addLight(const Material& material, int instance, int primitive) {
+		GPULight light = {};
+		light.emission = emission(material);
+		if (!(luminance(light.emission) > 0.0f)) return;
+
+		lights.push_back(light);
+		sources.push_back({ instance, primitive });
+		power.push_back(0.0);
+	}
+
+	// Moves light l to its instance's transform, and updates its power.
+	void place(size_t l, const std::vector<MeshInstance>& instances, const TwoLevelBVH& accel,
+		const IndexedGeometry& geometry)
+	{
+		GPULight& light = lights[l];
+		const MeshInstance& inst = instances[sources[l].instance];
+		float area;
+
+		if (accel.getMeshes()[inst.meshID].primType == InstanceSpheres) {
+			const Sphere& sp = accel.getSpheres()[sources[l].primitive];
+			const float scale = glm::length(glm::vec3(inst.model[0]));
+			light.type = LightSphere;
+			light.p0 = glm::vec4(glm::vec3(inst.model * glm::vec4(sp.center_x, sp.center_y, sp.center_z, 1.0f)), sp.radius * scale);
+			area = 4.0f * 3.14159265f * light.p0.w * light.p0.w;
+		}
+		else {
+			const IndexedTriangle& tri = geometry.triangles[sources[l].primitive];
+			const glm::vec3 v0 = glm::vec3(inst.model * glm::vec4(geometry.position(tri.v0), 1.0f));
+			const glm::vec3 v1 = glm::vec3(inst.model * glm::vec4(geometry.position(tri.v1), 1.0f));
+			const glm::vec3 v2 = glm::vec3(inst.model * glm::vec4(geometry.position(tri.v2), 1.0f));
+			light.type = LightTriangle;
+			light.p0 = glm::vec4(v0, 0.0f);
+			light.e1 = glm::vec4(v1 - v0, 0.0f);
+			light.e2 = glm::vec4(v2 - v0, 0.0f);
+			area = 0.5f * glm::length(glm::cross(v1 - v0, v2 - v0));
+		}
+		power[l] = (double)luminance(light.emission) * area;
+	}
+
+	// The CDF over every light's power, and the header. Degenerate lights
+	// keep an empty bucket, so they are never picked.
+	void normalize() {
+		double total = 0.0;
+		for (size_t l = 0; l < lights.size(); l++) {
+			if (power[l] > 0.0) total += power[l];
+			lights[l].cdf = (float)total;
+		}
+
+		header = GPULightHeader{};
+		if (total > 0.0) {
+			for (GPULight& light : lights) light.cdf = (float)(light.cdf / total);
+			lights.back().cdf = 1.0f;
+			header.totalPower = (float)total;
+			header.lightCount = (int)lights.size();
+		}
+	}
+
+	std::vector<GPULight> lights;
+	std::vector<LightSource> sources; // parallel to lights
+	std::vector<double> power;        // parallel to lights
+	std::vector<LightRange> instanceLights;
+	GPULightHeader header = {};
+};
+
+#endif // !RT_LIGHTS_H
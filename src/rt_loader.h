@@ -0,0 +1,144 @@
+#ifndef RT_LOADER_H
+#define RT_LOADER_H
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "rt_threadpool.h"
+#include "rt_meshcache.h"
+#include "rt_skycache.h"
+
+// Loads a scene's assets in the background while the window already renders.
+//
+// Every mesh is imported (or read from its cache) and gets its BVH built as a
+// task on a worker pool, each with its own Assimp importer, and the HDR sky is
+// decoded (or read from its cache) the same way. Finished assets wait in a staging queue until the GL
+// thread takes them, one at a time, to append to the scene and stream to the
+// GPU; nothing here touches GL or the shared scene arrays.
+class AssetLoader {
+public:
+	// workerCount 0 leaves one hardware thread to the GL thread.
+	explicit AssetLoader(int workerCount = 0)
+		: hardwareThreads(std::max(1, (int)std::thread::hardware_concurrency())),
+		pool(workerCount > 0 ? workerCount : std::max(1, hardwareThreads - 1)) {}
+
+	// Queued work that hasn't started is dropped; running tasks finish first.
+	~AssetLoader() {
+		cancelled = true;
+		pool.wait(group);
+	}
+
+	AssetLoader(const AssetLoader&) = delete;
+	AssetLoader& operator=(const AssetLoader&) = delete;
+
+	// Queues a mesh and returns its request. A file is only loaded once, and
+	// every instance of it shares the request and the mesh, whatever material
+	// the instance gives it.
+	int requestMesh(const std::string& path) {
+		auto found = requests.find(path);
+		if (found != requests.end()) return found->second;
+
+		const int request = (int)requests.size();
+		requests[path] = request;
+		meshJobs++;
+		pool.run(group, [this, path, request] {
+			std::unique_ptr<StagedMesh> mesh(new StagedMesh());
+			if (!cancelled) {
+				// Meshes build in parallel with each other, so each build only
+				// gets its share of the threads
+				BVHBuildOptions options;
+				options.threads = std::max(1, hardwareThreads / std::max(1, meshJobs.load()));
+				try {
+					MeshCache::load(path, *mesh, options);
+				}
+				catch (const std::exception& e) {
+					std::cout << "Failed to load mesh " << path << ": " << e.what() << std::endl;
+					*mesh = StagedMesh();
+				}
+			}
+
+			// Counted as loading until it's in the queue, so loadingMeshes() never misses it
+			std::lock_guard<std::mutex> lock(mutex);
+			readyMeshes.emplace_back(request, std::move(mesh));
+			meshJobs--;
+		});
+		return request;
+	}
+
+	// Queues the equirectangular HDR sky, for a cubemap of cubemapSize. It comes
+	// from its cache (SkyCache) unless that is invalid or useCache is false.
+	void requestSky(const std::string& path, int cubemapSize, bool useCache = true) {
+		skyPending = true;
+		pool.run(group, [this, path, cubemapSize, useCache] {
+			std::unique_ptr<StagedSky> sky(new StagedSky());
+			if (!cancelled) SkyCache::stage(path, cubemapSize, *sky, useCache);
+
+			std::lock_guard<std::mutex> lock(mutex);
+			readySky = std::move(sky);
+		});
+	}
+
+	// Takes the oldest finished mesh, if there is one. A mesh that failed to
+	// load comes back empty.
+	bool takeMesh(int& request, std::unique_ptr<StagedMesh>& mesh) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (readyMeshes.empty()) return false;
+		request = readyMeshes.front().first;
+		mesh = std::move(readyMeshes.front().second);
+		readyMeshes.pop_front();
+		return true;
+	}
+
+	// Takes the staged sky once it's done. Neither cached nor with image data
+	// if it failed to load.
+	bool takeSky(std::unique_ptr<StagedSky>& sky) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!readySky) return false;
+		sky = std::move(readySky);
+		skyPending = false;
+		return true;
+	}
+
+	// Whether anything is still loading or waiting to be taken.
+	bool busy() {
+		if (group.pending > 0) return true;
+		std::lock_guard<std::mutex> lock(mutex);
+		return !readyMeshes.empty() || readySky || skyPending;
+	}
+
+	// Whether any mesh is still loading or waiting to be taken.
+	bool loadingMeshes() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return meshJobs > 0 || !readyMeshes.empty();
+	}
+
+	// Blocks until every queued asset has loaded, helping with the work.
+	void waitAll() {
+		pool.wait(group);
+	}
+
+	int meshesLoading() const { return meshJobs; }
+
+private:
+	const int hardwareThreads;
+	ThreadPool pool;
+	ThreadPool::TaskGroup group;
+	std::atomic<bool> cancelled{ false };
+	std::atomic<int> meshJobs{ 0 };
+
+	std::map<std::string, int> requests; // path -> request, GL thread only
+
+	std::mutex mutex; // guards the staging queue below
+	std::deque<std::pair<int, std::unique_ptr<StagedMesh>>> readyMeshes;
+	std::unique_ptr<StagedSky> readySky;
+	bool skyPending = false; // GL thread only
+};
+
+#endif // !RT_LOADER_H
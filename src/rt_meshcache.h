@@ -0,0 +1,376 @@
+#ifndef RT_MESHCACHE_H
+#define RT_MESHCACHE_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "rt_structs.h"
+#include "rt_mesh.h"
+#include "rt_bvh.h"
+#include "rt_accel.h"
+
+// Read-only memory mapping of a whole file. Empty files and failures leave
+// data() null.
+class MappedFile {
+public:
+	explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return;
+
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) return;
+
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!mapping) return;
+
+		void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!view) return;
+		bytes = static_cast<const uint8_t*>(view);
+		length = (size_t)fileSize.QuadPart;
+#else
+		fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) return;
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size == 0) return;
+
+		void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (view == MAP_FAILED) return;
+		bytes = static_cast<const uint8_t*>(view);
+		length = (size_t)st.st_size;
+#endif
+	}
+
+	~MappedFile() {
+#ifdef _WIN32
+		if (bytes) UnmapViewOfFile(bytes);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+		if (bytes) munmap(const_cast<uint8_t*>(bytes), length);
+		if (fd >= 0) close(fd);
+#endif
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const uint8_t* data() const { return bytes; }
+	size_t size() const { return length; }
+
+private:
+	const uint8_t* bytes = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
+
+// FNV-1a of a mapped file's bytes, never 0, which the caches keep for "unreadable".
+inline uint64_t hashFileBytes(const MappedFile& file) {
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < file.size(); i++) {
+		hash = (hash ^ file.data()[i]) * 1099511628211ull;
+	}
+	return hash ? hash : 1;
+}
+
+// One mesh, imported and with its bottom-level BVH built, but not yet part
+// of the scene. Vertex indices and primitive indices are local to the mesh.
+// Holds no GL state and touches nothing shared, so meshes can be staged on
+// worker threads and added to the scene on the GL thread afterwards.
+struct StagedMesh {
+	IndexedGeometry geometry;
+	std::vector<BVHNode> nodes;
+	std::vector<WideBVHNode> wideNodes;
+	std::vector<int> primitiveIndices;
+
+	size_t triangleCount() const { return geometry.triangles.size(); }
+
+	TwoLevelBVH::BLASLayout layout() const {
+		TwoLevelBVH::BLASLayout layout;
+		layout.nodes = nodes.data();
+		layout.nodeCount = nodes.size();
+		layout.wideNodes = wideNodes.data();
+		layout.wideCount = wideNodes.size();
+		layout.primitiveIndices = primitiveIndices.data();
+		layout.primCount = primitiveIndices.size();
+		return layout;
+	}
+
+	// Appends the mesh to the scene geometry and adds its BLAS to accel.
+	// Returns the mesh ID and sets the mesh's triangle range.
+	int addTo(IndexedGeometry& scene, TwoLevelBVH& accel, size_t& firstTri, size_t& triCount) const {
+		firstTri = scene.triangles.size();
+		triCount = geometry.triangles.size();
+
+		const uint32_t baseVertex = (uint32_t)scene.positions.size();
+		scene.positions.insert(scene.positions.end(), geometry.positions.begin(), geometry.positions.end());
+		scene.normals.insert(scene.normals.end(), geometry.normals.begin(), geometry.normals.end());
+		scene.shading.insert(scene.shading.end(), geometry.shading.begin(), geometry.shading.end());
+		scene.triangles.reserve(firstTri + triCount);
+		for (IndexedTriangle tri : geometry.triangles) {
+			tri.v0 += baseVertex;
+			tri.v1 += baseVertex;
+			tri.v2 += baseVertex;
+			scene.triangles.push_back(tri);
+		}
+		return accel.addMesh(scene, firstTri, triCount, layout());
+	}
+};
+
+// Per-mesh binary cache, written next to the source file as <path>.rtmesh.
+//
+// Holds the imported vertices and triangles and the mesh's bottom-level BVH
+// in exactly the layout TwoLevelBVH consumes, so a hit maps the file and
+// copies the arrays out without running Assimp or BVHBuilder. A cache is only
+// used when its key matches: the format version, a hash of the source file,
+// the import flags, the BVH build options and the struct layouts. Anything
+// else is a miss, and the mesh is imported, built and the cache rewritten.
+class MeshCache {
+public:
+	// Loads a mesh, from its cache when that is valid. Only reads the source
+	// and cache files and writes the cache, so any number of meshes can load
+	// at once on different threads (as long as they are different files).
+	// options.threads bounds the BVH build's own threads. The triangles keep
+	// material 0; the instances placing the mesh give it theirs.
+	static void load(const std::string& path, StagedMesh& mesh,
+		const BVHBuildOptions& options = BVHBuildOptions()) {
+#ifdef RT_DEBUG
+		auto loadStart = std::chrono::high_resolution_clock::now();
+#endif
+		mesh = StagedMesh();
+
+		Header key = makeKey(path, options);
+		const std::string cachePath = path + ".rtmesh";
+
+		if (key.sourceHash != 0 && loadCache(cachePath, key, mesh)) {
+#ifdef RT_DEBUG
+			std::chrono::duration<double, std::milli> loadTime = std::chrono::high_resolution_clock::now() - loadStart;
+			std::cout << "Mesh cache hit: " << cachePath << " (" << mesh.triangleCount() << " triangles) in "
+				<< loadTime.count() << " ms" << std::endl;
+#endif
+			return;
+		}
+
+		// Miss: import, build and write the cache for next time
+		{
+			rt_Mesh imported(path);
+			imported.appendTo(mesh.geometry);
+		}
+
+		BVHBuilder builder;
+		builder.build(mesh.geometry, 0, mesh.triangleCount(), options);
+		mesh.wideNodes = builder.collapseToWide<BVH_WIDTH>();
+		mesh.nodes = builder.getNodes();
+		mesh.primitiveIndices = builder.getPrimitiveIndices();
+
+		if (key.sourceHash != 0) {
+			writeCache(cachePath, key, mesh);
+		}
+#ifdef RT_DEBUG
+		std::chrono::duration<double, std::milli> loadTime = std::chrono::high_resolution_clock::now() - loadStart;
+		std::cout << "Mesh cache miss: " << path << " imported and built in " << loadTime.count() << " ms" << std::endl;
+#endif
+	}
+
+private:
+	static const uint32_t MAGIC = 0x48534D52; // "RMSH"
+	static const uint32_t VERSION = 2; // 2: shading attributes
+
+	// File layout: Header, then each array at its offset, 16-byte aligned.
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceHash;        // FNV-1a of the source file's bytes
+		uint32_t importFlags;
+		uint32_t bvhWidth;
+		uint32_t buckets;
+		uint32_t maxLeafSize;
+		uint32_t layoutSizes[5];    // sizeof IndexedTriangle, BVHNode, WideBVHNode, glm::vec4, VertexShading
+
+		uint64_t vertexCount;       // positions, normals and shading attributes
+		uint64_t triangleCount;
+		uint64_t nodeCount;
+		uint64_t wideCount;
+		uint64_t primCount;
+
+		uint64_t positionsOffset;
+		uint64_t normalsOffset;
+		uint64_t shadingOffset;
+		uint64_t trianglesOffset;
+		uint64_t nodesOffset;
+		uint64_t wideOffset;
+		uint64_t primsOffset;
+		uint64_t fileSize;
+	};
+
+	static uint64_t align16(uint64_t offset) { return (offset + 15) & ~uint64_t(15); }
+
+	// Everything a cache has to match to be used. sourceHash is 0 if the source can't be read.
+	static Header makeKey(const std::string& path, const BVHBuildOptions& options) {
+		Header key = {};
+		key.magic = MAGIC;
+		key.version = VERSION;
+		key.importFlags = rt_Mesh::IMPORT_FLAGS;
+		key.bvhWidth = BVH_WIDTH;
+
+		key.buckets = (uint32_t)options.buckets;
+		key.maxLeafSize = (uint32_t)options.maxLeafSize;
+		key.layoutSizes[0] = sizeof(IndexedTriangle);
+		key.layoutSizes[1] = sizeof(BVHNode);
+		key.layoutSizes[2] = sizeof(WideBVHNode);
+		key.layoutSizes[3] = sizeof(glm::vec4);
+		key.layoutSizes[4] = sizeof(VertexShading);
+
+		MappedFile source(path);
+		if (!source.data()) return key;
+
+		key.sourceHash = hashFileBytes(source);
+		return key;
+	}
+
+	static bool keyMatches(const Header& h, const Header& key) {
+		return h.magic == key.magic && h.version == key.version &&
+			h.sourceHash == key.sourceHash && h.importFlags == key.importFlags &&
+			h.bvhWidth == key.bvhWidth && h.buckets == key.buckets &&
+			h.maxLeafSize == key.maxLeafSize &&
+			std::memcmp(h.layoutSizes, key.layoutSizes, sizeof(h.layoutSizes)) == 0;
+	}
+
+	// A section must lie inside the file, so a truncated write is just a miss.
+	static bool sectionFits(uint64_t offset, uint64_t count, uint64_t stride, uint64_t fileSize) {
+		return offset % 16 == 0 && offset <= fileSize && count <= (fileSize - offset) / stride;
+	}
+
+	static bool loadCache(const std::string& cachePath, const Header& key, StagedMesh& mesh) {
+		MappedFile file(cachePath);
+		if (!file.data() || file.size() < sizeof(Header)) return false;
+
+		Header h;
+		std::memcpy(&h, file.data(), sizeof(Header));
+		if (!keyMatches(h, key) || h.fileSize != file.size()) return false;
+		if (!sectionFits(h.positionsOffset, h.vertexCount, sizeof(glm::vec4), h.fileSize) ||
+			!sectionFits(h.normalsOffset, h.vertexCount, sizeof(glm::vec4), h.fileSize) ||
+			!sectionFits(h.shadingOffset, h.vertexCount, sizeof(VertexShading), h.fileSize) ||
+			!sectionFits(h.trianglesOffset, h.triangleCount, sizeof(IndexedTriangle), h.fileSize) ||
+			!sectionFits(h.nodesOffset, h.nodeCount, sizeof(BVHNode), h.fileSize) ||
+			!sectionFits(h.wideOffset, h.wideCount, sizeof(WideBVHNode), h.fileSize) ||
+			!sectionFits(h.primsOffset, h.primCount, sizeof(int), h.fileSize) ||
+			h.primCount != h.triangleCount) {
+			return false;
+		}
+
+		const glm::vec4* positions = reinterpret_cast<const glm::vec4*>(file.data() + h.positionsOffset);
+		const glm::vec4* normals = reinterpret_cast<const glm::vec4*>(file.data() + h.normalsOffset);
+		const VertexShading* shading = reinterpret_cast<const VertexShading*>(file.data() + h.shadingOffset);
+		const IndexedTriangle* triangles = reinterpret_cast<const IndexedTriangle*>(file.data() + h.trianglesOffset);
+
+		for (uint64_t i = 0; i < h.triangleCount; i++) {
+			if (triangles[i].v0 >= h.vertexCount || triangles[i].v1 >= h.vertexCount || triangles[i].v2 >= h.vertexCount) {
+				return false;
+			}
+		}
+
+		// Everything is already local to the mesh, as StagedMesh keeps it
+		mesh.geometry.positions.assign(positions, positions + h.vertexCount);
+		mesh.geometry.normals.assign(normals, normals + h.vertexCount);
+		mesh.geometry.shading.assign(shading, shading + h.vertexCount);
+		mesh.geometry.triangles.assign(triangles, triangles + h.triangleCount);
+
+		const BVHNode* nodes = reinterpret_cast<const BVHNode*>(file.data() + h.nodesOffset);
+		const WideBVHNode* wideNodes = reinterpret_cast<const WideBVHNode*>(file.data() + h.wideOffset);
+		const int* prims = reinterpret_cast<const int*>(file.data() + h.primsOffset);
+		mesh.nodes.assign(nodes, nodes + h.nodeCount);
+		mesh.wideNodes.assign(wideNodes, wideNodes + h.wideCount);
+		mesh.primitiveIndices.assign(prims, prims + h.primCount);
+		return true;
+	}
+
+	static void writeCache(const std::string& cachePath, Header h, const StagedMesh& mesh) {
+		const IndexedGeometry& geometry = mesh.geometry;
+		h.vertexCount = geometry.positions.size();
+		h.triangleCount = geometry.triangles.size();
+		h.nodeCount = mesh.nodes.size();
+		h.wideCount = mesh.wideNodes.size();
+		h.primCount = mesh.primitiveIndices.size();
+
+		h.positionsOffset = align16(sizeof(Header));
+		h.normalsOffset = align16(h.positionsOffset + h.vertexCount * sizeof(glm::vec4));
+		h.shadingOffset = align16(h.normalsOffset + h.vertexCount * sizeof(glm::vec4));
+		h.trianglesOffset = align16(h.shadingOffset + h.vertexCount * sizeof(VertexShading));
+		h.nodesOffset = align16(h.trianglesOffset + h.triangleCount * sizeof(IndexedTriangle));
+		h.wideOffset = align16(h.nodesOffset + h.nodeCount * sizeof(BVHNode));
+		h.primsOffset = align16(h.wideOffset + h.wideCount * sizeof(WideBVHNode));
+		h.fileSize = h.primsOffset + h.primCount * sizeof(int);
+
+		// Written to a temporary file first so a failed write never leaves a
+		// cache that looks valid
+		const std::string tempPath = cachePath + ".tmp";
+		{
+			std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+			if (!out) {
+				std::cout << "Failed to write mesh cache: " << cachePath << std::endl;
+				return;
+			}
+
+			uint64_t written = 0;
+			auto writeAt = [&](uint64_t offset, const void* data, uint64_t size) {
+				static const char zeros[16] = {};
+				out.write(zeros, (std::streamsize)(offset - written));
+				if (size > 0) out.write(static_cast<const char*>(data), (std::streamsize)size);
+				written = offset + size;
+			};
+
+			writeAt(0, &h, sizeof(Header));
+			writeAt(h.positionsOffset, geometry.positions.data(), h.vertexCount * sizeof(glm::vec4));
+			writeAt(h.normalsOffset, geometry.normals.data(), h.vertexCount * sizeof(glm::vec4));
+			writeAt(h.shadingOffset, geometry.shading.data(), h.vertexCount * sizeof(VertexShading));
+			writeAt(h.trianglesOffset, geometry.triangles.data(), h.triangleCount * sizeof(IndexedTriangle));
+			writeAt(h.nodesOffset, mesh.nodes.data(), h.nodeCount * sizeof(BVHNode));
+			writeAt(h.wideOffset, mesh.wideNodes.data(), h.wideCount * sizeof(WideBVHNode));
+			writeAt(h.primsOffset, mesh.primitiveIndices.data(), h.primCount * sizeof(int));
+
+			if (!out) {
+				std::cout << "Failed to write mesh cache: " << cachePath << std::endl;
+				out.close();
+				std::remove(tempPath.c_str());
+				return;
+			}
+		}
+
+		std::remove(cachePath.c_str()); // rename won't replace an existing file on Windows
+		if (std::rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+			std::cout << "Failed to write mesh cache: " << cachePath << std::endl;
+			std::remove(tempPath.c_str());
+		}
+	}
+};
+
+#endif // !RT_MESHCACHE_H
@@ -0,0 +1,63 @@
+#ifndef RT_PERMUTATION_H
+#define RT_PERMUTATION_H
+
+#include <string>
+#include <vector>
+
+#include "rt_structs.h"
+
+// What the ray tracing shaders are specialized for, as #defines for
+// shader::globalDefines(). A feature the scene doesn't use is compiled out
+// rather than branched around, which frees registers in the megakernel:
+//
+//   RT_SKYBOX:        the HDR sky, or the gradient when there is none
+//   RT_BVH_MODE:      brute force without a TLAS, else binary or wide BLAS traversal
+//   RT_MATERIAL_MASK: one bit per MaterialType any material has; scatter()
+//                     only keeps those lobes
+//   MAX_BOUNCES:      the bounce loop's bound, maxBounces rounded up to a
+//                     power of two (capped at 50) so dragging the slider only
+//                     recompiles a few times; u_maxBounces still sets the
+//                     exact count
+//
+// Each define replaces a uniform or a runtime test that the shaders fall back
+// to when it is missing (rt_common.glsl), so they still build without it,
+// e.g. for the benchmark. The caller rebuilds the programs when defines()
+// changes.
+struct ShaderPermutation {
+	// Must match BVH_MODE_* in rt_common.glsl.
+	enum BVHMode {
+		BVHBruteForce,
+		BVHBinary,
+		BVHWide
+	};
+
+	// Mirrors the default MAX_BOUNCES in rt_common.glsl.
+	static const int MAX_BOUNCES = 50;
+
+	bool skybox = true;
+	int bvhMode = BVHWide;
+	unsigned int materialMask = 0xF;
+	int maxBounces = MAX_BOUNCES;
+
+	// The MaterialType bits the materials use.
+	static unsigned int materialTypes(const std::vector<Material>& materials) {
+		unsigned int mask = 0;
+		for (const Material& mat : materials) {
+			if (mat.type >= Lambertian && mat.type <= Emissive) mask |= 1u << mat.type;
+		}
+		return mask;
+	}
+
+	std::string defines() const {
+		int bound = 1;
+		while (bound < maxBounces && bound < MAX_BOUNCES) bound *= 2;
+		if (bound > MAX_BOUNCES) bound = MAX_BOUNCES;
+
+		return "#define RT_SKYBOX " + std::to_string(skybox ? 1 : 0) + "\n"
+			+ "#define RT_BVH_MODE " + std::to_string(bvhMode) + "\n"
+			+ "#define RT_MATERIAL_MASK " + std::to_string(materialMask) + "\n"
+			+ "#define MAX_BOUNCES " + std::to_string(bound) + "\n";
+	}
+};
+
+#endif // !RT_PERMUTATION_H
@@ -0,0 +1,255 @@
+#ifndef RT_PROFILER_H
+#define RT_PROFILER_H
+
+#include <glad2/gl.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "imgui.h"
+
+// GPU timings for the passes of a frame, from GL_TIMESTAMP queries.
+//
+// Every pass brackets its commands with begin()/end(). Queries are kept for
+// FRAME_LATENCY frames, and a frame's results are only read once the GPU has
+// made them available, several frames later, so the profiler never waits on
+// the GPU; a frame whose results are not ready yet is just left out.
+// Each pass keeps a rolling history for its average and percentiles, and the
+// whole frame (first begin to last end) feeds the frame-time graph.
+class GPUProfiler {
+public:
+	static constexpr int FRAME_LATENCY = 3;
+	static constexpr int HISTORY = 240;
+
+	GPUProfiler() {
+		frameHistory.assign(HISTORY, 0.0f);
+		cpuHistory.assign(HISTORY, 0.0f);
+	}
+
+	~GPUProfiler() {
+		for (Pass& pass : passes) glDeleteQueries(2 * FRAME_LATENCY, pass.queries);
+	}
+
+	GPUProfiler(const GPUProfiler&) = delete;
+	GPUProfiler& operator=(const GPUProfiler&) = delete;
+
+	bool enabled = true;
+
+	// Collects the oldest frame still in flight, then starts a new one.
+	// cpuFrameMs is the frame's wall-clock time, for the graph.
+	void beginFrame(float cpuFrameMs) {
+		cpuHistory[historyIndex] = cpuFrameMs;
+		frameSlot = (frameSlot + 1) % FRAME_LATENCY;
+		collect(frameSlot);
+		historyIndex = (historyIndex + 1) % HISTORY;
+	}
+
+	void begin(const char* name) {
+		if (!enabled) return;
+		Pass& pass = findPass(name);
+		glQueryCounter(pass.queries[frameSlot * 2], GL_TIMESTAMP);
+		current = &pass;
+	}
+
+	void end() {
+		if (!current) return;
+		glQueryCounter(current->queries[frameSlot * 2 + 1], GL_TIMESTAMP);
+		current->issued[frameSlot] = true;
+		current = nullptr;
+	}
+
+	// Average GPU milliseconds of a pass over the history, 0 if unknown.
+	float average(const char* name) const {
+		for (const Pass& pass : passes) {
+			if (pass.name == name) return mean(pass.history);
+		}
+		return 0.0f;
+	}
+
+	void drawImGui() {
+		ImGui::Checkbox("GPU Timers", &enabled);
+
+		ImGui::PlotLines("##frame", frameHistory.data(), HISTORY, historyIndex, "GPU frame (ms)",
+			0.0f, std::max(1.0f, percentile(frameHistory, 0.99f) * 1.25f), ImVec2(0, 60));
+		ImGui::PlotLines("##cpu", cpuHistory.data(), HISTORY, historyIndex, "CPU frame (ms)",
+			0.0f, std::max(1.0f, percentile(cpuHistory, 0.99f) * 1.25f), ImVec2(0, 60));
+
+		if (ImGui::BeginTable("passes", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+			ImGui::TableSetupColumn("Pass");
+			ImGui::TableSetupColumn("avg ms");
+			ImGui::TableSetupColumn("p50");
+			ImGui::TableSetupColumn("p95");
+			ImGui::TableHeadersRow();
+			for (const Pass& pass : passes) {
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn(); ImGui::TextUnformatted(pass.name.c_str());
+				ImGui::TableNextColumn(); ImGui::Text("%.2f", mean(pass.history));
+				ImGui::TableNextColumn(); ImGui::Text("%.2f", percentile(pass.history, 0.5f));
+				ImGui::TableNextColumn(); ImGui::Text("%.2f", percentile(pass.history, 0.95f));
+			}
+			ImGui::EndTable();
+		}
+	}
+
+private:
+	struct Pass {
+		std::string name;
+		GLuint queries[2 * FRAME_LATENCY];  // start / end timestamp per frame slot
+		bool issued[FRAME_LATENCY] = {};
+		std::vector<float> history; // the last HISTORY results, oldest overwritten first
+		size_t next = 0;
+
+		void record(float ms) {
+			if (history.size() < HISTORY) history.push_back(ms);
+			else history[next] = ms;
+			next = (next + 1) % HISTORY;
+		}
+	};
+
+	Pass& findPass(const char* name) {
+		for (Pass& pass : passes) {
+			if (pass.name == name) return pass;
+		}
+		passes.emplace_back();
+		Pass& pass = passes.back();
+		pass.name = name;
+		pass.history.reserve(HISTORY);
+		glGenQueries(2 * FRAME_LATENCY, pass.queries);
+		return pass;
+	}
+
+	// Reads the slot's timestamps if they have all arrived.
+	void collect(int slot) {
+		for (const Pass& pass : passes) {
+			if (!pass.issued[slot]) continue;
+			GLint available = 0;
+			glGetQueryObjectiv(pass.queries[slot * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) return;
+		}
+
+		GLuint64 frameStart = ~(GLuint64)0;
+		GLuint64 frameEnd = 0;
+		for (Pass& pass : passes) {
+			if (!pass.issued[slot]) continue;
+			GLuint64 start = 0, end = 0;
+			glGetQueryObjectui64v(pass.queries[slot * 2], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(pass.queries[slot * 2 + 1], GL_QUERY_RESULT, &end);
+			pass.record((float)((end - start) / 1.0e6));
+			pass.issued[slot] = false;
+			frameStart = std::min(frameStart, start);
+			frameEnd = std::max(frameEnd, end);
+		}
+		if (frameEnd > frameStart) frameHistory[historyIndex] = (float)((frameEnd - frameStart) / 1.0e6);
+	}
+
+	static float mean(const std::vector<float>& values) {
+		float sum = 0.0f;
+		for (float v : values) sum += v;
+		return values.empty() ? 0.0f : sum / values.size();
+	}
+
+	static float percentile(std::vector<float> values, float p) {
+		if (values.empty()) return 0.0f;
+		const size_t k = std::min(values.size() - 1, (size_t)(p * (values.size() - 1) + 0.5f));
+		std::nth_element(values.begin(), values.begin() + k, values.end());
+		return values[k];
+	}
+
+	std::vector<Pass> passes;
+	Pass* current = nullptr;
+	int frameSlot = 0;
+	int historyIndex = 0;
+	std::vector<float> frameHistory;
+	std::vector<float> cpuHistory;
+};
+
+// Shader-side traversal counters: rays cast, BVH nodes visited and
+// primitives tested, summed by every invocation into the TraversalStats SSBO
+// (rt_scene.glsl, binding 20). Each frame writes its own buffer of a small
+// ring, read back behind a fence once the GPU is done with it.
+class TraversalStats {
+public:
+	static constexpr int FRAME_LATENCY = 3;
+
+	// Mirrors TraversalStats in rt_scene.glsl: 64-bit counters as lo/hi pairs.
+	struct Counters {
+		GLuint rays[2];
+		GLuint nodes[2];
+		GLuint prims[2];
+		GLuint pad[2];
+	};
+
+	TraversalStats() {
+		glGenBuffers(FRAME_LATENCY, buffers);
+		for (GLuint buffer : buffers) {
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Counters), nullptr, GL_DYNAMIC_READ);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	~TraversalStats() {
+		for (GLsync& fence : fences) {
+			if (fence) glDeleteSync(fence);
+		}
+		glDeleteBuffers(FRAME_LATENCY, buffers);
+	}
+
+	TraversalStats(const TraversalStats&) = delete;
+	TraversalStats& operator=(const TraversalStats&) = delete;
+
+	bool enabled = false;
+
+	// Picks up any finished frame, then zeroes and binds this frame's buffer.
+	void beginFrame() {
+		for (int i = 0; i < FRAME_LATENCY; i++) {
+			if (fences[i] && glClientWaitSync(fences[i], 0, 0) != GL_TIMEOUT_EXPIRED) {
+				Counters c;
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[i]);
+				glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(Counters), &c);
+				last = c;
+				glDeleteSync(fences[i]);
+				fences[i] = 0;
+			}
+		}
+
+		slot = (slot + 1) % FRAME_LATENCY;
+		if (fences[slot]) { // still in flight after FRAME_LATENCY frames, drop it
+			glDeleteSync(fences[slot]);
+			fences[slot] = 0;
+		}
+		GLuint zero = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[slot]);
+		glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20, buffers[slot]);
+	}
+
+	void endFrame() {
+		if (enabled) fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	// rayPassMs: the GPU time the counted work took, for rays per second.
+	void drawImGui(float rayPassMs) {
+		ImGui::Checkbox("Traversal Counters", &enabled);
+		if (!enabled) return;
+
+		const double rays = combine(last.rays);
+		ImGui::Text("Rays: %.2f M (%.1f Mrays/s)", rays / 1e6, rayPassMs > 0.0f ? rays / (rayPassMs * 1e3) : 0.0);
+		ImGui::Text("Nodes / ray: %.1f", rays > 0.0 ? combine(last.nodes) / rays : 0.0);
+		ImGui::Text("Prims / ray: %.1f", rays > 0.0 ? combine(last.prims) / rays : 0.0);
+	}
+
+private:
+	static double combine(const GLuint v[2]) {
+		return (double)v[0] + (double)v[1] * 4294967296.0;
+	}
+
+	GLuint buffers[FRAME_LATENCY];
+	GLsync fences[FRAME_LATENCY] = {};
+	int slot = 0;
+	Counters last = {};
+};
+
+#endif // !RT_PROFILER_H
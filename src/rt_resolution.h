@@ -0,0 +1,252 @@
+#ifndef RT_RESOLUTION_H
+#define RT_RESOLUTION_H
+
+#include <glad2/gl.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <glm/glm/glm.hpp>
+
+#include "rt_wavefront.h"
+
+// The accumulation ping-pong the ray pass renders into, at the render
+// resolution. resize() leaves the history target at its old size, so the
+// next frame can reproject it into the other one at the new size; fit() then
+// brings each target to the new size before it is written.
+class RenderTargets {
+public:
+	RenderTargets(int width, int height) : width(width), height(height) {
+		for (int i = 0; i < 2; i++) {
+			AccumulationTargets& target = targets[i];
+			glGenTextures(1, &target.color);
+			glGenTextures(1, &target.moments);
+			glGenTextures(1, &target.albedo);
+			glGenTextures(1, &target.normalDepth);
+			allocate(i);
+		}
+	}
+
+	~RenderTargets() {
+		for (const AccumulationTargets& target : targets) {
+			glDeleteTextures(1, &target.color);
+			glDeleteTextures(1, &target.moments);
+			glDeleteTextures(1, &target.albedo);
+			glDeleteTextures(1, &target.normalDepth);
+		}
+	}
+
+	RenderTargets(const RenderTargets&) = delete;
+	RenderTargets& operator=(const RenderTargets&) = delete;
+
+	// Reallocates every target but history, which keeps what it accumulated.
+	void resize(int newWidth, int newHeight, int history) {
+		width = newWidth;
+		height = newHeight;
+		fit(1 - history);
+	}
+
+	// Reallocates target i, cleared, if it is not at the current size.
+	void fit(int i) {
+		if (sizes[i] != glm::ivec2(width, height)) allocate(i);
+	}
+
+	const AccumulationTargets& operator[](int i) const { return targets[i]; }
+
+	// The size target i was allocated at, which for the history is the
+	// previous frame's render size.
+	glm::vec2 sizeOf(int i) const { return glm::vec2(sizes[i]); }
+
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+
+private:
+	void allocate(int i) {
+		// Each colour average has its luminance moments, for adaptive sampling,
+		// and the first-hit G-buffer the denoiser is guided by beside it.
+		const AccumulationTargets& target = targets[i];
+		std::vector<float> empty((size_t)width * height * 4, 0.0f);
+		allocate(target.color, GL_RGBA32F, empty);
+		allocate(target.moments, GL_RGBA32F, empty);
+		allocate(target.albedo, GL_RGBA16F, empty);
+		allocate(target.normalDepth, GL_RGBA32F, empty);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		sizes[i] = glm::ivec2(width, height);
+	}
+
+	void allocate(GLuint tex, GLenum internalFormat, const std::vector<float>& empty) const {
+		glBindTexture(GL_TEXTURE_2D, tex);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0,
+			GL_RGBA, GL_FLOAT, empty.data()); // store HDR float data
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+
+	AccumulationTargets targets[2];
+	glm::ivec2 sizes[2];
+	int width, height;
+};
+
+// The stage that brings the displayed image from the render resolution up to
+// the output's, between the denoiser and bloom.
+//
+// apply() is the hook for a temporal upscaler: one would keep an
+// output-resolution history, reproject it with the previous frame's
+// view-projection, reject taps through the G-buffer of the accumulation the
+// image came from, and blend in each jittered render-resolution frame. Until
+// then stretch() is the whole stage, a bilinear blit into an output-size
+// texture, and an image already at the output size is passed through.
+class Upscaler {
+public:
+	Upscaler(int outputWidth, int outputHeight) {
+		glGenFramebuffers(2, fbo);
+		glGenTextures(1, &output);
+		resize(outputWidth, outputHeight);
+	}
+
+	~Upscaler() {
+		glDeleteFramebuffers(2, fbo);
+		glDeleteTextures(1, &output);
+	}
+
+	Upscaler(const Upscaler&) = delete;
+	Upscaler& operator=(const Upscaler&) = delete;
+
+	// Reallocates the output for a new output size.
+	void resize(int newWidth, int newHeight) {
+		width = newWidth;
+		height = newHeight;
+		glBindTexture(GL_TEXTURE_2D, output);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo[1]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, output, 0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	// input is the displayed image at inputWidth x inputHeight, gbuffer the
+	// accumulation it came from and viewProj the view it was rendered from.
+	// Returns the image at the output size.
+	GLuint apply(GLuint input, int inputWidth, int inputHeight,
+		const AccumulationTargets& gbuffer, const glm::mat4& viewProj) {
+		(void)gbuffer;  // for a temporal upscaler
+		(void)viewProj;
+		if (inputWidth == width && inputHeight == height) return input;
+		return stretch(input, inputWidth, inputHeight);
+	}
+
+private:
+	GLuint stretch(GLuint input, int inputWidth, int inputHeight) {
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo[0]);
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, input, 0);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo[1]);
+		glBlitFramebuffer(0, 0, inputWidth, inputHeight, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return output;
+	}
+
+	GLuint fbo[2] = {}; // reads the input, draws the output
+	GLuint output = 0;
+	int width = 0, height = 0;
+};
+
+// Picks the render resolution, as a fraction of the output's.
+//
+// While the camera moves the ray pass is held under targetFrameMs by lowering
+// the scale in steps of 1/SCALE_STEPS, estimated from the measured cost of a
+// sample (which goes with the pixel count, the square of the scale). Once the
+// camera has been still for settleFrames frames it goes back to full
+// resolution, where accumulation converges. The accumulation is reprojected
+// across every change (RenderTargets) rather than restarted. Lowering the
+// scale happens as soon as a frame is over budget; raising it needs some
+// headroom, and every change waits a few frames for the timings to catch up,
+// so it does not flicker between two steps.
+class DynamicResolution {
+public:
+	static constexpr int SCALE_STEPS = 8;
+	static constexpr int COOLDOWN_FRAMES = 4; // the scheduler's query latency, and a little more
+
+	bool enabled = true;
+	float targetFrameMs = 16.0f; // ray pass budget per frame while moving
+	float minScale = 0.5f;
+	int settleFrames = 8;
+
+	DynamicResolution(int outputWidth, int outputHeight)
+		: outputWidth(outputWidth), outputHeight(outputHeight), stillFrames(settleFrames) {
+		refreshSize();
+	}
+
+	// Returns true if the render size changed.
+	bool setOutputSize(int width, int height) {
+		outputWidth = width;
+		outputHeight = height;
+		return refreshSize();
+	}
+
+	// Call once a frame, before it renders. sampleCostMs is the measured cost of
+	// one sample at the current render size (0 when unknown).
+	// Returns true if the render size changed.
+	bool update(bool cameraMoved, float sampleCostMs) {
+		stillFrames = cameraMoved ? 0 : std::min(stillFrames + 1, settleFrames);
+		if (cooldown > 0) cooldown--;
+
+		float target = scale;
+		if (!isMoving()) {
+			target = 1.0f;
+		}
+		else if (cooldown == 0 && sampleCostMs > 0.0f) {
+			const float fullCostMs = sampleCostMs / (scale * scale);
+			const float ideal = std::sqrt(targetFrameMs / fullCostMs);
+			const float lower = quantize(ideal);
+			const float upper = quantize(ideal - 0.5f / SCALE_STEPS); // half a step of headroom
+			if (lower < scale) target = lower;
+			else if (upper > scale) target = upper;
+		}
+
+		if (target == scale) return false;
+		scale = target;
+		cooldown = COOLDOWN_FRAMES;
+		return refreshSize();
+	}
+
+	// Whether the camera is moving, as far as resolution is concerned: it is
+	// only considered still once it has been for settleFrames frames.
+	bool isMoving() const {
+		return enabled && stillFrames < settleFrames;
+	}
+
+	float getScale() const { return scale; }
+	int getRenderWidth() const { return renderWidth; }
+	int getRenderHeight() const { return renderHeight; }
+
+private:
+	float quantize(float s) const {
+		const float stepped = std::floor(s * SCALE_STEPS) / SCALE_STEPS;
+		return std::max(std::min(minScale, 1.0f), std::min(stepped, 1.0f));
+	}
+
+	bool refreshSize() {
+		const int width = std::max(1, (int)(outputWidth * scale + 0.5f));
+		const int height = std::max(1, (int)(outputHeight * scale + 0.5f));
+		const bool changed = width != renderWidth || height != renderHeight;
+		renderWidth = width;
+		renderHeight = height;
+		return changed;
+	}
+
+	int outputWidth, outputHeight;
+	int renderWidth = 0, renderHeight = 0;
+	float scale = 1.0f;
+	int stillFrames;
+	int cooldown = 0;
+};
+
+#endif // !RT_RESOLUTION_H
@@ -0,0 +1,216 @@
+#ifndef RT_SCENEFILE_H
+#define RT_SCENEFILE_H
+
+#include <glm/glm/glm.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "rt_structs.h"
+#include "rt_json.h"
+
+// A mesh instance as the scene file places it. The mesh itself is loaded
+// later, by the asset loader.
+struct SceneMesh {
+	std::string name;
+	std::string path;
+	int materialID = 0;
+	glm::vec3 position = glm::vec3(0.0f);
+	glm::vec3 rotation = glm::vec3(0.0f); // radians, converted from the file's degrees
+	glm::vec3 scale = glm::vec3(1.0f);
+};
+
+// Everything main() needs to set a scene up, read from a JSON file:
+//
+//   {
+//     "camera":    { "position": [x, y, z], "target": [x, y, z], "fov": 45 },
+//     "skybox":    { "path": "textures/skybox/hdrSky.hdr", "intensity": 1.0 },
+//     "materials": [ { "type": "metal", "albedo": [r, g, b], "metallic": 1,
+//                      "roughness": 0.1, "emission": 0, "ior": 1.5,
+//                      "albedoTexture": "textures/wood.png", "roughnessTexture": ...,
+//                      "normalTexture": ..., "uvScale": [u, v], "uvOffset": [u, v] }, ... ],
+//     "spheres":   [ { "center": [x, y, z], "radius": 0.5, "material": 0 }, ... ],
+//     "meshes":    [ { "name": "Monkey", "path": "external/smooth-monkey.obj",
+//                      "material": 7, "position": [x, y, z],
+//                      "rotation": [x, y, z], "scale": 0.35 }, ... ]
+//   }
+//
+// Material types are lambertian, metal, dielectric and emissive. Textures
+// multiply the material's values (the roughness texture is glTF's
+// metallic-roughness: G roughness, B metallic), and uvScale and uvOffset
+// tile them or pick a rectangle out of an atlas. Mesh rotations are Euler
+// angles in degrees, scales a number or [x, y, z]. Everything but the
+// materials is optional.
+struct SceneDescription {
+	std::vector<Material> materials;
+	std::vector<Sphere> spheres;
+	std::vector<SceneMesh> meshes;
+	std::vector<std::string> textures; // every image the materials use, once each
+
+	std::string skyboxPath;
+	float skyboxIntensity = 1.0f;
+
+	bool hasCamera = false;
+	glm::vec3 cameraPosition = glm::vec3(0.0f);
+	glm::vec3 cameraTarget = glm::vec3(0.0f, 0.0f, -1.0f);
+	float cameraFov = 0.0f; // 0 keeps the camera's own
+
+	// Reads a scene file. Prints what went wrong and returns false if it can't.
+	bool load(const std::string& path) {
+		std::ifstream file(path);
+		if (!file) {
+			std::cout << "Failed to open scene file: " << path << std::endl;
+			return false;
+		}
+		std::stringstream stream;
+		stream << file.rdbuf();
+
+		JsonValue root;
+		std::string error;
+		if (!JsonValue::parse(stream.str(), root, error) || !root.isObject()) {
+			std::cout << "Failed to parse scene file " << path << ": "
+				<< (error.empty() ? "not an object" : error) << std::endl;
+			return false;
+		}
+
+		*this = SceneDescription();
+		if (const JsonValue* camera = root.find("camera")) {
+			hasCamera = true;
+			cameraPosition = vec3(camera->find("position"), cameraPosition);
+			cameraTarget = vec3(camera->find("target"), cameraTarget);
+			cameraFov = (float)camera->getNumber("fov", 0.0);
+		}
+
+		if (const JsonValue* skybox = root.find("skybox")) {
+			skyboxPath = skybox->isString() ? skybox->string : skybox->getString("path", "");
+			skyboxIntensity = (float)skybox->getNumber("intensity", 1.0);
+		}
+
+		if (const JsonValue* list = root.find("materials")) {
+			for (const JsonValue& m : list->items) {
+				Material mat = {};
+				const glm::vec3 albedo = vec3(m.find("albedo"), glm::vec3(0.8f));
+				mat.albedo_x = albedo.x;
+				mat.albedo_y = albedo.y;
+				mat.albedo_z = albedo.z;
+				if (!materialType(m.getString("type", "lambertian"), mat.type)) {
+					std::cout << "Scene file " << path << ": unknown material type \""
+						<< m.getString("type", "") << "\" for material " << materials.size() << std::endl;
+					return false;
+				}
+				mat.metallic = (float)m.getNumber("metallic", mat.type == Metal ? 1.0 : 0.0);
+				mat.emissionStrength = (float)m.getNumber("emission", 0.0);
+				mat.roughness = (float)m.getNumber("roughness", 0.0);
+				mat.refractionIndex = (float)m.getNumber("ior", mat.type == Dielectric ? 1.5 : 0.0);
+				mat.albedoTexture = textureIndex(m.getString("albedoTexture", ""));
+				mat.roughnessTexture = textureIndex(m.getString("roughnessTexture", ""));
+				mat.normalTexture = textureIndex(m.getString("normalTexture", ""));
+				const glm::vec2 uvScale = vec2(m.find("uvScale"), glm::vec2(1.0f));
+				const glm::vec2 uvOffset = vec2(m.find("uvOffset"), glm::vec2(0.0f));
+				mat.uvScale_x = uvScale.x;
+				mat.uvScale_y = uvScale.y;
+				mat.uvOffset_x = uvOffset.x;
+				mat.uvOffset_y = uvOffset.y;
+				materials.push_back(mat);
+			}
+		}
+		if (materials.empty()) {
+			std::cout << "Scene file " << path << " has no materials" << std::endl;
+			return false;
+		}
+
+		if (const JsonValue* list = root.find("spheres")) {
+			for (const JsonValue& s : list->items) {
+				const glm::vec3 center = vec3(s.find("center"), glm::vec3(0.0f));
+				Sphere sphere = {};
+				sphere.center_x = center.x;
+				sphere.center_y = center.y;
+				sphere.center_z = center.z;
+				sphere.radius = (float)s.getNumber("radius", 1.0);
+				sphere.materialID = materialIndex(s, path);
+				spheres.push_back(sphere);
+			}
+		}
+
+		if (const JsonValue* list = root.find("meshes")) {
+			for (const JsonValue& m : list->items) {
+				SceneMesh mesh;
+				mesh.path = m.getString("path", "");
+				if (mesh.path.empty()) {
+					std::cout << "Scene file " << path << ": mesh " << meshes.size() << " has no path" << std::endl;
+					return false;
+				}
+				mesh.name = m.getString("name", mesh.path);
+				mesh.materialID = materialIndex(m, path);
+				mesh.position = vec3(m.find("position"), mesh.position);
+				mesh.rotation = vec3(m.find("rotation"), glm::vec3(0.0f)) * (3.14159265f / 180.0f);
+				mesh.scale = vec3(m.find("scale"), mesh.scale);
+				meshes.push_back(mesh);
+			}
+		}
+
+#ifdef RT_DEBUG
+		std::cout << "Scene " << path << ": " << materials.size() << " materials, "
+			<< spheres.size() << " spheres, " << meshes.size() << " meshes, "
+			<< textures.size() << " textures" << std::endl;
+#endif
+		return true;
+	}
+
+private:
+	// [x, y, z], or a single number for all three.
+	static glm::vec3 vec3(const JsonValue* v, const glm::vec3& fallback) {
+		if (!v) return fallback;
+		if (v->isNumber()) return glm::vec3((float)v->number);
+		if (!v->isArray() || v->items.size() != 3) return fallback;
+		glm::vec3 result;
+		for (int i = 0; i < 3; i++) {
+			result[i] = v->items[i].isNumber() ? (float)v->items[i].number : fallback[i];
+		}
+		return result;
+	}
+
+	// [u, v], or a single number for both.
+	static glm::vec2 vec2(const JsonValue* v, const glm::vec2& fallback) {
+		if (!v) return fallback;
+		if (v->isNumber()) return glm::vec2((float)v->number);
+		if (!v->isArray() || v->items.size() != 2) return fallback;
+		glm::vec2 result;
+		for (int i = 0; i < 2; i++) {
+			result[i] = v->items[i].isNumber() ? (float)v->items[i].number : fallback[i];
+		}
+		return result;
+	}
+
+	// The texture's index in textures, adding it the first time. -1 for none.
+	int textureIndex(const std::string& texturePath) {
+		if (texturePath.empty()) return -1;
+		for (size_t i = 0; i < textures.size(); i++) {
+			if (textures[i] == texturePath) return (int)i;
+		}
+		textures.push_back(texturePath);
+		return (int)textures.size() - 1;
+	}
+
+	static bool materialType(const std::string& name, int& type) {
+		if (name == "lambertian" || name == "diffuse") type = Lambertian;
+		else if (name == "metal") type = Metal;
+		else if (name == "dielectric" || name == "glass") type = Dielectric;
+		else if (name == "emissive") type = Emissive;
+		else return false;
+		return true;
+	}
+
+	// An object's "material", clamped to the materials there are.
+	int materialIndex(const JsonValue& v, const std::string& path) const {
+		const int index = (int)v.getNumber("material", 0.0);
+		if (index >= 0 && index < (int)materials.size()) return index;
+		std::cout << "Scene file " << path << ": material " << index << " out of range, using 0" << std::endl;
+		return 0;
+	}
+};
+
+#endif // !RT_SCENEFILE_H
@@ -0,0 +1,41 @@
+#ifndef RT_SIMD_H
+#define RT_SIMD_H
+
+#include <glm/glm/glm.hpp>
+
+// SSE paths for the CPU geometry kernels. SSE2 is always there on x64 (and
+// with /arch:SSE2 on x86); anything else uses the scalar versions. Wider AVX
+// paths would need /arch:AVX, which the project doesn't build with.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RT_SSE 1
+#include <emmintrin.h>
+#else
+#define RT_SSE 0
+#endif
+
+#if RT_SSE
+// glm::vec4 is only 4-byte aligned, so loads and stores are unaligned.
+inline __m128 LoadVec4(const glm::vec4& v) { return _mm_loadu_ps(&v.x); }
+inline void StoreVec4(glm::vec4& v, __m128 x) { _mm_storeu_ps(&v.x, x); }
+
+inline glm::vec3 ToVec3(__m128 x) {
+	alignas(16) float f[4];
+	_mm_store_ps(f, x);
+	return glm::vec3(f[0], f[1], f[2]);
+}
+
+// Smallest and largest of the four lanes.
+inline float HorizontalMin(__m128 x) {
+	x = _mm_min_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 3, 0, 1)));
+	x = _mm_min_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 0, 3, 2)));
+	return _mm_cvtss_f32(x);
+}
+
+inline float HorizontalMax(__m128 x) {
+	x = _mm_max_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 3, 0, 1)));
+	x = _mm_max_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 0, 3, 2)));
+	return _mm_cvtss_f32(x);
+}
+#endif
+
+#endif // !RT_SIMD_H
@@ -3,6 +3,9 @@
 
 #include <glad2/gl.h>
 
+#include "rt_envmap.h"
+
+#include <memory>
 #include <vector>
 #include <string>
 #include <iostream>
@@ -92,21 +95,37 @@ GLuint loadHDRCubemap(const std::vector<std::string>& faces) {
     return textureID;
 }
 
-GLuint loadHDRTexture(std::string filename) {
-    // Enable HDR loading in stb_image
-    stbi_set_flip_vertically_on_load(true);
+// Decoded pixels of an HDR image, bottom row first, as uploadHDRTexture wants them.
+struct HDRImage {
+    std::unique_ptr<float, void (*)(void*)> data{ nullptr, stbi_image_free };
+    int width = 0, height = 0, nrComponents = 0;
+};
+
+// Decodes an equirectangular HDR image without touching GL, so it can run on
+// a worker thread.
+bool loadHDRImage(const std::string& filename, HDRImage& image) {
+    // Enable HDR loading in stb_image. Per thread, since textures decode alongside
+    stbi_set_flip_vertically_on_load_thread(true);
 
-    int width, height, nrComponents;
-    float* data = stbi_loadf(filename.c_str(), &width, &height, &nrComponents, 0);
+    image.data.reset(stbi_loadf(filename.c_str(), &image.width, &image.height, &image.nrComponents, 0));
 
-    if (!data) {
+    if (!image.data) {
         std::cerr << "Failed to load HDR image: " << filename << std::endl;
         std::cerr << "STB Error: " << stbi_failure_reason() << std::endl;
-        return 0;
+        return false;
     }
 
-    std::cout << "Loaded HDR image: " << width << "x" << height
-        << " with " << nrComponents << " components" << std::endl;
+    std::cout << "Loaded HDR image: " << image.width << "x" << image.height
+        << " with " << image.nrComponents << " components" << std::endl;
+    return true;
+}
+
+// Uploads a decoded HDR image. With cdf, also builds its importance sampling
+// tables from the same pixels.
+GLuint uploadHDRTexture(const HDRImage& image, EnvironmentCDF* cdf = nullptr) {
+    const float* data = image.data.get();
+    const int width = image.width, height = image.height, nrComponents = image.nrComponents;
+    if (!data) return 0;
 
     GLuint textureID;
     glGenTextures(1, &textureID);
@@ -133,7 +152,7 @@ GLuint loadHDRTexture(std::string filename) {
         break;
     default:
         std::cerr << "Unsupported number of components: " << nrComponents << std::endl;
-        stbi_image_free(data);
+        glDeleteTextures(1, &textureID);
         return 0;
     }
 
@@ -147,10 +166,19 @@ GLuint loadHDRTexture(std::string filename) {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    // Free image data
-    stbi_image_free(data);
+    if (cdf) {
+        cdf->build(data, width, height, nrComponents);
+    }
 
     return textureID;
 }
 
+// Loads an equirectangular HDR image. With cdf, also builds its importance
+// sampling tables from the same pixels.
+GLuint loadHDRTexture(std::string filename, EnvironmentCDF* cdf = nullptr) {
+    HDRImage image;
+    if (!loadHDRImage(filename, image)) return 0;
+    return uploadHDRTexture(image, cdf);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,519 @@
+#ifndef RT_SKYCACHE_H
+#define RT_SKYCACHE_H
+
+#include <glad2/gl.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "rt_meshcache.h"
+#include "rt_skybox.h"
+#include "equirectToCubemap.h"
+
+// Every face of every level of a sky cubemap, as the cache stores it.
+struct CubemapLevels {
+	GLenum internalFormat = 0; // GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT or GL_RGBA16F
+	int size = 0;              // of level 0
+	int levels = 0;            // 0 for none
+	std::vector<std::vector<uint8_t>> faces; // levels * 6 images, level-major
+
+	bool compressed() const { return internalFormat == GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT; }
+
+	// Bytes of one face of level, as GL reads and writes it.
+	size_t faceBytes(int level) const {
+		const size_t s = (size_t)std::max(1, size >> level);
+		return compressed() ? ((s + 3) / 4) * ((s + 3) / 4) * 16 : s * s * 8;
+	}
+};
+
+// A sky as the loader stages it: the decoded image when the cache missed, or
+// the cached cubemap and environment weights when it hit. Holds no GL state.
+struct StagedSky {
+	std::string path;
+	int cubemapSize = 0;
+	uint64_t sourceHash = 0; // 0 if the source can't be read
+
+	HDRImage image;          // data is null on a hit
+	CubemapLevels cubemap;   // levels is 0 on a miss
+	std::vector<float> envWeights; // EnvironmentCDF::texelWeights
+	int envWidth = 0, envHeight = 0;
+
+	bool cached() const { return cubemap.levels > 0; }
+};
+
+// Per-sky binary cache, written next to the source as <path>.ktx.
+//
+// A KTX 1.1 file with the converted, prefiltered cubemap, BC6H compressed
+// when the driver could do that and RGBA16F otherwise, so stock tools can
+// open it. Two key/value entries make it ours: the key it was built for
+// (format version, a hash of the .hdr, the cubemap size and the prefilter
+// settings), and the environment's importance sampling weights, so a hit
+// needs neither the stb decode nor the GPU conversion. Anything that doesn't
+// match is a miss, and the sky is decoded, converted and the cache rewritten.
+class SkyCache {
+public:
+	// Stages a sky, from its cache when that is valid. Only reads files, so it
+	// runs on a loader thread. useCache false always decodes the source.
+	static void stage(const std::string& path, int cubemapSize, StagedSky& sky, bool useCache = true) {
+		sky = StagedSky();
+		sky.path = path;
+		sky.cubemapSize = cubemapSize;
+		{
+			MappedFile source(path);
+			if (source.data()) sky.sourceHash = hashFileBytes(source);
+		}
+
+		if (useCache && sky.sourceHash != 0 && loadCache(path + ".ktx", makeKey(sky), sky)) {
+#ifdef RT_DEBUG
+			std::cout << "Sky cache hit: " << path << ".ktx (" << sky.cubemap.size << "x" << sky.cubemap.size
+				<< ", " << sky.cubemap.levels << " levels, " << (sky.cubemap.compressed() ? "BC6H" : "RGBA16F") << ")" << std::endl;
+#endif
+			return;
+		}
+		sky.cubemap = CubemapLevels();
+		sky.envWeights.clear();
+		loadHDRImage(path, sky.image);
+	}
+
+	// Creates the cubemap of a cache hit. 0 on a GL error.
+	static GLuint upload(const CubemapLevels& cubemap) {
+		while (glGetError() != GL_NO_ERROR) {}
+
+		GLuint texture = EquirectToCubemap::createCubemap(cubemap.internalFormat, cubemap.size, cubemap.levels);
+		for (int level = 0; level < cubemap.levels; level++) {
+			const int size = std::max(1, cubemap.size >> level);
+			for (int face = 0; face < 6; face++) {
+				const std::vector<uint8_t>& image = cubemap.faces[(size_t)level * 6 + face];
+				if (cubemap.compressed())
+					glCompressedTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, 0, 0, size, size,
+						cubemap.internalFormat, (GLsizei)image.size(), image.data());
+				else
+					glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, 0, 0, size, size,
+						GL_RGBA, GL_HALF_FLOAT, image.data());
+			}
+		}
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+		if (glGetError() != GL_NO_ERROR) {
+			glDeleteTextures(1, &texture);
+			return 0;
+		}
+		return texture;
+	}
+
+	// Writes the cache for sky from its cubemap's levels and the environment
+	// weights. Only writes files, so it runs on any thread. Failures only print.
+	static void write(const StagedSky& sky, const CubemapLevels& cubemap,
+		const std::vector<float>& envWeights, int envWidth, int envHeight) {
+		if (sky.sourceHash == 0) return;
+		writeCache(sky.path + ".ktx", makeKey(sky), cubemap, envWeights, envWidth, envHeight);
+	}
+
+private:
+	static const uint32_t VERSION = 1;
+
+	// Value of the RTSkyCacheKey entry.
+	struct Key {
+		uint32_t version;
+		uint32_t cubemapSize;
+		uint32_t levels;
+		uint32_t prefilterSamples;
+		uint64_t sourceHash;
+	};
+
+	// KTX 1.1 header, after the 12-byte identifier.
+	struct KTXHeader {
+		uint32_t endianness;
+		uint32_t glType;
+		uint32_t glTypeSize;
+		uint32_t glFormat;
+		uint32_t glInternalFormat;
+		uint32_t glBaseInternalFormat;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t numberOfArrayElements;
+		uint32_t numberOfFaces;
+		uint32_t numberOfMipmapLevels;
+		uint32_t bytesOfKeyValueData;
+	};
+
+	static const uint8_t* identifier() {
+		static const uint8_t id[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+		return id;
+	}
+
+	static const char* keyEntry() { return "RTSkyCacheKey"; }
+	static const char* weightsEntry() { return "RTEnvironmentWeights"; }
+
+	static Key makeKey(const StagedSky& sky) {
+		Key key = {};
+		key.version = VERSION;
+		key.cubemapSize = (uint32_t)sky.cubemapSize;
+		key.levels = (uint32_t)EquirectToCubemap::levelCount(sky.cubemapSize);
+		key.prefilterSamples = EquirectToCubemap::PREFILTER_SAMPLES;
+		key.sourceHash = sky.sourceHash;
+		return key;
+	}
+
+	static size_t pad4(size_t size) { return (size + 3) & ~size_t(3); }
+
+	static bool loadCache(const std::string& cachePath, const Key& key, StagedSky& sky) {
+		MappedFile file(cachePath);
+		const uint8_t* data = file.data();
+		const size_t fileSize = file.size();
+		if (!data || fileSize < 12 + sizeof(KTXHeader) || std::memcmp(data, identifier(), 12) != 0) return false;
+
+		KTXHeader h;
+		std::memcpy(&h, data + 12, sizeof(KTXHeader));
+		const bool compressed = h.glInternalFormat == GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT;
+		if (h.endianness != 0x04030201 || (!compressed && h.glInternalFormat != GL_RGBA16F) ||
+			h.pixelWidth != key.cubemapSize || h.pixelHeight != key.cubemapSize || h.pixelDepth != 0 ||
+			h.numberOfArrayElements != 0 || h.numberOfFaces != 6 || h.numberOfMipmapLevels != key.levels) {
+			return false;
+		}
+
+		size_t offset = 12 + sizeof(KTXHeader);
+		if (h.bytesOfKeyValueData > fileSize - offset) return false;
+		const size_t valuesEnd = offset + h.bytesOfKeyValueData;
+
+		// Key/value entries: a size, then the key's NUL-terminated string and the value
+		bool keyFound = false;
+		while (offset + 4 <= valuesEnd) {
+			uint32_t entrySize;
+			std::memcpy(&entrySize, data + offset, 4);
+			offset += 4;
+			if (entrySize > valuesEnd - offset) return false;
+
+			const char* entry = reinterpret_cast<const char*>(data + offset);
+			const char* nul = static_cast<const char*>(std::memchr(entry, 0, entrySize));
+			if (!nul) return false;
+			const size_t keyLength = (size_t)(nul - entry);
+			const uint8_t* value = data + offset + keyLength + 1;
+			const size_t valueSize = entrySize - keyLength - 1;
+
+			if (std::strcmp(entry, keyEntry()) == 0) {
+				Key stored;
+				if (valueSize != sizeof(Key)) return false;
+				std::memcpy(&stored, value, sizeof(Key));
+				keyFound = std::memcmp(&stored, &key, sizeof(Key)) == 0;
+				if (!keyFound) return false;
+			}
+			else if (std::strcmp(entry, weightsEntry()) == 0) {
+				int32_t dims[2];
+				if (valueSize < sizeof(dims)) return false;
+				std::memcpy(dims, value, sizeof(dims));
+				if (dims[0] <= 0 || dims[1] <= 0 ||
+					(valueSize - sizeof(dims)) / sizeof(float) != (size_t)dims[0] * dims[1]) {
+					return false;
+				}
+				sky.envWidth = dims[0];
+				sky.envHeight = dims[1];
+				sky.envWeights.resize((size_t)dims[0] * dims[1]);
+				std::memcpy(sky.envWeights.data(), value + sizeof(dims), sky.envWeights.size() * sizeof(float));
+			}
+			offset += pad4(entrySize);
+		}
+		if (!keyFound || sky.envWeights.empty()) return false;
+		offset = valuesEnd;
+
+		// Then per level its face size and the six faces
+		sky.cubemap.internalFormat = h.glInternalFormat;
+		sky.cubemap.size = (int)h.pixelWidth;
+		sky.cubemap.levels = (int)h.numberOfMipmapLevels;
+		sky.cubemap.faces.resize((size_t)sky.cubemap.levels * 6);
+		for (int level = 0; level < sky.cubemap.levels; level++) {
+			uint32_t imageSize;
+			if (fileSize - offset < 4) return false;
+			std::memcpy(&imageSize, data + offset, 4);
+			offset += 4;
+			if (imageSize != sky.cubemap.faceBytes(level)) return false;
+
+			for (int face = 0; face < 6; face++) {
+				if (fileSize - offset < pad4(imageSize)) return false;
+				sky.cubemap.faces[(size_t)level * 6 + face].assign(data + offset, data + offset + imageSize);
+				offset += pad4(imageSize);
+			}
+		}
+		return true;
+	}
+
+	static void writeCache(const std::string& cachePath, const Key& key, const CubemapLevels& cubemap,
+		const std::vector<float>& envWeights, int envWidth, int envHeight) {
+		// Key/value data, each entry padded to 4 bytes
+		std::vector<uint8_t> values;
+		auto addEntry = [&values](const char* name, const std::vector<uint8_t>& value) {
+			const uint32_t entrySize = (uint32_t)(std::strlen(name) + 1 + value.size());
+			const uint8_t* sizeBytes = reinterpret_cast<const uint8_t*>(&entrySize);
+			values.insert(values.end(), sizeBytes, sizeBytes + 4);
+			values.insert(values.end(), name, name + std::strlen(name) + 1);
+			values.insert(values.end(), value.begin(), value.end());
+			values.resize(values.size() + pad4(entrySize) - entrySize, 0);
+		};
+
+		std::vector<uint8_t> keyValue(sizeof(Key));
+		std::memcpy(keyValue.data(), &key, sizeof(Key));
+		addEntry(keyEntry(), keyValue);
+
+		const int32_t dims[2] = { envWidth, envHeight };
+		std::vector<uint8_t> weightsValue(sizeof(dims) + envWeights.size() * sizeof(float));
+		std::memcpy(weightsValue.data(), dims, sizeof(dims));
+		std::memcpy(weightsValue.data() + sizeof(dims), envWeights.data(), envWeights.size() * sizeof(float));
+		addEntry(weightsEntry(), weightsValue);
+
+		KTXHeader h = {};
+		h.endianness = 0x04030201;
+		h.glType = cubemap.compressed() ? 0 : GL_HALF_FLOAT;
+		h.glTypeSize = cubemap.compressed() ? 1 : 2;
+		h.glFormat = cubemap.compressed() ? 0 : GL_RGBA;
+		h.glInternalFormat = cubemap.internalFormat;
+		h.glBaseInternalFormat = cubemap.compressed() ? GL_RGB : GL_RGBA;
+		h.pixelWidth = h.pixelHeight = (uint32_t)cubemap.size;
+		h.numberOfFaces = 6;
+		h.numberOfMipmapLevels = (uint32_t)cubemap.levels;
+		h.bytesOfKeyValueData = (uint32_t)values.size();
+
+		// Written to a temporary file first so a failed write never leaves a
+		// cache that looks valid
+		const std::string tempPath = cachePath + ".tmp";
+		{
+			std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+			if (!out) {
+				std::cout << "Failed to write sky cache: " << cachePath << std::endl;
+				return;
+			}
+
+			static const char zeros[4] = {};
+			out.write(reinterpret_cast<const char*>(identifier()), 12);
+			out.write(reinterpret_cast<const char*>(&h), sizeof(KTXHeader));
+			out.write(reinterpret_cast<const char*>(values.data()), (std::streamsize)values.size());
+			for (int level = 0; level < cubemap.levels; level++) {
+				const uint32_t imageSize = (uint32_t)cubemap.faceBytes(level);
+				out.write(reinterpret_cast<const char*>(&imageSize), 4);
+				for (int face = 0; face < 6; face++) {
+					out.write(reinterpret_cast<const char*>(cubemap.faces[(size_t)level * 6 + face].data()), imageSize);
+					out.write(zeros, (std::streamsize)(pad4(imageSize) - imageSize));
+				}
+			}
+
+			if (!out) {
+				std::cout << "Failed to write sky cache: " << cachePath << std::endl;
+				out.close();
+				std::remove(tempPath.c_str());
+				return;
+			}
+		}
+
+		std::remove(cachePath.c_str()); // rename won't replace an existing file on Windows
+		if (std::rename(tempPath.c_str(), cachePath.c_str()) != 0) {
+			std::cout << "Failed to write sky cache: " << cachePath << std::endl;
+			std::remove(tempPath.c_str());
+		}
+	}
+};
+
+// Makes the BC6H copy of a freshly converted sky and writes its cache, over
+// the frames after the conversion rather than in the one that converts it.
+//
+// begin() queues a readback of the RGBA16F cubemap into a pixel pack buffer
+// behind a fence. Once the fence has signalled, update() hands that buffer
+// back to the driver as the source of a BC6H cubemap, which it returns for
+// the caller to render from, and queues the compressed levels' readback the
+// same way. When that one is done, a thread of its own writes the file. The
+// compression itself is still the driver's, but neither the readbacks nor
+// the disk write hold up a frame. Without BC6H support the RGBA16F levels are
+// cached instead.
+class SkyCacheWriter {
+public:
+	SkyCacheWriter() = default;
+
+	~SkyCacheWriter() {
+		if (writer.joinable()) writer.join();
+	}
+
+	SkyCacheWriter(const SkyCacheWriter&) = delete;
+	SkyCacheWriter& operator=(const SkyCacheWriter&) = delete;
+
+	// Starts on sky, whose converted RGBA16F cubemap is texture, with levels
+	// levels. Drops whatever an earlier sky still had to do.
+	void begin(const StagedSky& sky, GLuint texture, int levels,
+		std::vector<float> envWeights, int envWidth, int envHeight) {
+		cancel();
+		meta = StagedSky();
+		meta.path = sky.path;
+		meta.cubemapSize = sky.cubemapSize;
+		meta.sourceHash = sky.sourceHash;
+		weights = std::move(envWeights);
+		weightsWidth = envWidth;
+		weightsHeight = envHeight;
+
+		cubemap = CubemapLevels();
+		cubemap.internalFormat = GL_RGBA16F;
+		cubemap.size = sky.cubemapSize;
+		cubemap.levels = levels;
+		readBack(texture);
+		step = ReadingRaw;
+	}
+
+	// Whether a sky is still being compressed or cached.
+	bool busy() const {
+		return step != Idle;
+	}
+
+	// Takes the next step if the GPU is done with the last, without waiting.
+	// Returns the BC6H cubemap on the frame it is made, for the caller to
+	// replace the RGBA16F one with, and 0 otherwise.
+	GLuint update() {
+		return advance(false);
+	}
+
+	// Takes every remaining step, waiting for the GPU, and returns the BC6H
+	// cubemap if one was made on the way.
+	GLuint finish() {
+		GLuint compressed = 0;
+		while (busy()) {
+			const GLuint made = advance(true);
+			if (made != 0) compressed = made;
+		}
+		return compressed;
+	}
+
+	// Drops the work in flight; the sky is cached on a later launch instead.
+	void cancel() {
+		if (fence) glDeleteSync(fence);
+		fence = 0;
+		if (pbo) glDeleteBuffers(1, &pbo);
+		pbo = 0;
+		step = Idle;
+	}
+
+private:
+	enum Step { Idle, ReadingRaw, ReadingCompressed };
+
+	GLuint advance(bool wait) {
+		if (step == Idle) return 0;
+		const GLuint64 timeout = wait ? 10000000000ull : 0; // 10 s
+		const GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+		if (status == GL_TIMEOUT_EXPIRED && !wait) return 0;
+		glDeleteSync(fence);
+		fence = 0;
+		if (status == GL_WAIT_FAILED || status == GL_TIMEOUT_EXPIRED) {
+			std::cout << "Readback of " << meta.path << " failed, not caching it" << std::endl;
+			cancel();
+			return 0;
+		}
+
+		if (step == ReadingRaw) {
+			const GLuint compressed = compress();
+			if (compressed != 0) {
+				cubemap.internalFormat = GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT;
+				glDeleteBuffers(1, &pbo);
+				readBack(compressed);
+				step = ReadingCompressed;
+				return compressed;
+			}
+			std::cout << "BC6H compression unavailable, keeping the sky as RGBA16F" << std::endl;
+		}
+
+		// The levels are in the buffer: off to the disk
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+		cubemap.faces.resize((size_t)cubemap.levels * 6);
+		size_t offset = 0;
+		for (int level = 0; level < cubemap.levels; level++) {
+			for (int face = 0; face < 6; face++) {
+				std::vector<uint8_t>& image = cubemap.faces[(size_t)level * 6 + face];
+				image.resize(cubemap.faceBytes(level));
+				glGetBufferSubData(GL_PIXEL_PACK_BUFFER, (GLintptr)offset, (GLsizeiptr)image.size(), image.data());
+				offset += image.size();
+			}
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		cancel();
+
+		if (writer.joinable()) writer.join();
+		writer = std::thread([sky = std::move(meta), levels = std::move(cubemap), envWeights = std::move(weights),
+			width = weightsWidth, height = weightsHeight] {
+			SkyCache::write(sky, levels, envWeights, width, height);
+		});
+		return 0;
+	}
+
+	// Queues every face of every level of texture, in cubemap's format, into
+	// a new pbo, back to back in the order CubemapLevels keeps them.
+	void readBack(GLuint texture) {
+		size_t bytes = 0;
+		for (int level = 0; level < cubemap.levels; level++) bytes += 6 * cubemap.faceBytes(level);
+
+		glGenBuffers(1, &pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)bytes, nullptr, GL_STREAM_READ);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		size_t offset = 0;
+		for (int level = 0; level < cubemap.levels; level++) {
+			for (int face = 0; face < 6; face++) {
+				void* target = reinterpret_cast<void*>(offset);
+				if (cubemap.compressed())
+					glGetCompressedTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, target);
+				else
+					glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGBA, GL_HALF_FLOAT, target);
+				offset += cubemap.faceBytes(level);
+			}
+		}
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush(); // so the fence is actually submitted before anyone polls it
+	}
+
+	// A BC6H cubemap with the RGBA16F levels in pbo, or 0 when the driver
+	// won't compress to it.
+	GLuint compress() {
+		while (glGetError() != GL_NO_ERROR) {}
+
+		GLuint compressed = EquirectToCubemap::createCubemap(GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, cubemap.size, cubemap.levels);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		size_t offset = 0;
+		for (int level = 0; level < cubemap.levels; level++) {
+			const int size = std::max(1, cubemap.size >> level);
+			for (int face = 0; face < 6; face++) {
+				glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, 0, 0, size, size,
+					GL_RGBA, GL_HALF_FLOAT, reinterpret_cast<const void*>(offset));
+				offset += cubemap.faceBytes(level);
+			}
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+		if (glGetError() != GL_NO_ERROR) {
+			glDeleteTextures(1, &compressed);
+			return 0;
+		}
+		return compressed;
+	}
+
+	Step step = Idle;
+	GLuint pbo = 0;
+	GLsync fence = 0;
+
+	StagedSky meta; // the sky's path, size and source hash
+	CubemapLevels cubemap;
+	std::vector<float> weights;
+	int weightsWidth = 0, weightsHeight = 0;
+
+	std::thread writer; // the last sky's disk write
+};
+
+#endif // !RT_SKYCACHE_H
@@ -1,20 +1,71 @@
 #ifndef RT_STRUCTS_H
 #define RT_STRUCTS_H
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
 // Structs for passing geometric and material information to the shader
 
-struct Triangle {
-    glm::vec4 v0;      // 16 bytes
-    glm::vec4 v1;      // 16 bytes  
-    glm::vec4 v2;      // 16 bytes
-    glm::vec4 n0;      // 16 bytes
-    glm::vec4 n1;      // 16 bytes
-    glm::vec4 n2;      // 16 bytes
-    int materialID;                     // 4 bytes
-    float cx, cy, cz;               // centroid for bvh
-    // Total: 112 bytes
+// A triangle as three indices into the shared vertex arrays of an
+// IndexedGeometry. Must match IndexedTriangle in rt_scene.glsl.
+struct IndexedTriangle {
+    uint32_t v0, v1, v2;    // 12 bytes
+    int materialID;         // 4 bytes
+    // Total: 16 bytes
+};
+static_assert(sizeof(IndexedTriangle) == 16, "IndexedTriangle must be 16 bytes");
+
+// The attributes of a vertex only shading reads, fetched once for the
+// closest hit. Must match VertexShading in rt_geometry.glsl.
+struct VertexShading {
+    glm::vec4 tangent;      // 16 bytes, along +u. w: bitangent sign. Zero without UVs
+    glm::vec2 texcoord;     // 8 bytes, (0, 0) without UVs
+    glm::vec2 pad;          // 8 bytes
+    // Total: 32 bytes
+};
+static_assert(sizeof(VertexShading) == 32, "VertexShading must be 32 bytes");
+
+// Every mesh's vertices and triangles, shared by all of its faces instead of
+// expanded per triangle. Uploaded as is, one buffer per array.
+struct IndexedGeometry {
+    std::vector<glm::vec4> positions;   // w unused
+    std::vector<glm::vec4> normals;     // w unused
+    std::vector<VertexShading> shading;
+    std::vector<IndexedTriangle> triangles;
+
+    glm::vec3 position(uint32_t vertex) const { return glm::vec3(positions[vertex]); }
 };
-static_assert(sizeof(Triangle) == 112, "Triangle must be 112 bytes");
+
+// Intersection-only copy of a triangle, stored in BVH leaf order so traversal
+// reads it directly instead of going through primitiveIndices and the vertex
+// indices. The indexed triangle is only fetched once, for the closest hit.
+struct IsectTriangle {
+    glm::vec4 v0;      // 16 bytes, w: index into the triangle array (int bits)
+    glm::vec4 e1;      // 16 bytes, v1 - v0. w: intersection epsilon
+    glm::vec4 e2;      // 16 bytes, v2 - v0. w unused
+    // Total: 48 bytes
+};
+static_assert(sizeof(IsectTriangle) == 48, "IsectTriangle must be 48 bytes");
+
+static IsectTriangle MakeIsectTriangle(const IndexedGeometry& geometry, int triangleIndex) {
+    const IndexedTriangle& tri = geometry.triangles[triangleIndex];
+    glm::vec3 v0 = geometry.position(tri.v0);
+    glm::vec3 e1 = geometry.position(tri.v1) - v0;
+    glm::vec3 e2 = geometry.position(tri.v2) - v0;
+
+    IsectTriangle isect;
+    float w;
+    std::memcpy(&w, &triangleIndex, sizeof(float));
+    isect.v0 = glm::vec4(v0, w);
+
+    // Degenerate-triangle tolerance derived from the area
+    float area = glm::length(glm::cross(e1, e2)) * 0.5f;
+    isect.e1 = glm::vec4(e1, std::max(1e-8f, area * 1e-5f));
+    isect.e2 = glm::vec4(e2, 0.0f);
+    return isect;
+}
 
 struct Sphere {
     float center_x, center_y, center_z, center_w;  // 16 bytes (vec3 + padding)
@@ -32,15 +83,26 @@ enum MaterialType {
     Emissive
 };
 
+// Texture indices are into the scene's TextureSet, -1 for none. Textures
+// multiply the constants: albedo by the sRGB colour, roughness and metallic by
+// the green and blue channels (glTF packing). Texture coordinates are scaled
+// and offset first, to tile a texture or pick this material's rectangle of an atlas.
 struct Material {
-    float albedo_x, albedo_y, albedo_z, albedo_w;  // 16 bytes (vec3 + padding)
+    float albedo_x, albedo_y, albedo_z;             // 12 bytes
+    float metallic;                                 // 4 bytes, Metal only
     int type;                                       // 4 bytes
     float emissionStrength;                         // 4 bytes  
-    float fuzz;                                     // 4 bytes
+    float roughness;                                // 4 bytes, GGX for Metal and Dielectric
     float refractionIndex;                          // 4 bytes
-    // Total: 32 bytes
+    int albedoTexture = -1;                         // 4 bytes
+    int roughnessTexture = -1;                      // 4 bytes, metallic-roughness
+    int normalTexture = -1;                         // 4 bytes, tangent space
+    int pad0 = 0;                                   // 4 bytes
+    float uvScale_x = 1.0f, uvScale_y = 1.0f;       // 8 bytes
+    float uvOffset_x = 0.0f, uvOffset_y = 0.0f;     // 8 bytes
+    // Total: 64 bytes
 };
-static_assert(sizeof(Material) == 32, "Material must be 32 bytes");
+static_assert(sizeof(Material) == 64, "Material must be 64 bytes");
 
 struct BVHNode {
     glm::vec4 min;  // 16 bytes
@@ -52,14 +114,63 @@ struct BVHNode {
 };
 static_assert(sizeof(BVHNode) == 48, "BVHNode must be 48 bytes");
 
+// Branching factor of the compressed wide BVH uploaded to the shader.
+// 4 or 8; must match BVH_WIDTH in rt_scene.glsl.
+constexpr int BVH_WIDTH = 4;
+
+// Compressed wide BVH node, in the spirit of Ylitie et al. 2017 ("Efficient
+// Incoherent Ray Traversal on GPUs Through Compressed Wide BVHs"). Child
+// boxes are stored as 8-bit offsets from the node origin, scaled per axis by
+// a power of two, so one fetch brings in every child's bounds.
+// A child index >= 0 is an interior node; < 0 is a leaf with primitives
+// starting at -(index + 1), leafCount of them.
+template <int Width>
+struct alignas(16) WideBVHNodeT {
+    glm::vec3 origin;                   // 12 bytes
+    uint8_t exponent[3];                // 3 bytes, biased by 127
+    uint8_t childCount;                 // 1 byte
+    int32_t children[Width];            // 4 * Width bytes
+    uint8_t leafCount[Width];           // Width bytes, 0 for interior children
+    uint8_t qlo[3][Width];              // 3 * Width bytes, per axis
+    uint8_t qhi[3][Width];              // 3 * Width bytes, per axis
+    // Total: 64 bytes for BVH4, 112 bytes for BVH8 (vs. 24 bytes per child for BVHNode)
+};
+static_assert(sizeof(WideBVHNodeT<4>) == 64, "WideBVHNodeT<4> must be 64 bytes");
+static_assert(sizeof(WideBVHNodeT<8>) == 112, "WideBVHNodeT<8> must be 112 bytes");
+
+using WideBVHNode = WideBVHNodeT<BVH_WIDTH>;
+
+// What a bottom-level BVH is built over. Must match INSTANCE_* in rt_scene.glsl.
+enum InstancePrimType {
+    InstanceTriangles,
+    InstanceSpheres
+};
+
+// An instance of a mesh's bottom-level BVH placed in the world. Must match
+// Instance in rt_scene.glsl. Rays are moved into object space with modelInv,
+// so the same BLAS can be placed any number of times.
+struct GPUInstance {
+    glm::mat4 model;
+    glm::mat4 modelInv;
+    int blasRoot;       // root node in the BVHNodes buffer
+    int wideRoot;       // root node in the WideBVHNodes buffer
+    int firstTri;       // used by the brute force fallback
+    int triCount;
+    int materialID;     // overrides the triangles' material when >= 0
+    int primType;       // InstancePrimType
+    int pad1, pad2;
+    // Total: 160 bytes
+};
+static_assert(sizeof(GPUInstance) == 160, "GPUInstance must be 160 bytes");
+
 struct MeshInstance {
     std::string name;
-    size_t firstTri = 0;
+    int meshID = -1;        // which bottom-level BVH this instance places
+    size_t firstTri = 0;    // object-space triangles of that mesh in the shared geometry
     size_t triCount = 0;
     glm::mat4 model = glm::mat4(1.0f);
     glm::mat4 modelInv = glm::mat4(1.0f);
     int materialID = -1;
-    std::vector<Triangle> originalTris;
 
     // Transform components
     glm::vec3 position = glm::vec3(0.0f);
@@ -75,34 +186,7 @@ struct MeshInstance {
         m = glm::scale(m, scale);
         model = m;
         modelInv = glm::inverse(m);
-        for (Triangle& tri : originalTris) {
-            tri.materialID = materialID;
-        }
     }
 };
 
-static void ApplyTransform(const std::vector<Triangle>& src,
-    std::vector<Triangle>& dst,
-    const glm::mat4& M)
-{
-    dst.resize(src.size());
-    const glm::mat3 N = glm::transpose(glm::inverse(glm::mat3(M)));
-
-    auto xformP = [&](const glm::vec3& p) {
-        glm::vec4 r = M * glm::vec4(p.x, p.y, p.z, 1.0f);
-        return glm::vec4{ (float)r.x, (float)r.y, (float)r.z, 0.0f };
-        };
-    auto xformN = [&](const glm::vec3& n) {
-        glm::vec3 r = glm::normalize(N * glm::vec3(n.x, n.y, n.z));
-        return glm::vec4{ (float)r.x, (float)r.y, (float)r.z, 0.0f };
-        };
-
-    for (size_t i = 0; i < src.size(); ++i) {
-        Triangle t = src[i];
-        t.v0 = xformP(t.v0); t.v1 = xformP(t.v1); t.v2 = xformP(t.v2);
-        t.n0 = xformN(t.n0); t.n1 = xformN(t.n1); t.n2 = xformN(t.n2);
-        dst[i] = t;
-    }
-}
-
 #endif // RT_STRUCTS_H
\ No newline at end of file
@@ -0,0 +1,322 @@
+#ifndef RT_TEXTURES_H
+#define RT_TEXTURES_H
+
+#include <glad2/gl.h>
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "includes/shader.h"
+#include "rt_threadpool.h"
+
+// Every material texture of the scene, sampled by index from the ray
+// tracing shaders (rt_textures.glsl).
+//
+// With GL_ARB_bindless_texture each image is its own mipmapped texture,
+// rounded up to a power-of-two square, and the shaders fetch its handle from
+// a uniform block (binding 0; the ray tracing shaders are out of storage
+// blocks). Without it, every image is resampled to the largest of those sizes
+// and becomes a layer of a single 2D array texture. Both are BC7 compressed
+// by the driver when it allows that, RGBA8 otherwise, and keep a full mip
+// chain for the ray-cone LOD to choose from.
+//
+// Images are stored as decoded; albedo textures are sRGB and the shaders
+// linearize them, the rest are linear data.
+class TextureSet {
+public:
+	static constexpr int MAX_SIZE = 2048;     // larger images are downsampled on upload
+	static constexpr int MAX_BINDLESS = 2048; // must match MAX_BINDLESS_TEXTURES in rt_textures.glsl
+
+	TextureSet() = default;
+	~TextureSet() { release(); }
+
+	TextureSet(const TextureSet&) = delete;
+	TextureSet& operator=(const TextureSet&) = delete;
+
+	// Decodes every image, on worker threads. An image that fails to load
+	// becomes a white texel with a message, so indices into the set stay valid.
+	// Touches no GL state.
+	void load(const std::vector<std::string>& paths) {
+		images.assign(paths.size(), Image());
+
+		ThreadPool pool(std::max(1, (int)std::thread::hardware_concurrency() - 1));
+		ThreadPool::TaskGroup group;
+		for (size_t i = 0; i < paths.size(); i++) {
+			pool.run(group, [this, &paths, i] {
+				Image& image = images[i];
+				stbi_set_flip_vertically_on_load_thread(false); // first row is v = 0, as aiProcess_FlipUVs has it
+				int channels;
+				unsigned char* data = stbi_load(paths[i].c_str(), &image.width, &image.height, &channels, 4);
+				if (!data) {
+					std::cout << "Failed to load texture: " << paths[i] << " (" << stbi_failure_reason() << ")" << std::endl;
+					image.width = image.height = 1;
+					image.pixels.assign(4, 255);
+					return;
+				}
+				image.pixels.assign(data, data + (size_t)image.width * image.height * 4);
+				stbi_image_free(data);
+			});
+		}
+		pool.wait(group);
+	}
+
+	// Creates the GL side of whatever load() decoded, bindless when the driver
+	// supports it. Must happen before the ray tracing shaders compile, since
+	// shaderDefines() depends on it.
+	void upload() {
+		release();
+		bindless = !images.empty() && (int)images.size() <= MAX_BINDLESS &&
+			hasExtension("GL_ARB_bindless_texture") && loadBindlessFunctions();
+
+		const GLenum formats[] = { GL_COMPRESSED_RGBA_BPTC_UNORM, GL_RGBA8 };
+		for (GLenum format : formats) {
+			if (bindless ? createBindless(format) : createArray(format)) {
+				compressed = format == GL_COMPRESSED_RGBA_BPTC_UNORM;
+				break;
+			}
+			release();
+		}
+
+#ifdef RT_DEBUG
+		std::cout << "Material textures: " << images.size()
+			<< (bindless ? " bindless" : " in a " + std::to_string(layerSize) + "x" + std::to_string(layerSize) + " array")
+			<< (compressed ? ", BC7" : ", RGBA8") << std::endl;
+#endif
+		images.clear(); // everything lives on the GPU now
+	}
+
+	// For shader::globalDefines(): which of the two paths rt_textures.glsl takes.
+	std::string shaderDefines() const {
+		return bindless ? "#extension GL_ARB_bindless_texture : require\n#define RT_BINDLESS_TEXTURES\n" : "";
+	}
+
+	// Binds the array texture for a ray tracing shader. Bindless handles are
+	// resident already, and their uniform buffer stays bound.
+	void bind(const shader& s, int unit) const {
+		if (bindless) return;
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, arrayTexture);
+		s.setInt("u_materialTextures", unit);
+	}
+
+	bool isBindless() const { return bindless; }
+
+private:
+	struct Image {
+		int width = 0, height = 0;
+		std::vector<uint8_t> pixels; // RGBA8, first row first
+	};
+
+	std::vector<Image> images;
+	bool bindless = false;
+	bool compressed = false;
+
+	// Array path
+	GLuint arrayTexture = 0;
+	int layerSize = 0;
+
+	// Bindless path
+	std::vector<GLuint> textures;
+	std::vector<GLuint64> handles;
+	GLuint handleUBO = 0;
+
+	// ARB_bindless_texture entry points. The GLAD loader in this project is
+	// generated without extensions, so they are looked up here.
+	typedef GLuint64(GLAD_API_PTR* GetTextureHandleProc)(GLuint texture);
+	typedef void (GLAD_API_PTR* TextureHandleProc)(GLuint64 handle);
+	GetTextureHandleProc getTextureHandle = nullptr;
+	TextureHandleProc makeResident = nullptr;
+	TextureHandleProc makeNonResident = nullptr;
+
+	static bool hasExtension(const char* name) {
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; i++) {
+			const char* extension = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+			if (extension && std::strcmp(extension, name) == 0) return true;
+		}
+		return false;
+	}
+
+	bool loadBindlessFunctions() {
+		getTextureHandle = reinterpret_cast<GetTextureHandleProc>(glfwGetProcAddress("glGetTextureHandleARB"));
+		makeResident = reinterpret_cast<TextureHandleProc>(glfwGetProcAddress("glMakeTextureHandleResidentARB"));
+		makeNonResident = reinterpret_cast<TextureHandleProc>(glfwGetProcAddress("glMakeTextureHandleNonResidentARB"));
+		return getTextureHandle && makeResident && makeNonResident;
+	}
+
+	static int powerOfTwoSize(int size) {
+		int p = 1;
+		while (p < size && p < MAX_SIZE) p *= 2;
+		return p;
+	}
+
+	static int mipCount(int width, int height) {
+		int levels = 1;
+		while ((width | height) >> levels) levels++;
+		return levels;
+	}
+
+	// Resamples to width x height: bilinear when enlarging, a box average over
+	// each texel's footprint when shrinking (only images above MAX_SIZE shrink).
+	static std::vector<uint8_t> resample(const Image& image, int width, int height) {
+		if (image.width == width && image.height == height) return image.pixels;
+
+		std::vector<uint8_t> out((size_t)width * height * 4);
+		const float sx = (float)image.width / width;
+		const float sy = (float)image.height / height;
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				float sum[4] = {};
+				if (sx > 1.0f || sy > 1.0f) {
+					const int x0 = (int)(x * sx), x1 = std::max(x0 + 1, (int)((x + 1) * sx));
+					const int y0 = (int)(y * sy), y1 = std::max(y0 + 1, (int)((y + 1) * sy));
+					for (int j = y0; j < std::min(y1, image.height); j++) {
+						for (int i = x0; i < std::min(x1, image.width); i++) {
+							for (int c = 0; c < 4; c++) sum[c] += image.pixels[((size_t)j * image.width + i) * 4 + c];
+						}
+					}
+					const float n = (float)((std::min(x1, image.width) - x0) * (std::min(y1, image.height) - y0));
+					for (int c = 0; c < 4; c++) sum[c] /= n;
+				}
+				else {
+					// Wraps at the edges, like the REPEAT sampling it will get
+					const float fx = (x + 0.5f) * sx - 0.5f, fy = (y + 0.5f) * sy - 0.5f;
+					const int ix = (int)std::floor(fx), iy = (int)std::floor(fy);
+					const float tx = fx - ix, ty = fy - iy;
+					for (int j = 0; j < 2; j++) {
+						for (int i = 0; i < 2; i++) {
+							const int px = ((ix + i) % image.width + image.width) % image.width;
+							const int py = ((iy + j) % image.height + image.height) % image.height;
+							const float w = (i ? tx : 1.0f - tx) * (j ? ty : 1.0f - ty);
+							for (int c = 0; c < 4; c++) sum[c] += w * image.pixels[((size_t)py * image.width + px) * 4 + c];
+						}
+					}
+				}
+				for (int c = 0; c < 4; c++) out[((size_t)y * width + x) * 4 + c] = (uint8_t)std::min(255.0f, sum[c] + 0.5f);
+			}
+		}
+		return out;
+	}
+
+	// The next mip level of a power-of-two image, by 2x2 box filter.
+	static std::vector<uint8_t> halve(const std::vector<uint8_t>& pixels, int width, int height) {
+		const int w = std::max(1, width / 2), h = std::max(1, height / 2);
+		const int stepX = width > 1 ? 1 : 0, stepY = height > 1 ? 1 : 0;
+		std::vector<uint8_t> out((size_t)w * h * 4);
+		for (int y = 0; y < h; y++) {
+			for (int x = 0; x < w; x++) {
+				const size_t a = ((size_t)(2 * y) * width + 2 * x) * 4;
+				const size_t b = a + stepX * 4;
+				const size_t c = a + (size_t)stepY * width * 4;
+				const size_t d = c + stepX * 4;
+				for (int k = 0; k < 4; k++) {
+					out[((size_t)y * w + x) * 4 + k] = (uint8_t)((pixels[a + k] + pixels[b + k] + pixels[c + k] + pixels[d + k] + 2) / 4);
+				}
+			}
+		}
+		return out;
+	}
+
+	static void setSamplerState(GLenum target) {
+		glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	}
+
+	// Uploads image's mip chain into layer (or the whole texture for a 2D
+	// target). The driver compresses for a BC7 format. False on a GL error.
+	static bool uploadLevels(GLenum target, std::vector<uint8_t> pixels, int size, int layer) {
+		for (int level = 0, w = size, h = size; ; level++) {
+			if (target == GL_TEXTURE_2D_ARRAY)
+				glTexSubImage3D(target, level, 0, 0, layer, w, h, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+			else
+				glTexSubImage2D(target, level, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+			if (w == 1 && h == 1) break;
+			pixels = halve(pixels, w, h);
+			w = std::max(1, w / 2);
+			h = std::max(1, h / 2);
+		}
+		return glGetError() == GL_NO_ERROR;
+	}
+
+	bool createArray(GLenum format) {
+		while (glGetError() != GL_NO_ERROR) {}
+
+		layerSize = 1;
+		for (const Image& image : images) layerSize = std::max(layerSize, powerOfTwoSize(std::max(image.width, image.height)));
+
+		glGenTextures(1, &arrayTexture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, arrayTexture);
+		const int layers = std::max(1, (int)images.size()); // an empty set still binds a white layer
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY, mipCount(layerSize, layerSize), format, layerSize, layerSize, layers);
+		setSamplerState(GL_TEXTURE_2D_ARRAY);
+
+		bool ok = glGetError() == GL_NO_ERROR;
+		if (images.empty()) {
+			ok = ok && uploadLevels(GL_TEXTURE_2D_ARRAY, std::vector<uint8_t>(4, 255), 1, 0);
+		}
+		for (size_t i = 0; ok && i < images.size(); i++) {
+			ok = uploadLevels(GL_TEXTURE_2D_ARRAY, resample(images[i], layerSize, layerSize), layerSize, (int)i);
+		}
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		return ok;
+	}
+
+	// Square textures only, so every texture of the set has the same ray-cone LOD math
+	bool createBindless(GLenum format) {
+		while (glGetError() != GL_NO_ERROR) {}
+
+		for (const Image& image : images) {
+			const int size = powerOfTwoSize(std::max(image.width, image.height));
+			GLuint texture;
+			glGenTextures(1, &texture);
+			textures.push_back(texture);
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glTexStorage2D(GL_TEXTURE_2D, mipCount(size, size), format, size, size);
+			setSamplerState(GL_TEXTURE_2D);
+			if (glGetError() != GL_NO_ERROR || !uploadLevels(GL_TEXTURE_2D, resample(image, size, size), size, 0)) {
+				glBindTexture(GL_TEXTURE_2D, 0);
+				return false;
+			}
+
+			// A texture is immutable once it has a handle
+			const GLuint64 handle = getTextureHandle(texture);
+			if (handle == 0) return false;
+			makeResident(handle);
+			handles.push_back(handle);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		// Two handles per std140 uvec4, low word first. The buffer covers the whole block.
+		std::vector<GLuint64> block(MAX_BINDLESS, 0);
+		std::copy(handles.begin(), handles.end(), block.begin());
+		glGenBuffers(1, &handleUBO);
+		glBindBuffer(GL_UNIFORM_BUFFER, handleUBO);
+		glBufferData(GL_UNIFORM_BUFFER, block.size() * sizeof(GLuint64), block.data(), GL_STATIC_DRAW);
+		glBindBufferBase(GL_UNIFORM_BUFFER, 0, handleUBO); // binding = 0
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		return glGetError() == GL_NO_ERROR;
+	}
+
+	void release() {
+		for (GLuint64 handle : handles) makeNonResident(handle);
+		handles.clear();
+		if (!textures.empty()) glDeleteTextures((GLsizei)textures.size(), textures.data());
+		textures.clear();
+		if (handleUBO) glDeleteBuffers(1, &handleUBO);
+		handleUBO = 0;
+		if (arrayTexture) glDeleteTextures(1, &arrayTexture);
+		arrayTexture = 0;
+	}
+};
+
+#endif // !RT_TEXTURES_H
@@ -0,0 +1,108 @@
+#ifndef RT_THREADPOOL_H
+#define RT_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small fork/join thread pool for CPU work such as BVH builds. Tasks are
+// grouped in a TaskGroup; wait() runs queued tasks on the calling thread until
+// the group is done, so tasks may spawn and wait on their own subtasks without
+// deadlocking the pool.
+class ThreadPool {
+public:
+	struct TaskGroup {
+		std::atomic<int> pending{ 0 };
+	};
+
+	// workerCount extra threads; the thread calling wait() is the last worker.
+	explicit ThreadPool(int workerCount) {
+		for (int i = 0; i < workerCount; i++) {
+			workers.emplace_back([this] { workerLoop(); });
+		}
+	}
+
+	~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& t : workers) t.join();
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void run(TaskGroup& group, std::function<void()> task) {
+		group.pending++;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.push_back([this, &group, task = std::move(task)] {
+				task();
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					group.pending--;
+				}
+				finished.notify_all();
+			});
+		}
+		wake.notify_one();
+		finished.notify_all(); // threads blocked in wait() can help too
+	}
+
+	// Helps with queued work until every task in the group has finished, and
+	// sleeps only when there's nothing left to help with.
+	void wait(TaskGroup& group) {
+		while (group.pending > 0) {
+			if (runOne()) continue;
+
+			std::unique_lock<std::mutex> lock(mutex);
+			finished.wait(lock, [&] { return group.pending == 0 || !tasks.empty(); });
+		}
+	}
+
+	int threadCount() const { return (int)workers.size() + 1; }
+
+private:
+	bool runOne() {
+		std::function<void()> task;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (tasks.empty()) return false;
+			// Newest first: keeps a thread working inside the subtree it just split
+			task = std::move(tasks.back());
+			tasks.pop_back();
+		}
+		task();
+		return true;
+	}
+
+	void workerLoop() {
+		while (true) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+				if (stopping && tasks.empty()) return;
+				// Oldest first: the biggest, least-split ranges
+				task = std::move(tasks.front());
+				tasks.pop_front();
+			}
+			task();
+		}
+	}
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable wake;      // new tasks for the workers
+	std::condition_variable finished;  // a task finished or was queued, for wait()
+	bool stopping = false;
+};
+
+#endif // !RT_THREADPOOL_H
@@ -0,0 +1,131 @@
+#ifndef RT_TILES_H
+#define RT_TILES_H
+
+#include <glad2/gl.h>
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+// Decides how much tracing each displayed frame does, so post-processing and
+// presentation only run at display rate while the ray pass keeps the GPU busy.
+//
+// A frame takes samplesPerFrame() samples per pixel. The fragment path takes
+// them all in one draw per band: the image is cut into bandCount() horizontal
+// bands drawn as separate, flushed sub-dispatches, so no single draw runs
+// longer than maxDispatchMs and trips the driver watchdog (TDR).
+//
+// When adaptive, the sample count is picked from the measured cost of a
+// sample (GL_TIME_ELAPSED around the ray pass, read back a few frames late so
+// it never stalls) to fill targetFrameMs.
+class TileScheduler {
+public:
+	static constexpr int FRAME_LATENCY = 3;
+	static constexpr int MIN_BAND_HEIGHT = 16; // a tile row of the adaptive sampler
+
+	bool adaptive = true;
+	float targetFrameMs = 33.0f;  // ray pass budget per displayed frame
+	float maxDispatchMs = 100.0f; // longest single draw, far below the ~2 s TDR limit
+	int fixedSamples = 1;         // samples per frame when not adaptive
+	int maxSamples = 64;          // cap on the adaptive sample count
+
+	TileScheduler(int width, int height) : width(width), height(height) {
+		glGenQueries(FRAME_LATENCY, queries);
+	}
+
+	~TileScheduler() {
+		glDeleteQueries(FRAME_LATENCY, queries);
+	}
+
+	TileScheduler(const TileScheduler&) = delete;
+	TileScheduler& operator=(const TileScheduler&) = delete;
+
+	// A new image size. The sample cost is carried over in proportion to the
+	// pixel count, and timings still in flight, taken at the old size, are dropped.
+	void resize(int newWidth, int newHeight) {
+		if (costMs > 0.0f) costMs *= (float)newWidth * newHeight / ((float)width * height);
+		for (bool& p : pending) p = false;
+		width = newWidth;
+		height = newHeight;
+	}
+
+	// Folds in any finished timing, then plans this frame. At most sampleLimit
+	// samples are taken, for callers that need an exact total.
+	void beginFrame(int sampleLimit = INT_MAX) {
+		for (int i = 0; i < FRAME_LATENCY; i++) {
+			if (!pending[i]) continue;
+			GLint available = 0;
+			glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) continue;
+
+			GLuint64 ns = 0;
+			glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &ns);
+			const float ms = (float)(ns / 1.0e6) / pendingSamples[i];
+			costMs = costMs > 0.0f ? costMs + 0.25f * (ms - costMs) : ms; // smoothed
+			pending[i] = false;
+		}
+
+		if (!adaptive) samples = fixedSamples;
+		else if (costMs <= 0.0f) samples = 1; // nothing measured yet
+		else samples = std::min((int)(targetFrameMs / costMs), maxSamples);
+		samples = std::max(1, std::min(samples, sampleLimit));
+
+		// Enough bands that each draw stays under the dispatch limit
+		const int maxBands = std::max(1, height / MIN_BAND_HEIGHT);
+		bands = costMs > 0.0f ? (int)std::ceil(costMs * samples / maxDispatchMs) : 1;
+		bands = std::max(1, std::min(bands, maxBands));
+	}
+
+	// Brackets the frame's ray pass.
+	void beginTiming() {
+		if (pending[slot]) return; // the GPU is over FRAME_LATENCY frames behind, skip
+		glBeginQuery(GL_TIME_ELAPSED, queries[slot]);
+		timing = true;
+	}
+
+	void endTiming() {
+		if (timing) {
+			glEndQuery(GL_TIME_ELAPSED);
+			pending[slot] = true;
+			pendingSamples[slot] = samples;
+			timing = false;
+		}
+		slot = (slot + 1) % FRAME_LATENCY;
+	}
+
+	int samplesPerFrame() const { return samples; }
+	int bandCount() const { return bands; }
+
+	// Rows of band i, as a scissor rectangle's y and height.
+	void bandRows(int i, int& y, int& rows) const {
+		// Whole tile rows per band, so adaptive tiles are not split
+		const int tileRows = (height + MIN_BAND_HEIGHT - 1) / MIN_BAND_HEIGHT;
+		const int first = tileRows * i / bands;
+		const int last = tileRows * (i + 1) / bands;
+		y = first * MIN_BAND_HEIGHT;
+		rows = std::min(height, last * MIN_BAND_HEIGHT) - y;
+	}
+
+	// GPU milliseconds per full-image sample, 0 before the first measurement.
+	float sampleCostMs() const { return costMs; }
+
+	// Full-image samples per second the ray pass manages, in pixels.
+	double samplesPerSecond() const {
+		return costMs > 0.0f ? (double)width * height * 1000.0 / costMs : 0.0;
+	}
+
+private:
+	int width, height;
+
+	GLuint queries[FRAME_LATENCY];
+	bool pending[FRAME_LATENCY] = {};
+	int pendingSamples[FRAME_LATENCY] = {};
+	int slot = 0;
+	bool timing = false;
+
+	float costMs = 0.0f;
+	int samples = 1;
+	int bands = 1;
+};
+
+#endif // !RT_TILES_H
@@ -0,0 +1,216 @@
+#ifndef RT_UPLOAD_H
+#define RT_UPLOAD_H
+
+#include <glad2/gl.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+// Streams CPU-side edits into existing GPU buffers without stalling on them.
+//
+// A persistently mapped staging buffer is split into three regions, one per
+// frame in flight. Uploads are copied into the current frame's region and
+// then into their destination with glCopyBufferSubData, so the draw thread
+// never waits for the GPU to finish reading a buffer it wants to change. A
+// fence per region makes sure a region is only reused once the copies made
+// from it have executed.
+//
+// Without GL 4.4 (glBufferStorage), or for an upload too big for what's left
+// of the region, it falls back to glBufferSubData.
+class UploadRing {
+public:
+	explicit UploadRing(GLsizeiptr regionSize = 4 * 1024 * 1024) : regionSize(regionSize) {
+		if (!GLAD_GL_VERSION_4_4) {
+			std::cout << "UploadRing: GL 4.4 unavailable, falling back to glBufferSubData" << std::endl;
+			return;
+		}
+
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glGenBuffers(1, &staging);
+		glBindBuffer(GL_COPY_READ_BUFFER, staging);
+		glBufferStorage(GL_COPY_READ_BUFFER, regionSize * REGIONS, nullptr, flags);
+		mapped = static_cast<char*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, regionSize * REGIONS, flags));
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+		if (!mapped) {
+			std::cout << "UploadRing: failed to map staging buffer, falling back to glBufferSubData" << std::endl;
+			glDeleteBuffers(1, &staging);
+			staging = 0;
+		}
+	}
+
+	~UploadRing() {
+		for (GLsync& fence : fences) {
+			if (fence) glDeleteSync(fence);
+		}
+		if (staging) {
+			glBindBuffer(GL_COPY_READ_BUFFER, staging);
+			glUnmapBuffer(GL_COPY_READ_BUFFER);
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			glDeleteBuffers(1, &staging);
+		}
+	}
+
+	UploadRing(const UploadRing&) = delete;
+	UploadRing& operator=(const UploadRing&) = delete;
+
+	// Call once per frame before any upload. Only blocks if the GPU is still
+	// reading from this region, three frames later.
+	void beginFrame() {
+		regionOffset = 0;
+		GLsync& fence = fences[region];
+		if (!fence) return;
+
+		GLenum status = glClientWaitSync(fence, 0, 0);
+		while (status == GL_TIMEOUT_EXPIRED) {
+			status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1 ms
+		}
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+
+	// Copies size bytes of data to [offset, offset + size) of buffer.
+	void upload(GLuint buffer, GLintptr offset, GLsizeiptr size, const void* data) {
+		if (size <= 0 || !buffer) return;
+
+		// Copy offsets stay 16-byte aligned for the driver's sake
+		const GLsizeiptr aligned = (size + 15) & ~GLsizeiptr(15);
+		if (!mapped || regionOffset + aligned > regionSize) {
+			glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+			glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+			return;
+		}
+
+		const GLintptr src = region * regionSize + regionOffset;
+		std::memcpy(mapped + src, data, size);
+		regionOffset += aligned;
+
+		glBindBuffer(GL_COPY_READ_BUFFER, staging);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, src, offset, size);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	// Call once per frame after the last upload and the frame's GPU work.
+	void endFrame() {
+		if (!mapped) return;
+		if (regionOffset > 0) {
+			fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+		region = (region + 1) % REGIONS;
+	}
+
+private:
+	static constexpr int REGIONS = 3;
+
+	GLsizeiptr regionSize;
+	GLuint staging = 0;
+	char* mapped = nullptr;
+	int region = 0;
+	GLsizeiptr regionOffset = 0;
+	GLsync fences[REGIONS] = { nullptr, nullptr, nullptr };
+};
+
+// Element ranges of one CPU-side array that have changed since its last
+// upload. Overlapping and adjacent ranges are merged when flushed, so each
+// contiguous edited span costs one copy.
+class DirtyRanges {
+public:
+	void mark(size_t first, size_t count) {
+		if (count > 0) ranges.emplace_back(first, first + count);
+	}
+
+	bool empty() const { return ranges.empty(); }
+
+	// Uploads every dirty span of data to the same element offsets in buffer.
+	template <typename T>
+	void flush(UploadRing& ring, GLuint buffer, const std::vector<T>& data) {
+		if (ranges.empty()) return;
+
+		std::sort(ranges.begin(), ranges.end());
+		size_t begin = ranges[0].first;
+		size_t end = ranges[0].second;
+		for (size_t i = 1; i <= ranges.size(); i++) {
+			if (i < ranges.size() && ranges[i].first <= end) {
+				end = std::max(end, ranges[i].second);
+				continue;
+			}
+
+			end = std::min(end, data.size());
+			if (begin < end) {
+				ring.upload(buffer, begin * sizeof(T), (end - begin) * sizeof(T), data.data() + begin);
+			}
+			if (i < ranges.size()) {
+				begin = ranges[i].first;
+				end = ranges[i].second;
+			}
+		}
+		ranges.clear();
+	}
+
+private:
+	std::vector<std::pair<size_t, size_t>> ranges; // [first, end)
+};
+
+// An SSBO that a CPU-side array is appended to over time, e.g. as meshes
+// finish loading. Elements only ever go on the end, so an append uploads just
+// the new range through the ring. When the array outgrows the buffer, a
+// buffer twice the size takes its place and the old contents are copied over
+// on the GPU, keeping appends amortized constant time and off the CPU.
+class GrowableBuffer {
+public:
+	explicit GrowableBuffer(GLuint binding) : binding(binding) {}
+
+	~GrowableBuffer() {
+		if (buffer) glDeleteBuffers(1, &buffer);
+	}
+
+	GrowableBuffer(const GrowableBuffer&) = delete;
+	GrowableBuffer& operator=(const GrowableBuffer&) = delete;
+
+	// Uploads data[uploaded, data.size()), the elements added since the last call.
+	template <typename T>
+	void append(UploadRing& ring, const std::vector<T>& data) {
+		const GLsizeiptr size = (GLsizeiptr)(data.size() * sizeof(T));
+		if (size <= uploadedBytes) return;
+		reserve(size);
+		ring.upload(buffer, uploadedBytes, size - uploadedBytes, reinterpret_cast<const char*>(data.data()) + uploadedBytes);
+		uploadedBytes = size;
+	}
+
+	GLuint id() const { return buffer; }
+
+private:
+	void reserve(GLsizeiptr size) {
+		if (size <= capacity) return;
+		const GLsizeiptr newCapacity = std::max(size, capacity * 2);
+
+		GLuint grown;
+		glGenBuffers(1, &grown);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+		glBufferData(GL_COPY_WRITE_BUFFER, newCapacity, nullptr, GL_STATIC_DRAW);
+		if (buffer) {
+			glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, uploadedBytes);
+			glBindBuffer(GL_COPY_READ_BUFFER, 0);
+			glDeleteBuffers(1, &buffer); // deletion waits for the copy
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		buffer = grown;
+		capacity = newCapacity;
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+	}
+
+	GLuint binding;
+	GLuint buffer = 0;
+	GLsizeiptr capacity = 0;
+	GLsizeiptr uploadedBytes = 0;
+};
+
+#endif // !RT_UPLOAD_H
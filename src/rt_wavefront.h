@@ -0,0 +1,230 @@
+#ifndef RT_WAVEFRONT_H
+#define RT_WAVEFRONT_H
+
+#include <glad2/gl.h>
+
+#include <algorithm>
+#include <functional>
+#include <initializer_list>
+#include <iostream>
+
+#include "includes/shader.h"
+
+// GPU layout of a path slot. Must match PathState in wavefront_common.glsl.
+struct WavefrontPathState {
+	glm::vec4 origin;
+	glm::vec4 direction;
+	glm::vec4 throughput;
+	glm::vec4 radiance;
+	glm::vec4 hitPoint;
+	glm::vec4 hitNormal;
+	int hitInfo[4];
+	glm::vec4 albedo;
+	glm::vec4 normalDepth;
+	glm::vec4 texcoord;
+	// Total: 160 bytes
+};
+static_assert(sizeof(WavefrontPathState) == 160, "WavefrontPathState must be 160 bytes");
+
+// One side of the accumulation ping-pong: the colour average, its luminance
+// moments (rt_adaptive.glsl) and the first-hit G-buffer (rt_gbuffer.glsl).
+struct AccumulationTargets {
+	GLuint color;       // RGBA32F
+	GLuint moments;     // RGBA32F
+	GLuint albedo;      // RGBA16F
+	GLuint normalDepth; // RGBA32F
+};
+
+// An alternative to the full-screen fragment "megakernel". Instead of every
+// pixel running its whole path in one shader invocation, each bounce is split
+// into separate compute dispatches:
+//
+//   generate   -> one primary ray per pixel, pushed onto a ray queue
+//   extend     -> BVH traversal for every queued ray, hits sorted by material
+//   shade      -> one dispatch per material type, surviving rays re-queued
+//   accumulate -> progressive average into the accumulation texture
+//
+// Queues live in an SSBO and are sized with atomic counters on the GPU; the
+// dispatch kernel turns those counts into indirect dispatch arguments so the
+// CPU never waits on a readback. Glass and metal paths no longer stall the
+// lanes of diffuse paths, which is where the fragment path loses most of its time.
+class WavefrontTracer {
+public:
+	// Mirrors MAX_BOUNCES in rt_common.glsl.
+	static constexpr int MAX_BOUNCES = 50;
+
+	// Bounce dispatches per frame, the u_maxBounces the fragment path also gets.
+	void setMaxBounces(int bounces) { maxBounces = std::max(1, std::min(bounces, (int)MAX_BOUNCES)); }
+
+	WavefrontTracer(int width, int height)
+		: generateKernel("src/shaders/wavefront_generate.comp"),
+		dispatchKernel("src/shaders/wavefront_dispatch.comp"),
+		extendKernel("src/shaders/wavefront_extend.comp"),
+		shadeKernel("src/shaders/wavefront_shade.comp"),
+		accumulateKernel("src/shaders/wavefront_accumulate.comp") {
+		glGenBuffers(1, &pathSSBO);
+		glGenBuffers(1, &queueSSBO);
+		resize(width, height);
+	}
+
+	~WavefrontTracer() {
+		glDeleteBuffers(1, &pathSSBO);
+		glDeleteBuffers(1, &queueSSBO);
+	}
+
+	// Compiles the kernels again, e.g. once shader::globalDefines() has changed.
+	void reloadKernels() {
+		for (const shader* kernel : { &generateKernel, &dispatchKernel, &extendKernel, &shadeKernel, &accumulateKernel })
+			glDeleteProgram(kernel->ID);
+		generateKernel = shader("src/shaders/wavefront_generate.comp");
+		dispatchKernel = shader("src/shaders/wavefront_dispatch.comp");
+		extendKernel = shader("src/shaders/wavefront_extend.comp");
+		shadeKernel = shader("src/shaders/wavefront_shade.comp");
+		accumulateKernel = shader("src/shaders/wavefront_accumulate.comp");
+	}
+
+	// Hot reload: rebuilds the kernels whose files were saved since, keeping
+	// any that fail to compile. Returns whether one was replaced.
+	bool reloadChangedKernels() {
+		bool reloaded = false;
+		for (shader* kernel : { &generateKernel, &dispatchKernel, &extendKernel, &shadeKernel, &accumulateKernel }) {
+			if (kernel->sourcesChanged()) reloaded |= kernel->reload();
+		}
+		return reloaded;
+	}
+
+	// One path slot per pixel. The buffers only grow, so dropping to a lower
+	// render resolution and back does not reallocate them.
+	void resize(int newWidth, int newHeight) {
+		width = newWidth;
+		height = newHeight;
+		pathCount = (GLuint)(width * height);
+		if (pathCount <= capacity) return;
+		capacity = pathCount;
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, pathSSBO);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * sizeof(WavefrontPathState), nullptr, GL_DYNAMIC_COPY);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, queueSSBO);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, QUEUE_HEADER_SIZE + QUEUE_COUNT * capacity * sizeof(GLuint),
+			nullptr, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+#ifdef RT_DEBUG
+		std::cout << "Wavefront tracer: " << capacity << " paths, "
+			<< (capacity * sizeof(WavefrontPathState) + QUEUE_COUNT * capacity * sizeof(GLuint)) / (1024 * 1024)
+			<< " MB of path state and queues" << std::endl;
+#endif
+	}
+
+	// Traces one sample per traced pixel. Reads the previous accumulation from
+	// read and writes the new one to write.
+	// setSceneUniforms must set the same camera/scene uniforms as the fragment path.
+	void render(const AccumulationTargets& read, const AccumulationTargets& write,
+		const std::function<void(const shader&)>& setSceneUniforms) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, pathSSBO);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, queueSSBO);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, queueSSBO);
+
+		// Reset queue counters
+		GLuint zero = 0;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, queueSSBO);
+		glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, QUEUE_COUNTS_OFFSET,
+			QUEUE_COUNT * sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		const GLuint groupsX = (width + 7) / 8;
+		const GLuint groupsY = (height + 7) / 8;
+
+		// Scene uniforms stay on each program for the whole frame
+		for (shader* kernel : { &generateKernel, &dispatchKernel, &extendKernel, &shadeKernel, &accumulateKernel }) {
+			kernel->use();
+			setSceneUniforms(*kernel);
+			kernel->setUInt("u_pathCount", pathCount);
+			kernel->setInt("u_currentQueue", 0);
+		}
+
+		// Ray generation
+		generateKernel.use();
+		glDispatchCompute(groupsX, groupsY, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+		int currentQueue = 0;
+		for (int bounce = 0; bounce < maxBounces; ++bounce) {
+			// Size the extend dispatch from the live ray count
+			dispatchKernel.use();
+			dispatchKernel.setInt("u_stage", 0);
+			dispatchKernel.setInt("u_currentQueue", currentQueue);
+			glDispatchCompute(1, 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+			// Extend
+			extendKernel.use();
+			extendKernel.setInt("u_currentQueue", currentQueue);
+			glDispatchComputeIndirect(0);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+			// Size one shade dispatch per material queue
+			dispatchKernel.use();
+			dispatchKernel.setInt("u_stage", 1);
+			glDispatchCompute(1, 1, 1);
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+			// Shade, one material at a time
+			shadeKernel.use();
+			shadeKernel.setInt("u_currentQueue", currentQueue);
+			for (int type = 0; type < MATERIAL_TYPE_COUNT; ++type) {
+				shadeKernel.setInt("u_materialType", type);
+				glDispatchComputeIndirect((GLintptr)((1 + type) * 4 * sizeof(GLuint)));
+			}
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+			currentQueue = 1 - currentQueue;
+		}
+
+		// Accumulate into the progressive average
+		accumulateKernel.use();
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, read.color);
+		accumulateKernel.setInt("u_accumulationTex", 0);
+		glActiveTexture(GL_TEXTURE6);
+		glBindTexture(GL_TEXTURE_2D, read.moments);
+		accumulateKernel.setInt("u_momentsTex", 6);
+		glActiveTexture(GL_TEXTURE7);
+		glBindTexture(GL_TEXTURE_2D, read.albedo);
+		accumulateKernel.setInt("u_albedoTex", 7);
+		glActiveTexture(GL_TEXTURE8);
+		glBindTexture(GL_TEXTURE_2D, read.normalDepth);
+		accumulateKernel.setInt("u_normalDepthTex", 8);
+		glBindImageTexture(0, write.color, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+		glBindImageTexture(1, write.moments, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+		glBindImageTexture(2, write.albedo, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+		glBindImageTexture(3, write.normalDepth, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+		glDispatchCompute(groupsX, groupsY, 1);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+	}
+
+private:
+	static constexpr int QUEUE_COUNT = 6;         // 2 ray queues + one per material type
+	static constexpr int MATERIAL_TYPE_COUNT = 4;  // MATERIAL_LAMBERTIAN .. MATERIAL_EMISSIVE
+	static constexpr GLintptr QUEUE_COUNTS_OFFSET = 5 * 4 * sizeof(GLuint); // after dispatchArgs[5]
+	static constexpr GLsizeiptr QUEUE_HEADER_SIZE = QUEUE_COUNTS_OFFSET + 8 * sizeof(GLuint);
+
+	int width = 0, height = 0;
+	int maxBounces = MAX_BOUNCES;
+	GLuint pathCount = 0;
+	GLuint capacity = 0; // path slots the buffers hold
+	GLuint pathSSBO = 0;
+	GLuint queueSSBO = 0;
+
+	shader generateKernel;
+	shader dispatchKernel;
+	shader extendKernel;
+	shader shadeKernel;
+	shader accumulateKernel;
+};
+
+#endif // !RT_WAVEFRONT_H
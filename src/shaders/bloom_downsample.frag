@@ -0,0 +1,73 @@
+#version 430 core
+out vec4 fragColor;
+in vec2 fragUV;
+
+// Downsampling half of the bloom pyramid: each level is filtered from the next
+// larger one with the 13-tap filter of [Jimenez 2014, "Next Generation Post
+// Processing in Call of Duty: Advanced Warfare"], five overlapping 2x2 boxes
+// read through bilinear taps. The first pass reads the full-resolution image,
+// keeps only what is brighter than the threshold and weights each box by its
+// Karis average, so a lone firefly does not flicker across the whole glow.
+
+uniform sampler2D u_sourceTex; // sampled with linear filtering
+uniform bool u_firstPass;
+uniform float u_threshold;
+
+float luminance(vec3 c) {
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+vec3 brightPass(vec3 c) {
+    return luminance(c) > u_threshold ? c : vec3(0.0);
+}
+
+vec3 tap(vec2 offset) {
+    vec3 c = texture(u_sourceTex, fragUV + offset).rgb;
+    return u_firstPass ? brightPass(c) : c;
+}
+
+float karisWeight(vec3 box) {
+    return 1.0 / (1.0 + luminance(box));
+}
+
+void main() {
+    vec2 t = 1.0 / vec2(textureSize(u_sourceTex, 0));
+
+    // a - b - c
+    // - j - k -
+    // d - e - f
+    // - l - m -
+    // g - h - i
+    vec3 a = tap(t * vec2(-2.0,  2.0));
+    vec3 b = tap(t * vec2( 0.0,  2.0));
+    vec3 c = tap(t * vec2( 2.0,  2.0));
+    vec3 d = tap(t * vec2(-2.0,  0.0));
+    vec3 e = tap(vec2(0.0));
+    vec3 f = tap(t * vec2( 2.0,  0.0));
+    vec3 g = tap(t * vec2(-2.0, -2.0));
+    vec3 h = tap(t * vec2( 0.0, -2.0));
+    vec3 i = tap(t * vec2( 2.0, -2.0));
+    vec3 j = tap(t * vec2(-1.0,  1.0));
+    vec3 k = tap(t * vec2( 1.0,  1.0));
+    vec3 l = tap(t * vec2(-1.0, -1.0));
+    vec3 m = tap(t * vec2( 1.0, -1.0));
+
+    // The centre box carries half the weight, the four corner boxes the rest
+    vec3 boxes[5] = vec3[](
+        (j + k + l + m) * 0.25,
+        (a + b + d + e) * 0.25,
+        (b + c + e + f) * 0.25,
+        (d + e + g + h) * 0.25,
+        (e + f + h + i) * 0.25
+    );
+    float weights[5] = float[](0.5, 0.125, 0.125, 0.125, 0.125);
+
+    vec3 result = vec3(0.0);
+    float sumWeight = 0.0;
+    for (int n = 0; n < 5; ++n) {
+        float w = weights[n] * (u_firstPass ? karisWeight(boxes[n]) : 1.0);
+        result += boxes[n] * w;
+        sumWeight += w;
+    }
+    fragColor = vec4(result / sumWeight, 1.0);
+}
@@ -0,0 +1,26 @@
+#version 430 core
+out vec4 fragColor;
+in vec2 fragUV;
+
+// Upsampling half of the bloom pyramid: a 3x3 tent filter of the next smaller
+// level, added onto the current level by additive blending. Summed all the
+// way up, every level of the pyramid contributes a wider, fainter glow.
+
+uniform sampler2D u_sourceTex;
+uniform float u_filterRadius; // in texels of the source level
+
+void main() {
+    vec2 t = u_filterRadius / vec2(textureSize(u_sourceTex, 0));
+
+    vec3 result = texture(u_sourceTex, fragUV).rgb * 4.0;
+    result += texture(u_sourceTex, fragUV + vec2(-t.x, 0.0)).rgb * 2.0;
+    result += texture(u_sourceTex, fragUV + vec2( t.x, 0.0)).rgb * 2.0;
+    result += texture(u_sourceTex, fragUV + vec2(0.0, -t.y)).rgb * 2.0;
+    result += texture(u_sourceTex, fragUV + vec2(0.0,  t.y)).rgb * 2.0;
+    result += texture(u_sourceTex, fragUV + vec2(-t.x, -t.y)).rgb;
+    result += texture(u_sourceTex, fragUV + vec2( t.x, -t.y)).rgb;
+    result += texture(u_sourceTex, fragUV + vec2(-t.x,  t.y)).rgb;
+    result += texture(u_sourceTex, fragUV + vec2( t.x,  t.y)).rgb;
+
+    fragColor = vec4(result / 16.0, 1.0);
+}
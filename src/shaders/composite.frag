@@ -5,6 +5,7 @@ in vec2 fragUV;
 // final_composite.frag
 uniform sampler2D hdrTex;
 uniform sampler2D bloomTex;
+uniform float bloomStrength;
 uniform float exposure;
 
 
@@ -20,7 +21,7 @@ vec3 linearToGamma(vec3 linear){
 void main() {
     vec3 hdr = texture(hdrTex, fragUV).rgb;
     vec3 bloom = texture(bloomTex, fragUV).rgb;
-    vec3 color = hdr + bloom; // additive blending
+    vec3 color = hdr + bloom * bloomStrength; // additive blending
 
     // Tonemapping (e.g., Reinhard)
     color = vec3(1.0) - exp(-color * exposure);
@@ -0,0 +1,27 @@
+// Shared by the sky conversion kernels (src/equirectToCubemap.h).
+
+#define PI 3.1415926535896932385
+#define CUBEMAP_GROUP_SIZE 8
+
+#include "rt_microfacet.glsl"
+
+// The direction through uv on a cube face, face in GL_TEXTURE_CUBE_MAP_POSITIVE_X
+// + i order and uv in [0,1]^2 from the first texel, as the GL spec's cube map
+// face selection table has it.
+vec3 cubemapDirection(int face, vec2 uv) {
+    vec2 st = uv * 2.0 - 1.0;
+    vec3 dir;
+    if (face == 0) dir = vec3(1.0, -st.y, -st.x);
+    else if (face == 1) dir = vec3(-1.0, -st.y, st.x);
+    else if (face == 2) dir = vec3(st.x, 1.0, st.y);
+    else if (face == 3) dir = vec3(st.x, -1.0, -st.y);
+    else if (face == 4) dir = vec3(st.x, -st.y, 1.0);
+    else dir = vec3(-st.x, -st.y, -1.0);
+    return normalize(dir);
+}
+
+// Equirectangular texture coordinates of a direction. The image is uploaded
+// bottom row first, so v = 1 is straight up. Matches envUV in rt_lights.glsl.
+vec2 equirectUV(vec3 dir) {
+    return vec2((atan(dir.x, dir.z) + PI) / (2.0 * PI), 1.0 - acos(clamp(dir.y, -1.0, 1.0)) / PI);
+}
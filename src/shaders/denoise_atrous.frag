@@ -0,0 +1,62 @@
+#version 430 core
+out vec4 fragColor;
+in vec2 fragUV;
+
+#include "rt_denoise.glsl"
+
+uniform sampler2D u_inputTex; // rgb demodulated irradiance, a its variance
+uniform int u_stepSize;       // 1, 2, 4, ... the spacing of this pass's taps
+uniform float u_sigmaColor;   // luminance difference allowed, in standard deviations
+uniform bool u_finalPass;     // multiply the albedo back in
+
+const float kernel[3] = float[](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0); // B3 spline
+
+// One iteration of the à-trous filter: a 5x5 B3-spline kernel with holes of
+// u_stepSize pixels, weighted down across geometry edges and across luminance
+// changes the pixel's noise cannot explain. A converged pixel's variance is
+// near zero, so it keeps its value and the filter fades out as samples add up.
+void main() {
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    ivec2 size = textureSize(u_inputTex, 0);
+    vec4 center = texelFetch(u_inputTex, p, 0);
+    vec4 guide = texelFetch(u_normalDepthTex, p, 0);
+
+    // Variance blurred over 3x3, for a steadier colour edge-stop
+    float variance = 0.0;
+    for (int y = -1; y <= 1; ++y) {
+        for (int x = -1; x <= 1; ++x) {
+            ivec2 q = clamp(p + ivec2(x, y), ivec2(0), size - 1);
+            variance += texelFetch(u_inputTex, q, 0).a * (x == 0 ? 0.5 : 0.25) * (y == 0 ? 0.5 : 0.25);
+        }
+    }
+    float luminanceStop = u_sigmaColor * sqrt(max(variance, 0.0)) + 1e-6;
+    float centerLuminance = denoiseLuminance(center.rgb);
+
+    vec3 sumColor = vec3(0.0);
+    float sumVariance = 0.0;
+    float sumWeight = 0.0;
+    for (int y = -2; y <= 2; ++y) {
+        for (int x = -2; x <= 2; ++x) {
+            ivec2 q = p + ivec2(x, y) * u_stepSize;
+            if (q.x < 0 || q.y < 0 || q.x >= size.x || q.y >= size.y) continue;
+
+            vec4 tap = texelFetch(u_inputTex, q, 0);
+            float w = kernel[abs(x)] * kernel[abs(y)];
+            if (x != 0 || y != 0) {
+                w *= geometryWeight(guide, texelFetch(u_normalDepthTex, q, 0), length(vec2(x, y)) * float(u_stepSize));
+                w *= exp(-abs(centerLuminance - denoiseLuminance(tap.rgb)) / luminanceStop);
+            }
+
+            sumColor += w * tap.rgb;
+            sumVariance += w * w * tap.a;
+            sumWeight += w;
+        }
+    }
+
+    vec3 color = sumColor / sumWeight;
+    if (u_finalPass) {
+        fragColor = vec4(color * demodulationAlbedo(p), 1.0);
+    } else {
+        fragColor = vec4(color, sumVariance / (sumWeight * sumWeight));
+    }
+}
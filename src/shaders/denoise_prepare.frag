@@ -0,0 +1,43 @@
+#version 430 core
+out vec4 fragColor;
+in vec2 fragUV;
+
+#include "rt_denoise.glsl"
+
+uniform sampler2D u_colorTex;   // the accumulated colour average
+uniform sampler2D u_momentsTex; // x: mean luminance, y: mean squared luminance, z: sample count
+
+// The filter's input: demodulated irradiance in rgb, and in a the variance of
+// its mean, which steers how hard each pixel is filtered. Pixels with too few
+// samples of their own estimate it from similar neighbours instead.
+void main() {
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    ivec2 size = textureSize(u_colorTex, 0);
+    vec3 color = texelFetch(u_colorTex, p, 0).rgb;
+    vec4 moments = texelFetch(u_momentsTex, p, 0);
+    float n = moments.z;
+
+    float variance;
+    if (n >= 4.0) {
+        variance = max(moments.y - moments.x * moments.x, 0.0) / (n - 1.0);
+    } else {
+        vec4 guide = texelFetch(u_normalDepthTex, p, 0);
+        float sumWeight = 0.0;
+        vec2 sumMoments = vec2(0.0);
+        for (int y = -3; y <= 3; ++y) {
+            for (int x = -3; x <= 3; ++x) {
+                ivec2 q = clamp(p + ivec2(x, y), ivec2(0), size - 1);
+                float w = (x == 0 && y == 0) ? 1.0
+                        : geometryWeight(guide, texelFetch(u_normalDepthTex, q, 0), length(vec2(x, y)));
+                sumMoments += w * texelFetch(u_momentsTex, q, 0).xy;
+                sumWeight += w;
+            }
+        }
+        sumMoments /= sumWeight;
+        variance = max(sumMoments.y - sumMoments.x * sumMoments.x, 0.0) / max(n, 1.0);
+    }
+
+    vec3 albedo = demodulationAlbedo(p);
+    float albedoLuminance = denoiseLuminance(albedo);
+    fragColor = vec4(color / albedo, variance / (albedoLuminance * albedoLuminance));
+}
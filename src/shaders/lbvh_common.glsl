@@ -0,0 +1,67 @@
+// Shared state for the GPU LBVH build kernels (Karras 2012, "Maximizing
+// Parallelism in the Construction of BVHs, Octrees, and k-d Trees").
+//
+// One build covers one mesh: triangles [u_firstTri, u_firstTri + u_triCount)
+// get a bottom-level BVH written straight into BVHNodes starting at
+// u_nodeOffset and into PrimitiveIndices starting at u_primOffset.
+// With n triangles the tree has n - 1 internal nodes followed by n leaves,
+// so internal node 0 (or the only leaf, if n == 1) is the root.
+
+#include "rt_geometry.glsl"
+
+#define LBVH_GROUP_SIZE 256
+#define RADIX_BITS 4
+#define RADIX_BUCKETS 16
+
+uniform int u_triCount;
+uniform int u_firstTri;
+uniform int u_nodeOffset;
+uniform int u_primOffset;
+
+// sceneBounds: centroid bounds as order-preserving uints, min xyz then max xyz.
+// data: parents[2n - 1] (local node index, -1 for the root), then one
+// visit flag per internal node for the bottom-up bounds pass.
+layout(std430, binding = 10) coherent buffer LBVHScratch {
+    uint sceneBounds[8];
+    int scratch[];
+};
+
+layout(std430, binding = 11) buffer LBVHKeysIn { uint keysIn[]; };
+layout(std430, binding = 12) buffer LBVHValuesIn { uint valuesIn[]; };
+layout(std430, binding = 13) buffer LBVHKeysOut { uint keysOut[]; };
+layout(std430, binding = 14) buffer LBVHValuesOut { uint valuesOut[]; };
+
+// Digit-major: histogram[digit * numGroups + group]
+layout(std430, binding = 15) buffer LBVHHistogram { uint histogram[]; };
+
+// Corners of a triangle, fetched through its vertex indices.
+void triangleVertices(int triangleIndex, out vec3 p0, out vec3 p1, out vec3 p2) {
+    IndexedTriangle t = triangles[triangleIndex];
+    p0 = vertexPositions[t.v0].xyz;
+    p1 = vertexPositions[t.v1].xyz;
+    p2 = vertexPositions[t.v2].xyz;
+}
+
+vec3 triangleCentroid(int triangleIndex) {
+    vec3 p0, p1, p2;
+    triangleVertices(triangleIndex, p0, p1, p2);
+    return (p0 + p1 + p2) / 3.0;
+}
+
+int flagIndex(int internalNode) {
+    return 2 * u_triCount - 1 + internalNode;
+}
+
+int leafNode(int i) {
+    return u_triCount - 1 + i;
+}
+
+// Floats as uints that sort the same way, so atomicMin/Max work on them.
+uint floatToOrdered(float f) {
+    uint u = floatBitsToUint(f);
+    return (u & 0x80000000u) != 0u ? ~u : (u | 0x80000000u);
+}
+
+float orderedToFloat(uint u) {
+    return uintBitsToFloat((u & 0x80000000u) != 0u ? (u & 0x7FFFFFFFu) : ~u);
+}
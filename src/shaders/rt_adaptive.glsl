@@ -0,0 +1,52 @@
+// Adaptive sampling. Alongside the colour average, every pixel accumulates
+// the moments of its samples' luminance in a second RGBA32F target:
+//
+//   x: mean luminance, y: mean squared luminance, z: sample count, w: unused
+//
+// After each frame adaptive_tiles.comp turns these into the standard error of
+// each pixel's mean and marks every ADAPTIVE_TILE_SIZE tile whose worst pixel
+// is below u_adaptiveThreshold as converged. Converged tiles are skipped, but
+// the mask is rebuilt from the moments every frame, so a tile is traced again
+// as soon as it stops passing: when the threshold or minimum sample count is
+// raised, or when reprojected history changes its moments.
+
+#define ADAPTIVE_TILE_SIZE 16
+
+// Below this luminance noise is judged absolutely rather than relative to the
+// pixel, since it barely shows once tonemapped.
+#define ADAPTIVE_LUMINANCE_FLOOR 0.1
+
+uniform bool u_adaptiveSampling;
+uniform float u_adaptiveThreshold;  // relative standard error a tile must reach
+uniform int u_adaptiveMinSamples;   // samples every pixel takes before being judged
+uniform sampler2D u_adaptiveMask;   // r: 1 to trace the tile, 0 converged
+
+bool isTileConverged(ivec2 coord) {
+    return frameCount > u_adaptiveMinSamples &&
+           texelFetch(u_adaptiveMask, coord / ADAPTIVE_TILE_SIZE, 0).r < 0.5;
+}
+
+// Previous moments, empty on the first frame after a reset.
+vec4 previousMoments(vec4 stored) {
+    return frameCount > 1 ? stored : vec4(0.0);
+}
+
+// Blends one new sample into a pixel's colour average and moments, weighted
+// by the pixel's own sample count so skipped frames do not bias it.
+void accumulateSample(vec3 previousColor, vec4 moments, vec3 newSample,
+                      out vec3 color, out vec4 newMoments) {
+    float n = moments.z + 1.0;
+    float lum = dot(newSample, vec3(0.2126, 0.7152, 0.0722));
+    color = previousColor + (newSample - previousColor) / n;
+    newMoments = vec4(moments.x + (lum - moments.x) / n,
+                      moments.y + (lum * lum - moments.y) / n,
+                      n, 0.0);
+}
+
+// Relative standard error of a pixel's mean, from its moments.
+float pixelError(vec4 moments) {
+    float n = moments.z;
+    if (n < 2.0) return 1e30;
+    float variance = max(moments.y - moments.x * moments.x, 0.0) * n / (n - 1.0);
+    return sqrt(variance / n) / max(moments.x, ADAPTIVE_LUMINANCE_FLOOR);
+}
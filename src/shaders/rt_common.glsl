@@ -0,0 +1,145 @@
+// Shared uniforms, constants, sampling helpers and core types for the ray
+// tracing shaders. Included by fragment.frag and the wavefront kernels.
+
+uniform vec2 resolution;
+uniform float time;
+uniform int frameCount;
+
+// Camera Uniforms
+uniform vec3 camPos;
+uniform vec3 camFront;
+uniform vec3 camRight;
+uniform vec3 camUp;
+uniform float camFov;
+
+// Skybox Uniforms
+uniform samplerCube u_skybox;
+uniform bool u_useSkybox;
+uniform float skyboxIntensity;
+
+// Compile-time specializations from ShaderPermutation (rt_permutation.h).
+// Without them the shaders test the same things at runtime.
+#ifdef RT_SKYBOX
+#define USE_SKYBOX (RT_SKYBOX != 0)
+#else
+#define USE_SKYBOX u_useSkybox
+#endif
+
+#define BVH_MODE_BRUTE_FORCE 0
+#define BVH_MODE_BINARY 1
+#define BVH_MODE_WIDE 2
+
+#ifndef RT_MATERIAL_MASK
+#define RT_MATERIAL_MASK 15 // every material type
+#endif
+#define HAS_MATERIAL(type) ((RT_MATERIAL_MASK & (1 << (type))) != 0)
+
+// Some Constants
+#define PI 3.1415926535896932385
+#define MAX_OBJECTS 1024
+#ifndef MAX_BOUNCES
+#define MAX_BOUNCES 50 // upper bound for u_maxBounces
+#endif
+const float infinity = 1.0 / 0.0;
+
+// Helper and utility functions. Random numbers come from rt_sampler.glsl;
+// u holds two independent uniform numbers.
+
+vec3 randomUnitVector(vec2 u) {
+    float z = u.x * 2.0 - 1.0;   // z in [-1,1]
+    float a = u.y * 2.0 * PI;    // azimuth angle
+    float r = sqrt(max(0.0, 1.0 - z*z));
+    return vec3(r * cos(a), r * sin(a), z);
+}
+
+vec3 random_on_hemisphere(vec3 normal, vec2 u) {
+    vec3 p = randomUnitVector(u);
+    return (dot(p, normal) > 0.0) ? p : -p;
+}
+
+vec3 randomInUnitDisk(vec2 u){
+    float r = sqrt(u.x);            // radius
+    float theta = u.y * 2.0 * PI;   // angle
+    return vec3(r * cos(theta), r * sin(theta), 0.0);
+}
+
+// The primary ray direction through uv in [0,1]^2 of the image.
+vec3 cameraDirection(vec2 uv) {
+    // convert to NDC [-1,1]
+    vec2 ndc = uv * 2.0 - 1.0;
+    ndc.x *= resolution.x / resolution.y;
+
+    float fovScale = tan(radians(camFov) * 0.5);
+    return normalize(camFront + ndc.x * fovScale * camRight + ndc.y * fovScale * camUp);
+}
+
+bool nearZero(vec3 v) {
+    const float s = 1e-8; // tolerance threshold
+    return (abs(v.x) < s) && (abs(v.y) < s) && (abs(v.z) < s);
+}
+
+float reflectance(float cosine, float refIdx) {
+    // Schlick's approximation
+    float r0 = (1.0 - refIdx) / (1.0 + refIdx);
+    r0 = r0 * r0;
+    return r0 + (1.0 - r0) * pow(1.0 - cosine, 5.0);
+}
+
+// Ray struct
+
+struct Ray{
+    vec3 origin;
+    vec3 direction;
+};
+
+vec3 rayAt(Ray r, float t){
+    return r.origin + t* r.direction;
+}
+
+// Material Types
+#define MATERIAL_LAMBERTIAN 0
+#define MATERIAL_METAL 1
+#define MATERIAL_DIELECTRIC 2
+#define MATERIAL_EMISSIVE 3
+
+struct Material {
+    vec3 albedo;
+    float metallic;        // Metal: 0 is a glossy dielectric coat over diffuse, 1 pure conductor
+    int type;
+    float emissionStrength;
+    float roughness;       // GGX, Metal and Dielectric. alpha = roughness^2
+    float refractionIndex;
+    int albedoTexture;     // texture indices (rt_textures.glsl), -1 for none
+    int roughnessTexture;  // metallic in B, roughness in G
+    int normalTexture;     // tangent space
+    int pad0;
+    vec2 uvScale;          // applied to the hit's texture coordinates first
+    vec2 uvOffset;
+};
+
+// The Materials SSBO
+layout(std430, binding = 0) buffer Materials {
+    Material materials[];
+};
+
+// Records what was hit and where.
+// 4 pi r^2 over the solid angle 2 pi (1 - cos theta_max) of a sphere of
+// radius^2 r2 whose center is dist2 away, written without the cancellation in
+// 1 - cos theta_max for small, far spheres. Only for dist2 > r2.
+float sphereAreaPerSolidAngle(float dist2, float r2) {
+    return 2.0 * dist2 * (1.0 + sqrt(max(1.0 - r2 / dist2, 0.0)));
+}
+
+struct HitRecord {
+    vec3 p;
+    vec3 normal;
+    float t;
+    bool frontFace;
+    int materialID;
+    Material mat;
+    vec2 uv;           // texture coordinates (barycentrics until setTriangleAttributes)
+    vec4 tangent;      // along +u, w: bitangent sign. Zero without texture coordinates
+    float textureLod;  // 0.5 * log2(uv area / world area) of the surface, then the mip (rt_textures.glsl)
+    float sphereLightScale; // sphere hits: area over the solid angle it subtends from the ray
+                            // origin, in units of t^2 (sphereLightPdf). 0 for triangles
+};
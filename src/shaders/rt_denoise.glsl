@@ -0,0 +1,31 @@
+// Shared by the denoiser passes. The edge-stopping functions of the à-trous
+// wavelet filter [Dammertz et al. 2010, "Edge-Avoiding À-Trous Wavelet
+// Transform for fast Global Illumination Filtering"], with the variance-guided
+// colour term of SVGF [Schied et al. 2017].
+
+uniform sampler2D u_albedoTex;      // rgb first-hit albedo
+uniform sampler2D u_normalDepthTex; // xyz first-hit normal, w distance
+uniform float u_sigmaNormal;        // exponent on the cosine between normals
+uniform float u_sigmaDepth;         // relative distance change allowed per pixel
+
+float denoiseLuminance(vec3 c) {
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// The albedo lighting is divided by before filtering and multiplied back
+// after, so texture and material detail is not blurred with the noise.
+vec3 demodulationAlbedo(ivec2 p) {
+    return max(texelFetch(u_albedoTex, p, 0).rgb, vec3(0.01));
+}
+
+// How much the pixel with guides b, pixelDistance away, looks like the same
+// surface as the pixel with guides a. The sky only matches the sky.
+float geometryWeight(vec4 a, vec4 b, float pixelDistance) {
+    float la = length(a.xyz);
+    float lb = length(b.xyz);
+    if (la < 1e-3 || lb < 1e-3) return (la < 1e-3 && lb < 1e-3) ? 1.0 : 0.0;
+
+    float wNormal = pow(max(dot(a.xyz / la, b.xyz / lb), 0.0), u_sigmaNormal);
+    float wDepth = exp(-abs(a.w - b.w) / (u_sigmaDepth * a.w * pixelDistance + 1e-4));
+    return wNormal * wDepth;
+}
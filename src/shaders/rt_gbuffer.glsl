@@ -0,0 +1,30 @@
+// First-hit G-buffer, the guides the denoiser filters along. Accumulated like
+// the colour, so the guides are antialiased and match the averaged image:
+//
+//   albedo:      rgb the first hit's albedo, 1 for the sky and emitters (not demodulated)
+//   normalDepth: xyz the first hit's normal facing the camera, w its distance.
+//                The sky has a zero normal and GBUFFER_SKY_DEPTH.
+
+#define GBUFFER_SKY_DEPTH 1e20
+
+void gbufferFromHit(HitRecord rec, Ray r, out vec3 albedo, out vec4 normalDepth) {
+    albedo = rec.mat.type == MATERIAL_EMISSIVE ? vec3(1.0) : rec.mat.albedo;
+    normalDepth = vec4(rec.normal, rec.t * length(r.direction));
+}
+
+void gbufferFromMiss(out vec3 albedo, out vec4 normalDepth) {
+    albedo = vec3(1.0);
+    normalDepth = vec4(0.0, 0.0, 0.0, GBUFFER_SKY_DEPTH);
+}
+
+// Blends this frame's guides in; n is the pixel's sample count including this one.
+void accumulateGBuffer(vec3 previousAlbedo, vec4 previousNormalDepth, float n,
+                       vec3 albedo, vec4 normalDepth, out vec3 outAlbedo, out vec4 outNormalDepth) {
+    if (n <= 1.0) {
+        outAlbedo = albedo;
+        outNormalDepth = normalDepth;
+        return;
+    }
+    outAlbedo = previousAlbedo + (albedo - previousAlbedo) / n;
+    outNormalDepth = previousNormalDepth + (normalDepth - previousNormalDepth) / n;
+}
@@ -0,0 +1,89 @@
+// Mesh geometry and bottom-level BVH buffers: everything the BVH builders
+// and traversal share. Kept apart from rt_scene.glsl so build kernels don't
+// declare the rest of the scene's storage blocks.
+
+// BVH Traversal Infrastructure
+struct BVHNode {
+    vec4 minBounds;
+    vec4 maxBounds;
+    int leftChild;
+    int rightChild;
+    int pad0;
+    int pad1;
+};
+
+// Kernels that read nodes written by other invocations define this as coherent.
+#ifndef BVH_NODES_QUALIFIERS
+#define BVH_NODES_QUALIFIERS
+#endif
+
+layout(std430, binding = 3) BVH_NODES_QUALIFIERS buffer BVHNodes{
+    BVHNode bvhNodes[];
+};
+
+layout(std430, binding = 4) buffer PrimitiveIndices{
+    int primitiveIndices[];
+};
+
+// Triangles index into the shared vertex arrays below. Must match
+// IndexedTriangle in rt_structs.h.
+struct IndexedTriangle {
+    uint v0, v1, v2;
+    int materialID;
+};
+
+// The Triangles SSBO. Only read for the closest hit's shading attributes.
+layout(std430, binding = 1) buffer Triangles{
+    IndexedTriangle triangles[];
+};
+
+// Shared vertex attributes. w is unused, only exists for memory alignment.
+layout(std430, binding = 17) buffer VertexPositions{
+    vec4 vertexPositions[];
+};
+
+layout(std430, binding = 18) buffer VertexNormals{
+    vec4 vertexNormals[];
+};
+
+// The attributes only shading reads, fetched once for the closest hit.
+// Interleaved so they cost a single storage block. Must match VertexShading
+// in rt_structs.h.
+struct VertexShading {
+    vec4 tangent;  // along +u, w: bitangent sign. Zero without texture coordinates
+    vec2 texcoord;
+    vec2 pad;
+};
+
+layout(std430, binding = 21) buffer VertexShadingAttributes{
+    VertexShading vertexShading[];
+};
+
+// Intersection-only triangles in BVH leaf order, so a leaf's primitive range
+// indexes this directly. Must match IsectTriangle in rt_structs.h.
+struct IsectTriangle {
+    vec4 v0; // w: index into triangles[] (int bits)
+    vec4 e1; // v1 - v0. w: intersection epsilon
+    vec4 e2; // v2 - v0. w unused
+};
+
+layout(std430, binding = 16) buffer IsectTriangles{
+    IsectTriangle isectTriangles[];
+};
+
+// Builds the intersection form of a triangle straight from the indexed
+// geometry, for paths that don't go through the leaf-ordered stream.
+// Same values as MakeIsectTriangle in rt_structs.h.
+IsectTriangle loadIsectTriangle(int triangleIndex) {
+    IndexedTriangle t = triangles[triangleIndex];
+    vec3 p0 = vertexPositions[t.v0].xyz;
+    vec3 e1 = vertexPositions[t.v1].xyz - p0;
+    vec3 e2 = vertexPositions[t.v2].xyz - p0;
+
+    float area = length(cross(e1, e2)) * 0.5;
+    IsectTriangle tri;
+    tri.v0 = vec4(p0, intBitsToFloat(triangleIndex));
+    tri.e1 = vec4(e1, max(1e-8, area * 1e-5));
+    tri.e2 = vec4(e2, 0.0);
+    return tri;
+}
@@ -0,0 +1,212 @@
+// Light list and explicit light sampling. Built on the CPU by LightList in
+// rt_lights.h.
+//
+// Lights are picked in proportion to their power. Triangles are then sampled
+// uniformly by area, so every point on one has the same area-measure pdf,
+// luminance(emission) / lightTotalPower. Spheres are sampled uniformly over
+// the cone they subtend from the shading point, whose pdf follows from the
+// distance to the center and the radius, which the hit record carries. A
+// BSDF-sampled ray that hits a light can therefore be given its MIS weight
+// without looking the light up.
+
+#define LIGHT_SPHERE 0
+#define LIGHT_TRIANGLE 1
+
+// Must match GPULight in rt_lights.h.
+struct Light {
+    vec4 p0;       // sphere: center, w radius. triangle: v0
+    vec4 e1;       // triangle: v1 - v0
+    vec4 e2;       // triangle: v2 - v0
+    vec4 emission; // rgb: emitted radiance. w unused
+    int type;      // LIGHT_SPHERE or LIGHT_TRIANGLE
+    float cdf;     // normalized running sum of power, 1.0 at the last light
+    int pad0, pad1;
+};
+
+// The Lights SSBO. The header matches GPULightHeader in rt_lights.h.
+layout(std430, binding = 19) buffer Lights {
+    float lightTotalPower;
+    int lightCount;
+    int lightPad0, lightPad1;
+    Light lights[];
+};
+
+// Next-event estimation on/off. Off leaves lights to be found by BSDF sampling alone.
+uniform bool u_useLightSampling;
+
+float luminance(vec3 c) {
+    return dot(c, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// A point on a light, as seen from a shading point.
+struct LightSample {
+    vec3 direction; // unit, towards the light
+    float dist;
+    vec3 emission;
+    float pdf;      // solid angle measure
+};
+
+// The light whose CDF bucket holds u, by binary search. Buckets are
+// [previous cdf, cdf), so lights without power are never picked.
+int pickLight(float u) {
+    int lo = 0;
+    int hi = lightCount - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (lights[mid].cdf <= u) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Solid-angle pdf of sampleLight choosing a point with this emission, at dist
+// from the shading point, whose surface makes cosLight with the direction.
+// For triangles, and spheres around the shading point.
+float lightPdf(vec3 emission, float dist, float cosLight) {
+    if (lightTotalPower <= 0.0 || cosLight < 1e-6) return 0.0;
+    return luminance(emission) / lightTotalPower * dist * dist / cosLight;
+}
+
+// Solid-angle pdf of sampleLight choosing a direction in the cone of a sphere
+// with this emission, given its sphereAreaPerSolidAngle.
+float sphereLightPdf(vec3 emission, float areaPerSolidAngle) {
+    if (lightTotalPower <= 0.0) return 0.0;
+    return luminance(emission) / lightTotalPower * areaPerSolidAngle;
+}
+
+// Picks a light and a point on it for the shading point p. u holds three
+// independent uniform numbers: one picks the light, two pick the point.
+// Spheres are sampled over the cone of directions they cover from p, so no
+// sample lands on the far side [Shirley et al. 1996, "Monte Carlo Techniques
+// for Direct Lighting Calculations"], unless p is inside, when points are
+// uniform over the whole sphere.
+bool sampleLight(vec3 p, vec3 u, out LightSample ls) {
+    if (lightCount == 0) return false;
+
+    Light light = lights[pickLight(u.x)];
+
+    vec3 q;
+    vec3 n;
+    if (light.type == LIGHT_SPHERE) {
+        vec3 toCenter = light.p0.xyz - p;
+        float dist2 = dot(toCenter, toCenter);
+        float r2 = light.p0.w * light.p0.w;
+        if (dist2 > r2) {
+            // 1 - cos theta_max, without the cancellation for small, far spheres
+            float sin2Max = r2 / dist2;
+            float oneMinusCosMax = sin2Max / (1.0 + sqrt(1.0 - sin2Max));
+            float cosTheta = 1.0 - u.y * oneMinusCosMax;
+            float sinTheta = sqrt(max(0.0, 1.0 - cosTheta * cosTheta));
+            float phi = 2.0 * PI * u.z;
+
+            float dist = sqrt(dist2);
+            vec3 w = toCenter / dist;
+            vec3 t, b;
+            buildBasis(w, t, b);
+            ls.direction = toWorld(vec3(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta), t, b, w);
+
+            // The near intersection along it, or the tangent point at the rim
+            ls.dist = dist * cosTheta - sqrt(max(0.0, r2 - dist2 * sinTheta * sinTheta));
+            ls.emission = light.emission.rgb;
+            ls.pdf = sphereLightPdf(ls.emission, sphereAreaPerSolidAngle(dist2, r2));
+            return ls.dist > 1e-6 && ls.pdf > 0.0;
+        }
+        float z = 1.0 - 2.0 * u.y;
+        float r = sqrt(max(0.0, 1.0 - z * z));
+        float a = 2.0 * PI * u.z;
+        n = vec3(r * cos(a), r * sin(a), z);
+        q = light.p0.xyz + light.p0.w * n;
+    } else {
+        vec2 b = u.yz;
+        if (b.x + b.y > 1.0) b = 1.0 - b; // fold into the triangle
+        q = light.p0.xyz + b.x * light.e1.xyz + b.y * light.e2.xyz;
+        n = normalize(cross(light.e1.xyz, light.e2.xyz));
+    }
+
+    vec3 toLight = q - p;
+    ls.dist = length(toLight);
+    if (ls.dist < 1e-6) return false;
+
+    ls.direction = toLight / ls.dist;
+    ls.emission = light.emission.rgb;
+    ls.pdf = lightPdf(ls.emission, ls.dist, abs(dot(n, ls.direction)));
+    return ls.pdf > 0.0;
+}
+
+// MIS weight of a sample from the strategy with pdf a, against one with pdf b.
+float powerHeuristic(float a, float b) {
+    float a2 = a * a;
+    float b2 = b * b;
+    return a2 + b2 > 0.0 ? a2 / (a2 + b2) : 0.0;
+}
+
+// Environment importance sampling, from the tables EnvironmentCDF builds in
+// rt_envmap.h. Directions follow the equirect mapping of cubemap_common.glsl.
+uniform bool u_useEnvSampling;
+uniform sampler2D u_envConditional; // r: the row's CDF, g: the texel's weight
+uniform sampler2D u_envMarginal;    // r: CDF over rows
+uniform float u_envIntegral;        // mean texel weight
+#define USE_ENV_SAMPLING (USE_SKYBOX && u_useEnvSampling) // only ever set with the sky
+
+vec3 envDirection(vec2 uv) {
+    float theta = uv.x * 2.0 * PI - PI;
+    float phi = (1.0 - uv.y) * PI;
+    return vec3(sin(phi) * sin(theta), cos(phi), sin(phi) * cos(theta));
+}
+
+vec2 envUV(vec3 dir) {
+    dir = normalize(dir);
+    return vec2((atan(dir.x, dir.z) + PI) / (2.0 * PI), 1.0 - acos(clamp(dir.y, -1.0, 1.0)) / PI);
+}
+
+// Solid-angle pdf of the texel weight at uv: the [0,1]^2 pdf over the
+// Jacobian of the equirect mapping, 2 pi^2 sin(theta).
+float envPdfFromWeight(float weight, vec2 uv) {
+    float sinTheta = sin((1.0 - uv.y) * PI);
+    if (sinTheta <= 0.0 || u_envIntegral <= 0.0) return 0.0;
+    return weight / u_envIntegral / (2.0 * PI * PI * sinTheta);
+}
+
+// Solid-angle pdf with which sampleEnvironment returns dir.
+float envPdf(vec3 dir) {
+    vec2 uv = envUV(dir);
+    ivec2 size = textureSize(u_envConditional, 0);
+    ivec2 texel = clamp(ivec2(uv * vec2(size)), ivec2(0), size - 1);
+    return envPdfFromWeight(texelFetch(u_envConditional, texel, 0).g, uv);
+}
+
+// Picks a direction in proportion to the environment's luminance. u holds
+// two independent uniform numbers: .y picks the row, .x the column in it.
+vec3 sampleEnvironment(vec2 u, out float pdf) {
+    ivec2 size = textureSize(u_envConditional, 0);
+
+    int lo = 0;
+    int hi = size.y - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (texelFetch(u_envMarginal, ivec2(mid, 0), 0).r < u.y) lo = mid + 1;
+        else hi = mid;
+    }
+    int row = lo;
+    float rowLo = row > 0 ? texelFetch(u_envMarginal, ivec2(row - 1, 0), 0).r : 0.0;
+    float rowHi = texelFetch(u_envMarginal, ivec2(row, 0), 0).r;
+
+    lo = 0;
+    hi = size.x - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (texelFetch(u_envConditional, ivec2(mid, row), 0).r < u.x) lo = mid + 1;
+        else hi = mid;
+    }
+    int col = lo;
+    float colLo = col > 0 ? texelFetch(u_envConditional, ivec2(col - 1, row), 0).r : 0.0;
+    vec2 texel = texelFetch(u_envConditional, ivec2(col, row), 0).rg;
+
+    // Where in the texel u landed, so samples cover it continuously
+    vec2 offset = vec2((u.x - colLo) / max(texel.r - colLo, 1e-12),
+                       (u.y - rowLo) / max(rowHi - rowLo, 1e-12));
+    vec2 uv = (vec2(col, row) + clamp(offset, 0.0, 1.0)) / vec2(size);
+
+    pdf = envPdfFromWeight(texel.g, uv);
+    return envDirection(uv);
+}
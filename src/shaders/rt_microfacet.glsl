@@ -0,0 +1,60 @@
+// GGX microfacet helpers for the metal and dielectric lobes. Directions are
+// in a local frame around the shading normal, z up. alpha = roughness^2.
+
+// Below this roughness a lobe is treated as a perfect mirror / smooth glass.
+#define MIN_ROUGHNESS 1e-3
+
+// Orthonormal basis around unit n [Duff et al. 2017, "Building an Orthonormal
+// Basis, Revisited"].
+void buildBasis(vec3 n, out vec3 t, out vec3 b) {
+    float s = n.z >= 0.0 ? 1.0 : -1.0;
+    float a = -1.0 / (s + n.z);
+    float c = n.x * n.y * a;
+    t = vec3(1.0 + s * n.x * n.x * a, s * c, -s * n.x);
+    b = vec3(c, s + n.y * n.y * a, -n.y);
+}
+
+vec3 toLocal(vec3 v, vec3 t, vec3 b, vec3 n) {
+    return vec3(dot(v, t), dot(v, b), dot(v, n));
+}
+
+vec3 toWorld(vec3 v, vec3 t, vec3 b, vec3 n) {
+    return v.x * t + v.y * b + v.z * n;
+}
+
+// Smith masking for one direction, cos = its angle to the macro normal.
+float smithG1(float cosTheta, float alpha) {
+    float c = abs(cosTheta);
+    float a2 = alpha * alpha;
+    return 2.0 * c / (c + sqrt(a2 + (1.0 - a2) * c * c));
+}
+
+// A microfacet normal from the distribution of normals visible from v
+// (local, v.z > 0) [Heitz 2018, "Sampling the GGX Distribution of Visible
+// Normals"]. u holds two independent uniform numbers.
+vec3 sampleGGXVNDF(vec3 v, float alpha, vec2 u) {
+    // Stretch the view so the warped distribution is the hemisphere
+    vec3 vh = normalize(vec3(alpha * v.x, alpha * v.y, v.z));
+
+    float lensq = vh.x * vh.x + vh.y * vh.y;
+    vec3 t1 = lensq > 0.0 ? vec3(-vh.y, vh.x, 0.0) * inversesqrt(lensq) : vec3(1.0, 0.0, 0.0);
+    vec3 t2 = cross(vh, t1);
+
+    // A point on the projected disk, squeezed onto the visible half
+    float r = sqrt(u.x);
+    float phi = 2.0 * PI * u.y;
+    float p1 = r * cos(phi);
+    float p2 = r * sin(phi);
+    float s = 0.5 * (1.0 + vh.z);
+    p2 = (1.0 - s) * sqrt(max(0.0, 1.0 - p1 * p1)) + s * p2;
+
+    vec3 nh = p1 * t1 + p2 * t2 + sqrt(max(0.0, 1.0 - p1 * p1 - p2 * p2)) * vh;
+
+    // Unstretch
+    return normalize(vec3(alpha * nh.x, alpha * nh.y, max(1e-6, nh.z)));
+}
+
+// Schlick's Fresnel for a conductor-style tinted F0.
+vec3 fresnelSchlick(vec3 f0, float cosTheta) {
+    return f0 + (1.0 - f0) * pow(1.0 - clamp(cosTheta, 0.0, 1.0), 5.0);
+}
@@ -0,0 +1,142 @@
+// Per-pixel sample generation for the path tracer.
+//
+// Every random decision along a path reads a fixed dimension: the camera's
+// come first, then each bounce gets SAMPLE_DIMS_PER_BOUNCE of its own. A
+// dimension is a 2D point (1D decisions take .x), and the sample index is the
+// frame (plus the sample within it, when a draw takes several), so consecutive
+// frames walk the same sequence rather than drawing unrelated numbers.
+//
+//   SAMPLER_PCG:        independent PCG hashes of (pixel, frame, dimension).
+//   SAMPLER_SOBOL:      the 2D Sobol (0,2)-sequence, Owen scrambled and
+//                       shuffled per pixel and dimension [Burley 2020,
+//                       "Practical Hash-based Owen Scrambling"].
+//   SAMPLER_BLUE_NOISE: the same Sobol points, scrambled once per dimension
+//                       for the whole image, then rotated per pixel by a
+//                       blue-noise texture so the error between neighbouring
+//                       pixels is high-frequency.
+// Initialise with initSampler before the first sample of a path, and set
+// samplerBounce before reading a bounce's dimensions.
+
+#define SAMPLER_PCG 0
+#define SAMPLER_SOBOL 1
+#define SAMPLER_BLUE_NOISE 2
+
+uniform int u_samplerType;
+uniform sampler2D u_blueNoise; // r: a tileable blue-noise dither mask in [0,1)
+
+// Camera dimensions, read once per path
+#define SAMPLE_PIXEL 0      // jitter within the pixel
+#define SAMPLE_LENS 1       // point on the aperture, for a thin-lens camera
+#define SAMPLE_CAMERA_DIMS 2
+
+// Per-bounce dimensions
+#define SAMPLE_BSDF 0       // scattered direction
+#define SAMPLE_BSDF_LOBE 1  // lobe choice, reflect or refract
+#define SAMPLE_LIGHT 2      // point on the picked light
+#define SAMPLE_LIGHT_PICK 3 // which light
+#define SAMPLE_ENV 4        // environment direction
+#define SAMPLE_RR 5         // Russian roulette
+#define SAMPLE_DIMS_PER_BOUNCE 6
+
+uvec2 samplerPixel;
+uint samplerIndex;
+int samplerBounce;
+
+void initSampler(vec2 pixel, int sampleIndex) {
+    samplerPixel = uvec2(pixel);
+    samplerIndex = uint(max(sampleIndex, 0));
+    samplerBounce = 0;
+}
+
+// The frame's own sample.
+void initSampler(vec2 pixel) {
+    initSampler(pixel, frameCount - 1);
+}
+
+// PCG hash [Jarzynski and Olano 2020, "Hash Functions for GPU Rendering"].
+uint pcgHash(uint v) {
+    uint state = v * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+uint hashCombine(uint seed, uint v) {
+    return seed ^ (pcgHash(v) + 0x9e3779b9u + (seed << 6) + (seed >> 2));
+}
+
+float uintToFloat(uint x) {
+    return float(x >> 8) * (1.0 / 16777216.0); // [0, 1)
+}
+
+// Owen scrambling of a bit-reversed value, as a hashed permutation.
+uint laineKarrasPermutation(uint x, uint seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+}
+
+uint nestedUniformScramble(uint x, uint seed) {
+    return bitfieldReverse(laineKarrasPermutation(bitfieldReverse(x), seed));
+}
+
+// Sobol's second dimension, primitive polynomial x + 1. The first is the
+// bit-reversed index.
+uint sobolDim1(uint index) {
+    uint v = 1u << 31;
+    uint x = 0u;
+    for (; index != 0u; index >>= 1) {
+        if ((index & 1u) != 0u) x ^= v;
+        v ^= v >> 1;
+    }
+    return x;
+}
+
+vec2 owenSobol2D(uint index, uint seed) {
+    index = nestedUniformScramble(index, pcgHash(seed));
+    uint x = nestedUniformScramble(bitfieldReverse(index), hashCombine(seed, 0u));
+    uint y = nestedUniformScramble(sobolDim1(index), hashCombine(seed, 1u));
+    return vec2(uintToFloat(x), uintToFloat(y));
+}
+
+// Two dither values for a dimension, from the mask shifted by an offset of
+// its own so dimensions do not share a pattern.
+vec2 blueNoiseRotation(uint dim) {
+    ivec2 size = textureSize(u_blueNoise, 0);
+    uint h = pcgHash(dim + 0x5bd1e995u);
+    ivec2 p = ivec2(samplerPixel);
+    ivec2 a = (p + ivec2(h & 0xffffu, h >> 16)) % size;
+    ivec2 b = (p.yx + ivec2(h >> 16, h & 0xffffu) + size / 2) % size;
+    return vec2(texelFetch(u_blueNoise, a, 0).r, texelFetch(u_blueNoise, b, 0).r);
+}
+
+vec2 samplerGet2D(uint dim) {
+    uint pixelSeed = hashCombine(pcgHash(samplerPixel.x), samplerPixel.y);
+
+    if (u_samplerType == SAMPLER_SOBOL) {
+        return owenSobol2D(samplerIndex, hashCombine(pixelSeed, dim));
+    }
+    if (u_samplerType == SAMPLER_BLUE_NOISE) {
+        return fract(owenSobol2D(samplerIndex, pcgHash(dim)) + blueNoiseRotation(dim));
+    }
+
+    uint seed = hashCombine(hashCombine(pixelSeed, samplerIndex), dim);
+    uint x = pcgHash(seed);
+    return vec2(uintToFloat(x), uintToFloat(pcgHash(x)));
+}
+
+// A camera dimension of the current path.
+vec2 cameraSample2D(int dim) {
+    return samplerGet2D(uint(dim));
+}
+
+// A dimension of the current bounce.
+vec2 sample2D(int dim) {
+    return samplerGet2D(uint(SAMPLE_CAMERA_DIMS + samplerBounce * SAMPLE_DIMS_PER_BOUNCE + dim));
+}
+
+float sample1D(int dim) {
+    return sample2D(dim).x;
+}
@@ -0,0 +1,709 @@
+// Scene primitives, intersection routines and BVH traversal.
+
+#include "rt_geometry.glsl"
+
+// Compressed wide BVH. Must match WideBVHNodeT in rt_structs.h.
+#ifndef BVH_WIDTH
+#define BVH_WIDTH 4
+#endif
+
+struct WideBVHNode {
+    vec3 origin;
+    uint meta;                      // bytes 0-2: biased exponents, byte 3: child count
+    int children[BVH_WIDTH];        // >= 0 interior node, < 0 leaf at -(index + 1)
+    uint leafCounts[BVH_WIDTH / 4]; // packed 8-bit primitive counts
+    uint qlo[3 * BVH_WIDTH / 4];    // packed 8-bit child bounds, [axis][child]
+    uint qhi[3 * BVH_WIDTH / 4];
+};
+
+layout(std430, binding = 7) buffer WideBVHNodes{
+    WideBVHNode wideNodes[];
+};
+
+uniform bool u_useWideBVH;
+
+// Top-level BVH over instances. Leaf primitive ranges index the instance
+// array directly. Must match GPUInstance in rt_structs.h.
+layout(std430, binding = 8) buffer TLASNodes{
+    BVHNode tlasNodes[];
+};
+
+// Which traversal the scene gets, from RT_BVH_MODE when it is specialized
+#ifdef RT_BVH_MODE
+#define USE_TLAS (RT_BVH_MODE != BVH_MODE_BRUTE_FORCE)
+#define USE_WIDE_BVH (RT_BVH_MODE == BVH_MODE_WIDE)
+#else
+#define USE_TLAS (tlasNodes.length() > 0)
+#define USE_WIDE_BVH (u_useWideBVH && wideNodes.length() > 0)
+#endif
+
+// What an instance's bottom-level BVH is built over. Must match InstancePrimType in rt_structs.h.
+#define INSTANCE_TRIANGLES 0
+#define INSTANCE_SPHERES 1
+
+struct Instance {
+    mat4 model;
+    mat4 modelInv;
+    int blasRoot;   // root in bvhNodes
+    int wideRoot;   // root in wideNodes
+    int firstTri;
+    int triCount;
+    int materialID; // overrides the triangles' material when >= 0
+    int primType;   // INSTANCE_TRIANGLES or INSTANCE_SPHERES
+    int pad1, pad2;
+};
+
+layout(std430, binding = 9) buffer Instances{
+    Instance instances[];
+};
+
+// Traversal counters for the profiler: each invocation counts the rays it
+// casts, the BVH nodes it fetches and the primitives it tests, and adds them to
+// the TraversalStats SSBO once at the end with flushTraversalStats(). Counts are
+// 64-bit as lo/hi pairs. Must match TraversalStats::Counters in rt_profiler.h.
+layout(std430, binding = 20) buffer TraversalStats{
+    uint statTotals[8]; // rays, nodes, primitives, unused
+};
+
+uniform bool u_traversalStats;
+
+uint statRays = 0u;
+uint statNodes = 0u;
+uint statPrims = 0u;
+
+void addTraversalStat(int counter, uint value){
+    if(value == 0u) return;
+    uint old = atomicAdd(statTotals[2 * counter], value);
+    if(old + value < old) atomicAdd(statTotals[2 * counter + 1], 1u); // carry
+}
+
+void flushTraversalStats(){
+    if(!u_traversalStats) return;
+    addTraversalStat(0, statRays);
+    addTraversalStat(1, statNodes);
+    addTraversalStat(2, statPrims);
+}
+
+void setFaceNormal(inout HitRecord rec, Ray r, vec3 outwardNormal){
+    rec.frontFace = dot(r.direction, outwardNormal) < 0.0;
+    rec.normal = rec.frontFace ? outwardNormal : -outwardNormal;
+}
+
+// Primitives
+
+struct Sphere {
+    vec4 center; // w is unused. Memory alignment
+    float radius;
+    int materialID;
+    int pad1, pad2; // Memory alignment. Unused.
+};
+
+// The Spheres SSBO.
+layout(std430, binding = 2) buffer Spheres{
+    Sphere spheres[];
+};
+
+// Smooths out sharper edges. (Supposedly)
+vec3 averageNormal(IndexedTriangle t){
+    return normalize(vertexNormals[t.v0].xyz + vertexNormals[t.v1].xyz + vertexNormals[t.v2].xyz);
+}
+
+// Maintains surface detail from sharp edges.
+vec3 faceNormal(IndexedTriangle t) {
+    vec3 p0 = vertexPositions[t.v0].xyz;
+    return normalize(cross(vertexPositions[t.v1].xyz - p0, vertexPositions[t.v2].xyz - p0));
+}
+
+// BVH stack sizes. The application defines these from the depths its
+// builders report (see TwoLevelBVH::getMaxBLASDepth), so a traversal can never
+// run out of stack; the defaults only cover shaders compiled without them.
+#ifndef BVH_STACK_SIZE
+#define BVH_STACK_SIZE 64
+#endif
+#ifndef WIDE_BVH_STACK_SIZE
+#define WIDE_BVH_STACK_SIZE ((BVH_WIDTH - 1) * BVH_STACK_SIZE + 1)
+#endif
+#ifndef TLAS_STACK_SIZE
+#define TLAS_STACK_SIZE 32
+#endif
+
+// When defined, bottom-level traversal keeps only this many stack entries and
+// restarts from the root whenever it runs out, finding its place again from a
+// restart trail: one bit per level recording whether the near child there has
+// been finished. Far less private memory per ray than a full stack, for trees
+// up to 63 levels deep.
+#ifndef BVH_SHORT_STACK
+#define BVH_SHORT_STACK 0
+#endif
+
+// What box tests need of a ray, worked out once per traversal rather than per node.
+struct TraversalRay {
+    vec3 invDir;
+    vec3 originInvDir; // -origin * invDir, so each slab is a single fma
+    bvec3 negDir;      // which box plane the ray enters each slab through
+};
+
+TraversalRay makeTraversalRay(Ray r){
+    vec3 dir = r.direction;
+    TraversalRay tr;
+    tr.invDir = 1.0 / mix(dir, mix(vec3(1e-20), vec3(-1e-20), lessThan(dir, vec3(0.0))), lessThan(abs(dir), vec3(1e-20)));
+    tr.originInvDir = -r.origin * tr.invDir;
+    tr.negDir = lessThan(dir, vec3(0.0));
+    return tr;
+}
+
+// Distance at which the ray enters the box within [tMin, tMax], or -1 if it misses.
+float boxEntry(TraversalRay tr, vec3 minBounds, vec3 maxBounds, float tMin, float tMax){
+    vec3 tNear = fma(mix(minBounds, maxBounds, tr.negDir), tr.invDir, tr.originInvDir);
+    vec3 tFar = fma(mix(maxBounds, minBounds, tr.negDir), tr.invDir, tr.originInvDir);
+    float tEnter = max(max(tNear.x, tNear.y), max(tNear.z, tMin));
+    float tExit = min(min(tFar.x, tFar.y), min(tFar.z, tMax));
+    return tEnter <= tExit ? tEnter : -1.0;
+}
+
+// Moeller-Trumbore Algorithm
+// [https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm]
+// The edges and epsilon are precomputed in the intersection stream, and the
+// material is left for setTriangleAttributes once the closest hit is known.
+bool hitIsectTriangle(IsectTriangle tri, Ray r, float tMin, float tMax, inout HitRecord rec) {
+    ++statPrims;
+    vec3 edge1 = tri.e1.xyz;
+    vec3 edge2 = tri.e2.xyz;
+    float EPSILON = tri.e1.w;
+
+    vec3 ray_cross_e2 = cross(r.direction, edge2);
+    float det = dot(edge1, ray_cross_e2);
+
+    if(abs(det) < EPSILON) return false;
+
+    float inv_det = 1.0 / det;
+    vec3 s = r.origin - tri.v0.xyz;
+    float u = inv_det * dot(s, ray_cross_e2);
+
+    if(u < -EPSILON || u > 1.0 + EPSILON) return false;
+
+    vec3 s_cross_e1 = cross(s, edge1);
+    float v = inv_det * dot(r.direction, s_cross_e1);
+
+    if(v < -EPSILON || u + v > 1.0 + EPSILON) return false;
+
+    float t = inv_det * dot(edge2, s_cross_e1);
+
+    if(t < tMin || t > tMax) return false;
+
+    rec.t = t;
+    rec.p = r.origin + r.direction * t;
+    rec.uv = vec2(u, v);
+    rec.sphereLightScale = 0.0;
+
+    vec3 geometricNormal = normalize(cross(edge1, edge2));
+    rec.frontFace = dot(r.direction, geometricNormal) < 0.0;
+    rec.normal = rec.frontFace ? geometricNormal : -geometricNormal;
+
+    return true;
+}
+
+// The one attribute-stream fetch per traced BVH hit: the material, and the
+// texture coordinates and tangent at the barycentrics hitIsectTriangle left.
+void setTriangleAttributes(inout HitRecord rec, int triangleIndex) {
+    IndexedTriangle tri = triangles[triangleIndex];
+    rec.materialID = tri.materialID;
+    rec.mat = materials[rec.materialID];
+
+    VertexShading a = vertexShading[tri.v0];
+    VertexShading b = vertexShading[tri.v1];
+    VertexShading c = vertexShading[tri.v2];
+    vec3 bary = vec3(1.0 - rec.uv.x - rec.uv.y, rec.uv);
+    rec.uv = bary.x * a.texcoord + bary.y * b.texcoord + bary.z * c.texcoord;
+    rec.tangent = vec4(bary.x * a.tangent.xyz + bary.y * b.tangent.xyz + bary.z * c.tangent.xyz, a.tangent.w);
+
+    // Texel density for the ray-cone LOD, in object space until instanceHitToWorld
+    vec3 p0 = vertexPositions[tri.v0].xyz;
+    float area = length(cross(vertexPositions[tri.v1].xyz - p0, vertexPositions[tri.v2].xyz - p0));
+    vec2 duv1 = b.texcoord - a.texcoord;
+    vec2 duv2 = c.texcoord - a.texcoord;
+    float uvArea = abs(duv1.x * duv2.y - duv2.x * duv1.y);
+    rec.textureLod = 0.5 * log2(max(uvArea, 1e-20) / max(area, 1e-20));
+}
+
+// Sphere intersection algorithm.
+bool hitSphere(Sphere sphere, Ray r, float tMin, float tMax, out HitRecord rec){
+    ++statPrims;
+    vec3 oc = r.origin - sphere.center.xyz;
+    float a = dot(r.direction, r.direction);
+    float half_b = dot(oc, r.direction);
+    float c = dot(oc, oc) - sphere.radius * sphere.radius;
+    float discriminant = half_b * half_b - a * c;
+
+    if (discriminant < 0.0) return false;
+    float sqrtd = sqrt(discriminant);
+
+    float root = (-half_b - sqrtd) / a;
+    if (root < tMin || root > tMax){
+        root = (-half_b + sqrtd) / a;
+        if (root < tMin || root > tMax) return false;
+    }
+
+    rec.t = root;
+    rec.p = r.origin + root * r.direction;
+    rec.materialID = sphere.materialID;
+    rec.mat = materials[sphere.materialID];
+    vec3 outwardNormal = (rec.p - sphere.center.xyz) / sphere.radius;
+    setFaceNormal(rec, r, outwardNormal);
+
+    // Longitude and latitude, v = 0 at the top. The tangent runs east, and is
+    // zero at the poles
+    vec3 n = outwardNormal;
+    rec.uv = vec2(atan(-n.z, n.x) / (2.0 * PI) + 0.5, acos(clamp(n.y, -1.0, 1.0)) / PI);
+    vec3 east = vec3(n.z, 0.0, -n.x);
+    rec.tangent = dot(east, east) > 1e-12 ? vec4(normalize(east), -1.0) : vec4(0.0);
+    // The map squeezes u towards the poles: du = dphi / 2pi, dv = dtheta / pi
+    float sinTheta = max(sqrt(max(1.0 - n.y * n.y, 0.0)), 1e-4);
+    rec.textureLod = -0.5 * log2(2.0 * PI * PI * sphere.radius * sphere.radius * sinTheta);
+
+    // For the MIS weight of light sampling's cone (sampleLight). Ratios of t
+    // survive the instance transform, so this is left in object space.
+    float dist2 = dot(oc, oc);
+    float r2 = sphere.radius * sphere.radius;
+    rec.sphereLightScale = dist2 > r2 ? sphereAreaPerSolidAngle(dist2, r2) / a : 0.0;
+
+    return true;
+}
+
+// Tests the primitives of a binary BVH leaf, shrinking closestSoFar to each hit.
+// Sphere BLAS leaves index spheres[] where triangle leaves index isectTriangles[];
+// a triangle hit leaves its attributes for the caller to fetch once at the end.
+bool hitBVHLeaf(Ray r, BVHNode node, bool sphereLeaves, bool anyHit, float tMin,
+    inout float closestSoFar, inout HitRecord rec, inout int hitTriangleIndex){
+    int primStart = -node.leftChild - 1; // Convert the negative offset to positive
+    int primCount = node.rightChild;
+    bool hitAnything = false;
+
+    for(int i = 0; i < primCount; ++i){
+        int primIndex = primStart + i;
+
+        if(sphereLeaves){
+            if(primIndex >= spheres.length()) break;
+            HitRecord sphereRec;
+            if(hitSphere(spheres[primIndex], r, tMin, closestSoFar, sphereRec)){
+                hitAnything = true;
+                closestSoFar = sphereRec.t;
+                rec = sphereRec;
+                if(anyHit) return true;
+            }
+            continue;
+        }
+
+        if(primIndex >= isectTriangles.length()) break;
+
+        IsectTriangle tri = isectTriangles[primIndex];
+        if(hitIsectTriangle(tri, r, tMin, closestSoFar, rec)){
+            hitAnything = true;
+            closestSoFar = rec.t;
+            hitTriangleIndex = floatBitsToInt(tri.v0.w);
+            if(anyHit) return true;
+        }
+    }
+    return hitAnything;
+}
+
+#if BVH_SHORT_STACK > 0
+// Restart trail helpers. Bit 63 - depth stands for a level, so finishing a
+// subtree is an add that carries up into its ancestors, and a carry into bit 63
+// (the root's level) means the whole tree is done.
+bool trailBit(uvec2 trail, int depth){
+    int bit = 63 - depth;
+    return (bit < 32 ? (trail.x >> uint(bit)) & 1u : (trail.y >> uint(bit - 32)) & 1u) != 0u;
+}
+
+uvec2 setTrailBit(uvec2 trail, int depth){
+    int bit = 63 - depth;
+    if(bit < 32) trail.x |= 1u << uint(bit);
+    else trail.y |= 1u << uint(bit - 32);
+    return trail;
+}
+
+// Marks the subtree at depth finished: forgets the levels below it and adds one at its own.
+uvec2 trailPop(uvec2 trail, int depth){
+    int bit = 63 - depth;
+    if(bit < 32){
+        uint one = 1u << uint(bit);
+        uint lo = (trail.x & ~(one - 1u)) + one;
+        return uvec2(lo, trail.y + (lo == 0u ? 1u : 0u)); // lo only wraps to exactly 0
+    }
+    uint one = 1u << uint(bit - 32);
+    return uvec2(0u, (trail.y & ~(one - 1u)) + one);
+}
+
+// The level traversal continues at: the lowest set bit.
+int trailDepth(uvec2 trail){
+    return trail.x != 0u ? 63 - findLSB(trail.x) : 31 - findLSB(trail.y);
+}
+#endif
+
+// Ordered traversal of a binary bottom-level BVH from root. Both children of
+// a node are tested together and the nearer one is entered straight away, so
+// only the farther one is ever pushed, along with its entry distance so it is
+// dropped without a fetch once a closer hit is found. At most one entry per
+// level is on the stack, which is why BVH_STACK_SIZE only has to match the
+// tree depth. With anyHit set it returns at the first hit, without finding the
+// closest one or its attributes, for shadow rays.
+bool traverseBVH(Ray r, int root, bool sphereLeaves, bool anyHit, float tMin, float tMax, out HitRecord rec){
+    if(root < 0 || root >= bvhNodes.length()) return false;
+
+    TraversalRay tr = makeTraversalRay(r);
+    int hitTriangleIndex = -1;
+    bool hitAnything = false;
+    float closestSoFar = tMax;
+
+    BVHNode node = bvhNodes[root];
+    ++statNodes;
+    if(boxEntry(tr, node.minBounds.xyz, node.maxBounds.xyz, tMin, closestSoFar) < 0.0) return false;
+
+#if BVH_SHORT_STACK > 0
+    int stack[BVH_SHORT_STACK]; // a ring, the oldest entries overwritten
+    float stackT[BVH_SHORT_STACK];
+    int stackTop = 0;
+    int stackCount = 0;
+    uvec2 trail = uvec2(0u);
+    int depth = 0;
+#else
+    int stack[BVH_STACK_SIZE];
+    float stackT[BVH_STACK_SIZE];
+    int stackPtr = 0;
+#endif
+
+    for(;;){
+        if(node.leftChild >= 0){
+            BVHNode left = bvhNodes[node.leftChild];
+            BVHNode right = bvhNodes[node.rightChild];
+            statNodes += 2u;
+            float tLeft = boxEntry(tr, left.minBounds.xyz, left.maxBounds.xyz, tMin, closestSoFar);
+            float tRight = boxEntry(tr, right.minBounds.xyz, right.maxBounds.xyz, tMin, closestSoFar);
+
+            if(tLeft >= 0.0 || tRight >= 0.0){
+                bool leftFirst = tLeft >= 0.0 && (tRight < 0.0 || tLeft <= tRight);
+                bool both = tLeft >= 0.0 && tRight >= 0.0;
+                int farChild = leftFirst ? node.rightChild : node.leftChild;
+                float farT = max(tLeft, tRight);
+#if BVH_SHORT_STACK > 0
+                ++depth;
+                if(!both){
+                    trail = setTrailBit(trail, depth); // nothing left at this level afterwards
+                    node = leftFirst ? left : right;
+                }else if(trailBit(trail, depth)){
+                    node = leftFirst ? right : left; // near side finished before a restart
+                }else{
+                    stack[stackTop] = farChild;
+                    stackT[stackTop] = farT;
+                    stackTop = (stackTop + 1) % BVH_SHORT_STACK;
+                    stackCount = min(stackCount + 1, BVH_SHORT_STACK);
+                    node = leftFirst ? left : right;
+                }
+#else
+                if(both){
+                    stack[stackPtr] = farChild;
+                    stackT[stackPtr++] = farT;
+                }
+                node = leftFirst ? left : right;
+#endif
+                continue;
+            }
+        }
+        else if(hitBVHLeaf(r, node, sphereLeaves, anyHit, tMin, closestSoFar, rec, hitTriangleIndex)){
+            hitAnything = true;
+            if(anyHit) return true;
+        }
+
+        // Nothing further down here, move on to the next far child
+#if BVH_SHORT_STACK > 0
+        bool done = false;
+        for(;;){
+            trail = trailPop(trail, depth);
+            depth = trailDepth(trail);
+            if(depth == 0){
+                done = true;
+                break;
+            }
+            if(stackCount == 0){
+                // Entries were lost to the ring: walk down from the root again
+                node = bvhNodes[root];
+                ++statNodes;
+                depth = 0;
+                break;
+            }
+            stackTop = (stackTop + BVH_SHORT_STACK - 1) % BVH_SHORT_STACK;
+            --stackCount;
+            if(stackT[stackTop] <= closestSoFar){
+                node = bvhNodes[stack[stackTop]];
+                ++statNodes;
+                break;
+            }
+            // Behind the closest hit, so that subtree is finished as well
+        }
+        if(done) break;
+#else
+        while(stackPtr > 0 && stackT[stackPtr - 1] > closestSoFar) --stackPtr;
+        if(stackPtr == 0) break;
+        node = bvhNodes[stack[--stackPtr]];
+        ++statNodes;
+#endif
+    }
+
+    if(hitAnything && !sphereLeaves) setTriangleAttributes(rec, hitTriangleIndex);
+    return hitAnything;
+}
+
+// Closest hit in one of the bottom-level BVHs.
+bool hitWorldBVH(Ray r, int root, bool sphereLeaves, float tMin, float tMax, out HitRecord rec){
+    return traverseBVH(r, root, sphereLeaves, false, tMin, tMax, rec);
+}
+
+uint extractByte(uint word, int byteIndex){
+    return (word >> (uint(byteIndex) * 8u)) & 0xFFu;
+}
+
+// Traverses the compressed wide BVH. Every child box of a node is tested from a
+// single node fetch, leaves are intersected nearest first, and interior children
+// are pushed far-to-near along with their entry distance so entries that end up
+// behind the closest hit are dropped without fetching the node. Each level
+// pushes at most BVH_WIDTH - 1 more entries than it pops, which is what
+// WIDE_BVH_STACK_SIZE is sized for.
+bool hitWorldWideBVH(Ray r, int root, float tMin, float tMax, out HitRecord rec){
+    int hitTriangleIndex = -1;
+    bool hitAnything = false;
+    float closestSoFar = tMax;
+
+    TraversalRay tr = makeTraversalRay(r);
+
+    int stack[WIDE_BVH_STACK_SIZE];
+    float stackT[WIDE_BVH_STACK_SIZE];
+    int stackPtr = 0;
+    stack[stackPtr] = root;
+    stackT[stackPtr++] = tMin;
+
+    while(stackPtr > 0) {
+        --stackPtr;
+        if (stackT[stackPtr] > closestSoFar) continue;
+        int nodeIndex = stack[stackPtr];
+        if (nodeIndex >= wideNodes.length()) continue;
+
+        WideBVHNode node = wideNodes[nodeIndex];
+        ++statNodes;
+
+        vec3 scale = vec3(
+            uintBitsToFloat(extractByte(node.meta, 0) << 23),
+            uintBitsToFloat(extractByte(node.meta, 1) << 23),
+            uintBitsToFloat(extractByte(node.meta, 2) << 23)
+        );
+        int childCount = int(extractByte(node.meta, 3));
+
+        // Slab test every child, keeping the hits sorted by entry distance
+        int hitChild[BVH_WIDTH];
+        float hitT[BVH_WIDTH];
+        int hitCount = 0;
+
+        for(int i = 0; i < childCount; ++i){
+            vec3 lo, hi;
+            for(int axis = 0; axis < 3; ++axis){
+                int b = axis * BVH_WIDTH + i;
+                lo[axis] = float(extractByte(node.qlo[b >> 2], b & 3));
+                hi[axis] = float(extractByte(node.qhi[b >> 2], b & 3));
+            }
+            float tEnter = boxEntry(tr, node.origin + lo * scale, node.origin + hi * scale, tMin, closestSoFar);
+            if(tEnter < 0.0) continue;
+
+            int j = hitCount++;
+            while(j > 0 && hitT[j - 1] > tEnter){
+                hitT[j] = hitT[j - 1];
+                hitChild[j] = hitChild[j - 1];
+                --j;
+            }
+            hitT[j] = tEnter;
+            hitChild[j] = i;
+        }
+
+        // Leaves, nearest first
+        for(int k = 0; k < hitCount; ++k){
+            int child = node.children[hitChild[k]];
+            if(child >= 0 || hitT[k] > closestSoFar) continue;
+
+            int primStart = -child - 1;
+            int primCount = int(extractByte(node.leafCounts[hitChild[k] >> 2], hitChild[k] & 3));
+            for(int i = 0; i < primCount; ++i){
+                int primIndex = primStart + i;
+                if(primIndex >= isectTriangles.length()) break;
+
+                IsectTriangle tri = isectTriangles[primIndex];
+                if(hitIsectTriangle(tri, r, tMin, closestSoFar, rec)){
+                    hitAnything = true;
+                    closestSoFar = rec.t;
+                    hitTriangleIndex = floatBitsToInt(tri.v0.w);
+                }
+            }
+        }
+
+        // Interior children, far to near so the nearest is popped first
+        for(int k = hitCount - 1; k >= 0; --k){
+            int child = node.children[hitChild[k]];
+            if(child < 0 || hitT[k] > closestSoFar) continue;
+            stack[stackPtr] = child;
+            stackT[stackPtr++] = hitT[k];
+        }
+    }
+
+    if(hitAnything) setTriangleAttributes(rec, hitTriangleIndex);
+    return hitAnything;
+}
+
+// Moves a world-space hit found in an instance's object space back to world
+// space. The direction isn't renormalized in object space, so t carries over.
+void instanceHitToWorld(Instance inst, Ray r, inout HitRecord rec){
+    rec.p = r.origin + r.direction * rec.t;
+    // The inverse transpose keeps the normal on the same side as the ray
+    rec.normal = normalize(transpose(mat3(inst.modelInv)) * rec.normal);
+    rec.tangent.xyz = mat3(inst.model) * rec.tangent.xyz;
+    // Areas grow with the instance's scale, by |det|^(2/3) for a uniform one
+    rec.textureLod -= log2(abs(determinant(mat3(inst.model)))) / 3.0;
+    if(inst.materialID >= 0){
+        rec.materialID = inst.materialID;
+        rec.mat = materials[inst.materialID];
+    }
+}
+
+// Walks the top-level BVH, in the same near-first order as the bottom
+// levels. At each instance the ray is moved into object space and the
+// instance's bottom-level BVH is traversed. The sphere BLAS only has a binary
+// layout, and any-hit queries always walk the binary BLASes, which stay valid
+// whichever layout closest-hit traversal uses.
+bool traverseTLAS(Ray r, bool anyHit, float tMin, float tMax, out HitRecord rec){
+    HitRecord tempRec;
+    bool hitAnything = false;
+    float closestSoFar = tMax;
+
+    TraversalRay tr = makeTraversalRay(r);
+    BVHNode node = tlasNodes[0];
+    ++statNodes;
+    if(boxEntry(tr, node.minBounds.xyz, node.maxBounds.xyz, tMin, closestSoFar) < 0.0) return false;
+
+    int stack[TLAS_STACK_SIZE];
+    float stackT[TLAS_STACK_SIZE];
+    int stackPtr = 0;
+
+    for(;;){
+        if(node.leftChild >= 0){
+            BVHNode left = tlasNodes[node.leftChild];
+            BVHNode right = tlasNodes[node.rightChild];
+            statNodes += 2u;
+            float tLeft = boxEntry(tr, left.minBounds.xyz, left.maxBounds.xyz, tMin, closestSoFar);
+            float tRight = boxEntry(tr, right.minBounds.xyz, right.maxBounds.xyz, tMin, closestSoFar);
+
+            if(tLeft >= 0.0 || tRight >= 0.0){
+                bool leftFirst = tLeft >= 0.0 && (tRight < 0.0 || tLeft <= tRight);
+                if(tLeft >= 0.0 && tRight >= 0.0){
+                    stack[stackPtr] = leftFirst ? node.rightChild : node.leftChild;
+                    stackT[stackPtr++] = max(tLeft, tRight);
+                }
+                node = leftFirst ? left : right;
+                continue;
+            }
+        }else{
+            int first = -node.leftChild - 1;
+            for(int i = first; i < first + node.rightChild; ++i){
+                Instance inst = instances[i];
+
+                Ray objectRay;
+                objectRay.origin = (inst.modelInv * vec4(r.origin, 1.0)).xyz;
+                objectRay.direction = (inst.modelInv * vec4(r.direction, 0.0)).xyz;
+
+                bool sphereLeaves = inst.primType == INSTANCE_SPHERES;
+                if(anyHit){
+                    if(traverseBVH(objectRay, inst.blasRoot, sphereLeaves, true, tMin, tMax, tempRec)) return true;
+                    continue;
+                }
+
+                bool hit = (USE_WIDE_BVH && !sphereLeaves)
+                    ? hitWorldWideBVH(objectRay, inst.wideRoot, tMin, closestSoFar, tempRec)
+                    : traverseBVH(objectRay, inst.blasRoot, sphereLeaves, false, tMin, closestSoFar, tempRec);
+                if(hit){
+                    hitAnything = true;
+                    closestSoFar = tempRec.t;
+                    instanceHitToWorld(inst, r, tempRec);
+                    rec = tempRec;
+                }
+            }
+        }
+
+        while(stackPtr > 0 && stackT[stackPtr - 1] > closestSoFar) --stackPtr;
+        if(stackPtr == 0) break;
+        node = tlasNodes[stack[--stackPtr]];
+        ++statNodes;
+    }
+
+    return hitAnything;
+}
+
+bool hitWorldTLAS(Ray r, float tMin, float tMax, out HitRecord rec){
+    return traverseTLAS(r, false, tMin, tMax, rec);
+}
+
+// In case something breaks in bvh transfer - the original, slow approach.
+bool hitWorldBruteForce(Ray r, float tMin, float tMax, out HitRecord rec) {
+    HitRecord tempRec;
+    bool hitAnything = false;
+    float closestSoFar = tMax;
+
+    // Test all instanced triangles directly
+    for(int i = 0; i < instances.length(); i++){
+        Instance inst = instances[i];
+
+        Ray objectRay;
+        objectRay.origin = (inst.modelInv * vec4(r.origin, 1.0)).xyz;
+        objectRay.direction = (inst.modelInv * vec4(r.direction, 0.0)).xyz;
+
+        for(int j = inst.firstTri; j < inst.firstTri + inst.triCount; j++){
+            if(hitIsectTriangle(loadIsectTriangle(j), objectRay, tMin, closestSoFar, tempRec)){
+                hitAnything = true;
+                closestSoFar = tempRec.t;
+                setTriangleAttributes(tempRec, j);
+                instanceHitToWorld(inst, r, tempRec);
+                rec = tempRec;
+            }
+        }
+    }
+
+    // Test all spheres directly
+    for(int i = 0; i < spheres.length(); i++){
+        if(hitSphere(spheres[i], r, tMin, closestSoFar, tempRec)){
+            hitAnything = true;
+            closestSoFar = tempRec.t;
+            rec = tempRec;
+        }
+    }
+
+    return hitAnything;
+}
+
+// Closest hit against the whole scene, through the TLAS when it has been built.
+bool hitWorld(Ray r, float tMin, float tMax, out HitRecord rec){
+    ++statRays;
+    // Use BVH if available, otherwise fall back to brute force
+    if (USE_TLAS) {
+        // Spheres are an instance in the TLAS like the meshes
+        return hitWorldTLAS(r, tMin, tMax, rec);
+    } else {
+        // Fallback to original brute force method
+        return hitWorldBruteForce(r, tMin, tMax, rec);
+    }
+}
+
+// Shadow-ray test against the whole scene: true as soon as anything lies
+// between tMin and tMax, without finding the closest hit or its attributes.
+bool occluded(Ray r, float tMin, float tMax){
+    ++statRays;
+    HitRecord rec;
+    if (!USE_TLAS) {
+        return hitWorldBruteForce(r, tMin, tMax, rec);
+    }
+    return traverseTLAS(r, true, tMin, tMax, rec);
+}
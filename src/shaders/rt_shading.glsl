@@ -0,0 +1,396 @@
+// Material scattering, sky lighting, path integration and camera rays.
+
+#include "rt_sampler.glsl"
+#include "rt_adaptive.glsl"
+#include "rt_gbuffer.glsl"
+#include "rt_temporal.glsl"
+#include "rt_microfacet.glsl"
+#include "rt_lights.glsl"
+#include "rt_textures.glsl"
+
+// Solid-angle pdf of the Lambertian's cosine-weighted sampling.
+float lambertianPdf(float cosTheta) {
+    return max(cosTheta, 0.0) / PI;
+}
+
+// Distance-adaptive epsilon for ray origins leaving a surface.
+float surfaceEpsilon(HitRecord rec) {
+    return max(1e-4, abs(rec.t) * 1e-6);
+}
+
+// Cosine-weighted direction about n: a point on the unit sphere offset by n.
+vec3 sampleCosineHemisphere(vec3 n, vec2 u) {
+    vec3 dir = n + randomUnitVector(u);
+    return nearZero(dir) ? n : normalize(dir);
+}
+
+// Which kind of scatter a bounce was, for the per-lobe depth limits.
+#define LOBE_DIFFUSE 0
+#define LOBE_SPECULAR 1
+#define LOBE_TRANSMISSION 2
+
+// Path depth limits. A path ends once any lobe has used up its bounces, and
+// from u_rrStartDepth bounces on it survives Russian roulette with a
+// probability that follows its throughput.
+uniform int u_maxBounces;            // all lobes together, at most MAX_BOUNCES
+uniform int u_maxDiffuseBounces;
+uniform int u_maxSpecularBounces;    // metal and glass reflection
+uniform int u_maxTransmissionBounces;
+uniform int u_rrStartDepth;
+
+// Determines behavior of ray after hitting certain materials. pdf is the
+// solid-angle density of the scattered direction for the Lambertian, which
+// light sampling is combined with, and 0 for every other lobe.
+//
+// Metal is a GGX microfacet lobe sampled from its visible normals, tinted by
+// F0 = mix(0.04, albedo, metallic), over a Lambertian base that fades out as
+// metallic reaches 1. Dielectrics refract through GGX normals the same way.
+// Roughness 0 gives the perfect mirror and smooth glass.
+bool scatter(Ray rayIn, HitRecord rec, out vec3 attenuation, out Ray scattered, out float pdf, out int lobe) {
+    float shadowEpsilon = surfaceEpsilon(rec);
+    float alpha = rec.mat.roughness * rec.mat.roughness;
+    bool isSmooth = rec.mat.roughness < MIN_ROUGHNESS;
+    vec3 unitDir = normalize(rayIn.direction);
+    vec2 u = sample2D(SAMPLE_BSDF);
+    pdf = 0.0;
+    lobe = LOBE_DIFFUSE;
+    
+    if (HAS_MATERIAL(MATERIAL_LAMBERTIAN) && rec.mat.type == MATERIAL_LAMBERTIAN) {
+        vec3 scatterDir = sampleCosineHemisphere(rec.normal, u);
+        
+        // Start the ray slightly above the surface
+        scattered = Ray(rec.p + rec.normal * shadowEpsilon, scatterDir);
+        // (albedo / pi) * cos / pdf, with pdf = cos / pi
+        attenuation = rec.mat.albedo;
+        pdf = lambertianPdf(dot(scatterDir, rec.normal));
+        return true;
+    } 
+    else if (HAS_MATERIAL(MATERIAL_METAL) && rec.mat.type == MATERIAL_METAL) {
+        vec3 t, b;
+        buildBasis(rec.normal, t, b);
+        vec3 v = toLocal(-unitDir, t, b, rec.normal);
+        if (v.z <= 0.0) return false;
+
+        // Pick a lobe, then weight it by the inverse of that choice
+        float diffuseChance = 0.5 * (1.0 - rec.mat.metallic);
+        if (sample1D(SAMPLE_BSDF_LOBE) < diffuseChance) {
+            vec3 scatterDir = sampleCosineHemisphere(rec.normal, u);
+            scattered = Ray(rec.p + rec.normal * shadowEpsilon, scatterDir);
+            vec3 specular = fresnelSchlick(vec3(0.04), v.z);
+            attenuation = rec.mat.albedo * (1.0 - rec.mat.metallic) * (1.0 - specular) / diffuseChance;
+            return true;
+        }
+
+        lobe = LOBE_SPECULAR;
+        vec3 h = isSmooth ? vec3(0.0, 0.0, 1.0) : sampleGGXVNDF(v, alpha, u);
+        vec3 l = reflect(-v, h);
+        if (l.z <= 0.0) return false; // shadowed by the microsurface
+
+        // F * G2 / G1(v), with separable masking-shadowing
+        vec3 f0 = mix(vec3(0.04), rec.mat.albedo, rec.mat.metallic);
+        vec3 specular = fresnelSchlick(f0, dot(v, h)) * (isSmooth ? 1.0 : smithG1(l.z, alpha));
+
+        // Start the ray slightly above the surface
+        scattered = Ray(rec.p + rec.normal * shadowEpsilon, toWorld(l, t, b, rec.normal));
+        attenuation = specular / (1.0 - diffuseChance);
+        return true;
+    }
+    else if (HAS_MATERIAL(MATERIAL_DIELECTRIC) && rec.mat.type == MATERIAL_DIELECTRIC) {
+        float refractionRatio = rec.frontFace ? (1.0 / rec.mat.refractionIndex) : rec.mat.refractionIndex;
+
+        // Reflect and refract about a sampled microfacet normal
+        vec3 h = rec.normal;
+        if (!isSmooth) {
+            vec3 t, b;
+            buildBasis(rec.normal, t, b);
+            vec3 v = toLocal(-unitDir, t, b, rec.normal);
+            if (v.z <= 0.0) return false;
+            h = toWorld(sampleGGXVNDF(v, alpha, u), t, b, rec.normal);
+        }
+
+        float cosTheta = min(dot(-unitDir, h), 1.0);
+        float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+
+        bool cannotRefract = refractionRatio * sinTheta > 1.0;
+        vec3 direction;
+        vec3 rayOrigin;
+        
+        if (cannotRefract || reflectance(cosTheta, refractionRatio) > sample1D(SAMPLE_BSDF_LOBE)) {
+            direction = reflect(unitDir, h);
+            lobe = LOBE_SPECULAR;
+            if (dot(direction, rec.normal) <= 0.0) return false;
+            rayOrigin = rec.p + rec.normal * shadowEpsilon; // Above surface for reflection
+        } else {
+            direction = refract(unitDir, h, refractionRatio);
+            lobe = LOBE_TRANSMISSION;
+            if (dot(direction, rec.normal) >= 0.0) return false;
+            rayOrigin = rec.p - rec.normal * shadowEpsilon; // Below surface for refraction
+        }
+
+        scattered = Ray(rayOrigin, direction);
+        attenuation = vec3(isSmooth ? 1.0 : smithG1(dot(direction, rec.normal), alpha));
+        return true;
+    }
+    else if (HAS_MATERIAL(MATERIAL_EMISSIVE) && rec.mat.type == MATERIAL_EMISSIVE) {
+        attenuation = rec.mat.albedo.rgb * rec.mat.emissionStrength;
+        return false;
+    }
+
+    return false;
+}
+
+
+// Sample from the skybox. Level 0 is the sky itself; the others are
+// prefiltered for rough reflections.
+vec3 GainSkyBoxLight(Ray ray) {
+    if(USE_SKYBOX){
+        vec3 skyColor = textureLod(u_skybox, ray.direction, 0.0).rgb;
+        
+        // Add intensity control for HDR skybox
+        skyColor *= skyboxIntensity;
+        
+        return skyColor;
+    }else{
+        vec3 unitDir = normalize(ray.direction);
+        float t = 0.5 * (unitDir.y + 1.0); // blend factor
+        return mix(vec3(0.0), vec3(0.5, 0.7, 1.0) * 0.5, t);
+    }
+}
+
+// Rough metals can take the sky their whole GGX lobe reflects from the
+// cubemap level of their roughness (src/equirectToCubemap.h), instead of
+// tracing the rest of the path to the sky. Only the visibility of the sampled
+// direction is traced.
+uniform bool u_prefilteredSky;
+uniform float u_prefilterMinRoughness;
+
+vec3 prefilteredSkyLight(vec3 mirrorDirection, float roughness) {
+    float lod = roughness * float(textureQueryLevels(u_skybox) - 1);
+    return textureLod(u_skybox, mirrorDirection, lod).rgb * skyboxIntensity;
+}
+
+// Sky light reaching a path that escaped the scene. After a diffuse bounce the
+// environment was also sampled directly, so only the MIS share is kept.
+vec3 environmentLight(Ray r, float bsdfPdf) {
+    float weight = 1.0;
+    if (USE_ENV_SAMPLING && bsdfPdf > 0.0) {
+        weight = powerHeuristic(bsdfPdf, envPdf(r.direction));
+    }
+    return GainSkyBoxLight(r) * weight;
+}
+
+// Next-event estimation at a Lambertian hit: one light sample, its shadow
+// ray, and the sample's MIS weight against BSDF sampling.
+vec3 sampleDirectLight(HitRecord rec) {
+    vec3 u = vec3(sample1D(SAMPLE_LIGHT_PICK), sample2D(SAMPLE_LIGHT));
+
+    LightSample ls;
+    if (!sampleLight(rec.p, u, ls)) return vec3(0.0);
+
+    float cosSurface = dot(rec.normal, ls.direction);
+    if (cosSurface <= 0.0) return vec3(0.0);
+
+    float eps = surfaceEpsilon(rec);
+    Ray shadowRay = Ray(rec.p + rec.normal * eps, ls.direction);
+    if (occluded(shadowRay, 1e-6, ls.dist - 2.0 * eps)) return vec3(0.0);
+
+    vec3 brdf = rec.mat.albedo.rgb / PI;
+    return brdf * ls.emission * cosSurface / ls.pdf * powerHeuristic(ls.pdf, lambertianPdf(cosSurface));
+}
+
+// The same for the HDR environment: one direction drawn from its CDF, and a
+// shadow ray that has to escape the scene.
+vec3 sampleEnvironmentLight(HitRecord rec) {
+    vec2 u = sample2D(SAMPLE_ENV);
+
+    float pdf;
+    vec3 direction = sampleEnvironment(u, pdf);
+    if (pdf <= 0.0) return vec3(0.0);
+
+    float cosSurface = dot(rec.normal, direction);
+    if (cosSurface <= 0.0) return vec3(0.0);
+
+    Ray shadowRay = Ray(rec.p + rec.normal * surfaceEpsilon(rec), direction);
+    if (occluded(shadowRay, 1e-6, infinity)) return vec3(0.0);
+
+    vec3 brdf = rec.mat.albedo.rgb / PI;
+    return brdf * GainSkyBoxLight(shadowRay) * cosSurface / pdf * powerHeuristic(pdf, lambertianPdf(cosSurface));
+}
+
+// Carries a path's ray cone (rt_textures.glsl) to the next vertex: its width
+// there, and the spread the scatter out of it adds. Diffuse bounces widen it
+// the most, so their lookups land on coarse mips.
+vec2 propagateCone(vec2 cone, HitRecord rec, Ray r, int lobe) {
+    float width = cone.x + cone.y * rec.t * length(r.direction);
+    float spread = lobe == LOBE_DIFFUSE ? 0.5 : rec.mat.roughness * rec.mat.roughness;
+    return vec2(width, cone.y + spread);
+}
+
+// Shades one surface interaction of a path: adds the surface's emission and
+// scatters the ray onward. Returns false once the path has terminated.
+// Shared by rayColor and the wavefront shade kernel so both modes agree.
+// bsdfPdf carries the pdf of the scatter that produced r, 0 for camera rays
+// and specular bounces, and comes back as the pdf of the next one.
+// lobeBounces counts the diffuse, specular and transmission bounces so far,
+// and cone is the path's ray cone, carried on to the scattered ray.
+bool shadeHit(inout Ray r, HitRecord rec, inout vec3 accumulatedColor, inout vec3 brightnessScore,
+              inout float bsdfPdf, inout ivec3 lobeBounces, inout vec2 cone) {
+    // Light sampling already covered this emitter from the previous vertex,
+    // so a BSDF-sampled hit only keeps its MIS share.
+    float emissionWeight = 1.0;
+    vec3 emission = rec.mat.albedo.rgb * rec.mat.emissionStrength;
+    if (HAS_MATERIAL(MATERIAL_EMISSIVE) && u_useLightSampling && rec.mat.type == MATERIAL_EMISSIVE && bsdfPdf > 0.0) {
+        float rayLength = length(r.direction);
+        float cosLight = abs(dot(rec.normal, r.direction / rayLength));
+        float neePdf = rec.sphereLightScale > 0.0
+            ? sphereLightPdf(emission, rec.sphereLightScale * rayLength * rayLength)
+            : lightPdf(emission, rec.t * rayLength, cosLight);
+        emissionWeight = powerHeuristic(bsdfPdf, neePdf);
+    }
+    brightnessScore += emission * accumulatedColor * emissionWeight;
+
+    vec3 attenuation;
+    Ray scattered;
+    int lobe;
+    bool didScatter = scatter(r, rec, attenuation, scattered, bsdfPdf, lobe);
+
+    if (!didScatter) {
+        return false;
+    }
+
+    if (HAS_MATERIAL(MATERIAL_LAMBERTIAN) && rec.mat.type == MATERIAL_LAMBERTIAN) {
+        if (u_useLightSampling) brightnessScore += accumulatedColor * sampleDirectLight(rec);
+        if (USE_ENV_SAMPLING) brightnessScore += accumulatedColor * sampleEnvironmentLight(rec);
+    }
+
+    lobeBounces[lobe]++;
+    ivec3 lobeLimits = ivec3(u_maxDiffuseBounces, u_maxSpecularBounces, u_maxTransmissionBounces);
+    if (lobeBounces[lobe] > lobeLimits[lobe]) {
+        return false;
+    }
+
+    // An approximation: the sky's radiance and its visibility across the lobe
+    // are taken to be independent
+    if (USE_SKYBOX && u_prefilteredSky && lobe == LOBE_SPECULAR && HAS_MATERIAL(MATERIAL_METAL) &&
+        rec.mat.type == MATERIAL_METAL && rec.mat.roughness >= u_prefilterMinRoughness &&
+        !occluded(scattered, 1e-6, infinity)) {
+        vec3 mirrorDirection = reflect(normalize(r.direction), rec.normal);
+        brightnessScore += accumulatedColor * attenuation * prefilteredSkyLight(mirrorDirection, rec.mat.roughness);
+        return false;
+    }
+
+    accumulatedColor *= attenuation;
+
+    // Russian roulette: weak paths mostly stop, and the survivors make up
+    // for them, so the estimate stays unbiased.
+    int depth = lobeBounces.x + lobeBounces.y + lobeBounces.z;
+    if (depth >= u_rrStartDepth) {
+        float survival = clamp(max(accumulatedColor.r, max(accumulatedColor.g, accumulatedColor.b)), 0.05, 1.0);
+        if (sample1D(SAMPLE_RR) >= survival) {
+            return false;
+        }
+        accumulatedColor /= survival;
+    }
+
+    cone = propagateCone(cone, rec, r, lobe);
+    r = scattered;
+    return true;
+}
+
+// The real driver function of the whole algorithm.
+// This function decides the color of each ray shot out by the camera.
+// Starting as pure white light, each scatter modulates the ray by the
+// scattering object's albedo, until it reaches the skybox, or has 
+// bounced enough to lose all color,
+// The first hit's guides for the denoiser come back in albedo and normalDepth.
+vec3 rayColor(Ray r, int maxBounces, out vec3 albedo, out vec4 normalDepth){
+    vec3 accumulatedColor = vec3(1.0);
+    vec3 brightnessScore = vec3(0.0);
+    float bsdfPdf = 0.0;
+    ivec3 lobeBounces = ivec3(0);
+    vec2 cone = vec2(0.0, pixelSpreadAngle());
+    gbufferFromMiss(albedo, normalDepth);
+    
+    for (int bounce = 0; bounce < min(maxBounces, MAX_BOUNCES); ++bounce) {
+        HitRecord rec;
+        if (hitWorld(r, 1e-6, infinity, rec)) {
+            samplerBounce = bounce;
+            texturedSurface(rec, r, cone);
+            if (bounce == 0) gbufferFromHit(rec, r, albedo, normalDepth);
+
+            if (!shadeHit(r, rec, accumulatedColor, brightnessScore, bsdfPdf, lobeBounces, cone)) {
+                break;
+            }
+        } else {
+            brightnessScore += accumulatedColor * environmentLight(r, bsdfPdf);
+            break;
+        }
+    }
+
+    return brightnessScore;
+}
+
+uniform bool u_disablePixelSkip; // batch renders, which owe every pixel exactly its spp
+
+// True for pixels that are left untraced this frame. With adaptive sampling
+// these are the converged tiles, otherwise a grid that thins out over time.
+// None are skipped on a frame the history is reprojected, or at all with
+// u_disablePixelSkip.
+bool isPixelSkipped(ivec2 coord) {
+    if (u_disablePixelSkip) {
+        return false;
+    }
+
+    // After a camera move every pixel needs its first hit to be reprojected
+    if (u_reproject) {
+        return false;
+    }
+
+    if (u_adaptiveSampling) {
+        return isTileConverged(coord);
+    }
+
+    // Reduce the work per frame as accumulation happens
+    // Early frames contirbute a lot to noise reduction, but
+    // later frames have diminishing returns. We can skip
+    // some pixels to save performance, while still letting 
+    // the image converge eventually.
+
+    float C = 120.0; // Tuning constant that controls the rate 
+                    // at which subsampling kicks in.
+    // Smaller C -> skip pixels earlier (faster, noisier).
+    // Larger C -> skip pixels later (slower, cleaner).
+
+
+    // The skip factor grows logarithmically with frameCount.
+    // Example: if frameCount = C, skipFactor = 1 (shade all pixels).
+    // If frameCount = 2C, skipFactor = 1.
+    // If frameCount = 4C, skipFactor = 2 (shade every other pixel).
+    // If frameCount = 8C, skipFactor = 3 (shade every 3rd pixel).
+    int skipFactor = max(1, int(log2(float(frameCount) / C)));
+    
+    // Subsample the image by skipping some pixels based on their position.
+    // This is deterministic, but due to the changining nature of skipFactor,
+    // appears to be pretty much random, ensuring we don't have any weird
+    // grids of alternating high fidelity and low fidelity.
+    return coord.x % skipFactor != 0 || coord.y % skipFactor != 0;
+}
+
+// This is for antialiasing.
+vec2 getJitteredUV(vec2 fragCoord, vec2 resolution) {
+    // random offset in [-0.5, 0.5] per pixel
+    vec2 jitter = cameraSample2D(SAMPLE_PIXEL) - 0.5;
+    return (fragCoord + jitter) / resolution;
+}
+
+// Determines the direction of the ray at the current fragment, based on camera parameters.
+// The sampler must already be initialised for the pixel.
+Ray getRay(vec2 fragCoord){
+    // jittered pixel coordinates
+    vec2 jitteredUV = getJitteredUV(fragCoord, resolution);
+
+    Ray r;
+    r.origin = camPos;
+    r.direction = cameraDirection(jitteredUV);
+    return r;
+}
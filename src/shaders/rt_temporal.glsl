@@ -0,0 +1,103 @@
+// Temporal reprojection. When the camera moves the accumulation is carried
+// over instead of being thrown away: each pixel's first hit this frame is
+// projected into the previous view, and the history there, made up of colour,
+// moments and G-buffer, is blended in with bilinear weights. Taps that saw a
+// different surface (another distance from the old camera, or a normal facing
+// elsewhere) are rejected, as in TAA, and the history's sample count is
+// clamped to u_maxHistory so view-dependent shading can catch up. The same
+// path carries the history across a change of render resolution, when the
+// history textures are still u_prevResolution.
+// Needs rt_adaptive.glsl and rt_gbuffer.glsl.
+
+uniform bool u_reproject;     // the camera or the render size changed since the last frame
+uniform mat4 u_prevViewProj;  // the previous frame's view-projection
+uniform vec3 u_prevCamPos;
+uniform vec2 u_prevResolution; // the size of the history textures
+uniform int u_maxHistory;     // samples of history a reprojection keeps at most
+
+// How far a history tap may be from the expected surface
+#define REPROJECT_DEPTH_TOLERANCE 0.05  // relative distance
+#define REPROJECT_NORMAL_TOLERANCE 0.8  // cosine
+
+struct History {
+    vec3 color;
+    vec4 moments;
+    vec3 albedo;
+    vec4 normalDepth;
+};
+
+bool isSkyGuide(vec4 normalDepth) {
+    return normalDepth.w > 0.5 * GBUFFER_SKY_DEPTH;
+}
+
+// The same pixel's history, empty on the first frame after a reset.
+History loadHistory(sampler2D colorTex, sampler2D momentsTex, sampler2D albedoTex,
+                    sampler2D normalDepthTex, ivec2 coord) {
+    History h;
+    h.color = texelFetch(colorTex, coord, 0).rgb;
+    h.moments = previousMoments(texelFetch(momentsTex, coord, 0));
+    h.albedo = texelFetch(albedoTex, coord, 0).rgb;
+    h.normalDepth = texelFetch(normalDepthTex, coord, 0);
+    return h;
+}
+
+// The history of whatever this pixel sees now, from where it was in the
+// previous frame. guide is this frame's first-hit G-buffer, seen along the
+// ray through the pixel centre.
+History reprojectHistory(sampler2D colorTex, sampler2D momentsTex, sampler2D albedoTex,
+                         sampler2D normalDepthTex, vec2 fragCoord, vec4 guide) {
+    History h;
+    h.color = vec3(0.0);
+    h.moments = vec4(0.0);
+    h.albedo = vec3(0.0);
+    h.normalDepth = vec4(0.0);
+
+    // The sky only moves with the camera's rotation
+    vec3 direction = cameraDirection(fragCoord / resolution);
+    bool sky = isSkyGuide(guide);
+    vec4 worldPos = sky ? vec4(direction, 0.0) : vec4(camPos + direction * guide.w, 1.0);
+
+    vec4 clip = u_prevViewProj * worldPos;
+    if (clip.w <= 0.0) return h;
+    vec2 prevPixel = (clip.xy / clip.w * 0.5 + 0.5) * u_prevResolution - 0.5;
+
+    float expectedDepth = length(worldPos.xyz - u_prevCamPos);
+    vec3 normal = sky ? vec3(0.0) : normalize(guide.xyz);
+
+    ivec2 base = ivec2(floor(prevPixel));
+    vec2 f = prevPixel - vec2(base);
+    float sumWeight = 0.0;
+    for (int i = 0; i < 4; ++i) {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        ivec2 q = base + offset;
+        if (q.x < 0 || q.y < 0 || q.x >= int(u_prevResolution.x) || q.y >= int(u_prevResolution.y)) continue;
+
+        vec4 tapGuide = texelFetch(normalDepthTex, q, 0);
+        if (sky != isSkyGuide(tapGuide)) continue;
+        if (!sky) {
+            if (abs(tapGuide.w - expectedDepth) > REPROJECT_DEPTH_TOLERANCE * expectedDepth) continue;
+            if (dot(normalize(tapGuide.xyz + 1e-6), normal) < REPROJECT_NORMAL_TOLERANCE) continue;
+        }
+
+        vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+        float w = bilinear.x * bilinear.y;
+        h.color += w * texelFetch(colorTex, q, 0).rgb;
+        h.moments += w * texelFetch(momentsTex, q, 0);
+        h.albedo += w * texelFetch(albedoTex, q, 0).rgb;
+        h.normalDepth += w * tapGuide;
+        sumWeight += w;
+    }
+
+    if (sumWeight < 1e-3) {
+        h.moments = vec4(0.0); // disoccluded: start over
+        return h;
+    }
+
+    h.color /= sumWeight;
+    h.moments /= sumWeight;
+    h.albedo /= sumWeight;
+    h.normalDepth /= sumWeight;
+    h.normalDepth.w = sky ? GBUFFER_SKY_DEPTH : guide.w; // now seen from the new camera
+    h.moments.z = min(h.moments.z, float(u_maxHistory));
+    return h;
+}
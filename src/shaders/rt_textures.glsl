@@ -0,0 +1,100 @@
+// Material textures, sampled at a mip chosen by a ray cone.
+//
+// Every path carries a cone: its width where the current ray starts, and its
+// spread angle, which starts at one pixel's and widens with each bounce by
+// the lobe's roughness (shadeHit). Where the cone lands, its width against
+// the surface's texel density (HitRecord.textureLod) picks the mip.
+//
+// The textures are either bindless handles (RT_BINDLESS_TEXTURES, from
+// TextureSet::shaderDefines) or the layers of one array texture; both are
+// square and power-of-two sized.
+
+#ifdef RT_BINDLESS_TEXTURES
+#define MAX_BINDLESS_TEXTURES 2048 // TextureSet::MAX_BINDLESS
+
+// Two 64-bit handles per uvec4, since std140 pads an array of uvec2 to that anyway
+layout(std140, binding = 0) uniform TextureHandles {
+    uvec4 textureHandles[MAX_BINDLESS_TEXTURES / 2];
+};
+
+vec4 sampleMaterialTexture(int index, vec2 uv, float lod) {
+    uvec4 pair = textureHandles[index >> 1];
+    sampler2D tex = sampler2D((index & 1) == 0 ? pair.xy : pair.zw);
+    return textureLod(tex, uv, lod + log2(float(textureSize(tex, 0).x)));
+}
+#else
+uniform sampler2DArray u_materialTextures;
+
+vec4 sampleMaterialTexture(int index, vec2 uv, float lod) {
+    float size = float(textureSize(u_materialTextures, 0).x);
+    return textureLod(u_materialTextures, vec3(uv, float(index)), lod + log2(size));
+}
+#endif
+
+// The angle one pixel subtends, the spread of a camera ray's cone.
+float pixelSpreadAngle() {
+    return atan(2.0 * tan(radians(camFov) * 0.5) / resolution.y);
+}
+
+// Turns rec.textureLod from the surface's texel density into the mip level
+// (before the texture's own size) for a cone of cone.x width at r's origin
+// and cone.y spread, and rec.uv into the material's texture coordinates.
+void setTextureLod(inout HitRecord rec, Ray r, vec2 cone) {
+    float rayLength = length(r.direction);
+    float width = max(abs(cone.x + cone.y * rec.t * rayLength), 1e-8);
+    float cosine = max(abs(dot(rec.normal, r.direction / rayLength)), 1e-2);
+    vec2 uvScale = rec.mat.uvScale;
+    rec.textureLod += log2(width) - log2(cosine) + 0.5 * log2(max(abs(uvScale.x * uvScale.y), 1e-20));
+    rec.uv = rec.uv * uvScale + rec.mat.uvOffset;
+}
+
+// Tangent-space normal mapping. Needs the tangent, so surfaces without
+// texture coordinates keep their normal.
+//
+// A strongly bent normal can mirror r below the real surface, and the path
+// would die there; the normal is then bent back until the reflection just
+// clears it (Keller et al., "The Iray Light Transport Simulation and
+// Rendering System").
+void applyNormalMap(inout HitRecord rec, Ray r) {
+    if (rec.mat.normalTexture < 0 || dot(rec.tangent.xyz, rec.tangent.xyz) < 1e-12) return;
+
+    vec3 m = sampleMaterialTexture(rec.mat.normalTexture, rec.uv, rec.textureLod).xyz * 2.0 - 1.0;
+    vec3 n = rec.normal;
+    vec3 t = rec.tangent.xyz - n * dot(n, rec.tangent.xyz);
+    if (dot(t, t) < 1e-12) return;
+    t = normalize(t);
+    // The bitangent follows the outward normal, not the one facing the ray
+    vec3 b = cross(n, t) * rec.tangent.w * (rec.frontFace ? 1.0 : -1.0);
+    vec3 mapped = normalize(t * m.x + b * m.y + n * max(m.z, 1e-3));
+
+    vec3 v = -normalize(r.direction);
+    vec3 reflected = reflect(-v, mapped);
+    float bound = min(0.9 * dot(v, n), 0.01);
+    float height = dot(reflected, n);
+    if (height < bound) {
+        reflected = normalize(reflected + n * (bound - height));
+        mapped = normalize(v + reflected);
+    }
+    rec.normal = mapped;
+}
+
+// Albedo (sRGB) and metallic-roughness (glTF: roughness in G, metallic in B)
+// multiply the material's own values.
+void applyMaterialTextures(inout HitRecord rec) {
+    if (rec.mat.albedoTexture >= 0) {
+        vec3 albedo = sampleMaterialTexture(rec.mat.albedoTexture, rec.uv, rec.textureLod).rgb;
+        rec.mat.albedo *= pow(albedo, vec3(2.2));
+    }
+    if (rec.mat.roughnessTexture >= 0) {
+        vec4 mr = sampleMaterialTexture(rec.mat.roughnessTexture, rec.uv, rec.textureLod);
+        rec.mat.roughness *= mr.g;
+        rec.mat.metallic *= mr.b;
+    }
+}
+
+// Everything texturing does to a hit that r, with the given cone, found.
+void texturedSurface(inout HitRecord rec, Ray r, vec2 cone) {
+    setTextureLod(rec, r, cone);
+    applyNormalMap(rec, r);
+    applyMaterialTextures(rec);
+}
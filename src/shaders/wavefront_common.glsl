@@ -0,0 +1,54 @@
+// Path state and ray queues shared by the wavefront path tracer kernels.
+//
+// Every pixel owns one path slot. Kernels communicate through index queues:
+// two ray queues that ping-pong between bounces, and one queue per material
+// type that the extend kernel sorts hits into, so each shade dispatch runs a
+// single material's code with coherent warps.
+
+#define WAVEFRONT_GROUP_SIZE 64
+
+#define QUEUE_RAYS_A 0
+#define QUEUE_RAYS_B 1
+#define QUEUE_MATERIAL_BASE 2 // + material type
+#define QUEUE_COUNT 6
+
+struct PathState {
+    vec4 origin;      // w: ray cone width at the origin (rt_textures.glsl)
+    vec4 direction;   // w: pdf of the scatter that produced it, 0 if specular or primary
+    vec4 throughput;  // w: 1.0 if the pixel is traced this frame
+    vec4 radiance;    // w: hit's sphereLightScale
+    vec4 hitPoint;    // w: hit distance
+    vec4 hitNormal;   // w: 1.0 if front face
+    ivec4 hitInfo;    // x: material ID, yzw: diffuse / specular / transmission bounces so far
+    vec4 albedo;      // first hit's G-buffer albedo, w unused
+    vec4 normalDepth; // first hit's G-buffer normal and distance
+    vec4 texcoord;    // xy: hit's texture coordinates, z: its texture LOD, w: ray cone spread
+};
+
+layout(std430, binding = 5) buffer PathStates {
+    PathState paths[];
+};
+
+layout(std430, binding = 6) buffer WavefrontQueues {
+    uvec4 dispatchArgs[5]; // [0] extend, [1 + type] shade. xyz = work groups
+    uint queueCount[QUEUE_COUNT];
+    uint queuePad0, queuePad1;
+    uint queueItems[];     // QUEUE_COUNT segments of u_pathCount entries
+};
+
+uniform uint u_pathCount;
+uniform int u_currentQueue; // QUEUE_RAYS_A or QUEUE_RAYS_B
+
+void pushQueue(int queue, uint pathIndex) {
+    uint slot = atomicAdd(queueCount[queue], 1u);
+    queueItems[uint(queue) * u_pathCount + slot] = pathIndex;
+}
+
+uint queueItem(int queue, uint slot) {
+    return queueItems[uint(queue) * u_pathCount + slot];
+}
+
+vec2 pathPixel(uint pathIndex) {
+    uint width = uint(resolution.x);
+    return vec2(pathIndex % width, pathIndex / width) + 0.5;
+}